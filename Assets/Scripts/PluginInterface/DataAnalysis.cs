@@ -46,6 +46,22 @@ public static class DataAnalysis
     public delegate int MaskCropAndDownsampleDelegate(IntPtr dataPtr, out IntPtr newDataPtr, long dimX, long dimY, long dimZ, long cropX1, long cropY1, long cropZ1,
    long cropX2, long cropY2, long cropZ2, int factorX, int factorY, int factorZ);
 
+    public enum SpectralKernel
+    {
+        None = 0,
+        Boxcar = 1,
+        Hanning = 2
+    }
+
+    [PluginFunctionAttr("SmoothCube")]
+    public static readonly SmoothCubeDelegate SmoothCube = null;
+    public delegate int SmoothCubeDelegate(IntPtr dataPtr, out IntPtr smoothedDataPtr, long dimX, long dimY, long dimZ, float spatialFwhm, int spectralKernel, int spectralWidth);
+
+    [PluginFunctionAttr("SmoothCropAndDownsample")]
+    public static readonly SmoothCropAndDownsampleDelegate SmoothCropAndDownsample = null;
+    public delegate int SmoothCropAndDownsampleDelegate(IntPtr dataPtr, out IntPtr newDataPtr, long dimX, long dimY, long dimZ, long cropX1, long cropY1, long cropZ1,
+       long cropX2, long cropY2, long cropZ2, int factorX, int factorY, int factorZ, bool maxDownsampling, float spatialFwhm, int spectralKernel, int spectralWidth);
+
     [PluginFunctionAttr("GetVoxelFloatValue")] 
     public static readonly GetVoxelFloatValueDelegate GetVoxelFloatValue = null;
     public delegate int GetVoxelFloatValueDelegate(IntPtr dataPtr, out float voxelValue, long dimX, long dimY, long dimZ, long x, long y, long z);
@@ -66,6 +82,108 @@ public static class DataAnalysis
     public static readonly GetZProfileDelegate GetZProfile = null;
     public delegate int GetZProfileDelegate(IntPtr dataPtr, out IntPtr profile, long dimX, long dimY, long dimZ, long x, long y);
 
+    public enum ProfileRegionType
+    {
+        Box = 0,
+        Ellipse = 1,
+        MaskLabel = 2
+    }
+
+    public enum ProfileAggregate
+    {
+        Sum = 0,
+        Mean = 1,
+        Max = 2
+    }
+
+    // Region of a spectral profile, see spectral_profile.h. Boxes are 0-based and half-open.
+    [StructLayout(LayoutKind.Sequential)]
+    public struct SpectralProfileRegion
+    {
+        public int type;
+        public int label;
+        public long x0, x1;
+        public long y0, y1;
+        public long z0, z1;
+        public double centreX, centreY;
+        public double semiMajor, semiMinor;
+        public double angle;
+    }
+
+    [PluginFunctionAttr("CreateSpectralProfileEngine")]
+    public static readonly CreateSpectralProfileEngineDelegate CreateSpectralProfileEngine = null;
+    public delegate int CreateSpectralProfileEngineDelegate(IntPtr dataPtr, IntPtr maskDataPtr, long dimX, long dimY, long dimZ, out IntPtr engine);
+
+    [PluginFunctionAttr("ComputeSpectralProfile")]
+    public static readonly ComputeSpectralProfileDelegate ComputeSpectralProfile = null;
+    public delegate int ComputeSpectralProfileDelegate(IntPtr engine, ref SpectralProfileRegion region, int aggregate, [Out] float[] profile, out long regionSize);
+
+    [PluginFunctionAttr("InvalidateSpectralProfileCache")]
+    public static readonly InvalidateSpectralProfileCacheDelegate InvalidateSpectralProfileCache = null;
+    public delegate int InvalidateSpectralProfileCacheDelegate(IntPtr engine);
+
+    [PluginFunctionAttr("FreeSpectralProfileEngine")]
+    public static readonly FreeSpectralProfileEngineDelegate FreeSpectralProfileEngine = null;
+    public delegate int FreeSpectralProfileEngineDelegate(IntPtr engine);
+
+    // Axes of a position-velocity slice, see slice_tool.h
+    [StructLayout(LayoutKind.Sequential, CharSet = CharSet.Ansi)]
+    public struct PvAxisInfo
+    {
+        public double offsetStart, offsetDelta;
+        public double spectralStart, spectralDelta;
+        [MarshalAs(UnmanagedType.ByValTStr, SizeConst = 32)]
+        public string offsetUnit;
+        [MarshalAs(UnmanagedType.ByValTStr, SizeConst = 32)]
+        public string spectralUnit;
+        [MarshalAs(UnmanagedType.ByValTStr, SizeConst = 32)]
+        public string spectralSystem;
+    }
+
+    [PluginFunctionAttr("ExtractPvSlice")]
+    public static readonly ExtractPvSliceDelegate ExtractPvSlice = null;
+    public delegate int ExtractPvSliceDelegate(IntPtr dataPtr, long dimX, long dimY, long dimZ, double[] vertices, int numVertices, double width,
+        long zStart, long zEnd, IntPtr astFrameSet, out IntPtr image, out long numOffsets, out PvAxisInfo axes);
+
+    [PluginFunctionAttr("ResampleObliqueSlice")]
+    public static readonly ResampleObliqueSliceDelegate ResampleObliqueSlice = null;
+    public delegate int ResampleObliqueSliceDelegate(IntPtr dataPtr, long dimX, long dimY, long dimZ, double[] origin, double[] axisU, double[] axisV,
+        long width, long height, [Out] float[] image);
+
+    [PluginFunctionAttr("GetSpectralCubeMemoryInfo")]
+    public static readonly GetSpectralCubeMemoryInfoDelegate GetSpectralCubeMemoryInfo = null;
+    public delegate int GetSpectralCubeMemoryInfoDelegate(long dimX, long dimY, long dimZ, out long requiredBytes, out long availableBytes, out long inUseBytes);
+
+    [PluginFunctionAttr("CreateSpectralCube")]
+    public static readonly CreateSpectralCubeDelegate CreateSpectralCube = null;
+    public delegate int CreateSpectralCubeDelegate(IntPtr dataPtr, long dimX, long dimY, long dimZ, long maxBytes, out IntPtr spectralCube);
+
+    [PluginFunctionAttr("FreeSpectralCube")]
+    public static readonly FreeSpectralCubeDelegate FreeSpectralCube = null;
+    public delegate int FreeSpectralCubeDelegate(IntPtr spectralCube);
+
+    [PluginFunctionAttr("ComputeMomentMaps")]
+    public static readonly ComputeMomentMapsDelegate ComputeMomentMaps = null;
+    public delegate int ComputeMomentMapsDelegate(IntPtr dataPtr, long dimX, long dimY, long dimZ, long zStart, long zEnd, float[] spectrum, float threshold,
+        [Out] float[] moment0, [Out] float[] moment1);
+
+    [PluginFunctionAttr("TypedCubeFindStats")]
+    public static readonly TypedCubeFindStatsDelegate TypedCubeFindStats = null;
+    public delegate int TypedCubeFindStatsDelegate(IntPtr cube, out float maxResult, out float minResult, out float meanResult, out float stdDevResult);
+
+    [PluginFunctionAttr("TypedCubeGetHistogram")]
+    public static readonly TypedCubeGetHistogramDelegate TypedCubeGetHistogram = null;
+    public delegate int TypedCubeGetHistogramDelegate(IntPtr cube, int numBins, float minVal, float maxVal, out IntPtr histogram);
+
+    [PluginFunctionAttr("TypedCubeCropAndDownsample")]
+    public static readonly TypedCubeCropAndDownsampleDelegate TypedCubeCropAndDownsample = null;
+    public delegate int TypedCubeCropAndDownsampleDelegate(IntPtr cube, out IntPtr newDataPtr, long cropX1, long cropY1, long cropZ1, long cropX2, long cropY2,
+        long cropZ2, int factorX, int factorY, int factorZ, bool maxDownsampling);
+
+    [PluginFunctionAttr("TypedCubeMomentMaps")]
+    public static readonly TypedCubeMomentMapsDelegate TypedCubeMomentMaps = null;
+    public delegate int TypedCubeMomentMapsDelegate(IntPtr cube, long zStart, long zEnd, float[] spectrum, float threshold, [Out] float[] moment0, [Out] float[] moment1);
+
     [PluginFunctionAttr("GetPercentileValuesFromHistogram")] 
     public static readonly GetPercentileValuesFromHistogramDelegate GetPercentileValuesFromHistogram = null;
     public delegate int GetPercentileValuesFromHistogramDelegate(IntPtr histogram, int numBins, float minValue, float maxValue, float minPercentile, float maxPercentile, out float minPercentileValue, out float maxPercentileValue);
@@ -74,10 +192,90 @@ public static class DataAnalysis
     public static readonly GetPercentileValuesFromDataDelegate GetPercentileValuesFromData = null;
     public delegate int GetPercentileValuesFromDataDelegate(IntPtr dataPtr, long numElements, float minPercentile, float maxPercentile, out float minPercentileValue, out float maxPercentileValue);
 
+    [PluginFunctionAttr("GetPercentileValues")] 
+    public static readonly GetPercentileValuesDelegate GetPercentileValues = null;
+    public delegate int GetPercentileValuesDelegate(IntPtr dataPtr, long numElements, float[] percentiles, int numPercentiles, [Out] float[] percentileValues);
+
     
     [PluginFunctionAttr("GetHistogram")] 
     public static readonly GetHistogramDelegate GetHistogram = null;
     public delegate int GetHistogramDelegate(IntPtr dataPtr, long numElements, int numBins, float minVal, float maxVal, out IntPtr histogram);
+
+    public enum HistogramSpacing
+    {
+        Linear = 0,
+        Log = 1,
+        Asinh = 2,
+        Sqrt = 3
+    }
+
+    [PluginFunctionAttr("CreateMultiResolutionHistogram")] 
+    public static readonly CreateMultiResolutionHistogramDelegate CreateMultiResolutionHistogram = null;
+    public delegate int CreateMultiResolutionHistogramDelegate(IntPtr dataPtr, long numElements, out IntPtr histogram);
+
+    [PluginFunctionAttr("GetMultiResolutionHistogramInfo")] 
+    public static readonly GetMultiResolutionHistogramInfoDelegate GetMultiResolutionHistogramInfo = null;
+    public delegate int GetMultiResolutionHistogramInfoDelegate(IntPtr histogram, out float minVal, out float maxVal, out long count);
+
+    [PluginFunctionAttr("RebinMultiResolutionHistogram")] 
+    public static readonly RebinMultiResolutionHistogramDelegate RebinMultiResolutionHistogram = null;
+    public delegate int RebinMultiResolutionHistogramDelegate(IntPtr histogram, float minVal, float maxVal, int numBins, int spacing, float softening, [Out] int[] histogramValues, [Out] float[] binEdges);
+
+    [PluginFunctionAttr("FreeMultiResolutionHistogram")] 
+    public static readonly FreeMultiResolutionHistogramDelegate FreeMultiResolutionHistogram = null;
+    public delegate int FreeMultiResolutionHistogramDelegate(IntPtr histogram);
+
+    public enum NoiseMethod
+    {
+        MedianAbsoluteDeviation = 0,
+        SigmaClip = 1,
+        NegativeGaussian = 2
+    }
+
+    [PluginFunctionAttr("GetNoiseEstimate")] 
+    public static readonly GetNoiseEstimateDelegate GetNoiseEstimate = null;
+    public delegate int GetNoiseEstimateDelegate(IntPtr dataPtr, long numElements, int method, out float rms);
+
+    [PluginFunctionAttr("GetNoiseSpectrum")] 
+    public static readonly GetNoiseSpectrumDelegate GetNoiseSpectrum = null;
+    public delegate int GetNoiseSpectrumDelegate(IntPtr dataPtr, long dimX, long dimY, long dimZ, int method, [Out] float[] spectrum);
+
+    [PluginFunctionAttr("GetNoiseCube")] 
+    public static readonly GetNoiseCubeDelegate GetNoiseCube = null;
+    public delegate int GetNoiseCubeDelegate(IntPtr dataPtr, long dimX, long dimY, long dimZ, long tileX, long tileY, long tileZ, int method, [Out] float[] noise);
+
+    // Statistics of one channel, see statistics_tool.h
+    [StructLayout(LayoutKind.Sequential)]
+    public struct ChannelStatistics
+    {
+        public float minVal;
+        public float maxVal;
+        public float mean;
+        public float rms;
+        public float robustRms;
+        public float nanFraction;
+        public long count;
+    }
+
+    [PluginFunctionAttr("GetChannelStatistics")]
+    public static readonly GetChannelStatisticsDelegate GetChannelStatistics = null;
+    public delegate int GetChannelStatisticsDelegate(IntPtr dataPtr, long dimX, long dimY, long dimZ, int numBins, [Out] ChannelStatistics[] stats,
+        [Out] int[] histograms);
+
+    [PluginFunctionAttr("GetRegionStats")]
+    public static readonly GetRegionStatsDelegate GetRegionStats = null;
+    public delegate int GetRegionStatsDelegate(IntPtr dataPtr, long dimX, long dimY, long dimZ, long x0, long x1, long y0, long y1, long z0, long z1,
+        IntPtr maskDataPtr, short label, out float maxResult, out float minResult, out float meanResult, out float stdDevResult, out long count);
+
+    [PluginFunctionAttr("GetRegionHistogram")]
+    public static readonly GetRegionHistogramDelegate GetRegionHistogram = null;
+    public delegate int GetRegionHistogramDelegate(IntPtr dataPtr, long dimX, long dimY, long dimZ, long x0, long x1, long y0, long y1, long z0, long z1,
+        IntPtr maskDataPtr, short label, int numBins, float minVal, float maxVal, [Out] int[] histogram);
+
+    [PluginFunctionAttr("GetRegionPercentileValues")]
+    public static readonly GetRegionPercentileValuesDelegate GetRegionPercentileValues = null;
+    public delegate int GetRegionPercentileValuesDelegate(IntPtr dataPtr, long dimX, long dimY, long dimZ, long x0, long x1, long y0, long y1, long z0, long z1,
+        IntPtr maskDataPtr, short label, float[] percentiles, int numPercentiles, [Out] float[] percentileValues);
     
     [StructLayout(LayoutKind.Sequential, Pack=8)]
     public struct SourceInfo
@@ -164,14 +362,110 @@ public static class DataAnalysis
     [PluginFunctionAttr("GetMaskedSources")]
     public static readonly GetMaskedSourcesDelegate GetMaskedSources = null;
     public delegate int GetMaskedSourcesDelegate(IntPtr maskDataPtr, long dimX, long dimY, long dimZ, out int maskCount, out IntPtr sources);
+
+    [PluginFunctionAttr("FindSourcesSmoothAndClip")]
+    public static readonly FindSourcesSmoothAndClipDelegate FindSourcesSmoothAndClip = null;
+    public delegate int FindSourcesSmoothAndClipDelegate(IntPtr dataPtr, IntPtr maskDataPtr, long dimX, long dimY, long dimZ, long x0, long x1, long y0, long y1,
+        long z0, long z1, float[] spatialFwhms, int numSpatialKernels, int[] spectralWidths, int numSpectralKernels, int spectralKernel, float threshold,
+        int noiseMethod, bool perChannelNoise, long minSizeX, long minSizeY, long minSizeZ, out int sourceCount, out IntPtr sources);
+
+    [PluginFunctionAttr("LabelMaskComponents")]
+    public static readonly LabelMaskComponentsDelegate LabelMaskComponents = null;
+    public delegate int LabelMaskComponentsDelegate(IntPtr maskDataPtr, long dimX, long dimY, long dimZ, int connectivity, long minVoxels,
+        long minSizeX, long minSizeY, long minSizeZ, out int labelCount, out IntPtr sources);
+
+    [PluginFunctionAttr("LabelBinaryMaskComponents")]
+    public static readonly LabelBinaryMaskComponentsDelegate LabelBinaryMaskComponents = null;
+    public delegate int LabelBinaryMaskComponentsDelegate(IntPtr binaryMaskPtr, IntPtr maskDataPtr, long dimX, long dimY, long dimZ, int connectivity,
+        long minVoxels, long minSizeX, long minSizeY, long minSizeZ, out int labelCount, out IntPtr sources);
+
+    public enum MorphologyOperation
+    {
+        Dilate = 0,
+        Erode = 1,
+        FillHoles = 2,
+        Open = 3,
+        Close = 4
+    }
+
+    [PluginFunctionAttr("ApplyMaskMorphology")]
+    public static readonly ApplyMaskMorphologyDelegate ApplyMaskMorphology = null;
+    public delegate int ApplyMaskMorphologyDelegate(IntPtr maskDataPtr, long dimX, long dimY, long dimZ, short label, int operation, int iterations,
+        int connectivity, long x0, long x1, long y0, long y1, long z0, long z1, out SourceInfo dirtyRegion);
+
+    [PluginFunctionAttr("DilateMaskByFlux")]
+    public static readonly DilateMaskByFluxDelegate DilateMaskByFlux = null;
+    public delegate int DilateMaskByFluxDelegate(IntPtr dataPtr, IntPtr maskDataPtr, long dimX, long dimY, long dimZ, short label, int maxIterations,
+        int connectivity, float fluxThreshold, long x0, long x1, long y0, long y1, long z0, long z1, out int iterationsApplied, out SourceInfo dirtyRegion);
     
     [PluginFunctionAttr("GetSourceStats")] 
     public static readonly GetSourceStatsDelegate GetSourceStats = null;
     public delegate int GetSourceStatsDelegate(IntPtr dataPtr, IntPtr maskDataPtr, long dimX, long dimY, long dimZ, SourceInfo source, ref SourceStats stats, IntPtr astFrame);
 
+    [PluginFunctionAttr("CreateSparseMask")]
+    public static readonly CreateSparseMaskDelegate CreateSparseMask = null;
+    public delegate int CreateSparseMaskDelegate(long dimX, long dimY, long dimZ, out IntPtr sparseMask);
+
+    [PluginFunctionAttr("CreateSparseMaskFromDense")]
+    public static readonly CreateSparseMaskFromDenseDelegate CreateSparseMaskFromDense = null;
+    public delegate int CreateSparseMaskFromDenseDelegate(IntPtr maskDataPtr, long dimX, long dimY, long dimZ, out IntPtr sparseMask);
+
+    [PluginFunctionAttr("FreeSparseMask")]
+    public static readonly FreeSparseMaskDelegate FreeSparseMask = null;
+    public delegate int FreeSparseMaskDelegate(IntPtr sparseMask);
+
+    [PluginFunctionAttr("GetSparseMaskVoxel")]
+    public static readonly GetSparseMaskVoxelDelegate GetSparseMaskVoxel = null;
+    public delegate int GetSparseMaskVoxelDelegate(IntPtr sparseMask, long x, long y, long z, out Int16 value);
+
+    [PluginFunctionAttr("SetSparseMaskVoxel")]
+    public static readonly SetSparseMaskVoxelDelegate SetSparseMaskVoxel = null;
+    public delegate int SetSparseMaskVoxelDelegate(IntPtr sparseMask, long x, long y, long z, Int16 value);
+
+    [PluginFunctionAttr("CompactSparseMask")]
+    public static readonly CompactSparseMaskDelegate CompactSparseMask = null;
+    public delegate int CompactSparseMaskDelegate(IntPtr sparseMask);
+
+    [PluginFunctionAttr("GetSparseMaskInfo")]
+    public static readonly GetSparseMaskInfoDelegate GetSparseMaskInfo = null;
+    public delegate int GetSparseMaskInfoDelegate(IntPtr sparseMask, out long memoryBytes, out long occupiedBricks, out long encodedBricks);
+
+    [PluginFunctionAttr("SparseMaskToDense")]
+    public static readonly SparseMaskToDenseDelegate SparseMaskToDense = null;
+    public delegate int SparseMaskToDenseDelegate(IntPtr sparseMask, long x0, long x1, long y0, long y1, long z0, long z1, IntPtr output);
+
+    [PluginFunctionAttr("GetSparseMaskSources")]
+    public static readonly GetSparseMaskSourcesDelegate GetSparseMaskSources = null;
+    public delegate int GetSparseMaskSourcesDelegate(IntPtr sparseMask, out int sourceCount, out IntPtr sourceInfo);
+
+    [PluginFunctionAttr("GetSparseMaskLabelVoxels")]
+    public static readonly GetSparseMaskLabelVoxelsDelegate GetSparseMaskLabelVoxels = null;
+    public delegate int GetSparseMaskLabelVoxelsDelegate(IntPtr sparseMask, Int16 label, out long voxelCount, out IntPtr voxelIndices);
+
+    [PluginFunctionAttr("GetSparseSourceStats")]
+    public static readonly GetSparseSourceStatsDelegate GetSparseSourceStats = null;
+    public delegate int GetSparseSourceStatsDelegate(IntPtr dataPtr, IntPtr sparseMask, SourceInfo source, ref SourceStats stats, IntPtr astFrame);
+
+    [PluginFunctionAttr("SparseMaskCropAndDownsample")]
+    public static readonly SparseMaskCropAndDownsampleDelegate SparseMaskCropAndDownsample = null;
+    public delegate int SparseMaskCropAndDownsampleDelegate(IntPtr sparseMask, out IntPtr newDataPtr, long cropX1, long cropY1, long cropZ1,
+        long cropX2, long cropY2, long cropZ2, int factorX, int factorY, int factorZ);
+
+    [PluginFunctionAttr("SparseMaskWriteFits")]
+    public static readonly SparseMaskWriteFitsDelegate SparseMaskWriteFits = null;
+    public delegate int SparseMaskWriteFitsDelegate(IntPtr fptr, IntPtr sparseMask, IntPtr firstPix, out int status);
+
     [PluginFunctionAttr("GetZScale")] 
     public static readonly GetZScaleDelegate GetZScale = null;
     public unsafe delegate int GetZScaleDelegate(void* dataPtr, long width, long height, out float z1, out float z2);
+
+    [PluginFunctionAttr("GetZScaleRange")] 
+    public static readonly GetZScaleRangeDelegate GetZScaleRange = null;
+    public delegate int GetZScaleRangeDelegate(IntPtr dataPtr, long dimX, long dimY, long dimZ, long zStart, long zEnd, long sampleSize, float contrast, out float z1, out float z2);
+
+    [PluginFunctionAttr("GetChannelZScales")] 
+    public static readonly GetChannelZScalesDelegate GetChannelZScales = null;
+    public delegate int GetChannelZScalesDelegate(IntPtr dataPtr, long dimX, long dimY, long dimZ, long zStart, long zEnd, long sampleSize, float contrast, [Out] float[] z1, [Out] float[] z2);
     
     
     [PluginFunctionAttr("FreeDataAnalysisMemory")] 
@@ -250,4 +544,27 @@ public static class DataAnalysis
         sources.Sort((s1, s2) => s1.maskVal - s2.maskVal);
         return sources;
     }
+
+    public static unsafe List<SourceInfo> FindSourcesSmoothAndClipArray(IntPtr dataPtr, IntPtr maskDataPtr, long dimX, long dimY, long dimZ,
+        long x0, long x1, long y0, long y1, long z0, long z1, float[] spatialFwhms, int[] spectralWidths, SpectralKernel spectralKernel,
+        float threshold, NoiseMethod noiseMethod, bool perChannelNoise, long minSizeX, long minSizeY, long minSizeZ)
+    {
+        int sourceCount;
+        IntPtr sourcesPtr;
+        List<SourceInfo> sources = new List<SourceInfo>();
+
+        if (FindSourcesSmoothAndClip(dataPtr, maskDataPtr, dimX, dimY, dimZ, x0, x1, y0, y1, z0, z1, spatialFwhms, spatialFwhms.Length,
+                spectralWidths, spectralWidths.Length, (int)spectralKernel, threshold, (int)noiseMethod, perChannelNoise, minSizeX, minSizeY, minSizeZ,
+                out sourceCount, out sourcesPtr) != 0)
+        {
+            Debug.Log("Error finding sources");
+            return sources;
+        }
+        for (var i = 0; i < sourceCount; i++)
+        {
+            sources.Add(Marshal.PtrToStructure<SourceInfo>(IntPtr.Add(sourcesPtr, sizeof(SourceInfo) * i)));
+        }
+        FreeDataAnalysisMemory(sourcesPtr);
+        return sources;
+    }
 }
\ No newline at end of file
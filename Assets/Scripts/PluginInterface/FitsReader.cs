@@ -72,6 +72,97 @@ public class FitsReader
         TULONG = 40,      // unsigned long
         TULONGLONG = 80   // unsigned long long 'W'
     }
+
+    // Allocation modes of the native cube buffers, see cube_buffer.h
+    public enum CubeBufferMode
+    {
+        Default = 0,     // Plain heap allocation
+        FirstTouch = 1,  // Pages placed on the NUMA node of the thread that processes them
+        HugePages = 2    // As FirstTouch, backed by 2 MB pages where available
+    }
+
+    // Tile compression algorithms for compressed FITS output, using the CFITSIO values
+    public enum TileCompression
+    {
+        Rice = 11,
+        Gzip = 21,
+        GzipShuffled = 22,  // GZIP_2, with bytes shuffled by significance before compression
+        HCompress = 41
+    }
+
+    [StructLayout(LayoutKind.Sequential)]
+    public struct CubeBufferStats
+    {
+        public long sizeBytes;
+        public long pageSize;
+        public long hugePageBytes;
+        public int mode;
+        public int numNodes;
+        public long sampledPages;
+        public long unplacedPages;
+        [MarshalAs(UnmanagedType.ByValArray, SizeConst = 8)]
+        public long[] pagesPerNode;
+    }
+
+    // One parsed header card, see FitsReadHeaderTable in fits_reader.h
+    [StructLayout(LayoutKind.Sequential, CharSet = CharSet.Ansi)]
+    public struct FitsHeaderCard
+    {
+        [MarshalAs(UnmanagedType.ByValTStr, SizeConst = 75)]
+        public string key;
+        [MarshalAs(UnmanagedType.ByValTStr, SizeConst = 71)]
+        public string value;
+        [MarshalAs(UnmanagedType.ByValTStr, SizeConst = 73)]
+        public string comment;
+    }
+
+    // Counters of the native region prefetcher, see region_prefetcher.h
+    [StructLayout(LayoutKind.Sequential)]
+    public struct PrefetchStats
+    {
+        public long requests;
+        public long hits;
+        public long misses;
+        public long prefetchesIssued;
+        public long prefetchesCompleted;
+        public long prefetchesUsed;
+        public long evictions;
+        public long cachedBytes;
+        public long bytesRead;
+    }
+
+    // Progress of a native coarse-to-fine load, see progressive_loader.h
+    [StructLayout(LayoutKind.Sequential)]
+    public struct ProgressiveLoadState
+    {
+        public int numLevels;
+        public int levelsCompleted;
+        public int currentFactor;
+        public int status;
+        public int finished;
+        public int padding;
+        public long channelsRead;
+        public long channelsTotal;
+    }
+
+    // Cube kept in the storage type of the file, see typed_cube.h. Integer values decode as raw * scale + zero.
+    [StructLayout(LayoutKind.Sequential)]
+    public struct TypedCube
+    {
+        public IntPtr data;
+        public int storage;
+        public int hasBlank;
+        public long blank;
+        public double scale;
+        public double zero;
+        public long dimX;
+        public long dimY;
+        public long dimZ;
+    }
+
+    // Called from the native loader thread, so implementations must not touch Unity objects directly
+    [UnmanagedFunctionPointer(CallingConvention.Cdecl)]
+    public delegate void ProgressiveLoadCallback(int level, int factor, int status);
     
     public static readonly Dictionary<int, string> ErrorCodes = new()
     {
@@ -277,6 +368,22 @@ public class FitsReader
     [DllImport("idavie_native")]
     public static extern int FitsWriteNewCopySubImageInt16(string newFileName, IntPtr fptr, IntPtr cornerMin, IntPtr cornerMax, IntPtr array, string historyTimeStamp, out int status);
 
+    [DllImport("idavie_native")]
+    public static extern int FitsWriteCompressedImageFloat(string fileName, IntPtr headerSource, IntPtr data, long dimX, long dimY, long dimZ,
+        long cropStartX, long cropStartY, long cropStartZ, int factorX, int factorY, int factorZ, int compressionType, string historyTimeStamp, out int status);
+
+    [DllImport("idavie_native")]
+    public static extern int FitsWriteCompressedImageInt16(string fileName, IntPtr headerSource, IntPtr data, long dimX, long dimY, long dimZ,
+        long cropStartX, long cropStartY, long cropStartZ, int factorX, int factorY, int factorZ, int compressionType, string historyTimeStamp, out int status);
+
+    [DllImport("idavie_native")]
+    public static extern int FitsWriteCompressedSparseMask(string fileName, IntPtr headerSource, IntPtr sparseMask,
+        long cropStartX, long cropStartY, long cropStartZ, int factorX, int factorY, int factorZ, int compressionType, string historyTimeStamp, out int status);
+
+    [DllImport("idavie_native")]
+    public static extern int FitsWriteSubcubeFromMemory(string fileName, IntPtr headerSource, IntPtr data, long dimX, long dimY, long dimZ,
+        long cropX1, long cropY1, long cropZ1, long cropX2, long cropY2, long cropZ2, int factorX, int factorY, int factorZ, string historyTimeStamp, out int status);
+
     [DllImport("idavie_native")]
     public static extern int FitsWriteHistory(IntPtr fptr, string history, out int status);
     
@@ -327,6 +434,10 @@ public class FitsReader
     [DllImport("idavie_native")]
     public static extern int FitsReadSubImageFloat(IntPtr fptr, int dims, int zAxis, IntPtr startPix, IntPtr finalPix, long nelem, out IntPtr array, out int status);
 
+    [DllImport("idavie_native")]
+    public static extern int FitsReadSubImageDecimated(IntPtr fptr, int dims, int zAxis, IntPtr startPix, IntPtr finalPix, int factorX, int factorY, int factorZ,
+        int mode, out IntPtr array, [Out] long[] newDims, out int status);
+
     [Obsolete("FitsReadImageInt16 is deprecated, please use FitsReadSubImageInt16 instead.")]
     [DllImport("idavie_native")]
     public static extern int FitsReadImageInt16(IntPtr fptr, int dims, long nelem, out IntPtr array, out int status);
@@ -334,12 +445,71 @@ public class FitsReader
     [DllImport("idavie_native")]
     public static extern int FitsReadSubImageInt16(IntPtr fptr, int dims, int zAxis, IntPtr startPix, IntPtr finalPix, long nelem, out IntPtr array, out int status);
 
+    [DllImport("idavie_native")]
+    public static extern int FitsReadMaskSubImage(IntPtr fptr, int dims, int zAxis, IntPtr startPix, IntPtr finalPix, int narrowLabels, out IntPtr array,
+        out int bytesPerVoxel, out int sourceCount, out IntPtr sources, out int status);
+
     [DllImport("idavie_native")]
     public static extern int FitsCreateHdrPtrForAst(IntPtr fptr, out IntPtr header, out int nkeys, out int status);
 
+    [DllImport("idavie_native")]
+    public static extern int FitsReadHeaderTable(IntPtr fptr, out IntPtr cards, out int numberCards, out int status);
+
+    [DllImport("idavie_native")]
+    public static extern int FreeFitsHeaderTable(IntPtr cards);
+
     [DllImport("idavie_native")]
     public static extern int CreateEmptyImageInt16(long sizeX, long sizeY, long sizeZ, out IntPtr array);
 
+    [DllImport("idavie_native")]
+    public static extern int SetCubeBufferMode(int mode);
+
+    [DllImport("idavie_native")]
+    public static extern int GetCubeBufferMode(out int mode);
+
+    [DllImport("idavie_native")]
+    public static extern int AllocateCubeBuffer(long numberElements, int elementSize, out IntPtr buffer);
+
+    [DllImport("idavie_native")]
+    public static extern int FreeCubeBuffer(IntPtr buffer);
+
+    [DllImport("idavie_native")]
+    public static extern int GetCubeBufferStats(IntPtr buffer, out CubeBufferStats stats);
+
+    [DllImport("idavie_native")]
+    public static extern int CreateRegionPrefetcher(string fileName, int selectedHDU, long cacheBytes, out IntPtr prefetcher);
+
+    [DllImport("idavie_native")]
+    public static extern int PrefetcherReadRegion(IntPtr prefetcher, long cropX1, long cropY1, long cropZ1, long cropX2, long cropY2, long cropZ2, out IntPtr data);
+
+    [DllImport("idavie_native")]
+    public static extern int PrefetcherHintRegion(IntPtr prefetcher, long cropX1, long cropY1, long cropZ1, long cropX2, long cropY2, long cropZ2);
+
+    [DllImport("idavie_native")]
+    public static extern int GetPrefetcherStats(IntPtr prefetcher, out PrefetchStats stats);
+
+    [DllImport("idavie_native")]
+    public static extern int FreeRegionPrefetcher(IntPtr prefetcher);
+
+    [DllImport("idavie_native")]
+    public static extern int StartProgressiveLoad(string fileName, int selectedHDU, long cropX1, long cropY1, long cropZ1, long cropX2, long cropY2, long cropZ2,
+        int coarsestFactor, ProgressiveLoadCallback callback, out IntPtr load, out IntPtr data);
+
+    [DllImport("idavie_native")]
+    public static extern int GetProgressiveLoadState(IntPtr load, out ProgressiveLoadState state);
+
+    [DllImport("idavie_native")]
+    public static extern int FreeProgressiveLoad(IntPtr load);
+
+    [DllImport("idavie_native")]
+    public static extern int FitsReadSubImageTyped(IntPtr fptr, int dims, int zAxis, IntPtr startPix, IntPtr finalPix, out IntPtr cube, out int status);
+
+    [DllImport("idavie_native")]
+    public static extern int FreeTypedCube(IntPtr cube);
+
+    [DllImport("idavie_native")]
+    public static extern int BenchmarkCubeBufferBandwidth(long numberElements, int iterations, out double serialTouchBandwidth, out double firstTouchBandwidth, out double hugePageBandwidth);
+
     [DllImport("idavie_native")]
     public static extern int FreeFitsPtrMemory(IntPtr pointerToDelete);
 
@@ -354,29 +524,30 @@ public class FitsReader
 
     [DllImport("idavie_native")]
     public static extern int WriteMomentMap(IntPtr mainFitsFile, string fileName, IntPtr imagePixelArray, long xDims, long yDims, int mapNumber);
+
+    [DllImport("idavie_native")]
+    public static extern int WritePvSlice(IntPtr mainFitsFile, string fileName, IntPtr imagePixelArray, long xDims, long yDims, ref DataAnalysis.PvAxisInfo axes);
     
     public static IDictionary<string, string> ExtractHeaders(IntPtr fptr, out int status)
     {
-        int numberKeys, keysLeft;
-        if (FitsGetNumHeaderKeys(fptr, out numberKeys, out keysLeft, out status) != 0)
+        IntPtr cards;
+        int numberCards;
+        if (FitsReadHeaderTable(fptr, out cards, out numberCards, out status) != 0)
         {
             Debug.LogError($"Fits extract header error {FitsErrorMessage(status)}");
             return null;
         }
         IDictionary<string, string> dict = new Dictionary<string, string>();
-        for (int i = 1; i <= numberKeys; i++)
-        {
-            StringBuilder keyName = new StringBuilder(70);
-            StringBuilder keyValue = new StringBuilder(70);
-            FitsReadKeyN(fptr, i, keyName, keyValue, null, out status);
-            string key = keyName.ToString();
-            if (!dict.ContainsKey(key))
-                dict.Add(key, keyValue.ToString());
+        int cardSize = Marshal.SizeOf<FitsHeaderCard>();
+        for (int i = 0; i < numberCards; i++)
+        {
+            FitsHeaderCard card = Marshal.PtrToStructure<FitsHeaderCard>(IntPtr.Add(cards, i * cardSize));
+            if (!dict.ContainsKey(card.key))
+                dict.Add(card.key, card.value);
             else
-                dict[key] = dict[key] + keyValue.ToString();
-            keyName.Clear();
-            keyValue.Clear();
+                dict[card.key] = dict[card.key] + card.value;
         }
+        FreeFitsHeaderTable(cards);
         return dict;
     }
 
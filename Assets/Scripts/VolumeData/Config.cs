@@ -87,6 +87,13 @@ namespace VolumeData
         /// that uses the histogram instead of the full data set.
         /// </summary>
         public bool useQuickModeForPercentiles = true;
+
+        /// <summary>
+        /// Allocation mode of the loaded cube data. FirstTouch and HugePages spread the cube over all NUMA
+        /// nodes of multi-socket machines, so that the multithreaded analysis runs at full memory bandwidth.
+        /// </summary>
+        [JsonConverter(typeof(StringEnumConverter))]
+        public FitsReader.CubeBufferMode cubeBufferMode = FitsReader.CubeBufferMode.Default;
         
         // Default rest frequencies in GHz. These are used for frequency <-> velocity conversions
         public Dictionary<String,double> restFrequenciesGHz = new Dictionary<string, double>
@@ -184,6 +184,10 @@ namespace VolumeData
         public int[] Histogram;
         
         public float HistogramBinWidth;
+        
+        // Native multi-resolution histogram from which the scaled histogram is re-binned
+        public IntPtr MultiResolutionHistogram = IntPtr.Zero;
+        
         public float MaxValue;
         public float MinValue;
         public float MeanValue;
@@ -339,6 +343,8 @@ namespace VolumeData
                     FitsReader.FreeFitsPtrMemory(dataPtr);
             long numberDataPoints = volumeDataSetRes.cubeSize[0] * volumeDataSetRes.cubeSize[1] * volumeDataSetRes.cubeSize[index2];
             IntPtr fitsDataPtr = IntPtr.Zero;
+            IntPtr typedCubePtr = IntPtr.Zero;
+            List<DataAnalysis.SourceInfo> maskSources = null;
             
             if (volumeDataSetRes.IsMask)
             {
@@ -375,13 +381,24 @@ namespace VolumeData
                 IntPtr finalPixPtr = Marshal.AllocHGlobal(sizeof(int) * finalPix.Length);
                 Marshal.Copy(startPix, 0, startPixPtr, startPix.Length);
                 Marshal.Copy(finalPix, 0, finalPixPtr, finalPix.Length);
-                if (FitsReader.FitsReadSubImageInt16(fptr, cubeDimensions, index2, startPixPtr, finalPixPtr, numberDataPoints, out fitsDataPtr, out status) != 0)
+                // The mask stays Int16 so that it can be painted, and its source table is built while it is read
+                if (FitsReader.FitsReadMaskSubImage(fptr, cubeDimensions, index2, startPixPtr, finalPixPtr, 0, out fitsDataPtr, out _,
+                        out int sourceCount, out IntPtr sourcesPtr, out status) != 0)
                 {
                     Debug.Log($"Fits Read mask cube data error {FitsReader.FitsErrorMessage(status)}");
                     FitsReader.FitsCloseFile(fptr, out status);
                     return null;
                 }
 
+                maskSources = new List<DataAnalysis.SourceInfo>(sourceCount);
+                int sourceInfoSize = Marshal.SizeOf<DataAnalysis.SourceInfo>();
+                for (var i = 0; i < sourceCount; i++)
+                {
+                    maskSources.Add(Marshal.PtrToStructure<DataAnalysis.SourceInfo>(IntPtr.Add(sourcesPtr, sourceInfoSize * i)));
+                }
+                if (sourcesPtr != IntPtr.Zero)
+                    FitsReader.FreeFitsPtrMemory(sourcesPtr);
+
                 if (startPixPtr == IntPtr.Zero)
                     Marshal.FreeHGlobal(startPixPtr);
                 if (finalPixPtr == IntPtr.Zero)
@@ -421,7 +438,21 @@ namespace VolumeData
                 IntPtr finalPixPtr = Marshal.AllocHGlobal(sizeof(int) * finalPix.Length);
                 Marshal.Copy(startPix, 0, startPixPtr, startPix.Length);
                 Marshal.Copy(finalPix, 0, finalPixPtr, finalPix.Length);
-                if (FitsReader.FitsReadSubImageFloat(fptr, cubeDimensions, index2, startPixPtr, finalPixPtr, numberDataPoints, out fitsDataPtr, out status) != 0)
+                FitsReader.SetCubeBufferMode((int)Config.Instance.cubeBufferMode);
+                // Integer cubes are read in their storage type, so that the load-time statistics read two or four times fewer bytes
+                bool isIntegerCube = volumeDataSetRes.HeaderDictionary.TryGetValue("BITPIX", out string bitpixValue)
+                                     && int.TryParse(bitpixValue.Trim(), out int bitpix)
+                                     && (bitpix == (int)FitsReader.BitpixDataType.SHORT_IMG || bitpix == (int)FitsReader.BitpixDataType.LONG_IMG);
+                if (isIntegerCube)
+                {
+                    if (FitsReader.FitsReadSubImageTyped(fptr, cubeDimensions, index2, startPixPtr, finalPixPtr, out typedCubePtr, out status) != 0)
+                    {
+                        Debug.Log($"Fits Read typed cube data error code {FitsReader.FitsErrorMessage(status)}");
+                        FitsReader.FitsCloseFile(fptr, out status);
+                        return null;
+                    }
+                }
+                else if (FitsReader.FitsReadSubImageFloat(fptr, cubeDimensions, index2, startPixPtr, finalPixPtr, numberDataPoints, out fitsDataPtr, out status) != 0)
                 {
                     Debug.Log($"Fits Read cube data error code {FitsReader.FitsErrorMessage(status)}");
                     FitsReader.FitsCloseFile(fptr, out status);
@@ -437,18 +468,44 @@ namespace VolumeData
             FitsReader.FitsCloseFile(fptr, out status);
             if (!volumeDataSetRes.IsMask)
             {
-                DataAnalysis.FindStats(fitsDataPtr, numberDataPoints, out volumeDataSetRes.MaxValue, out volumeDataSetRes.MinValue, out volumeDataSetRes.MeanValue,
-                    out volumeDataSetRes.StanDev);
                 int histogramSize = Mathf.RoundToInt(Mathf.Sqrt(numberDataPoints));
                 volumeDataSetRes.Histogram = new int[histogramSize];
                 volumeDataSetRes.FullHistogram = new int[histogramSize];
                 IntPtr histogramPtr = IntPtr.Zero;
-                volumeDataSetRes.HistogramBinWidth = (volumeDataSetRes.MaxValue - volumeDataSetRes.MinValue) / histogramSize;
-                DataAnalysis.GetHistogram(fitsDataPtr, numberDataPoints, histogramSize, volumeDataSetRes.MinValue, volumeDataSetRes.MaxValue, out histogramPtr);
+                if (typedCubePtr != IntPtr.Zero)
+                {
+                    DataAnalysis.TypedCubeFindStats(typedCubePtr, out volumeDataSetRes.MaxValue, out volumeDataSetRes.MinValue, out volumeDataSetRes.MeanValue,
+                        out volumeDataSetRes.StanDev);
+                    volumeDataSetRes.HistogramBinWidth = (volumeDataSetRes.MaxValue - volumeDataSetRes.MinValue) / histogramSize;
+                    DataAnalysis.TypedCubeGetHistogram(typedCubePtr, histogramSize, volumeDataSetRes.MinValue, volumeDataSetRes.MaxValue, out histogramPtr);
+                    // The rest of the viewer works on float cubes, so the decoded copy is expanded once the statistics are done
+                    int expandStatus = DataAnalysis.TypedCubeCropAndDownsample(typedCubePtr, out fitsDataPtr, 1, 1, 1, volumeDataSetRes.cubeSize[0],
+                        volumeDataSetRes.cubeSize[1], volumeDataSetRes.cubeSize[index2], 1, 1, 1, false);
+                    FitsReader.FreeTypedCube(typedCubePtr);
+                    if (expandStatus != 0)
+                    {
+                        Debug.Log("Could not expand the typed cube to floats.");
+                        if (histogramPtr != IntPtr.Zero)
+                            DataAnalysis.FreeDataAnalysisMemory(histogramPtr);
+                        return null;
+                    }
+                }
+                else
+                {
+                    DataAnalysis.FindStats(fitsDataPtr, numberDataPoints, out volumeDataSetRes.MaxValue, out volumeDataSetRes.MinValue, out volumeDataSetRes.MeanValue,
+                        out volumeDataSetRes.StanDev);
+                    volumeDataSetRes.HistogramBinWidth = (volumeDataSetRes.MaxValue - volumeDataSetRes.MinValue) / histogramSize;
+                    DataAnalysis.GetHistogram(fitsDataPtr, numberDataPoints, histogramSize, volumeDataSetRes.MinValue, volumeDataSetRes.MaxValue, out histogramPtr);
+                }
                 Marshal.Copy(histogramPtr, volumeDataSetRes.Histogram, 0, histogramSize);
                 Marshal.Copy(histogramPtr, volumeDataSetRes.FullHistogram, 0, histogramSize);
                 if (histogramPtr != IntPtr.Zero)
                     DataAnalysis.FreeDataAnalysisMemory(histogramPtr);
+                if (DataAnalysis.CreateMultiResolutionHistogram(fitsDataPtr, numberDataPoints, out volumeDataSetRes.MultiResolutionHistogram) != 0)
+                {
+                    Debug.LogWarning("Could not create multi-resolution histogram, histogram updates will rescan the cube.");
+                    volumeDataSetRes.MultiResolutionHistogram = IntPtr.Zero;
+                }
                 volumeDataSetRes.HasFitsRestFrequency =
                     volumeDataSetRes.HeaderDictionary.ContainsKey("RESTFRQ") || volumeDataSetRes.HeaderDictionary.ContainsKey("RESTFREQ");
             }
@@ -506,9 +563,8 @@ namespace VolumeData
             {
                 Stopwatch sw = new Stopwatch();
                 sw.Start();
-                var sourceArray = DataAnalysis.GetMaskedSourceArray(volumeDataSetRes.FitsData, volumeDataSetRes.XDim, volumeDataSetRes.YDim, volumeDataSetRes.ZDim);
                 volumeDataSetRes.SourceStatsDict = new Dictionary<int, DataAnalysis.SourceStats>();
-                foreach (var source in sourceArray)
+                foreach (var source in maskSources)
                 {
                     volumeDataSetRes.SourceStatsDict[source.maskVal] = DataAnalysis.SourceStats.FromSourceInfo(source);
                     volumeDataSetRes.UpdateStats(source.maskVal);
@@ -651,6 +707,12 @@ namespace VolumeData
             long numberDataPoints = volumeDataSet.XDim * volumeDataSet.YDim * volumeDataSet.ZDim;
             IntPtr histogramPtr = IntPtr.Zero;
             volumeDataSet.HistogramBinWidth = (max - min) / volumeDataSet.Histogram.Length;
+            if (volumeDataSet.MultiResolutionHistogram != IntPtr.Zero &&
+                DataAnalysis.RebinMultiResolutionHistogram(volumeDataSet.MultiResolutionHistogram, min, max, volumeDataSet.Histogram.Length,
+                    (int)DataAnalysis.HistogramSpacing.Linear, 0, volumeDataSet.Histogram, null) == 0)
+            {
+                return;
+            }
             DataAnalysis.GetHistogram(volumeDataSet.FitsData, numberDataPoints, volumeDataSet.Histogram.Length, min, max, out histogramPtr);
             Marshal.Copy(histogramPtr, volumeDataSet.Histogram, 0, volumeDataSet.Histogram.Length);
             if (histogramPtr != IntPtr.Zero)
@@ -1883,6 +1945,11 @@ namespace VolumeData
                 FitsReader.FreeFitsMemory(FitsHeader, out status);
                 FitsHeader = IntPtr.Zero;
             }
+            if (MultiResolutionHistogram != IntPtr.Zero)
+            {
+                DataAnalysis.FreeMultiResolutionHistogram(MultiResolutionHistogram);
+                MultiResolutionHistogram = IntPtr.Zero;
+            }
 
             if (AstFrameSet != IntPtr.Zero)
             {
@@ -0,0 +1,515 @@
+/*
+ * iDaVIE (immersive Data Visualisation Interactive Explorer)
+ * Copyright (C) 2024 Inter-University Institute for Data Intensive Astronomy
+ *
+ * This file is part of the iDaVIE project.
+ *
+ * iDaVIE is free software: you can redistribute it and/or modify it under the terms 
+ * of the GNU Lesser General Public License (LGPL) as published by the Free Software 
+ * Foundation, either version 3 of the License, or (at your option) any later version.
+ *
+ * iDaVIE is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; 
+ * without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR 
+ * PURPOSE. See the GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License along with 
+ * iDaVIE in the LICENSE file. If not, see <https://www.gnu.org/licenses/>.
+ *
+ * Additional information and disclaimers regarding liability and third-party 
+ * components can be found in the DISCLAIMER and NOTICE files included with this project.
+ *
+ */
+#include "cube_buffer.h"
+#include "data_analysis_tool.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <limits>
+#include <mutex>
+#include <new>
+#include <sstream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <omp.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+using namespace std;
+
+namespace
+{
+constexpr int64_t HUGE_PAGE_SIZE = 2 * 1024 * 1024;
+constexpr int64_t MAX_SAMPLED_PAGES = 4096;
+
+struct CubeBufferAllocation
+{
+    void* base;           // Start of the OS mapping (may precede the returned pointer for alignment)
+    int64_t mappedBytes;  // Size of the OS mapping
+    int64_t sizeBytes;    // Size requested by the caller
+    int32_t mode;
+    bool largePages;      // True if the mapping was created with explicit large pages (Windows)
+};
+
+std::atomic<int32_t> currentMode{CUBE_BUFFER_DEFAULT};
+std::mutex registryMutex;
+std::unordered_map<const void*, CubeBufferAllocation> registry;
+
+int64_t GetSystemPageSize()
+{
+#ifdef _WIN32
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return info.dwPageSize;
+#else
+    return sysconf(_SC_PAGESIZE);
+#endif
+}
+
+/**
+ * Maps @p sizeBytes of zero-filled virtual memory directly from the OS. No physical pages are committed
+ * by the call (except for Windows large pages, which cannot be demand-paged), so that the subsequent
+ * first touch decides their NUMA placement.
+ */
+bool MapCubeBuffer(int64_t sizeBytes, bool hugePages, CubeBufferAllocation& allocation)
+{
+    allocation.sizeBytes = sizeBytes;
+    allocation.largePages = false;
+#ifdef _WIN32
+    if (hugePages)
+    {
+        const int64_t largePageSize = GetLargePageMinimum();
+        if (largePageSize > 0)
+        {
+            const int64_t mappedBytes = (sizeBytes + largePageSize - 1) / largePageSize * largePageSize;
+            // Fails without the SeLockMemoryPrivilege, in which case we fall back to regular pages
+            void* ptr = VirtualAlloc(nullptr, mappedBytes, MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES, PAGE_READWRITE);
+            if (ptr)
+            {
+                allocation.base = ptr;
+                allocation.mappedBytes = mappedBytes;
+                allocation.largePages = true;
+                return true;
+            }
+        }
+    }
+    void* ptr = VirtualAlloc(nullptr, sizeBytes, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+    if (!ptr)
+    {
+        return false;
+    }
+    allocation.base = ptr;
+    allocation.mappedBytes = sizeBytes;
+    return true;
+#else
+    // Over-allocate so that the buffer can start on a huge page boundary, then trim the excess
+    const int64_t alignment = hugePages ? HUGE_PAGE_SIZE : GetSystemPageSize();
+    const int64_t alignedBytes = (sizeBytes + alignment - 1) / alignment * alignment;
+    const int64_t mappedBytes = alignedBytes + (hugePages ? alignment : 0);
+    void* ptr = mmap(nullptr, mappedBytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (ptr == MAP_FAILED)
+    {
+        return false;
+    }
+    auto start = reinterpret_cast<uintptr_t>(ptr);
+    auto alignedStart = (start + alignment - 1) / alignment * alignment;
+    if (hugePages)
+    {
+        if (alignedStart > start)
+        {
+            munmap(ptr, alignedStart - start);
+        }
+        auto tail = start + mappedBytes - (alignedStart + alignedBytes);
+        if (tail > 0)
+        {
+            munmap(reinterpret_cast<void*>(alignedStart + alignedBytes), tail);
+        }
+#ifdef MADV_HUGEPAGE
+        // Advisory only: if transparent huge pages are disabled the buffer silently uses regular pages
+        madvise(reinterpret_cast<void*>(alignedStart), alignedBytes, MADV_HUGEPAGE);
+#endif
+    }
+    allocation.base = reinterpret_cast<void*>(alignedStart);
+    allocation.mappedBytes = alignedBytes;
+    return true;
+#endif
+}
+
+void UnmapCubeBuffer(const CubeBufferAllocation& allocation)
+{
+#ifdef _WIN32
+    VirtualFree(allocation.base, 0, MEM_RELEASE);
+#else
+    munmap(allocation.base, allocation.mappedBytes);
+#endif
+}
+
+/**
+ * Zeroes the buffer using the same static OpenMP schedule over element indices as the analysis kernels
+ * (FindStats, GetHistogram, ...), so that each thread's share of the data lands on its own NUMA node.
+ */
+template<typename T>
+void FirstTouchCubeBuffer(T* buffer, int64_t numberElements)
+{
+    #pragma omp parallel for schedule(static)
+    for (int64_t i = 0; i < numberElements; i++)
+    {
+        buffer[i] = 0;
+    }
+}
+
+void* AllocateCubeBufferBytes(int64_t numberElements, int elementSize, int32_t mode)
+{
+    CubeBufferAllocation allocation{};
+    allocation.mode = mode;
+    if (!MapCubeBuffer(numberElements * elementSize, mode == CUBE_BUFFER_HUGE_PAGES, allocation))
+    {
+        return nullptr;
+    }
+    switch (elementSize)
+    {
+        case 1:
+            FirstTouchCubeBuffer(static_cast<int8_t*>(allocation.base), numberElements);
+            break;
+        case 2:
+            FirstTouchCubeBuffer(static_cast<int16_t*>(allocation.base), numberElements);
+            break;
+        case 8:
+            FirstTouchCubeBuffer(static_cast<int64_t*>(allocation.base), numberElements);
+            break;
+        default:
+            FirstTouchCubeBuffer(static_cast<int32_t*>(allocation.base), numberElements * elementSize / 4);
+            break;
+    }
+    std::lock_guard<std::mutex> lock(registryMutex);
+    registry[allocation.base] = allocation;
+    return allocation.base;
+}
+
+#ifndef _WIN32
+/**
+ * Returns the number of bytes backed by transparent huge pages in the mapping starting at @p address,
+ * as reported by /proc/self/smaps.
+ */
+int64_t GetHugePageBytes(const void* address)
+{
+    std::ifstream smaps("/proc/self/smaps");
+    std::string line;
+    bool inMapping = false;
+    auto target = reinterpret_cast<uintptr_t>(address);
+    int64_t hugeBytes = 0;
+    while (std::getline(smaps, line))
+    {
+        uintptr_t start, end;
+        char dash;
+        std::istringstream range(line);
+        if (range >> std::hex >> start >> dash >> end && dash == '-')
+        {
+            if (inMapping)
+            {
+                break;
+            }
+            inMapping = target >= start && target < end;
+            continue;
+        }
+        if (inMapping && line.rfind("AnonHugePages:", 0) == 0)
+        {
+            std::istringstream value(line.substr(14));
+            int64_t kiloBytes = 0;
+            value >> kiloBytes;
+            hugeBytes = kiloBytes * 1024;
+        }
+    }
+    return hugeBytes;
+}
+#endif
+
+/**
+ * Determines the NUMA node of each page in @p pages. Nodes that cannot be determined (pages that are not
+ * resident yet) are reported as -1.
+ */
+void QueryPageNodes(std::vector<void*>& pages, std::vector<int>& nodes)
+{
+    nodes.assign(pages.size(), -1);
+#ifdef _WIN32
+    std::vector<PSAPI_WORKING_SET_EX_INFORMATION> info(pages.size());
+    for (size_t i = 0; i < pages.size(); i++)
+    {
+        info[i].VirtualAddress = pages[i];
+    }
+    if (QueryWorkingSetEx(GetCurrentProcess(), info.data(), static_cast<DWORD>(info.size() * sizeof(PSAPI_WORKING_SET_EX_INFORMATION))))
+    {
+        for (size_t i = 0; i < pages.size(); i++)
+        {
+            if (info[i].VirtualAttributes.Valid)
+            {
+                nodes[i] = info[i].VirtualAttributes.Node;
+            }
+        }
+    }
+#elif defined(SYS_move_pages)
+    // move_pages with a null node list only queries the current placement of each page
+    syscall(SYS_move_pages, 0, pages.size(), pages.data(), nullptr, nodes.data(), 0);
+#endif
+}
+}
+
+template<typename T>
+T* AllocateCubeBuffer(int64_t numberElements)
+{
+    const int32_t mode = currentMode.load();
+    if (mode == CUBE_BUFFER_DEFAULT)
+    {
+        return new (std::nothrow) T[numberElements];
+    }
+    return static_cast<T*>(AllocateCubeBufferBytes(numberElements, sizeof(T), mode));
+}
+
+template float* AllocateCubeBuffer<float>(int64_t);
+template int16_t* AllocateCubeBuffer<int16_t>(int64_t);
+template int32_t* AllocateCubeBuffer<int32_t>(int64_t);
+template uint8_t* AllocateCubeBuffer<uint8_t>(int64_t);
+
+bool ReleaseCubeBuffer(void* buffer)
+{
+    if (buffer == nullptr)
+    {
+        return false;
+    }
+    CubeBufferAllocation allocation;
+    {
+        std::lock_guard<std::mutex> lock(registryMutex);
+        auto it = registry.find(buffer);
+        if (it == registry.end())
+        {
+            return false;
+        }
+        allocation = it->second;
+        registry.erase(it);
+    }
+    UnmapCubeBuffer(allocation);
+    return true;
+}
+
+/**
+ * @brief Selects the allocation mode used for subsequently allocated cube buffers.
+ *
+ * The mode applies to the float cubes allocated by the FITS loader and to buffers allocated via
+ * AllocateCubeBuffer. Buffers that are already allocated keep their placement.
+ *
+ * @param mode One of the CubeBufferMode values.
+ * @return EXIT_SUCCESS if the mode is valid, EXIT_FAILURE otherwise.
+ */
+int SetCubeBufferMode(int mode)
+{
+    if (mode < CUBE_BUFFER_DEFAULT || mode > CUBE_BUFFER_HUGE_PAGES)
+    {
+        return EXIT_FAILURE;
+    }
+    currentMode = mode;
+    return EXIT_SUCCESS;
+}
+
+/**
+ * @brief Retrieves the allocation mode currently used for cube buffers.
+ *
+ * @param mode Output pointer for the current CubeBufferMode.
+ * @return EXIT_SUCCESS
+ */
+int GetCubeBufferMode(int* mode)
+{
+    *mode = currentMode.load();
+    return EXIT_SUCCESS;
+}
+
+/**
+ * @brief Allocates a cube buffer of the given element size using the current allocation mode.
+ *
+ * In the default mode the buffer is allocated with `new[]` and left uninitialised. In the other modes
+ * the buffer is mapped from the OS and zeroed in parallel with a static schedule, so that pages are
+ * distributed over the NUMA nodes in the same way as the work of the OpenMP analysis kernels.
+ *
+ * @param numberElements Number of elements in the buffer.
+ * @param elementSize Size of each element in bytes (1, 2, 4 or 8).
+ * @param buffer Output pointer to the allocated buffer. Must be freed with FreeCubeBuffer.
+ * @return EXIT_SUCCESS on success, EXIT_FAILURE if the allocation failed or the element size is invalid.
+ */
+int AllocateCubeBuffer(int64_t numberElements, int elementSize, void** buffer)
+{
+    if (numberElements <= 0 || (elementSize != 1 && elementSize != 2 && elementSize != 4 && elementSize != 8))
+    {
+        return EXIT_FAILURE;
+    }
+    const int32_t mode = currentMode.load();
+    void* newBuffer = nullptr;
+    if (mode == CUBE_BUFFER_DEFAULT)
+    {
+        newBuffer = new (std::nothrow) char[numberElements * elementSize];
+    }
+    else
+    {
+        newBuffer = AllocateCubeBufferBytes(numberElements, elementSize, mode);
+    }
+    if (newBuffer == nullptr)
+    {
+        return EXIT_FAILURE;
+    }
+    *buffer = newBuffer;
+    return EXIT_SUCCESS;
+}
+
+/**
+ * @brief Frees a buffer allocated with AllocateCubeBuffer, whichever mode it was allocated in.
+ *
+ * @param buffer Pointer to the buffer to free.
+ * @return EXIT_SUCCESS
+ */
+int FreeCubeBuffer(void* buffer)
+{
+    if (!ReleaseCubeBuffer(buffer))
+    {
+        delete[] static_cast<char*>(buffer);
+    }
+    return EXIT_SUCCESS;
+}
+
+/**
+ * @brief Reports huge page usage and NUMA placement of a cube buffer.
+ *
+ * Up to 4096 evenly spaced pages of the buffer are sampled, and the number of sampled pages found on
+ * each NUMA node is returned. Only buffers allocated in a non-default mode can be queried, since the
+ * extent of plain heap buffers is unknown.
+ *
+ * @param buffer Pointer to a buffer returned by AllocateCubeBuffer or by the FITS loader.
+ * @param stats Output pointer to the placement statistics.
+ * @return EXIT_SUCCESS on success, EXIT_FAILURE if the buffer was not allocated as a cube buffer.
+ */
+int GetCubeBufferStats(const void* buffer, CubeBufferStats* stats)
+{
+    CubeBufferAllocation allocation;
+    {
+        std::lock_guard<std::mutex> lock(registryMutex);
+        auto it = registry.find(buffer);
+        if (it == registry.end())
+        {
+            return EXIT_FAILURE;
+        }
+        allocation = it->second;
+    }
+
+    *stats = {};
+    stats->sizeBytes = allocation.sizeBytes;
+    stats->mode = allocation.mode;
+    stats->pageSize = allocation.mode == CUBE_BUFFER_HUGE_PAGES ? HUGE_PAGE_SIZE : GetSystemPageSize();
+#ifdef _WIN32
+    stats->hugePageBytes = allocation.largePages ? allocation.mappedBytes : 0;
+#else
+    stats->hugePageBytes = GetHugePageBytes(allocation.base);
+#endif
+
+    // Sample at system page granularity, since huge pages may have been split by the OS
+    const int64_t systemPageSize = GetSystemPageSize();
+    const int64_t numberPages = (allocation.sizeBytes + systemPageSize - 1) / systemPageSize;
+    const int64_t numberSamples = std::min(numberPages, MAX_SAMPLED_PAGES);
+    std::vector<void*> pages(numberSamples);
+    for (int64_t i = 0; i < numberSamples; i++)
+    {
+        int64_t page = i * numberPages / numberSamples;
+        pages[i] = static_cast<char*>(allocation.base) + page * systemPageSize;
+    }
+    std::vector<int> nodes;
+    QueryPageNodes(pages, nodes);
+
+    stats->sampledPages = numberSamples;
+    for (auto node : nodes)
+    {
+        if (node >= 0 && node < CUBE_BUFFER_MAX_NUMA_NODES)
+        {
+            if (stats->pagesPerNode[node] == 0)
+            {
+                stats->numNodes++;
+            }
+            stats->pagesPerNode[node]++;
+        }
+        else
+        {
+            stats->unplacedPages++;
+        }
+    }
+    return EXIT_SUCCESS;
+}
+
+/**
+ * @brief Measures the read bandwidth of FindStats on cube buffers placed by different strategies.
+ *
+ * Three buffers of @p numberElements floats are filled on a single thread, mimicking the FITS loader:
+ * one allocated with `new[]` (pages placed by the serial fill), one allocated with parallel first touch,
+ * and one allocated with huge pages and parallel first touch. FindStats is then run @p iterations times
+ * on each buffer, and the best observed bandwidth is reported in GB/s.
+ *
+ * @param numberElements Number of float elements per buffer. Should be much larger than the last-level cache.
+ * @param iterations Number of timed FindStats passes per buffer.
+ * @param serialTouchBandwidth Output bandwidth for the buffer placed by a serial fill.
+ * @param firstTouchBandwidth Output bandwidth for the buffer placed by parallel first touch.
+ * @param hugePageBandwidth Output bandwidth for the huge page buffer placed by parallel first touch.
+ * @return EXIT_SUCCESS on success, EXIT_FAILURE if any of the buffers could not be allocated.
+ */
+int BenchmarkCubeBufferBandwidth(int64_t numberElements, int iterations, double* serialTouchBandwidth, double* firstTouchBandwidth, double* hugePageBandwidth)
+{
+    if (numberElements <= 0 || iterations <= 0)
+    {
+        return EXIT_FAILURE;
+    }
+    const int32_t previousMode = currentMode.load();
+    float* buffers[3] = {};
+    double* results[3] = {serialTouchBandwidth, firstTouchBandwidth, hugePageBandwidth};
+    const int32_t modes[3] = {CUBE_BUFFER_DEFAULT, CUBE_BUFFER_FIRST_TOUCH, CUBE_BUFFER_HUGE_PAGES};
+    int result = EXIT_SUCCESS;
+
+    for (int b = 0; b < 3 && result == EXIT_SUCCESS; b++)
+    {
+        currentMode = modes[b];
+        buffers[b] = modes[b] == CUBE_BUFFER_DEFAULT ? new (std::nothrow) float[numberElements] : AllocateCubeBuffer<float>(numberElements);
+        if (buffers[b] == nullptr)
+        {
+            result = EXIT_FAILURE;
+            break;
+        }
+        // Serial fill, as done by CFITSIO when reading the cube
+        for (int64_t i = 0; i < numberElements; i++)
+        {
+            buffers[b][i] = static_cast<float>(i & 1023);
+        }
+
+        double bestSeconds = std::numeric_limits<double>::max();
+        for (int n = 0; n < iterations; n++)
+        {
+            float maxVal, minVal, meanVal, stdDevVal;
+            auto start = std::chrono::high_resolution_clock::now();
+            FindStats(buffers[b], numberElements, &maxVal, &minVal, &meanVal, &stdDevVal);
+            auto end = std::chrono::high_resolution_clock::now();
+            bestSeconds = std::min(bestSeconds, std::chrono::duration<double>(end - start).count());
+        }
+        *results[b] = numberElements * sizeof(float) / bestSeconds / 1.0e9;
+    }
+
+    for (int b = 0; b < 3; b++)
+    {
+        if (buffers[b] != nullptr && !ReleaseCubeBuffer(buffers[b]))
+        {
+            delete[] buffers[b];
+        }
+    }
+    currentMode = previousMode;
+    return result;
+}
@@ -0,0 +1,97 @@
+/*
+ * iDaVIE (immersive Data Visualisation Interactive Explorer)
+ * Copyright (C) 2024 Inter-University Institute for Data Intensive Astronomy
+ *
+ * This file is part of the iDaVIE project.
+ *
+ * iDaVIE is free software: you can redistribute it and/or modify it under the terms 
+ * of the GNU Lesser General Public License (LGPL) as published by the Free Software 
+ * Foundation, either version 3 of the License, or (at your option) any later version.
+ *
+ * iDaVIE is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; 
+ * without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR 
+ * PURPOSE. See the GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License along with 
+ * iDaVIE in the LICENSE file. If not, see <https://www.gnu.org/licenses/>.
+ *
+ * Additional information and disclaimers regarding liability and third-party 
+ * components can be found in the DISCLAIMER and NOTICE files included with this project.
+ *
+ */
+#ifndef NATIVE_PLUGINS_CUBE_BUFFER_H
+#define NATIVE_PLUGINS_CUBE_BUFFER_H
+
+#include <cstdint>
+#include <cstddef>
+
+#define DllExport __declspec (dllexport)
+
+#define EXIT_SUCCESS 0
+#define EXIT_FAILURE 1
+
+#define CUBE_BUFFER_MAX_NUMA_NODES 8
+
+/**
+ * @brief Allocation modes for large cube buffers.
+ *
+ * CUBE_BUFFER_DEFAULT keeps the plain `new[]` allocation used throughout the plugin.
+ * CUBE_BUFFER_FIRST_TOUCH maps the buffer directly from the OS and zeroes it in parallel, so that
+ * each page is placed on the NUMA node of the thread that will later process it.
+ * CUBE_BUFFER_HUGE_PAGES additionally requests 2 MB pages (transparent huge pages on Linux,
+ * large pages on Windows) before the parallel first touch.
+ */
+enum CubeBufferMode : int32_t
+{
+    CUBE_BUFFER_DEFAULT = 0,
+    CUBE_BUFFER_FIRST_TOUCH = 1,
+    CUBE_BUFFER_HUGE_PAGES = 2
+};
+
+/**
+ * @brief Page placement summary of a cube buffer, as reported by GetCubeBufferStats.
+ *
+ * The placement is determined from an evenly spaced sample of the buffer's pages, so that the
+ * query stays cheap for buffers of tens of gigabytes.
+ */
+struct CubeBufferStats
+{
+    int64_t sizeBytes;                                  /**< Size of the buffer in bytes */
+    int64_t pageSize;                                   /**< Page size requested for the buffer */
+    int64_t hugePageBytes;                              /**< Bytes reported by the OS as backed by huge pages */
+    int32_t mode;                                       /**< CubeBufferMode used for the allocation */
+    int32_t numNodes;                                   /**< Number of NUMA nodes holding sampled pages */
+    int64_t sampledPages;                               /**< Number of pages sampled */
+    int64_t unplacedPages;                              /**< Sampled pages that are not yet resident */
+    int64_t pagesPerNode[CUBE_BUFFER_MAX_NUMA_NODES];   /**< Sampled page count per NUMA node */
+};
+
+/**
+ * @brief Allocates a cube buffer of @p numberElements elements using the current allocation mode.
+ *
+ * Buffers allocated in the default mode are plain `new[]` arrays. Any other mode returns memory that
+ * must be released through ReleaseCubeBuffer (the plugin's free functions already do so).
+ *
+ * @return Pointer to the buffer, or nullptr if the allocation failed.
+ */
+template<typename T> T* AllocateCubeBuffer(int64_t numberElements);
+
+/**
+ * @brief Releases a buffer allocated by AllocateCubeBuffer in a non-default mode.
+ *
+ * @return true if the pointer belonged to a cube buffer and was released, false otherwise
+ *         (in which case the caller still owns it).
+ */
+bool ReleaseCubeBuffer(void* buffer);
+
+extern "C"
+{
+DllExport int SetCubeBufferMode(int);
+DllExport int GetCubeBufferMode(int*);
+DllExport int AllocateCubeBuffer(int64_t, int, void**);
+DllExport int FreeCubeBuffer(void*);
+DllExport int GetCubeBufferStats(const void*, CubeBufferStats*);
+DllExport int BenchmarkCubeBufferBandwidth(int64_t, int, double*, double*, double*);
+}
+
+#endif //NATIVE_PLUGINS_CUBE_BUFFER_H
@@ -20,10 +20,16 @@
  *
  */
 #include "data_analysis_tool.h"
-#include "cdl_zscale.h"
+#include "cube_buffer.h"
+#include "statistics_tool.h"
+#include "zscale_tool.h"
+#include "sparse_mask.h"
+#include "spectral_cube.h"
+#include "typed_cube.h"
 
 #include <unordered_map>
 #include <limits>
+#include <type_traits>
 
 using namespace std;
 
@@ -53,7 +59,7 @@ int FindMaxMin(const float *dataPtr, int64_t numberElements, float *maxResult, f
     {
         float currentMax = -numeric_limits<float>::max();
         float currentMin = numeric_limits<float>::max();
-        #pragma omp for
+        #pragma omp for schedule(static)
         for (int64_t i = 0; i < numberElements; i++)
         {
             float val = dataPtr[i];
@@ -96,39 +102,69 @@ int FindMaxMin(const float *dataPtr, int64_t numberElements, float *maxResult, f
  */
 int FindStats(const float* dataPtr, int64_t numberElements, float* maxResult, float* minResult, float* meanResult, float* stdDevResult)
 {
-    float maxVal = -numeric_limits<float>::max();
-    float minVal = numeric_limits<float>::max();
+    ComputeStats(dataPtr, FloatDecoder(), numberElements, true, maxResult, minResult, meanResult, stdDevResult);
+    return EXIT_SUCCESS;
+}
+
+/**
+ * @brief Implementation of FindStats for any storage type and value decoder, see FloatDecoder.
+ *
+ * Extremes and moments are accumulated on the raw values, and decoded once at the end.
+ *
+ * @param normaliseByAllElements If true, the mean and standard deviation are normalised by numberElements, as
+ *        FindStats always has; otherwise, by the number of valid voxels.
+ * @return int EXIT_SUCCESS, or EXIT_FAILURE if the mean is normalised by the valid voxels and there are none.
+ */
+template<typename T, typename Decoder>
+int ComputeStats(const T* dataPtr, const Decoder& decoder, int64_t numberElements, bool normaliseByAllElements, float* maxResult, float* minResult,
+                 float* meanResult, float* stdDevResult)
+{
+    T maxVal = numeric_limits<T>::lowest();
+    T minVal = numeric_limits<T>::max();
     double sum = 0;
     double squareSum = 0;
+    int64_t count = 0;
     #pragma omp parallel
     {
-        float currentMax = -numeric_limits<float>::max();
-        float currentMin = numeric_limits<float>::max();
-        #pragma omp for reduction(+:sum) reduction(+:squareSum)
+        T currentMax = numeric_limits<T>::lowest();
+        T currentMin = numeric_limits<T>::max();
+        #pragma omp for schedule(static) reduction(+:sum) reduction(+:squareSum) reduction(+:count)
         for (int64_t i = 0; i < numberElements; i++)
         {
-            double val = dataPtr[i];
-            if (!isnan(val))
+            T raw = dataPtr[i];
+            if (!decoder.IsBlank(raw))
             {
+                double val = raw;
                 sum += val;
                 squareSum += val * val;
-                currentMax = fmax(currentMax, val);
-                currentMin = fmin(currentMin, val);
+                count++;
+                currentMax = max(currentMax, raw);
+                currentMin = min(currentMin, raw);
             }
         }
         #pragma omp critical
         {
-            maxVal = fmax(currentMax, maxVal);
-            minVal = fmin(currentMin, minVal);
+            maxVal = max(currentMax, maxVal);
+            minVal = min(currentMin, minVal);
         }
-        *maxResult = maxVal;
-        *minResult = minVal;
-        *meanResult = sum / numberElements;
-        *stdDevResult = sqrt((numberElements * squareSum - sum * sum) / (numberElements * (numberElements - 1)));
     }
+    if (!normaliseByAllElements && count == 0)
+    {
+        return EXIT_FAILURE;
+    }
+    const int64_t n = normaliseByAllElements ? numberElements : count;
+    // A negative scale swaps the raw extremes
+    *maxResult = decoder(decoder.scale >= 0 ? maxVal : minVal);
+    *minResult = decoder(decoder.scale >= 0 ? minVal : maxVal);
+    *meanResult = decoder.zero + decoder.scale * sum / n;
+    *stdDevResult = fabs(decoder.scale) * sqrt((n * squareSum - sum * sum) / (n * (n - 1)));
     return EXIT_SUCCESS;
 }
 
+template int ComputeStats<float, FloatDecoder>(const float*, const FloatDecoder&, int64_t, bool, float*, float*, float*, float*);
+template int ComputeStats<int16_t, ScaledDecoder<int16_t>>(const int16_t*, const ScaledDecoder<int16_t>&, int64_t, bool, float*, float*, float*, float*);
+template int ComputeStats<int32_t, ScaledDecoder<int32_t>>(const int32_t*, const ScaledDecoder<int32_t>&, int64_t, bool, float*, float*, float*, float*);
+
 /**
  * @brief Retrieves the value of a voxel at the given (x, y, z) coordinate from a 3D float array.
  *
@@ -257,11 +293,11 @@ int GetXProfile(const float *dataPtr, float **profile, int64_t xDim, int64_t yDi
 
 int GetYProfile(const float *dataPtr, float **profile, int64_t xDim, int64_t yDim, int64_t zDim, int64_t x, int64_t z)
 {
-    float* newProfile = new float[yDim];
     if (x > xDim || z > zDim || x < 1 || z < 1)
         return EXIT_FAILURE;
-    for (int i = 0; i < yDim; i++)
-        newProfile[i] = dataPtr[(z - 1) * xDim * yDim + yDim * i + (x - 1)];
+    float* newProfile = new float[yDim];
+    for (int64_t i = 0; i < yDim; i++)
+        newProfile[i] = dataPtr[(z - 1) * xDim * yDim + xDim * i + (x - 1)];
     *profile = newProfile;
     return EXIT_SUCCESS;
 }
@@ -291,10 +327,18 @@ int GetYProfile(const float *dataPtr, float **profile, int64_t xDim, int64_t yDi
  */
 int GetZProfile(const float *dataPtr, float **profile, int64_t xDim, int64_t yDim, int64_t zDim, int64_t x, int64_t y)
 {
-    float* newProfile = new float[zDim];
     if (x > xDim || y > yDim || x < 1 || y < 1)
         return EXIT_FAILURE;
-    for (int i = 0; i < zDim; i++)
+    float* newProfile = new float[zDim];
+    std::shared_ptr<const SpectralCube> spectralCube = FindSpectralCube(dataPtr, xDim, yDim, zDim);
+    if (spectralCube)
+    {
+        const float* spectrum = spectralCube->data + ((y - 1) * xDim + (x - 1)) * zDim;
+        std::copy(spectrum, spectrum + zDim, newProfile);
+        *profile = newProfile;
+        return EXIT_SUCCESS;
+    }
+    for (int64_t i = 0; i < zDim; i++)
         newProfile[i] = dataPtr[i * xDim * yDim + (y - 1) * xDim + (x - 1)];
     *profile = newProfile;
     return EXIT_SUCCESS;
@@ -330,23 +374,26 @@ int DataCropAndDownsample(const float* dataPtr, float** newDataPtr, int64_t dimX
                           int64_t cropY2, int64_t cropZ2, int factorX, int factorY, int factorZ, bool maxDownsampling) {
     // Make use of templated function to allow constexpr branching in inner loops without reducing performance
     if (maxDownsampling) {
-        return DataCropAndDownsample<true>(dataPtr, newDataPtr, dimX, dimY, dimZ, cropX1, cropY1, cropZ1, cropX2, cropY2, cropZ2, factorX, factorY, factorZ);
+        return DataCropAndDownsample<true>(dataPtr, FloatDecoder(), newDataPtr, dimX, dimY, dimZ, cropX1, cropY1, cropZ1, cropX2, cropY2, cropZ2, factorX, factorY, factorZ);
     } else {
-        return DataCropAndDownsample<false>(dataPtr, newDataPtr, dimX, dimY, dimZ, cropX1, cropY1, cropZ1, cropX2, cropY2, cropZ2, factorX, factorY, factorZ);
+        return DataCropAndDownsample<false>(dataPtr, FloatDecoder(), newDataPtr, dimX, dimY, dimZ, cropX1, cropY1, cropZ1, cropX2, cropY2, cropZ2, factorX, factorY, factorZ);
     }
 }
 
 /**
- * @brief Internal templated function that crops and downsamples a 3D float volume.
+ * @brief Internal templated function that crops and downsamples a 3D volume into a float volume.
  * 
  * Depending on the template parameter maxMode, this function performs either
  * average pooling (when false) or max pooling (when true) on the cropped 3D region.
- * The function handles partial blocks at the volume edges and skips NaN values
+ * The function handles partial blocks at the volume edges and skips blank values
  * during accumulation.
  * 
  * @tparam maxMode If true, uses max pooling; otherwise, uses average pooling.
+ * @tparam T The storage type of the input volume.
+ * @tparam Decoder The value decoder of the input volume, see FloatDecoder.
  * 
- * @param dataPtr Pointer to the input 3D float volume (flattened in Z-Y-X order).
+ * @param dataPtr Pointer to the input 3D volume (flattened in Z-Y-X order).
+ * @param decoder Converts the stored values to physical values.
  * @param newDataPtr Output pointer to hold the resulting downsampled 3D volume.
  * @param dimX Original X-dimension of the input volume.
  * @param dimY Original Y-dimension of the input volume.
@@ -365,10 +412,10 @@ int DataCropAndDownsample(const float* dataPtr, float** newDataPtr, int64_t dimX
  * 
  * @note Memory for the output is allocated internally and must be freed by the caller.
  * @note Uses OpenMP to parallelize over the Z-dimension for performance.
- * @note If all values in a downsampling block are NaN, the result will be NaN.
+ * @note If all values in a downsampling block are blank, the result will be NaN.
  */
-template<bool maxMode>
-int DataCropAndDownsample(const float* dataPtr, float** newDataPtr, const int64_t dimX, const int64_t dimY, const int64_t dimZ, const int64_t cropX1, const int64_t cropY1,
+template<bool maxMode, typename T, typename Decoder>
+int DataCropAndDownsample(const T* dataPtr, const Decoder& decoder, float** newDataPtr, const int64_t dimX, const int64_t dimY, const int64_t dimZ, const int64_t cropX1, const int64_t cropY1,
                           const int64_t cropZ1, const int64_t cropX2, const int64_t cropY2, const int64_t cropZ2, const int factorX, const int factorY, const int factorZ)
 {
     if (cropX1 > dimX || cropX2 > dimX || cropY1 > dimY || cropY2 > dimY || cropZ1 > dimZ || cropZ2 > dimZ || cropX1 < 1 || cropX2 < 1 || cropY1 < 1 || cropY2 < 1 || cropZ1 < 1 ||
@@ -377,14 +424,17 @@ int DataCropAndDownsample(const float* dataPtr, float** newDataPtr, const int64_
         return EXIT_FAILURE;
     }
 
-    int64_t newDimX = (abs(cropX1 - cropX2) + 1) / factorX;
-    int64_t newDimY = (abs(cropY1 - cropY2) + 1) / factorY;
-    int64_t newDimZ = (abs(cropZ1 - cropZ2) + 1) / factorZ;
-    if ((abs(cropX1 - cropX2) + 1) % factorX != 0)
+    const int64_t cropDimX = abs(cropX1 - cropX2) + 1;
+    const int64_t cropDimY = abs(cropY1 - cropY2) + 1;
+    const int64_t cropDimZ = abs(cropZ1 - cropZ2) + 1;
+    int64_t newDimX = cropDimX / factorX;
+    int64_t newDimY = cropDimY / factorY;
+    int64_t newDimZ = cropDimZ / factorZ;
+    if (cropDimX % factorX != 0)
         newDimX++;
-    if ((abs(cropY1 - cropY2) + 1) % factorY != 0)
+    if (cropDimY % factorY != 0)
         newDimY++;
-    if ((abs(cropZ1 - cropZ2) + 1) % factorZ != 0)
+    if (cropDimZ % factorZ != 0)
         newDimZ++;
 
     const int64_t newSize = newDimX * newDimY * newDimZ;
@@ -416,17 +466,18 @@ int DataCropAndDownsample(const float* dataPtr, float** newDataPtr, const int64_
                 blockSizeX = factorX;
                 blockSizeY = factorY;
                 blockSizeZ = factorZ;
-                if ((newX + 1) * factorX >= dimX)
+                // Partial blocks are clipped at the edges of the crop region, not of the cube
+                if ((newX + 1) * factorX >= cropDimX)
                 {
-                    blockSizeX = dimX - (newX * factorX);
+                    blockSizeX = cropDimX - (newX * factorX);
                 }
-                if ((newY + 1) * factorY >= dimY)
+                if ((newY + 1) * factorY >= cropDimY)
                 {
-                    blockSizeY = dimY - (newY * factorY);
+                    blockSizeY = cropDimY - (newY * factorY);
                 }
-                if ((newZ + 1) * factorZ >= dimZ)
+                if ((newZ + 1) * factorZ >= cropDimZ)
                 {
-                    blockSizeZ = dimZ - (newZ * factorZ);
+                    blockSizeZ = cropDimZ - (newZ * factorZ);
                 }
                 for (auto pixelZ = 0; pixelZ < blockSizeZ; pixelZ++)
                 {
@@ -437,7 +488,7 @@ int DataCropAndDownsample(const float* dataPtr, float** newDataPtr, const int64_
                         for (auto pixelX = 0; pixelX < blockSizeX; pixelX++)
                         {
                             oldX = newX * factorX + pixelX + smallX - 1;
-                            auto pixVal = dataPtr[oldZ * dimX * dimY + oldY * dimX + oldX];
+                            float pixVal = decoder(dataPtr[oldZ * dimX * dimY + oldY * dimX + oldX]);
                             if (!isnan(pixVal))
                             {
                                 pixelCount++;
@@ -479,6 +530,13 @@ int DataCropAndDownsample(const float* dataPtr, float** newDataPtr, const int64_
     return EXIT_SUCCESS;
 }
 
+template int DataCropAndDownsample<true, float, FloatDecoder>(const float*, const FloatDecoder&, float**, int64_t, int64_t, int64_t, int64_t, int64_t, int64_t, int64_t, int64_t, int64_t, int, int, int);
+template int DataCropAndDownsample<false, float, FloatDecoder>(const float*, const FloatDecoder&, float**, int64_t, int64_t, int64_t, int64_t, int64_t, int64_t, int64_t, int64_t, int64_t, int, int, int);
+template int DataCropAndDownsample<true, int16_t, ScaledDecoder<int16_t>>(const int16_t*, const ScaledDecoder<int16_t>&, float**, int64_t, int64_t, int64_t, int64_t, int64_t, int64_t, int64_t, int64_t, int64_t, int, int, int);
+template int DataCropAndDownsample<false, int16_t, ScaledDecoder<int16_t>>(const int16_t*, const ScaledDecoder<int16_t>&, float**, int64_t, int64_t, int64_t, int64_t, int64_t, int64_t, int64_t, int64_t, int64_t, int, int, int);
+template int DataCropAndDownsample<true, int32_t, ScaledDecoder<int32_t>>(const int32_t*, const ScaledDecoder<int32_t>&, float**, int64_t, int64_t, int64_t, int64_t, int64_t, int64_t, int64_t, int64_t, int64_t, int, int, int);
+template int DataCropAndDownsample<false, int32_t, ScaledDecoder<int32_t>>(const int32_t*, const ScaledDecoder<int32_t>&, float**, int64_t, int64_t, int64_t, int64_t, int64_t, int64_t, int64_t, int64_t, int64_t, int, int, int);
+
 /**
  * @brief Crops and downsamples a 3D int16_t mask volume, preserving the presence of non-zero values.
  *
@@ -510,6 +568,17 @@ int DataCropAndDownsample(const float* dataPtr, float** newDataPtr, const int64_
  */
 int MaskCropAndDownsample(const int16_t *dataPtr, int16_t **newDataPtr, int64_t dimX, int64_t dimY, int64_t dimZ,
     int64_t cropX1, int64_t cropY1, int64_t cropZ1, int64_t cropX2, int64_t cropY2, int64_t cropZ2, int factorX, int factorY, int factorZ)
+{
+    DenseMaskReader reader = {dataPtr, dimX, dimY};
+    return ComputeMaskCropAndDownsample(reader, newDataPtr, dimX, dimY, dimZ, cropX1, cropY1, cropZ1, cropX2, cropY2, cropZ2, factorX, factorY, factorZ);
+}
+
+/**
+ * @brief Implementation of MaskCropAndDownsample for any mask reader (dense or sparse), see DenseMaskReader.
+ */
+template<typename MaskReader>
+int ComputeMaskCropAndDownsample(const MaskReader& reader, int16_t **newDataPtr, int64_t dimX, int64_t dimY, int64_t dimZ,
+    int64_t cropX1, int64_t cropY1, int64_t cropZ1, int64_t cropX2, int64_t cropY2, int64_t cropZ2, int factorX, int factorY, int factorZ)
 {
     if (cropX1 > dimX || cropX2 > dimX || cropY1 > dimY || cropY2 > dimY || cropZ1 > dimZ || cropZ2 > dimZ || cropX1 < 1 || cropX2 < 1 || cropY1 < 1 || cropY2 < 1 || cropZ1 < 1 || cropZ2 < 1)
         return EXIT_FAILURE;
@@ -559,7 +628,7 @@ int MaskCropAndDownsample(const int16_t *dataPtr, int16_t **newDataPtr, int64_t
                         for (auto pixelX = 0; pixelX < blockSizeX; pixelX++)
                         {
                             oldX = newX * factorX + pixelX + smallX - 1;
-                            pixVal = dataPtr[oldZ * dimX * dimY + oldY * dimX + oldX];
+                            pixVal = reader.At(oldX, oldY, oldZ);
                             if (pixVal != 0)
                                 break;
                         }
@@ -577,6 +646,9 @@ int MaskCropAndDownsample(const int16_t *dataPtr, int16_t **newDataPtr, int64_t
     return EXIT_SUCCESS;
 }
 
+template int ComputeMaskCropAndDownsample<DenseMaskReader>(const DenseMaskReader&, int16_t**, int64_t, int64_t, int64_t, int64_t, int64_t, int64_t, int64_t, int64_t, int64_t, int, int, int);
+template int ComputeMaskCropAndDownsample<SparseMaskReader>(const SparseMaskReader&, int16_t**, int64_t, int64_t, int64_t, int64_t, int64_t, int64_t, int64_t, int64_t, int64_t, int, int, int);
+
 /**
  * @brief Estimates the values at given percentiles from a histogram.
  *
@@ -644,7 +716,8 @@ int GetPercentileValuesFromHistogram(const int* histogram, int numBins, float mi
  * @brief Computes the values at specified percentiles from a float array of data.
  *
  * This function calculates the values corresponding to given percentiles (e.g., 2nd and 98th)
- * by sorting a copy of the input data and selecting the appropriate ranked elements.
+ * using the selection-based percentile engine (see GetPercentileValues), which neither copies
+ * nor sorts the input data. Non-finite values are excluded from the ranking.
  *
  * @param data Pointer to the input array of floating-point values.
  * @param size Number of elements in the input data array.
@@ -652,25 +725,17 @@ int GetPercentileValuesFromHistogram(const int* histogram, int numBins, float mi
  * @param maxPercentile The upper percentile to compute (e.g., 98.0 for the 98th percentile).
  * @param minPercentileValue Output pointer to store the value at minPercentile.
  * @param maxPercentileValue Output pointer to store the value at maxPercentile.
- * @return int Returns EXIT_SUCCESS upon success.
- *
- * @note Percentile values should be in the range [0, 100]. The function does not check bounds,
- *       so values outside this range may lead to undefined behavior.
- *
- * @warning This function creates a sorted copy of the input data, which requires additional memory.
- *          It performs an in-place sort, so performance may be affected for large datasets.
+ * @return int Returns EXIT_SUCCESS upon success, or EXIT_FAILURE if a percentile is outside
+ *         the range [0, 100] or the data contains no finite values.
  */
-
 int GetPercentileValuesFromData(const float* data, int64_t size, float minPercentile, float maxPercentile, float* minPercentileValue, float* maxPercentileValue) {
-    std::vector<float> sortedData(data, data + size);
-
-            std::sort(sortedData.begin(), sortedData.end());
-
-    int minIndex = static_cast<int>(minPercentile * (sortedData.size() - 1) / 100.0);
-    int maxIndex = static_cast<int>(maxPercentile * (sortedData.size() - 1) / 100.0);
+    const float percentiles[2] = {minPercentile, maxPercentile};
+    float percentileValues[2];
+    if (GetPercentileValues(data, size, percentiles, 2, percentileValues) != EXIT_SUCCESS)
+        return EXIT_FAILURE;
 
-    *minPercentileValue = sortedData[minIndex];
-    *maxPercentileValue = sortedData[maxIndex];
+    *minPercentileValue = percentileValues[0];
+    *maxPercentileValue = percentileValues[1];
     return EXIT_SUCCESS;
 }
 
@@ -699,6 +764,41 @@ int GetPercentileValuesFromData(const float* data, int64_t size, float minPercen
 int GetHistogram(const float* dataPtr, int64_t numElements, int numBins, float minVal, float maxVal, int** histogram)
 {
     int* histogramArray = new int[numBins]();
+    ComputeHistogram(dataPtr, FloatDecoder(), numElements, numBins, minVal, maxVal, histogramArray);
+    *histogram = histogramArray;
+    return EXIT_SUCCESS;
+}
+
+/**
+ * @brief Implementation of GetHistogram for any storage type and value decoder, see FloatDecoder. Adds the counts
+ * to the numBins entries of histogramArray.
+ */
+template<typename T, typename Decoder>
+int ComputeHistogram(const T* dataPtr, const Decoder& decoder, int64_t numElements, int numBins, float minVal, float maxVal, int* histogramArray)
+{
+    auto binIndex = [=](float dataValue)
+    {
+        if (isnan(dataValue) || dataValue < minVal || dataValue > maxVal)
+        {
+            return -1;
+        }
+        if (dataValue == maxVal)			//inclusive of max value for final bin
+        {
+            return numBins - 1;
+        }
+        return min(numBins - 1, (int) floor(((double)dataValue - (double)minVal) * (double)numBins / ((double)maxVal - (double)minVal)));
+    };
+    // 16-bit values are binned through a lookup table covering every possible raw value
+    vector<int> lookup;
+    if constexpr (is_same<T, int16_t>::value)
+    {
+        lookup.resize(65536);
+        for (int raw = -32768; raw < 32768; raw++)
+        {
+            lookup[raw + 32768] = binIndex(decoder((int16_t) raw));
+        }
+    }
+
     int* hist_private;
     #pragma omp parallel
     {
@@ -708,19 +808,20 @@ int GetHistogram(const float* dataPtr, int64_t numElements, int numBins, float m
         {
             hist_private = new int[numBins * nthreads]();
         }
-        #pragma omp for
+        #pragma omp for schedule(static)
         for (int64_t n = 0; n < numElements; ++n)
         {
-            float dataValue = dataPtr[n];
-            if (isnan(dataValue) || dataValue < minVal || dataValue > maxVal)
-                continue;
-            if (dataValue == maxVal)			//inclusive of max value for final bin
+            int histogramIndex;
+            if constexpr (is_same<T, int16_t>::value)
             {
-                hist_private[ithread * numBins + numBins - 1]++;
+                histogramIndex = lookup[dataPtr[n] + 32768];
             }
             else
             {
-                int histogramIndex = floor(((double)dataPtr[n] - (double)minVal) * (double)numBins / ((double)maxVal - (double)minVal));
+                histogramIndex = binIndex(decoder(dataPtr[n]));
+            }
+            if (histogramIndex >= 0)
+            {
                 hist_private[ithread * numBins + histogramIndex]++;
             }
         }
@@ -732,10 +833,13 @@ int GetHistogram(const float* dataPtr, int64_t numElements, int numBins, float m
         }
     }
     delete[] hist_private;
-    *histogram = histogramArray;
     return EXIT_SUCCESS;
 }
 
+template int ComputeHistogram<float, FloatDecoder>(const float*, const FloatDecoder&, int64_t, int, float, float, int*);
+template int ComputeHistogram<int16_t, ScaledDecoder<int16_t>>(const int16_t*, const ScaledDecoder<int16_t>&, int64_t, int, float, float, int*);
+template int ComputeHistogram<int32_t, ScaledDecoder<int32_t>>(const int32_t*, const ScaledDecoder<int32_t>&, int64_t, int, float, float, int*);
+
 /**
  * @brief Identifies distinct non-zero mask values in a 3D volume and extracts their bounding boxes.
  *
@@ -833,6 +937,16 @@ int GetMaskedSources(const int16_t* maskDataPtr, int64_t dimX, int64_t dimY, int
  */
 
 int GetSourceStats(const float* dataPtr, const int16_t* maskDataPtr, int64_t dimX, int64_t dimY, int64_t dimZ, SourceInfo source, SourceStats* stats, AstFrameSet* frameSetPtr)
+{
+    DenseMaskReader reader = {maskDataPtr, dimX, dimY};
+    return ComputeSourceStats(dataPtr, reader, dimX, dimY, dimZ, source, stats, frameSetPtr);
+}
+
+/**
+ * @brief Implementation of GetSourceStats for any mask reader (dense or sparse), see DenseMaskReader.
+ */
+template<typename MaskReader>
+int ComputeSourceStats(const float* dataPtr, const MaskReader& reader, int64_t dimX, int64_t dimY, int64_t dimZ, SourceInfo source, SourceStats* stats, AstFrameSet* frameSetPtr)
 {
     if (stats && source.minX >= 0 && source.maxX < dimX && source.minY >= 0 && source.maxY < dimY && source.minZ >= 0 && source.maxZ < dimZ)
     {
@@ -866,15 +980,17 @@ int GetSourceStats(const float* dataPtr, const int16_t* maskDataPtr, int64_t dim
         stats->maxY = source.minY;
         stats->maxZ = source.minZ;
 
+        std::vector<int16_t> rowScratch(source.maxX - source.minX + 1);
         for (int64_t k = source.minZ; k <= source.maxZ; k++)
         {
             double spectralSum = 0.0;
             for (int64_t j = source.minY; j <= source.maxY; j++)
             {
+                const int16_t* maskRow = reader.Row(j, k, source.minX, source.maxX + 1, rowScratch.data());
                 for (int64_t i = source.minX; i <= source.maxX; i++)
                 {
                     int64_t index = i + dimX * j + dimX * dimY * k;
-                    auto maskVal = maskDataPtr[index];
+                    auto maskVal = maskRow[i - source.minX];
                     if (maskVal == source.maskVal)
                     {
                         double flux = dataPtr[index];
@@ -1005,8 +1121,11 @@ int GetSourceStats(const float* dataPtr, const int16_t* maskDataPtr, int64_t dim
     return EXIT_FAILURE;
 }
 
+template int ComputeSourceStats<DenseMaskReader>(const float*, const DenseMaskReader&, int64_t, int64_t, int64_t, SourceInfo, SourceStats*, AstFrameSet*);
+template int ComputeSourceStats<SparseMaskReader>(const float*, const SparseMaskReader&, int64_t, int64_t, int64_t, SourceInfo, SourceStats*, AstFrameSet*);
+
 /**
- * @brief Computes the z-scale (contrast stretch) limits for an image using the cdl_zscale algorithm.
+ * @brief Computes the z-scale (contrast stretch) limits for an image using the ZScale algorithm.
  *
  * This function calculates suitable lower and upper limits (`z1` and `z2`) for scaling image intensity values,
  * commonly used for display contrast adjustment, based on the input float image data.
@@ -1017,16 +1136,14 @@ int GetSourceStats(const float* dataPtr, const int16_t* maskDataPtr, int64_t dim
  * @param[out] z1 Pointer to store the computed lower z-scale limit.
  * @param[out] z2 Pointer to store the computed upper z-scale limit.
  * 
- * @return int Returns EXIT_SUCCESS upon completion.
+ * @return int Returns EXIT_SUCCESS upon completion, or EXIT_FAILURE if the image has no finite values.
  *
- * @note Internally, the data pointer is cast to unsigned char* for use with `cdl_zscale`.
- *       Ensure `cdl_zscale` is compatible with this cast or adjust accordingly.
- * @note The parameters `-32`, `0.25`, `600`, and `120` are fixed arguments to `cdl_zscale` controlling its behavior.
+ * @note Uses the default contrast (0.25) and sample size (600) of the ZScale engine; see GetZScaleRange and
+ *       GetChannelZScales for cubes, channel ranges and per-channel limits.
  */
 int GetZScale(const float* data, int64_t width, int64_t height, float* z1, float* z2)
 {
-    cdl_zscale((unsigned char*)data, width, height, -32, z1, z2, 0.25, 600, 120);
-    return EXIT_SUCCESS;
+    return GetZScaleRange(data, width, height, 1, 0, 1, ZSCALE_DEFAULT_SAMPLE_SIZE, ZSCALE_DEFAULT_CONTRAST, z1, z2);
 }
 
 /**
@@ -1034,6 +1151,7 @@ int GetZScale(const float* data, int64_t width, int64_t height, float* z1, float
  *
  * This function deletes a memory block allocated with `new[]`. The pointer
  * must point to memory allocated as an array; otherwise, behavior is undefined.
+ * Cube buffers allocated in a non-default CubeBufferMode are released to the OS instead.
  *
  * @param ptrToDelete Pointer to the memory block to be freed.
  * 
@@ -1045,6 +1163,8 @@ int GetZScale(const float* data, int64_t width, int64_t height, float* z1, float
  */
 int FreeDataAnalysisMemory(void* ptrToDelete)
 {
+    if (ReleaseCubeBuffer(ptrToDelete))
+        return EXIT_SUCCESS;
     delete[] ptrToDelete;
     return EXIT_SUCCESS;
 }
@@ -76,8 +76,6 @@ struct SourceStats
     int64_t spectralProfileSize;
 };
 
-template<bool maxMode> int DataCropAndDownsample(const float *, float **, int64_t , int64_t , int64_t , int64_t , int64_t , int64_t , int64_t , int64_t , int64_t , int , int , int);
-
 extern "C"
 {
 #include "ast.h"
@@ -99,4 +97,52 @@ DllExport int GetZScale(const float*, int64_t, int64_t, float*, float*);
 DllExport int FreeDataAnalysisMemory(void* );
 }
 
+/**
+ * @brief Mask reader adaptor for plain dense int16 masks. Rows are returned in place, without copying.
+ *
+ * Mask readers provide Row(y, z, x0, x1, scratch), returning the mask values of [x0, x1) in the given row
+ * (optionally decoded into scratch), and At(x, y, z) for single voxels. SparseMaskReader is the sparse counterpart.
+ */
+struct DenseMaskReader
+{
+    const int16_t* mask;
+    int64_t dimX, dimY;
+
+    const int16_t* Row(int64_t y, int64_t z, int64_t x0, int64_t /*x1*/, int16_t* /*scratch*/) const
+    {
+        return mask + (z * dimY + y) * dimX + x0;
+    }
+    int16_t At(int64_t x, int64_t y, int64_t z) const
+    {
+        return mask[(z * dimY + y) * dimX + x];
+    }
+};
+
+/**
+ * @brief Value decoder for float cubes, which hold physical values directly. NaN voxels are blank.
+ *
+ * Value decoders provide operator()(raw), returning the physical value of a raw voxel (NaN for blanks), IsBlank(raw),
+ * and the scale and zero relating raw to physical values. ScaledDecoder is the counterpart for integer TypedCubes.
+ */
+struct FloatDecoder
+{
+    double scale = 1.0;
+    double zero = 0.0;
+
+    bool IsBlank(float raw) const
+    {
+        return isnan(raw);
+    }
+    float operator()(float raw) const
+    {
+        return raw;
+    }
+};
+
+template<typename T, typename Decoder> int ComputeStats(const T*, const Decoder&, int64_t, bool, float*, float*, float*, float*);
+template<typename T, typename Decoder> int ComputeHistogram(const T*, const Decoder&, int64_t, int, float, float, int*);
+template<bool maxMode, typename T, typename Decoder> int DataCropAndDownsample(const T*, const Decoder&, float**, int64_t, int64_t, int64_t, int64_t, int64_t, int64_t, int64_t, int64_t, int64_t, int, int, int);
+template<typename MaskReader> int ComputeSourceStats(const float*, const MaskReader&, int64_t, int64_t, int64_t, SourceInfo, SourceStats*, AstFrameSet*);
+template<typename MaskReader> int ComputeMaskCropAndDownsample(const MaskReader&, int16_t**, int64_t, int64_t, int64_t, int64_t, int64_t, int64_t, int64_t, int64_t, int64_t, int, int, int);
+
 #endif //NATIVE_PLUGINS_DATA_ANALYSIS_TOOL_H
@@ -21,15 +21,21 @@
  */
 
 #include "fits_reader.h"
+#include "cube_buffer.h"
+#include "tile_compression.h"
+#include "slice_tool.h"
+#include "data_analysis_tool.h"
 
 // #include <chrono>
+#include <algorithm>
 #include <cmath>
 #include <filesystem>
 #include <fstream>
 #include <limits>
-#include <regex>
+#include <new>
 #include <sstream>
 #include <string>
+#include <vector>
 
 int FitsOpenFileReadOnly(fitsfile **fptr, char* filename,  int *status)
 {
@@ -256,6 +262,133 @@ int FitsCopyImageSection(char * inFile, char * outFile, char * section, char * h
     return success;
 }
 
+void CopyHeaderRecords(fitsfile* source, fitsfile* destination, int* status)
+{
+    if (!source)
+        return;
+    int numKeys = 0;
+    int readStatus = 0;
+    fits_get_hdrspace(source, &numKeys, nullptr, &readStatus);
+    char card[FLEN_CARD];
+    for (int i = 1; i <= numKeys && readStatus == 0 && *status == 0; i++)
+    {
+        if (fits_read_record(source, i, card, &readStatus))
+            break;
+        int keyClass = fits_get_keyclass(card);
+        if (keyClass == TYP_STRUC_KEY || keyClass == TYP_CMPRS_KEY || keyClass == TYP_SCAL_KEY || keyClass == TYP_NULL_KEY || keyClass == TYP_CKSUM_KEY)
+            continue;
+        fits_write_record(destination, card, status);
+    }
+}
+
+void UpdateSubcubeWcs(fitsfile* fptr, const int64_t* cropStart, const int* factors, int* status)
+{
+    for (int axis = 1; axis <= 3; axis++)
+    {
+        double factor = factors[axis - 1];
+        char key[FLEN_KEYWORD];
+        double value;
+        int keyStatus = 0;
+        snprintf(key, FLEN_KEYWORD, "CRPIX%d", axis);
+        if (fits_read_key(fptr, TDOUBLE, key, &value, nullptr, &keyStatus) == 0)
+        {
+            // Output pixel p covers original pixels centred on factor * p + offset (1-based)
+            double offset = (cropStart[axis - 1] - 2) * factor + (factor + 1) / 2.0;
+            value = (value - offset) / factor;
+            fits_update_key(fptr, TDOUBLE, key, &value, nullptr, status);
+        }
+        if (factors[axis - 1] == 1)
+            continue;
+        keyStatus = 0;
+        snprintf(key, FLEN_KEYWORD, "CDELT%d", axis);
+        if (fits_read_key(fptr, TDOUBLE, key, &value, nullptr, &keyStatus) == 0)
+        {
+            value *= factor;
+            fits_update_key(fptr, TDOUBLE, key, &value, nullptr, status);
+        }
+        for (int row = 1; row <= 3; row++)
+        {
+            keyStatus = 0;
+            snprintf(key, FLEN_KEYWORD, "CD%d_%d", row, axis);
+            if (fits_read_key(fptr, TDOUBLE, key, &value, nullptr, &keyStatus) == 0)
+            {
+                value *= factor;
+                fits_update_key(fptr, TDOUBLE, key, &value, nullptr, status);
+            }
+        }
+    }
+}
+
+int FitsWriteSubcubeFromMemory(char* outFile, fitsfile* headerSource, const float* data, int64_t dimX, int64_t dimY, int64_t dimZ,
+    int64_t cropX1, int64_t cropY1, int64_t cropZ1, int64_t cropX2, int64_t cropY2, int64_t cropZ2, int factorX, int factorY, int factorZ,
+    char* historyTimeStamp, int* status)
+{
+    int64_t cropStart[3] = {std::min(cropX1, cropX2), std::min(cropY1, cropY2), std::min(cropZ1, cropZ2)};
+    int64_t cropEnd[3] = {std::max(cropX1, cropX2), std::max(cropY1, cropY2), std::max(cropZ1, cropZ2)};
+    int factors[3] = {std::max(factorX, 1), std::max(factorY, 1), std::max(factorZ, 1)};
+    if (!data || cropStart[0] < 1 || cropStart[1] < 1 || cropStart[2] < 1 || cropEnd[0] > dimX || cropEnd[1] > dimY || cropEnd[2] > dimZ)
+        return *status = BAD_PIX_NUM;
+    int64_t width = cropEnd[0] - cropStart[0] + 1;
+    int64_t height = cropEnd[1] - cropStart[1] + 1;
+    int64_t depth = cropEnd[2] - cropStart[2] + 1;
+
+    std::stringstream debug;
+    debug << "Writing in-memory subcube [" << cropStart[0] << ":" << cropEnd[0] << ", " << cropStart[1] << ":" << cropEnd[1] << ", " << cropStart[2] << ":" << cropEnd[2] << "] to " << outFile << ".";
+    WriteLogFile(defaultDebugFile.data(), debug.str().c_str(), 0);
+
+    fitsfile* outfptr;
+    if (FitsCreateFile(&outfptr, outFile, status))
+        return *status;
+    long naxes[3] = {(long) width, (long) height, (long) depth};
+    fits_create_img(outfptr, FLOAT_IMG, 3, naxes, status);
+    CopyHeaderRecords(headerSource, outfptr, status);
+    UpdateSubcubeWcs(outfptr, cropStart, factors, status);
+    if (historyTimeStamp)
+        fits_write_history(outfptr, historyTimeStamp, status);
+
+    // Whole channels of the crop are gathered in parallel into a chunk buffer, and each chunk is handed to CFITSIO as
+    // a single large sequential write
+    int64_t sliceSize = width * height;
+    int64_t slicesPerChunk = std::max<int64_t>(1, SUBCUBE_EXPORT_CHUNK_BYTES / (sliceSize * (int64_t) sizeof(float)));
+    try
+    {
+        std::vector<float> chunk(std::min(slicesPerChunk, depth) * sliceSize);
+        for (int64_t z0 = 0; z0 < depth && *status == 0; z0 += slicesPerChunk)
+        {
+            int64_t slices = std::min(slicesPerChunk, depth - z0);
+            int64_t rows = slices * height;
+#pragma omp parallel for
+            for (int64_t row = 0; row < rows; row++)
+            {
+                int64_t z = cropStart[2] - 1 + z0 + row / height;
+                int64_t y = cropStart[1] - 1 + row % height;
+                const float* source = data + (z * dimY + y) * dimX + cropStart[0] - 1;
+                memcpy(chunk.data() + row * width, source, width * sizeof(float));
+            }
+            LONGLONG firstPixel[3] = {1, 1, (LONGLONG) z0 + 1};
+            fits_write_pixll(outfptr, TFLOAT, firstPixel, (LONGLONG) (rows * width), chunk.data(), status);
+        }
+    }
+    catch (const std::bad_alloc&)
+    {
+        *status = MEMORY_ALLOCATION;
+    }
+
+    debug.clear();
+    debug.str("");
+    debug << "Completed in-memory subcube writing with result code " << *status << ".";
+    WriteLogFile(defaultDebugFile.data(), debug.str().c_str(), 0);
+
+    if (*status)
+    {
+        int deleteStatus = 0;
+        fits_delete_file(outfptr, &deleteStatus);
+        return *status;
+    }
+    FitsCloseFile(outfptr, status);
+    return *status;
+}
+
 int FitsCopyCubeSection(fitsfile *infptr, fitsfile *outfptr, char *section, int *status)
 {
     int success = fits_copy_image_section(infptr, outfptr, section, status);
@@ -466,6 +599,11 @@ int FitsReadSubImageFloat(fitsfile *fptr, int dims, int zAxis, long *startPix, l
     std::stringstream debug;
     debug << "Reading file with " << dims << " dimensions, sized [" << finalPix[0] - startPix[0] + 1 << ", " << finalPix[1] - startPix[1] + 1 << ", " << finalPix[2] - startPix[2] + 1 << "].";
     WriteLogFile(defaultDebugFile.data(), debug.str().c_str(), 0);
+
+    // Tile-compressed images are decompressed in parallel, only touching the tiles that overlap the subset
+    if (ReadTileCompressedSubImage(fptr, dims, startPix, finalPix, nelem, array, status))
+        return *status;
+
     int anynul;
     float nulval = 0;
     long* increment = new long[dims];
@@ -474,7 +612,14 @@ int FitsReadSubImageFloat(fitsfile *fptr, int dims, int zAxis, long *startPix, l
     
     // Calculate the size of a 2D slice
     int64_t sliceSize = (finalPix[0] - startPix[0] + 1) * (finalPix[1] - startPix[1] + 1);
-    float* dataarray = new float[nelem];
+    // Allocated according to the current cube buffer mode, so that pages are placed for the analysis kernels
+    float* dataarray = AllocateCubeBuffer<float>(nelem);
+    if (dataarray == nullptr)
+    {
+        delete[] increment;
+        *status = MEMORY_ALLOCATION;
+        return *status;
+    }
     /**
      * @brief slicesInChunk specifies the number of slices to read at a time.
      */
@@ -545,6 +690,128 @@ int FitsReadSubImageFloat(fitsfile *fptr, int dims, int zAxis, long *startPix, l
     return 0;
 }
 
+int FitsReadSubImageDecimated(fitsfile *fptr, int dims, int zAxis, long *startPix, long *finalPix, int factorX, int factorY, int factorZ, int mode, float **array,
+                              int64_t *newDims, int *status)
+{
+    if (*status)
+        return *status;
+    if (dims < 3 || zAxis < 2 || zAxis >= dims || factorX < 1 || factorY < 1 || factorZ < 1 ||
+        (mode != DECIMATED_READ_STRIDE && mode != DECIMATED_READ_AVERAGE))
+        return *status = BAD_DIMEN;
+
+    const int64_t srcX = finalPix[0] - startPix[0] + 1;
+    const int64_t srcY = finalPix[1] - startPix[1] + 1;
+    const int64_t srcZ = finalPix[zAxis] - startPix[zAxis] + 1;
+    if (srcX < 1 || srcY < 1 || srcZ < 1)
+        return *status = BAD_PIX_NUM;
+    const int64_t newDimX = (srcX + factorX - 1) / factorX;
+    const int64_t newDimY = (srcY + factorY - 1) / factorY;
+    const int64_t newDimZ = (srcZ + factorZ - 1) / factorZ;
+    const int64_t newSliceSize = newDimX * newDimY;
+
+    std::stringstream debug;
+    debug << "Reading decimated cube sized [" << newDimX << ", " << newDimY << ", " << newDimZ << "] from a subset sized [" << srcX << ", " << srcY << ", " << srcZ
+          << "] in " << (mode == DECIMATED_READ_STRIDE ? "stride" : "average") << " mode.";
+    WriteLogFile(defaultDebugFile.data(), debug.str().c_str(), 0);
+
+    float* dataarray = AllocateCubeBuffer<float>(newSliceSize * newDimZ);
+    if (dataarray == nullptr)
+        return *status = MEMORY_ALLOCATION;
+
+    int anynul;
+    float nulval = 0;
+    try
+    {
+        std::vector<long> sliceStartPix(startPix, startPix + dims);
+        std::vector<long> sliceFinalPix(finalPix, finalPix + dims);
+        std::vector<long> increment(dims, 1);
+
+        if (mode == DECIMATED_READ_STRIDE)
+        {
+            // CFITSIO skips the unused voxels itself, so chunks of output channels are read straight into the result
+            increment[0] = factorX;
+            increment[1] = factorY;
+            increment[zAxis] = factorZ;
+            const int64_t channelsPerRead = std::max((int64_t) 1, (int64_t) DECIMATED_READ_SLAB_BYTES / (int64_t) (newSliceSize * sizeof(float)));
+            for (int64_t z = 0; z < newDimZ && !*status; z += channelsPerRead)
+            {
+                const int64_t numChannels = std::min(channelsPerRead, newDimZ - z);
+                sliceStartPix[zAxis] = startPix[zAxis] + z * factorZ;
+                sliceFinalPix[zAxis] = startPix[zAxis] + (z + numChannels - 1) * factorZ;
+                fits_read_subset(fptr, TFLOAT, sliceStartPix.data(), sliceFinalPix.data(), increment.data(), &nulval, dataarray + z * newSliceSize, &anynul, status);
+            }
+        }
+        else
+        {
+            // Each slab holds factorZ channels of as many full output rows as fit in the slab budget
+            const int64_t outputRowBytes = srcX * factorY * factorZ * (int64_t) sizeof(float);
+            const int64_t rowsPerSlab = std::min(newDimY, std::max((int64_t) 1, (int64_t) DECIMATED_READ_SLAB_BYTES / outputRowBytes));
+            std::vector<float> slab(srcX * rowsPerSlab * factorY * factorZ);
+            for (int64_t z = 0; z < newDimZ && !*status; z++)
+            {
+                sliceStartPix[zAxis] = startPix[zAxis] + z * factorZ;
+                sliceFinalPix[zAxis] = std::min(sliceStartPix[zAxis] + factorZ - 1, finalPix[zAxis]);
+                const int64_t blockSizeZ = sliceFinalPix[zAxis] - sliceStartPix[zAxis] + 1;
+                for (int64_t y = 0; y < newDimY && !*status; y += rowsPerSlab)
+                {
+                    const int64_t numRows = std::min(rowsPerSlab, newDimY - y);
+                    sliceStartPix[1] = startPix[1] + y * factorY;
+                    sliceFinalPix[1] = std::min(sliceStartPix[1] + numRows * factorY - 1, finalPix[1]);
+                    const int64_t slabY = sliceFinalPix[1] - sliceStartPix[1] + 1;
+                    if (fits_read_subset(fptr, TFLOAT, sliceStartPix.data(), sliceFinalPix.data(), increment.data(), &nulval, slab.data(), &anynul, status))
+                        break;
+
+                    float* outputRows = dataarray + z * newSliceSize + y * newDimX;
+#pragma omp parallel for
+                    for (int64_t row = 0; row < numRows; row++)
+                    {
+                        const int64_t firstY = row * factorY;
+                        const int64_t lastY = std::min(firstY + factorY, slabY);
+                        for (int64_t newX = 0; newX < newDimX; newX++)
+                        {
+                            const int64_t firstX = newX * factorX;
+                            const int64_t lastX = std::min(firstX + factorX, srcX);
+                            float pixelAccumulation = 0;
+                            int pixelCount = 0;
+                            for (int64_t pixelZ = 0; pixelZ < blockSizeZ; pixelZ++)
+                            {
+                                for (int64_t pixelY = firstY; pixelY < lastY; pixelY++)
+                                {
+                                    const float* slabRow = slab.data() + (pixelZ * slabY + pixelY) * srcX;
+                                    for (int64_t pixelX = firstX; pixelX < lastX; pixelX++)
+                                    {
+                                        if (!std::isnan(slabRow[pixelX]))
+                                        {
+                                            pixelAccumulation += slabRow[pixelX];
+                                            pixelCount++;
+                                        }
+                                    }
+                                }
+                            }
+                            outputRows[row * newDimX + newX] = pixelCount ? pixelAccumulation / (float) pixelCount : std::numeric_limits<float>::quiet_NaN();
+                        }
+                    }
+                }
+            }
+        }
+    }
+    catch (const std::bad_alloc&)
+    {
+        *status = MEMORY_ALLOCATION;
+    }
+
+    if (*status)
+    {
+        FreeFitsPtrMemory(dataarray);
+        return *status;
+    }
+    newDims[0] = newDimX;
+    newDims[1] = newDimY;
+    newDims[2] = newDimZ;
+    *array = dataarray;
+    return 0;
+}
+
 int FitsReadImageInt16(fitsfile *fptr, int dims, int64_t nelem, int16_t **array, int *status)
 {
     int anynul;
@@ -562,28 +829,34 @@ int FitsReadImageInt16(fitsfile *fptr, int dims, int64_t nelem, int16_t **array,
     return success;
 }
 
-int FitsReadSubImageInt16(fitsfile *fptr, int dims, int zAxis, long *startPix, long *finalPix, int64_t nelem, float **array, int *status)
+int FitsReadSubImageInt16(fitsfile *fptr, int dims, int zAxis, long *startPix, long *finalPix, int64_t nelem, int16_t **array, int *status)
 {
     int anynul;
-    float nulval = 0;
+    int16_t nulval = 0;
     long* increment = new long[dims];
     for (int i = 0; i < dims; i++)
         increment[i] = 1;
     
     // Calculate the size of a 2D slice
     int64_t sliceSize = (finalPix[0] - startPix[0] + 1) * (finalPix[1] - startPix[1] + 1);
-    float* dataarray = new float[nelem];
+    int16_t* dataarray = AllocateCubeBuffer<int16_t>(nelem);
+    if (dataarray == nullptr)
+    {
+        delete[] increment;
+        *status = MEMORY_ALLOCATION;
+        return *status;
+    }
     
     /**
      * @brief slicesInChunk specifies the number of slices to read at a time.
      */
     long slicesInChunk = std::max((long) 1, (long) std::floor(std::numeric_limits<long>::max() / sliceSize));
-    long finalZ = finalPix[2];
+    long finalZ = finalPix[zAxis];
 
     // auto start = std::chrono::high_resolution_clock::now();
     // Loop over the third dimension
     int64_t offset = 0;
-    for (long z = startPix[2]; z <= finalPix[2]; z+=slicesInChunk)
+    for (long z = startPix[zAxis]; z <= finalPix[zAxis]; z+=slicesInChunk)
     {
         // Set the start and end pixels for the current slice
         long* sliceStartPix = new long[dims];
@@ -594,7 +867,7 @@ int FitsReadSubImageInt16(fitsfile *fptr, int dims, int zAxis, long *startPix, l
             sliceFinalPix[i] = finalPix[i];
         }
         sliceStartPix[zAxis] = z;
-        sliceFinalPix[zAxis] = std::min(z + slicesInChunk, finalZ);
+        sliceFinalPix[zAxis] = std::min(z + slicesInChunk - 1, finalZ);
 
         // Read the current slice directly into the final dataarray
         std::stringstream debug;
@@ -604,6 +877,7 @@ int FitsReadSubImageInt16(fitsfile *fptr, int dims, int zAxis, long *startPix, l
         
         if (success != 0)
         {
+            FreeFitsPtrMemory(dataarray);
             delete[] increment;
             delete[] sliceStartPix;
             delete[] sliceFinalPix;
@@ -612,7 +886,7 @@ int FitsReadSubImageInt16(fitsfile *fptr, int dims, int zAxis, long *startPix, l
 
         // Calculate the offset in the dataarray
         // int64_t offset = sliceSize * (z - startPix[2]);
-        int64_t nelem = (sliceFinalPix[0] - sliceStartPix[0] + 1) * (sliceFinalPix[1] - sliceStartPix[1] + 1) * (sliceFinalPix[2] - sliceStartPix[2] + 1);
+        int64_t nelem = sliceSize * (sliceFinalPix[zAxis] - sliceStartPix[zAxis] + 1);
         offset += nelem;
         delete[] sliceStartPix;
         delete[] sliceFinalPix;
@@ -629,60 +903,376 @@ int FitsReadSubImageInt16(fitsfile *fptr, int dims, int zAxis, long *startPix, l
     return 0;
 }
 
+namespace
+{
+    // Bounding box of one mask value, empty while minX > maxX
+    struct MaskBox
+    {
+        int32_t minX, maxX, minY, maxY, minZ, maxZ;
+    };
+
+    // Boxes of every Int16 mask value seen by one thread, indexed by the value cast to uint16_t
+    struct MaskBoxTable
+    {
+        std::vector<MaskBox> boxes;
+        std::vector<int16_t> labels;    /**< Values in the order this thread first saw them */
+        size_t labelsAssigned;          /**< Labels already given a narrow index */
+    };
+
+    /**
+     * @brief Grows the per-thread boxes with the non-zero voxels of channels [z0, z1) of the subset, held in slab.
+     */
+    void ScanMaskSlab(const int16_t* slab, int64_t dimX, int64_t dimY, int64_t z0, int64_t z1, std::vector<MaskBoxTable>& tables)
+    {
+        const int64_t numLines = (z1 - z0) * dimY;
+#pragma omp parallel
+        {
+            MaskBoxTable& table = tables[omp_get_thread_num()];
+#pragma omp for schedule(static)
+            for (int64_t line = 0; line < numLines; line++)
+            {
+                const int32_t y = (int32_t) (line % dimY);
+                const int32_t z = (int32_t) (z0 + line / dimY);
+                const int16_t* row = slab + line * dimX;
+                for (int64_t x = 0; x < dimX; x++)
+                {
+                    const int16_t value = row[x];
+                    if (!value)
+                        continue;
+                    // Runs of the same value only touch the box at their ends
+                    const int32_t runStart = (int32_t) x;
+                    while (x + 1 < dimX && row[x + 1] == value)
+                        x++;
+                    MaskBox& box = table.boxes[(uint16_t) value];
+                    if (box.minX > box.maxX)
+                    {
+                        box = {runStart, (int32_t) x, y, y, z, z};
+                        table.labels.push_back(value);
+                        continue;
+                    }
+                    box.minX = std::min(box.minX, runStart);
+                    box.maxX = std::max(box.maxX, (int32_t) x);
+                    box.minY = std::min(box.minY, y);
+                    box.maxY = std::max(box.maxY, y);
+                    box.minZ = std::min(box.minZ, z);
+                    box.maxZ = std::max(box.maxZ, z);
+                }
+            }
+        }
+    }
+}
+
+int FitsReadMaskSubImage(fitsfile *fptr, int dims, int zAxis, long *startPix, long *finalPix, int narrowLabels, void **array, int *bytesPerVoxel,
+                         int *sourceCount, SourceInfo **sources, int *status)
+{
+    if (*status)
+        return *status;
+    if (dims < 3 || zAxis < 2 || zAxis >= dims)
+        return *status = BAD_DIMEN;
+
+    const int64_t dimX = finalPix[0] - startPix[0] + 1;
+    const int64_t dimY = finalPix[1] - startPix[1] + 1;
+    const int64_t dimZ = finalPix[zAxis] - startPix[zAxis] + 1;
+    const int64_t sliceSize = dimX * dimY;
+    const int64_t nelem = sliceSize * dimZ;
+    const int64_t channelsPerRead = std::max((int64_t) 1, (int64_t) MASK_READ_SLAB_BYTES / (sliceSize * (int64_t) sizeof(int16_t)));
+
+    std::stringstream debug;
+    debug << "Reading mask sub image sized [" << dimX << ", " << dimY << ", " << dimZ << "] in slabs of " << channelsPerRead << " channels.";
+    WriteLogFile(defaultDebugFile.data(), debug.str().c_str(), 0);
+
+    int16_t* wide = nullptr;
+    uint8_t* narrow = nullptr;
+    try
+    {
+        const int32_t noMin = std::numeric_limits<int32_t>::max();
+        const MaskBox emptyBox = {noMin, -1, noMin, -1, noMin, -1};
+        std::vector<MaskBoxTable> tables(omp_get_max_threads());
+        for (auto& table : tables)
+        {
+            table.boxes.assign(65536, emptyBox);
+            // Reserved up front, so that the parallel scan never reallocates
+            table.labels.reserve(65536);
+            table.labelsAssigned = 0;
+        }
+        std::vector<int16_t> slab;
+        std::vector<int> narrowIndex;
+        std::vector<int16_t> narrowValues;
+        if (narrowLabels)
+        {
+            narrow = AllocateCubeBuffer<uint8_t>(nelem);
+            slab.resize(std::min(channelsPerRead, dimZ) * sliceSize);
+            narrowIndex.assign(65536, 0);
+        }
+        else
+        {
+            wide = AllocateCubeBuffer<int16_t>(nelem);
+        }
+        if (!narrow && !wide)
+            throw std::bad_alloc();
+
+        std::vector<long> sliceStartPix(startPix, startPix + dims);
+        std::vector<long> sliceFinalPix(finalPix, finalPix + dims);
+        std::vector<long> increment(dims, 1);
+        int16_t nulval = 0;
+        int anynul;
+        for (int64_t z0 = 0; z0 < dimZ && !*status; z0 += channelsPerRead)
+        {
+            const int64_t z1 = std::min(dimZ, z0 + channelsPerRead);
+            sliceStartPix[zAxis] = startPix[zAxis] + (long) z0;
+            sliceFinalPix[zAxis] = startPix[zAxis] + (long) z1 - 1;
+            int16_t* target = wide ? wide + z0 * sliceSize : slab.data();
+            if (fits_read_subset(fptr, TSHORT, sliceStartPix.data(), sliceFinalPix.data(), increment.data(), &nulval, target, &anynul, status))
+                break;
+            ScanMaskSlab(target, dimX, dimY, z0, z1, tables);
+            if (!narrow)
+                continue;
+
+            // Values first seen in this slab get the next narrow index
+            for (auto& table : tables)
+            {
+                for (; table.labelsAssigned < table.labels.size(); table.labelsAssigned++)
+                {
+                    int& index = narrowIndex[(uint16_t) table.labels[table.labelsAssigned]];
+                    if (!index)
+                    {
+                        narrowValues.push_back(table.labels[table.labelsAssigned]);
+                        index = (int) narrowValues.size();
+                    }
+                }
+            }
+            const int64_t slabSize = (z1 - z0) * sliceSize;
+            if (narrowValues.size() > std::numeric_limits<uint8_t>::max())
+            {
+                // Too many sources for one byte per voxel: widen what has been read so far and continue in Int16
+                wide = AllocateCubeBuffer<int16_t>(nelem);
+                if (!wide)
+                    throw std::bad_alloc();
+                const int64_t narrowSize = z0 * sliceSize;
+#pragma omp parallel for
+                for (int64_t i = 0; i < narrowSize; i++)
+                    wide[i] = narrow[i] ? narrowValues[narrow[i] - 1] : 0;
+                std::copy(slab.begin(), slab.begin() + slabSize, wide + narrowSize);
+                FreeFitsPtrMemory(narrow);
+                narrow = nullptr;
+                std::vector<int16_t>().swap(slab);
+                continue;
+            }
+            uint8_t* output = narrow + z0 * sliceSize;
+#pragma omp parallel for
+            for (int64_t i = 0; i < slabSize; i++)
+                output[i] = (uint8_t) narrowIndex[(uint16_t) slab[i]];
+        }
+        if (*status)
+        {
+            FreeFitsPtrMemory(narrow ? (void*) narrow : (void*) wide);
+            return *status;
+        }
+
+        // Merge the per-thread boxes into a table sorted by mask value
+        std::vector<MaskBox> boxes(65536, emptyBox);
+        for (const auto& table : tables)
+        {
+            for (int16_t label : table.labels)
+            {
+                const MaskBox& source = table.boxes[(uint16_t) label];
+                MaskBox& box = boxes[(uint16_t) label];
+                box.minX = std::min(box.minX, source.minX);
+                box.maxX = std::max(box.maxX, source.maxX);
+                box.minY = std::min(box.minY, source.minY);
+                box.maxY = std::max(box.maxY, source.maxY);
+                box.minZ = std::min(box.minZ, source.minZ);
+                box.maxZ = std::max(box.maxZ, source.maxZ);
+            }
+        }
+        std::vector<int16_t> values;
+        for (int value = std::numeric_limits<int16_t>::lowest(); value <= std::numeric_limits<int16_t>::max(); value++)
+        {
+            if (value && boxes[(uint16_t) value].minX <= boxes[(uint16_t) value].maxX)
+                values.push_back((int16_t) value);
+        }
+        SourceInfo* sourceArray = new SourceInfo[values.size()]();
+        for (size_t i = 0; i < values.size(); i++)
+        {
+            const MaskBox& box = boxes[(uint16_t) values[i]];
+            SourceInfo info{};
+            info.minX = box.minX;
+            info.maxX = box.maxX;
+            info.minY = box.minY;
+            info.maxY = box.maxY;
+            info.minZ = box.minZ;
+            info.maxZ = box.maxZ;
+            info.maskVal = values[i];
+            sourceArray[i] = info;
+        }
+
+        if (narrow)
+        {
+            // Narrow indices were assigned in the order the values were found; renumber them to follow the sorted table
+            uint8_t renumber[256] = {};
+            bool sorted = true;
+            for (size_t i = 0; i < values.size(); i++)
+            {
+                const int index = narrowIndex[(uint16_t) values[i]];
+                renumber[index] = (uint8_t) (i + 1);
+                sorted &= index == (int) (i + 1);
+            }
+            if (!sorted)
+            {
+#pragma omp parallel for
+                for (int64_t i = 0; i < nelem; i++)
+                    narrow[i] = renumber[narrow[i]];
+            }
+        }
+
+        *array = narrow ? (void*) narrow : (void*) wide;
+        *bytesPerVoxel = narrow ? 1 : 2;
+        *sourceCount = (int) values.size();
+        *sources = sourceArray;
+        return 0;
+    }
+    catch (const std::bad_alloc&)
+    {
+        if (narrow)
+            FreeFitsPtrMemory(narrow);
+        if (wide)
+            FreeFitsPtrMemory(wide);
+        return *status = MEMORY_ALLOCATION;
+    }
+}
+
+namespace
+{
+    const char* const SPECTRAL_AXIS_TYPES[] = {"FREQ", "VRAD", "VOPT", "VELO", "ZOPT", "WAVE", "AWAV", "AIRW", "VREL", "ENER", "WAVN"};
+    const char* const SWAPPED_AXIS_PREFIXES[] = {"CTYPE", "CDELT", "CRPIX", "CRVAL", "CUNIT", "NAXIS", "CROTA"};
+
+    // Length of the keyword at the start of a card, up to the first space or '='
+    int CardKeywordLength(const char* card)
+    {
+        int length = 0;
+        while (length < 8 && card[length] != ' ' && card[length] != '=' && card[length] != '\0')
+            length++;
+        return length;
+    }
+
+    // Matches the 6-character keywords "C????n" and "NAXISn" describing axis n
+    bool IsAxisKeyword(const char* card, int keywordLength, char axis)
+    {
+        if (keywordLength != 6 || card[5] != axis)
+            return false;
+        return card[0] == 'C' || strncmp(card, "NAXIS", 5) == 0;
+    }
+
+    // Checks the quoted CTYPE value for a spectral axis type, e.g. 'FREQ-LSR'
+    bool IsSpectralAxisType(const char* ctype)
+    {
+        if (ctype[0] != '\'')
+            return false;
+        for (const char* type : SPECTRAL_AXIS_TYPES)
+        {
+            if (strncmp(ctype + 1, type, 4) == 0)
+                return true;
+        }
+        return false;
+    }
+}
+
 int FitsCreateHdrPtrForAst(fitsfile *fptr, char **header, int *nkeys, int *status)    //need to free header string with FreeFitsMemory() after use
 {
+    // The header is read once without comment cards, then filtered and rewritten in place card by card: axes 5 and
+    // above are dropped, as is axis 4 unless it is spectral, in which case it replaces axis 3.
+    if (fits_hdr2str(fptr, 1, nullptr, 0, header, nkeys, status))
+        return *status;
+    char* cards = *header;
+    int numberCards = *nkeys;
     bool needToSwap = false;
-    int numberExcl = 12;
-    char ctype4[68], subtype4[5];
-    char **excludeList = new char*[sizeof(char*) * numberExcl];
-    for (int i = 0; i < numberExcl; i++)
-    {
-        excludeList[i] = new char[7];
-    }
-    for (int i = 0; i < 5; i++)
-    {
-        std::string cString = "C????" + std::to_string(i + 5);
-        std::string nString = "NAXIS" + std::to_string(i + 5);
-        strcpy_s(excludeList[i], 7, cString.c_str() );
-        strcpy_s(excludeList[i + 5], 7, nString.c_str());
-    }
-    if (fits_read_keyword(fptr, "CTYPE4", ctype4, nullptr, status) == 202) {
-        *status = 0;
-        strcpy_s(excludeList[10], 7, "C????4");
-        strcpy_s(excludeList[11], 7, "NAXIS4");
-        //if an axis 4, check if it is spectral, in which case swap with axis 3 later
-    } else {
-        strncpy_s(subtype4, 5,  ctype4 + 1, 4);
-        subtype4[4] = '\0';
-        if (strcmp(subtype4, "FREQ") == 0 || strcmp(subtype4, "VRAD") == 0 || strcmp(subtype4, "VOPT") == 0 ||
-        strcmp(subtype4, "VELO") == 0 || strcmp(subtype4, "ZOPT") == 0 || strcmp(subtype4, "WAVE") == 0 ||
-        strcmp(subtype4, "AWAV") == 0 || strcmp(subtype4, "AIRW") == 0 || strcmp(subtype4, "VOPT") == 0 ||
-        strcmp(subtype4, "VREL") == 0 || strcmp(subtype4, "ENER") == 0 || strcmp(subtype4, "ENER") == 0 ||
-        strcmp(subtype4, "WAVN") == 0)
-        {
-            needToSwap = true;
-            strcpy_s(excludeList[10], 7, "C????3");
-            strcpy_s(excludeList[11], 7, "NAXIS3");
+    for (int i = 0; i < numberCards; i++)
+    {
+        if (strncmp(cards + i * 80, "CTYPE4  =", 9) == 0)
+        {
+            char card[FLEN_CARD];
+            char value[FLEN_VALUE];
+            memcpy(card, cards + i * 80, 80);
+            card[80] = '\0';
+            int parseStatus = 0;
+            fits_parse_value(card, value, nullptr, &parseStatus);
+            needToSwap = parseStatus == 0 && IsSpectralAxisType(value);
+            break;
         }
-        else
+    }
+    char excludedAxis = needToSwap ? '3' : '4';
+    int kept = 0;
+    for (int i = 0; i < numberCards; i++)
+    {
+        char* card = cards + i * 80;
+        int keywordLength = CardKeywordLength(card);
+        bool excluded = IsAxisKeyword(card, keywordLength, excludedAxis);
+        for (char axis = '5'; axis <= '9' && !excluded; axis++)
+            excluded = IsAxisKeyword(card, keywordLength, axis);
+        if (excluded)
+            continue;
+        char* target = cards + kept * 80;
+        if (target != card)
+            memmove(target, card, 80);
+        if (needToSwap && keywordLength == 6 && target[5] == '4')
         {
-            strcpy_s(excludeList[10], 7, "C????4");
-            strcpy_s(excludeList[11], 7, "NAXIS4");
+            for (const char* prefix : SWAPPED_AXIS_PREFIXES)
+            {
+                if (strncmp(target, prefix, 5) == 0)
+                {
+                    target[5] = '3';
+                    break;
+                }
+            }
         }
+        kept++;
     }
-    fits_hdr2str(fptr, 1, excludeList, numberExcl, header, nkeys, status);
-    if (needToSwap)
+    cards[kept * 80] = '\0';
+    *nkeys = kept;
+    return EXIT_SUCCESS;
+}
+
+int FitsReadHeaderTable(fitsfile *fptr, FitsHeaderCard **cards, int *numberCards, int *status)
+{
+    char* header = nullptr;
+    int nkeys = 0;
+    *cards = nullptr;
+    *numberCards = 0;
+    if (fits_hdr2str(fptr, 0, nullptr, 0, &header, &nkeys, status))
+        return *status;
+    // fits_hdr2str appends the END card and counts it, but FitsReadKeyN never returned it
+    if (nkeys > 0 && strncmp(header + (nkeys - 1) * 80, "END     ", 8) == 0)
+        nkeys--;
+    FitsHeaderCard* table = new (std::nothrow) FitsHeaderCard[nkeys];
+    if (!table)
     {
-        std::string headerString(*header);
-        std::regex regPattern ("(CTYPE|CDELT|CRPIX|CRVAL|CUNIT|NAXIS|CROTA)(4)");
-        std::string result = std::regex_replace(headerString, regPattern, "$013");
-        strcpy_s(*header, *nkeys * 80 + 1, result.c_str());
+        int freeStatus = 0;
+        fits_free_memory(header, &freeStatus);
+        return *status = MEMORY_ALLOCATION;
     }
-    for (int i = 0; i < numberExcl; i++)
+#pragma omp parallel for
+    for (int64_t i = 0; i < nkeys; i++)
     {
-        delete[](excludeList[i]);
+        char card[FLEN_CARD];
+        memcpy(card, header + i * 80, 80);
+        card[80] = '\0';
+        FitsHeaderCard& entry = table[i];
+        entry.key[0] = entry.value[0] = entry.comment[0] = '\0';
+        int length = 0;
+        int cardStatus = 0;
+        fits_get_keyname(card, entry.key, &length, &cardStatus);
+        fits_parse_value(card, entry.value, entry.comment, &cardStatus);
     }
-    delete[](excludeList);
+    int freeStatus = 0;
+    fits_free_memory(header, &freeStatus);
+    *cards = table;
+    *numberCards = nkeys;
+    return *status;
+}
+
+int FreeFitsHeaderTable(FitsHeaderCard *cards)
+{
+    delete[] cards;
     return EXIT_SUCCESS;
 }
 
@@ -700,6 +1290,8 @@ int CreateEmptyImageInt16(int64_t sizeX, int64_t sizeY, int64_t sizeZ, int16_t**
 
 int FreeFitsPtrMemory(void* ptrToDelete)
 {
+    if (ReleaseCubeBuffer(ptrToDelete))
+        return 0;
     delete[] ptrToDelete;
     return 0;
 }
@@ -737,7 +1329,7 @@ int WriteLogFile(const char * fileName, const char * content, int type) {
     }
 }
 
-int writeMomMapFitsHeader(fitsfile* mainFitsFile, fitsfile *newFitsFile, int mapNumber)
+int writeSoftwareFitsHeader(fitsfile *newFitsFile)
 {
     int status = 0;
 
@@ -798,6 +1390,13 @@ int writeMomMapFitsHeader(fitsfile* mainFitsFile, fitsfile *newFitsFile, int map
         WriteLogFile(defaultDebugFile.data(), debug.str().c_str(), 2);
     }
 
+    return status;
+}
+
+int writeMomMapFitsHeader(fitsfile* mainFitsFile, fitsfile *newFitsFile, int mapNumber)
+{
+    int status = writeSoftwareFitsHeader(newFitsFile);
+
     char* valueString = new char[FLEN_VALUE];
 
     // Write the required string keys to the new fits file
@@ -966,3 +1565,66 @@ int WriteMomentMap(fitsfile* mainFitsFile, char* filename, float* imagePixelArra
 
     return status;
 }
+
+int WritePvSlice(fitsfile* mainFitsFile, char* filename, float* imagePixelArray, long xDims, long yDims, const PvAxisInfo* axes)
+{
+    fitsfile* newFitsFile;
+    int status = 0;
+    fits_create_file(&newFitsFile, filename, &status);
+    if (status)
+    {
+        std::stringstream debug;
+        debug << "Error " + std::to_string(status) + " opening FITS file for WritePvSlice()!";
+        WriteLogFile(defaultDebugFile.data(), debug.str().c_str(), 2);
+        return status;
+    }
+
+    long naxes[2] = {xDims, yDims};
+    fits_create_img(newFitsFile, FLOAT_IMG, 2, naxes, &status);
+    status = status ? status : writeSoftwareFitsHeader(newFitsFile);
+
+    // Offset along the path on axis 1 and the cube's spectral axis on axis 2, both referenced to the first pixel
+    double referencePixel = 1.0;
+    char offsetType[] = "OFFSET";
+    char offsetUnit[PV_AXIS_STRING_LENGTH], spectralType[PV_AXIS_STRING_LENGTH], spectralUnit[PV_AXIS_STRING_LENGTH];
+    strcpy(offsetUnit, axes->offsetUnit);
+    strcpy(spectralType, axes->spectralSystem);
+    strcpy(spectralUnit, axes->spectralUnit);
+    double offsetStart = axes->offsetStart, offsetDelta = axes->offsetDelta;
+    double spectralStart = axes->spectralStart, spectralDelta = axes->spectralDelta;
+    fits_write_key(newFitsFile, TSTRING, "CTYPE1", offsetType, "Offset along the slice path", &status);
+    fits_write_key(newFitsFile, TDOUBLE, "CRPIX1", &referencePixel, "", &status);
+    fits_write_key(newFitsFile, TDOUBLE, "CRVAL1", &offsetStart, "", &status);
+    fits_write_key(newFitsFile, TDOUBLE, "CDELT1", &offsetDelta, "", &status);
+    fits_write_key(newFitsFile, TSTRING, "CUNIT1", offsetUnit, "", &status);
+    fits_write_key(newFitsFile, TSTRING, "CTYPE2", spectralType, "", &status);
+    fits_write_key(newFitsFile, TDOUBLE, "CRPIX2", &referencePixel, "", &status);
+    fits_write_key(newFitsFile, TDOUBLE, "CRVAL2", &spectralStart, "", &status);
+    fits_write_key(newFitsFile, TDOUBLE, "CDELT2", &spectralDelta, "", &status);
+    if (spectralUnit[0])
+        fits_write_key(newFitsFile, TSTRING, "CUNIT2", spectralUnit, "", &status);
+    if (status)
+    {
+        std::stringstream debug;
+        debug << "Error " << std::to_string(status) << " when writing the axes to FITS header in WritePvSlice()!";
+        WriteLogFile(defaultDebugFile.data(), debug.str().c_str(), 2);
+    }
+
+    char bunit[FLEN_VALUE];
+    int keyStatus = 0;
+    if (mainFitsFile && !fits_read_key(mainFitsFile, TSTRING, "BUNIT", bunit, nullptr, &keyStatus))
+        fits_write_key(newFitsFile, TSTRING, "BUNIT", bunit, "", &status);
+
+    long fpixel[2] = {1, 1};
+    fits_write_pix(newFitsFile, TFLOAT, fpixel, naxes[0] * naxes[1], imagePixelArray, &status);
+    if (status)
+    {
+        std::stringstream debug;
+        debug << "Error " + std::to_string(status) + " when writing FITS file in WritePvSlice()!";
+        WriteLogFile(defaultDebugFile.data(), debug.str().c_str(), 2);
+    }
+
+    int closeStatus = 0;
+    fits_close_file(newFitsFile, &closeStatus);
+    return status ? status : closeStatus;
+}
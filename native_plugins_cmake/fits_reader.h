@@ -43,6 +43,44 @@ const std::vector<std::string> REQUIRED_MOMENT_MAP_STR_KEYS = {"CTYPE1", "CTYPE2
 //Use the WriteLogFile function to output directly to a text file for debugging.
 static constexpr std::string_view defaultDebugFile = "Outputs/Logs/iDaVIE_Plugin_Log_0.log";
 
+struct PvAxisInfo;
+struct SourceInfo;
+
+// Size of the chunks handed to CFITSIO when writing a subcube from memory
+#define SUBCUBE_EXPORT_CHUNK_BYTES (64LL * 1024 * 1024)
+
+// Size of the slabs streamed from disk when reading a decimated preview cube
+#define DECIMATED_READ_SLAB_BYTES (64LL * 1024 * 1024)
+
+// Size of the channel slabs read from disk when loading a mask with FitsReadMaskSubImage
+#define MASK_READ_SLAB_BYTES (64LL * 1024 * 1024)
+
+// Decimation modes used by FitsReadSubImageDecimated
+#define DECIMATED_READ_STRIDE 0
+#define DECIMATED_READ_AVERAGE 1
+
+/**
+ * @brief Copies the header of the source's current HDU to the destination, leaving out structural, compression,
+ * scaling, blank and checksum keywords, which are defined by the image being written.
+ */
+void CopyHeaderRecords(fitsfile*, fitsfile*, int*);
+
+/**
+ * @brief Shifts CRPIXn for a crop starting at cropStart (1-based, in the pixels of a cube downsampled by factors), and
+ * scales CDELTn and the CDi_n columns by the downsampling factors, for the first three axes.
+ */
+void UpdateSubcubeWcs(fitsfile*, const int64_t*, const int*, int*);
+
+/**
+ * @brief One card of a parsed header, as returned by FitsReadHeaderTable. Fields hold the same strings as FitsReadKeyN.
+ */
+struct FitsHeaderCard
+{
+    char key[FLEN_KEYWORD];         /**< Keyword name, including HIERARCH names */
+    char value[FLEN_VALUE];         /**< Value string, with string values still quoted; empty for commentary cards */
+    char comment[FLEN_COMMENT];     /**< Comment, or the text of COMMENT and HISTORY cards */
+};
+
 extern "C"
 {
 DllExport int FitsOpenFileReadOnly(fitsfile **, char *,  int *);
@@ -113,6 +151,23 @@ DllExport int FitsCopyImageSection(char * , char* , char* , char* , int , int* )
  */
 DllExport int FitsCopyCubeSection(fitsfile *, fitsfile *, char *, int *); 
 
+/**
+ * @brief Writes a subcube of a cube held in memory to a new FITS file, without re-reading the source file.
+ *        The header is copied from headerSource, with the WCS updated for the crop and for any downsampling of the
+ *        in-memory cube. Channels of the crop are gathered in parallel and written in large sequential chunks.
+ * 
+ * @param outFile The destination file name.
+ * @param headerSource The fitsfile (at the cube's HDU) whose header is copied, or nullptr.
+ * @param data The in-memory cube, in X-Y-Z order.
+ * @param dimX, dimY, dimZ The dimensions of the in-memory cube.
+ * @param cropX1, cropY1, cropZ1, cropX2, cropY2, cropZ2 Corners of the subcube (1-based, inclusive) in the in-memory cube.
+ * @param factorX, factorY, factorZ Downsampling factors of the in-memory cube relative to headerSource (1 if not downsampled).
+ * @param historyTimeStamp A char array containing the history data to be written to the file header.
+ * @param status Value containing outcome of CFITSIO operation.
+ * @return int The result code, 0 for success, a CFITSIO error code if not.
+ */
+DllExport int FitsWriteSubcubeFromMemory(char*, fitsfile*, const float*, int64_t, int64_t, int64_t, int64_t, int64_t, int64_t, int64_t, int64_t, int64_t, int, int, int, char*, int*);
+
 [[deprecated("Replaced by FitsWriteSubImageInt16, which is more flexible.")]]
 DllExport int FitsWriteImageInt16(fitsfile * , int , int64_t , int16_t* , int* );
 
@@ -189,6 +244,31 @@ DllExport int FitsReadImageFloat(fitsfile *, int , int64_t , float **, int *);
  */
 DllExport int FitsReadSubImageFloat(fitsfile *, int, int, long *, long *, int64_t, float **, int *);
 
+/**
+ * @brief Reads a downsampled copy of a rectangular subset of the FITS image straight from disk, without ever holding
+ * the full-resolution subset in memory.
+ *
+ * In DECIMATED_READ_STRIDE mode only every factor-th voxel along each axis is read. In DECIMATED_READ_AVERAGE mode
+ * slabs of factorZ channels are streamed from the file and block-averaged into the output, ignoring NaN values in
+ * the same way as DataCropAndDownsample. Partial blocks at the upper edges are kept, so that each output axis has
+ * ceil(size / factor) pixels.
+ *
+ * @param fptr The fitsfile being worked on.
+ * @param dims The number of axes in the FITS image.
+ * @param zAxis The index of the z Axis in the FITS image.
+ * @param startPix An array containing the indices of the first pixel (xyz, left bottom front) to be read.
+ * @param finalPix An array containing the indices of the last pixel (xyz, right top back) to be read.
+ * @param factorX Downsampling factor in the X direction.
+ * @param factorY Downsampling factor in the Y direction.
+ * @param factorZ Downsampling factor in the Z direction.
+ * @param mode DECIMATED_READ_STRIDE or DECIMATED_READ_AVERAGE.
+ * @param array The target array to which the downsampled data will be loaded, to be freed with FreeFitsPtrMemory.
+ * @param newDims Array of three values receiving the X, Y and Z dimensions of the downsampled cube.
+ * @param status Value containing outcome of CFITSIO operation.
+ * @return int The result code, 0 for success, a CFITSIO error code if not.
+ */
+DllExport int FitsReadSubImageDecimated(fitsfile *, int, int, long *, long *, int, int, int, int, float **, int64_t *, int *);
+
 [[deprecated("Replaced by FitsReadSubImageInt16, which is more flexible.")]]
 DllExport int FitsReadImageInt16(fitsfile *, int , int64_t , int16_t **, int *);
 
@@ -206,10 +286,57 @@ DllExport int FitsReadImageInt16(fitsfile *, int , int64_t , int16_t **, int *);
  * @param status Value containing outcome of CFITSIO operation.
  * @return int The result code, 0 for success, a CFITSIO error coded if not.
  */
-DllExport int FitsReadSubImageInt16(fitsfile *, int, int, long *, long *, int64_t, float **, int *);
+DllExport int FitsReadSubImageInt16(fitsfile *, int, int, long *, long *, int64_t, int16_t **, int *);
+
+/**
+ * @brief Reads a rectangular subset of an Int16 mask image and builds its source table in the same pass, so that no
+ *        separate GetMaskedSources scan is needed.
+ *
+ * The mask is read in channel slabs, and each slab is scanned for source bounding boxes in parallel. When
+ * narrowLabels is set and the subset holds fewer than 256 sources, the mask is stored as one byte per voxel, voxel
+ * value i referring to sources[i - 1]; otherwise the original Int16 values are kept.
+ *
+ * @param fptr The fitsfile being worked on.
+ * @param dims The number of axes in the FITS image.
+ * @param zAxis The index of the z Axis in the FITS image.
+ * @param startPix An array containing the indices of the first pixel (xyz, left bottom front) to be read.
+ * @param finalPix An array containing the indices of the last pixel (xyz, right top back) to be read.
+ * @param narrowLabels Non-zero to allow the one byte per voxel representation.
+ * @param array The target array to which the mask will be loaded, to be freed with FreeFitsPtrMemory.
+ * @param bytesPerVoxel Set to 1 for the narrow representation, or 2 for Int16 values.
+ * @param sourceCount The number of sources found.
+ * @param sources The source table, sorted by mask value with 0-based bounding boxes as for GetMaskedSources, to be
+ *        freed with FreeFitsPtrMemory.
+ * @param status Value containing outcome of CFITSIO operation.
+ * @return int The result code, 0 for success, a CFITSIO error code if not.
+ */
+DllExport int FitsReadMaskSubImage(fitsfile *, int, int, long *, long *, int, void **, int *, int *, SourceInfo **, int *);
 
+/**
+ * @brief Creates the header string passed to AST for the current HDU. Axes 5 and above are removed, as is axis 4
+ * unless it is spectral, in which case its keywords are renamed to replace axis 3.
+ * 
+ * @param fptr The fitsfile being worked on.
+ * @param header Pointer to the header string, to be freed with FreeFitsMemory.
+ * @param nkeys The number of 80-character cards in the header string.
+ * @param status Value containing outcome of CFITSIO operation.
+ * @return int The result code, 0 for success, a CFITSIO error code if not.
+ */
 DllExport int FitsCreateHdrPtrForAst(fitsfile *, char **, int *, int *);
 
+/**
+ * @brief Reads every card of the current HDU's header in a single pass, returning a key/value/comment table.
+ * 
+ * @param fptr The fitsfile being worked on.
+ * @param cards Pointer to the table, to be freed with FreeFitsHeaderTable.
+ * @param numberCards The number of cards in the table.
+ * @param status Value containing outcome of CFITSIO operation.
+ * @return int The result code, 0 for success, a CFITSIO error code if not.
+ */
+DllExport int FitsReadHeaderTable(fitsfile *, FitsHeaderCard **, int *, int *);
+
+DllExport int FreeFitsHeaderTable(FitsHeaderCard *);
+
 DllExport int CreateEmptyImageInt16(int64_t , int64_t , int64_t , int16_t** );
 
 DllExport int FreeFitsPtrMemory(void* );
@@ -237,6 +364,20 @@ DllExport int WriteLogFile(const char * fileName, const char * content, int type
  */
 DllExport int WriteMomentMap(fitsfile *, char*, float*, long, long, int);
 
+/**
+ * @brief 
+ * Writes out a position-velocity slice from ExtractPvSlice to filename in FITS format, with the offset along the
+ * path on axis 1 and the spectral axis on axis 2. BUNIT is copied from the main file.
+ * @param mainFitsFile The cube the slice was extracted from, or nullptr.
+ * @param filename The destination file name.
+ * @param imgPixs The slice, with the offset axis fastest.
+ * @param xDims The number of offsets (NAXIS1).
+ * @param yDims The number of channels (NAXIS2).
+ * @param axes The axis description returned by ExtractPvSlice.
+ * @return int Returns the status. 0 if successful, see the usual table if not 0.
+ */
+DllExport int WritePvSlice(fitsfile *, char*, float*, long, long, const PvAxisInfo*);
+
 /**
  * @brief 
  * Function to write header values for the fits file, called when writing moment maps.
@@ -246,6 +387,14 @@ DllExport int WriteMomentMap(fitsfile *, char*, float*, long, long, int);
  */
 int writeFitsHeader(fitsfile *, fitsfile *, int);
 
+/**
+ * @brief 
+ * Function to write the keys describing the software (SOFTNAME, SOFTVERS, ...) to a new fits file.
+ * @param newFitsFile The fitsfile to be written to.
+ * @return int Returns the status. 0 if successful, see the usual table if not 0.
+ */
+int writeSoftwareFitsHeader(fitsfile *);
+
 }
 
 #endif //FITS_READER_FITS_READER_H
@@ -0,0 +1,437 @@
+/*
+ * iDaVIE (immersive Data Visualisation Interactive Explorer)
+ * Copyright (C) 2024 Inter-University Institute for Data Intensive Astronomy
+ *
+ * This file is part of the iDaVIE project.
+ *
+ * iDaVIE is free software: you can redistribute it and/or modify it under the terms 
+ * of the GNU Lesser General Public License (LGPL) as published by the Free Software 
+ * Foundation, either version 3 of the License, or (at your option) any later version.
+ *
+ * iDaVIE is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; 
+ * without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR 
+ * PURPOSE. See the GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License along with 
+ * iDaVIE in the LICENSE file. If not, see <https://www.gnu.org/licenses/>.
+ *
+ * Additional information and disclaimers regarding liability and third-party 
+ * components can be found in the DISCLAIMER and NOTICE files included with this project.
+ *
+ */
+#include "labelling_tool.h"
+
+#include <algorithm>
+#include <new>
+
+using namespace std;
+
+/*
+ * Connected components are found on runs of foreground voxels along x rather than on voxels, so the working
+ * memory scales with the number of runs. Runs are linked to the runs of the preceding rows in raster order with
+ * a union-find forest. The cube is split into slabs of planes that are linked in parallel, after which the
+ * runs either side of each slab boundary are merged.
+ */
+namespace
+{
+struct Run
+{
+    int32_t start;
+    int32_t end;  // Inclusive
+};
+
+struct RunTable
+{
+    int64_t dimX, dimY, dimZ;
+    vector<int64_t> rowStart;  // Index of the first run of each row (size: rows + 1)
+    vector<Run> runs;
+
+    int64_t Row(int64_t y, int64_t z) const
+    {
+        return z * dimY + y;
+    }
+};
+
+template<typename T>
+RunTable ExtractRuns(const T* mask, int64_t dimX, int64_t dimY, int64_t dimZ)
+{
+    RunTable table{};
+    table.dimX = dimX;
+    table.dimY = dimY;
+    table.dimZ = dimZ;
+    const int64_t numRows = dimY * dimZ;
+    table.rowStart.assign(numRows + 1, 0);
+
+    #pragma omp parallel for schedule(static)
+    for (int64_t r = 0; r < numRows; r++)
+    {
+        const T* row = mask + r * dimX;
+        int64_t count = 0;
+        for (int64_t x = 0; x < dimX; x++)
+        {
+            count += row[x] && (x == 0 || !row[x - 1]);
+        }
+        table.rowStart[r + 1] = count;
+    }
+    for (int64_t r = 0; r < numRows; r++)
+    {
+        table.rowStart[r + 1] += table.rowStart[r];
+    }
+
+    table.runs.resize(table.rowStart[numRows]);
+    #pragma omp parallel for schedule(static)
+    for (int64_t r = 0; r < numRows; r++)
+    {
+        const T* row = mask + r * dimX;
+        Run* out = table.runs.data() + table.rowStart[r];
+        for (int64_t x = 0; x < dimX; x++)
+        {
+            if (row[x] && (x == 0 || !row[x - 1]))
+            {
+                out->start = (int32_t) x;
+            }
+            if (row[x] && (x == dimX - 1 || !row[x + 1]))
+            {
+                out->end = (int32_t) x;
+                out++;
+            }
+        }
+    }
+    return table;
+}
+
+int64_t FindRoot(vector<int64_t>& parent, int64_t i)
+{
+    while (parent[i] != i)
+    {
+        parent[i] = parent[parent[i]];
+        i = parent[i];
+    }
+    return i;
+}
+
+void Union(vector<int64_t>& parent, int64_t a, int64_t b)
+{
+    a = FindRoot(parent, a);
+    b = FindRoot(parent, b);
+    // The smaller run index becomes the root, so that roots are the first run of each component in raster order
+    if (a < b)
+    {
+        parent[b] = a;
+    }
+    else if (b < a)
+    {
+        parent[a] = b;
+    }
+}
+
+/**
+ * Links the runs of two rows whose x ranges, widened by the tolerance, overlap.
+ */
+void LinkRows(const RunTable& table, vector<int64_t>& parent, int64_t rowA, int64_t rowB, int tolerance)
+{
+    int64_t i = table.rowStart[rowA];
+    int64_t j = table.rowStart[rowB];
+    const int64_t endA = table.rowStart[rowA + 1];
+    const int64_t endB = table.rowStart[rowB + 1];
+    while (i < endA && j < endB)
+    {
+        const Run& a = table.runs[i];
+        const Run& b = table.runs[j];
+        if (b.end + tolerance < a.start)
+        {
+            j++;
+        }
+        else if (a.end + tolerance < b.start)
+        {
+            i++;
+        }
+        else
+        {
+            Union(parent, i, j);
+            if (a.end < b.end)
+            {
+                i++;
+            }
+            else
+            {
+                j++;
+            }
+        }
+    }
+}
+
+/**
+ * Links a row to the preceding rows in the same plane (if withinPlane) and in the previous plane (if acrossPlanes).
+ * Face-adjacent rows are linked with x tolerance 0 for 6-connectivity and 1 otherwise; rows that are diagonal in y
+ * and z are linked with tolerance 0 for 18-connectivity and 1 for 26-connectivity.
+ */
+void LinkRow(const RunTable& table, vector<int64_t>& parent, int64_t y, int64_t z, int connectivity, bool withinPlane, bool acrossPlanes)
+{
+    const int64_t row = table.Row(y, z);
+    if (table.rowStart[row] == table.rowStart[row + 1])
+    {
+        return;
+    }
+    const int faceTolerance = connectivity == 6 ? 0 : 1;
+    const int diagonalTolerance = connectivity == 26 ? 1 : 0;
+    if (withinPlane && y > 0)
+    {
+        LinkRows(table, parent, row, table.Row(y - 1, z), faceTolerance);
+    }
+    if (acrossPlanes && z > 0)
+    {
+        LinkRows(table, parent, row, table.Row(y, z - 1), faceTolerance);
+        if (connectivity != 6)
+        {
+            if (y > 0)
+            {
+                LinkRows(table, parent, row, table.Row(y - 1, z - 1), diagonalTolerance);
+            }
+            if (y < table.dimY - 1)
+            {
+                LinkRows(table, parent, row, table.Row(y + 1, z - 1), diagonalTolerance);
+            }
+        }
+    }
+}
+
+struct Component
+{
+    int64_t numVoxels;
+    SourceInfo bounds;
+};
+
+/**
+ * Labels the connected components of a mask into an int16 mask. The output box is only written once all components
+ * are known, and is left unchanged if the components that pass the filter do not fit into the label range.
+ */
+template<typename T>
+int LabelComponents(const T* mask, int64_t dimX, int64_t dimY, int64_t dimZ, int connectivity, const ComponentFilter& filter, int16_t firstLabel,
+                    const LabelOutput& output, vector<SourceInfo>& sources)
+{
+    if (mask == nullptr || output.mask == nullptr || dimX <= 0 || dimY <= 0 || dimZ <= 0 || dimX > INT32_MAX ||
+        (connectivity != 6 && connectivity != 18 && connectivity != 26) || firstLabel < 0)
+    {
+        return EXIT_FAILURE;
+    }
+
+    const RunTable table = ExtractRuns(mask, dimX, dimY, dimZ);
+    const auto numRuns = (int64_t) table.runs.size();
+    vector<int64_t> parent(numRuns);
+    for (int64_t i = 0; i < numRuns; i++)
+    {
+        parent[i] = i;
+    }
+
+    // Link each slab of planes independently: the runs of a slab only ever point to runs in the same slab
+    const int numSlabs = (int) min<int64_t>(dimZ, omp_get_max_threads());
+    #pragma omp parallel for schedule(static)
+    for (int s = 0; s < numSlabs; s++)
+    {
+        const int64_t zStart = dimZ * s / numSlabs;
+        const int64_t zEnd = dimZ * (s + 1) / numSlabs;
+        for (int64_t z = zStart; z < zEnd; z++)
+        {
+            for (int64_t y = 0; y < dimY; y++)
+            {
+                LinkRow(table, parent, y, z, connectivity, true, z > zStart);
+            }
+        }
+    }
+    // Merge across the slab boundaries
+    for (int s = 1; s < numSlabs; s++)
+    {
+        const int64_t z = dimZ * s / numSlabs;
+        for (int64_t y = 0; y < dimY; y++)
+        {
+            LinkRow(table, parent, y, z, connectivity, false, true);
+        }
+    }
+
+    // Resolve roots in parallel (read only), then number the components in raster order
+    vector<int64_t> componentOf(numRuns);
+    #pragma omp parallel for schedule(static)
+    for (int64_t i = 0; i < numRuns; i++)
+    {
+        int64_t root = i;
+        while (parent[root] != root)
+        {
+            root = parent[root];
+        }
+        componentOf[i] = root;
+    }
+    parent = vector<int64_t>();
+    int64_t numComponents = 0;
+    for (int64_t i = 0; i < numRuns; i++)
+    {
+        componentOf[i] = componentOf[i] == i ? numComponents++ : componentOf[componentOf[i]];
+    }
+
+    Component empty{};
+    empty.bounds.minX = INT64_MAX;
+    empty.bounds.maxX = -1;
+    empty.bounds.minY = INT64_MAX;
+    empty.bounds.maxY = -1;
+    empty.bounds.minZ = INT64_MAX;
+    empty.bounds.maxZ = -1;
+    vector<Component> components(numComponents, empty);
+    for (int64_t r = 0; r < dimY * dimZ; r++)
+    {
+        const int64_t y = r % dimY;
+        const int64_t z = r / dimY;
+        for (int64_t i = table.rowStart[r]; i < table.rowStart[r + 1]; i++)
+        {
+            Component& component = components[componentOf[i]];
+            component.numVoxels += table.runs[i].end - table.runs[i].start + 1;
+            component.bounds.minX = min<int64_t>(component.bounds.minX, table.runs[i].start);
+            component.bounds.maxX = max<int64_t>(component.bounds.maxX, table.runs[i].end);
+            component.bounds.minY = min(component.bounds.minY, y);
+            component.bounds.maxY = max(component.bounds.maxY, y);
+            component.bounds.minZ = min(component.bounds.minZ, z);
+            component.bounds.maxZ = max(component.bounds.maxZ, z);
+        }
+    }
+
+    // Labels of the components that pass the filter (0 for removed components)
+    vector<int16_t> labels(numComponents, 0);
+    int64_t label = firstLabel;
+    for (int64_t c = 0; c < numComponents; c++)
+    {
+        const SourceInfo& bounds = components[c].bounds;
+        if (components[c].numVoxels < filter.minVoxels || bounds.maxX - bounds.minX + 1 < filter.minSize[0] ||
+            bounds.maxY - bounds.minY + 1 < filter.minSize[1] || bounds.maxZ - bounds.minZ + 1 < filter.minSize[2])
+        {
+            continue;
+        }
+        if (++label > LABELLING_MAX_LABEL)
+        {
+            return EXIT_FAILURE;
+        }
+        labels[c] = (int16_t) label;
+    }
+
+    #pragma omp parallel for schedule(static)
+    for (int64_t r = 0; r < dimY * dimZ; r++)
+    {
+        const int64_t y = r % dimY;
+        const int64_t z = r / dimY;
+        int16_t* row = output.mask + ((output.z0 + z) * output.dimY + output.y0 + y) * output.dimX + output.x0;
+        fill(row, row + dimX, (int16_t) 0);
+        for (int64_t i = table.rowStart[r]; i < table.rowStart[r + 1]; i++)
+        {
+            fill(row + table.runs[i].start, row + table.runs[i].end + 1, labels[componentOf[i]]);
+        }
+    }
+
+    for (int64_t c = 0; c < numComponents; c++)
+    {
+        if (labels[c])
+        {
+            SourceInfo source = components[c].bounds;
+            source.minX += output.x0;
+            source.maxX += output.x0;
+            source.minY += output.y0;
+            source.maxY += output.y0;
+            source.minZ += output.z0;
+            source.maxZ += output.z0;
+            source.maskVal = labels[c];
+            sources.push_back(source);
+        }
+    }
+    return EXIT_SUCCESS;
+}
+
+template<typename T>
+int LabelAndExport(const T* mask, int16_t* labelledMask, int64_t dimX, int64_t dimY, int64_t dimZ, int connectivity, int64_t minVoxels,
+                   int64_t minSizeX, int64_t minSizeY, int64_t minSizeZ, int* labelCount, SourceInfo** sources)
+{
+    if (labelCount == nullptr || sources == nullptr)
+    {
+        return EXIT_FAILURE;
+    }
+    const ComponentFilter filter = {minVoxels, {minSizeX, minSizeY, minSizeZ}};
+    const LabelOutput output = {labelledMask, dimX, dimY, 0, 0, 0};
+    vector<SourceInfo> found;
+    try
+    {
+        if (LabelComponents(mask, dimX, dimY, dimZ, connectivity, filter, 0, output, found) != EXIT_SUCCESS)
+        {
+            return EXIT_FAILURE;
+        }
+    }
+    catch (const std::bad_alloc&)
+    {
+        return EXIT_FAILURE;
+    }
+    *labelCount = (int) found.size();
+    *sources = new SourceInfo[found.size()];
+    copy(found.begin(), found.end(), *sources);
+    return EXIT_SUCCESS;
+}
+}
+
+/**
+ * @brief Labels the connected components of a binary mask box into a region of an int16 mask.
+ *
+ * @param mask The binary mask of the box (non-zero for foreground), with x varying fastest.
+ * @param dimX The x dimension of the box.
+ * @param dimY The y dimension of the box.
+ * @param dimZ The z dimension of the box.
+ * @param connectivity The voxel connectivity: 6 (faces), 18 (faces and edges) or 26 (faces, edges and corners).
+ * @param filter The filter that components must pass to be labelled.
+ * @param firstLabel Components are labelled consecutively from firstLabel + 1, in raster order of their first voxel.
+ * @param output The int16 mask and position of the box within it. The box is overwritten.
+ * @param sources The bounding boxes of the labelled components, in output mask coordinates, are appended to this vector.
+ * @return int Returns EXIT_SUCCESS on success, or EXIT_FAILURE if the arguments are invalid or the labels do not fit
+ *         into the int16 range (in which case the output is unchanged).
+ */
+int LabelBinaryComponents(const uint8_t* mask, int64_t dimX, int64_t dimY, int64_t dimZ, int connectivity, const ComponentFilter& filter,
+                          int16_t firstLabel, const LabelOutput& output, vector<SourceInfo>& sources)
+{
+    return LabelComponents(mask, dimX, dimY, dimZ, connectivity, filter, firstLabel, output, sources);
+}
+
+/**
+ * @brief Splits the non-zero voxels of an int16 mask into connected components and relabels them in place.
+ *
+ * The labelling runs on runs of foreground voxels, linked by a union-find forest over slabs of planes in parallel,
+ * so its working memory scales with the number of runs rather than the number of voxels. Components are labelled
+ * 1..N in raster order of their first voxel; existing label values are not preserved.
+ *
+ * @param maskDataPtr Pointer to the int16 mask (non-zero for foreground), relabelled in place.
+ * @param dimX The x dimension of the mask.
+ * @param dimY The y dimension of the mask.
+ * @param dimZ The z dimension of the mask.
+ * @param connectivity The voxel connectivity: 6 (faces), 18 (faces and edges) or 26 (faces, edges and corners).
+ * @param minVoxels Components with fewer voxels are removed from the mask.
+ * @param minSizeX Components with a smaller x extent are removed from the mask.
+ * @param minSizeY Components with a smaller y extent are removed from the mask.
+ * @param minSizeZ Components with a smaller z extent are removed from the mask.
+ * @param labelCount Output pointer to the number of labelled components.
+ * @param sources Output pointer to an array of `SourceInfo` structures, one per label (allocated internally).
+ *                Must be freed with FreeDataAnalysisMemory.
+ * @return int Returns EXIT_SUCCESS on success, or EXIT_FAILURE if the arguments are invalid, memory could not be
+ *         allocated, or there are more than 32767 components (in which case the mask is unchanged).
+ */
+int LabelMaskComponents(int16_t* maskDataPtr, int64_t dimX, int64_t dimY, int64_t dimZ, int connectivity, int64_t minVoxels, int64_t minSizeX,
+                        int64_t minSizeY, int64_t minSizeZ, int* labelCount, SourceInfo** sources)
+{
+    return LabelAndExport<int16_t>(maskDataPtr, maskDataPtr, dimX, dimY, dimZ, connectivity, minVoxels, minSizeX, minSizeY, minSizeZ,
+                                   labelCount, sources);
+}
+
+/**
+ * @brief Labels the connected components of a boolean mask into an int16 mask of the same dimensions.
+ *
+ * See LabelMaskComponents for the labelling and parameters. The int16 mask is overwritten entirely.
+ *
+ * @param binaryMaskPtr Pointer to the boolean mask (one byte per voxel, non-zero for foreground).
+ * @param maskDataPtr Pointer to the int16 mask receiving the labels.
+ */
+int LabelBinaryMaskComponents(const uint8_t* binaryMaskPtr, int16_t* maskDataPtr, int64_t dimX, int64_t dimY, int64_t dimZ, int connectivity,
+                              int64_t minVoxels, int64_t minSizeX, int64_t minSizeY, int64_t minSizeZ, int* labelCount, SourceInfo** sources)
+{
+    return LabelAndExport<uint8_t>(binaryMaskPtr, maskDataPtr, dimX, dimY, dimZ, connectivity, minVoxels, minSizeX, minSizeY, minSizeZ,
+                                   labelCount, sources);
+}
@@ -0,0 +1,67 @@
+/*
+ * iDaVIE (immersive Data Visualisation Interactive Explorer)
+ * Copyright (C) 2024 Inter-University Institute for Data Intensive Astronomy
+ *
+ * This file is part of the iDaVIE project.
+ *
+ * iDaVIE is free software: you can redistribute it and/or modify it under the terms 
+ * of the GNU Lesser General Public License (LGPL) as published by the Free Software 
+ * Foundation, either version 3 of the License, or (at your option) any later version.
+ *
+ * iDaVIE is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; 
+ * without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR 
+ * PURPOSE. See the GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License along with 
+ * iDaVIE in the LICENSE file. If not, see <https://www.gnu.org/licenses/>.
+ *
+ * Additional information and disclaimers regarding liability and third-party 
+ * components can be found in the DISCLAIMER and NOTICE files included with this project.
+ *
+ */
+#ifndef NATIVE_PLUGINS_LABELLING_TOOL_H
+#define NATIVE_PLUGINS_LABELLING_TOOL_H
+
+#include <cstdint>
+#include <vector>
+#include <omp.h>
+
+#include "data_analysis_tool.h"
+
+#define DllExport __declspec (dllexport)
+
+#define EXIT_SUCCESS 0
+#define EXIT_FAILURE 1
+
+// Largest label that fits into the int16 mask layout
+#define LABELLING_MAX_LABEL 32767
+
+/**
+ * @brief Filters applied to connected components before they are labelled. Components with fewer voxels than
+ * minVoxels, or with a bounding box extent smaller than minSize along any axis, are removed from the mask.
+ */
+struct ComponentFilter
+{
+    int64_t minVoxels;
+    int64_t minSize[3];
+};
+
+/**
+ * @brief Location of a labelled box within an int16 mask, which may be larger than the box.
+ */
+struct LabelOutput
+{
+    int16_t* mask;
+    int64_t dimX, dimY;
+    int64_t x0, y0, z0;
+};
+
+int LabelBinaryComponents(const uint8_t*, int64_t, int64_t, int64_t, int, const ComponentFilter&, int16_t, const LabelOutput&, std::vector<SourceInfo>&);
+
+extern "C"
+{
+DllExport int LabelMaskComponents(int16_t*, int64_t, int64_t, int64_t, int, int64_t, int64_t, int64_t, int64_t, int*, SourceInfo**);
+DllExport int LabelBinaryMaskComponents(const uint8_t*, int16_t*, int64_t, int64_t, int64_t, int, int64_t, int64_t, int64_t, int64_t, int*, SourceInfo**);
+}
+
+#endif //NATIVE_PLUGINS_LABELLING_TOOL_H
@@ -0,0 +1,455 @@
+/*
+ * iDaVIE (immersive Data Visualisation Interactive Explorer)
+ * Copyright (C) 2024 Inter-University Institute for Data Intensive Astronomy
+ *
+ * This file is part of the iDaVIE project.
+ *
+ * iDaVIE is free software: you can redistribute it and/or modify it under the terms 
+ * of the GNU Lesser General Public License (LGPL) as published by the Free Software 
+ * Foundation, either version 3 of the License, or (at your option) any later version.
+ *
+ * iDaVIE is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; 
+ * without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR 
+ * PURPOSE. See the GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License along with 
+ * iDaVIE in the LICENSE file. If not, see <https://www.gnu.org/licenses/>.
+ *
+ * Additional information and disclaimers regarding liability and third-party 
+ * components can be found in the DISCLAIMER and NOTICE files included with this project.
+ *
+ */
+#include "morphology_tool.h"
+
+#include <algorithm>
+#include <cmath>
+#include <new>
+#include <vector>
+
+using namespace std;
+
+/*
+ * All operations are restricted to a box of the mask: voxels outside the box are neither read nor written. Each
+ * dilation or erosion step first marks the voxels to change in parallel, reading the mask only, and then applies
+ * the marks, so the result does not depend on the order in which voxels are visited.
+ */
+namespace
+{
+struct MorphologyBox
+{
+    int16_t* mask;
+    int64_t dimX, dimY;
+    int64_t x0, x1;
+    int64_t y0, y1;
+    int64_t z0, z1;
+
+    int64_t Width() const { return x1 - x0; }
+    int64_t Height() const { return y1 - y0; }
+    int64_t Depth() const { return z1 - z0; }
+    int64_t Size() const { return Width() * Height() * Depth(); }
+
+    int16_t& At(int64_t x, int64_t y, int64_t z) const
+    {
+        return mask[(z * dimY + y) * dimX + x];
+    }
+
+    int64_t LocalIndex(int64_t x, int64_t y, int64_t z) const
+    {
+        return ((z - z0) * Height() + (y - y0)) * Width() + (x - x0);
+    }
+};
+
+/**
+ * Returns a bounding box that contains no voxels, which any Add grows to the first voxel.
+ */
+SourceInfo EmptyBounds()
+{
+    SourceInfo bounds{};
+    bounds.minX = INT64_MAX;
+    bounds.maxX = -1;
+    bounds.minY = INT64_MAX;
+    bounds.maxY = -1;
+    bounds.minZ = INT64_MAX;
+    bounds.maxZ = -1;
+    return bounds;
+}
+
+/**
+ * Bounding box of the voxels changed by an operation, in the SourceInfo layout. Empty while minX > maxX.
+ */
+struct DirtyRegion
+{
+    SourceInfo bounds = EmptyBounds();
+
+    void Add(int64_t x, int64_t y, int64_t z)
+    {
+        bounds.minX = min(bounds.minX, x);
+        bounds.maxX = max(bounds.maxX, x);
+        bounds.minY = min(bounds.minY, y);
+        bounds.maxY = max(bounds.maxY, y);
+        bounds.minZ = min(bounds.minZ, z);
+        bounds.maxZ = max(bounds.maxZ, z);
+    }
+
+    void Add(const DirtyRegion& other)
+    {
+        if (other.bounds.maxX >= 0)
+        {
+            Add(other.bounds.minX, other.bounds.minY, other.bounds.minZ);
+            Add(other.bounds.maxX, other.bounds.maxY, other.bounds.maxZ);
+        }
+    }
+};
+
+/**
+ * Returns true if any neighbour of (x, y, z) inside the box satisfies the predicate. 6-connectivity checks the face
+ * neighbours, and 26-connectivity the full 3x3x3 neighbourhood.
+ */
+template<typename Predicate>
+bool AnyNeighbour(const MorphologyBox& box, int64_t x, int64_t y, int64_t z, int connectivity, Predicate&& predicate)
+{
+    for (int64_t k = max(box.z0, z - 1); k <= min(box.z1 - 1, z + 1); k++)
+    {
+        for (int64_t j = max(box.y0, y - 1); j <= min(box.y1 - 1, y + 1); j++)
+        {
+            for (int64_t i = max(box.x0, x - 1); i <= min(box.x1 - 1, x + 1); i++)
+            {
+                const int64_t distance = abs(i - x) + abs(j - y) + abs(k - z);
+                if (distance == 0 || (connectivity == 6 && distance > 1))
+                {
+                    continue;
+                }
+                if (predicate(box.At(i, j, k)))
+                {
+                    return true;
+                }
+            }
+        }
+    }
+    return false;
+}
+
+/**
+ * Marks the empty voxels next to the label (dilation) or the label voxels next to any other value (erosion), and
+ * sums the data values of the marked voxels if data is given. Returns the number of marked voxels.
+ */
+int64_t MarkStep(const MorphologyBox& box, int16_t label, int connectivity, bool dilate, const float* data, vector<uint8_t>& marks, double& flux)
+{
+    int64_t count = 0;
+    double sum = 0;
+    #pragma omp parallel for schedule(static) reduction(+:count, sum)
+    for (int64_t z = box.z0; z < box.z1; z++)
+    {
+        for (int64_t y = box.y0; y < box.y1; y++)
+        {
+            for (int64_t x = box.x0; x < box.x1; x++)
+            {
+                const int16_t value = box.At(x, y, z);
+                bool mark;
+                if (dilate)
+                {
+                    mark = value == 0 && AnyNeighbour(box, x, y, z, connectivity, [label](int16_t v) { return v == label; });
+                }
+                else
+                {
+                    mark = value == label && AnyNeighbour(box, x, y, z, connectivity, [label](int16_t v) { return v != label; });
+                }
+                marks[box.LocalIndex(x, y, z)] = mark;
+                if (mark)
+                {
+                    count++;
+                    if (data)
+                    {
+                        const float val = data[(z * box.dimY + y) * box.dimX + x];
+                        sum += isfinite(val) ? val : 0.0;
+                    }
+                }
+            }
+        }
+    }
+    flux = sum;
+    return count;
+}
+
+/**
+ * Sets the marked voxels to the given value and records them in the dirty region.
+ */
+void ApplyMarks(const MorphologyBox& box, const vector<uint8_t>& marks, int16_t value, DirtyRegion& dirty)
+{
+    #pragma omp parallel
+    {
+        DirtyRegion localDirty;
+        #pragma omp for schedule(static)
+        for (int64_t z = box.z0; z < box.z1; z++)
+        {
+            for (int64_t y = box.y0; y < box.y1; y++)
+            {
+                for (int64_t x = box.x0; x < box.x1; x++)
+                {
+                    if (marks[box.LocalIndex(x, y, z)])
+                    {
+                        box.At(x, y, z) = value;
+                        localDirty.Add(x, y, z);
+                    }
+                }
+            }
+        }
+        #pragma omp critical
+        {
+            dirty.Add(localDirty);
+        }
+    }
+}
+
+void Dilate(const MorphologyBox& box, int16_t label, int iterations, int connectivity, vector<uint8_t>& marks, DirtyRegion& dirty)
+{
+    double flux;
+    for (int i = 0; i < iterations && MarkStep(box, label, connectivity, true, nullptr, marks, flux) > 0; i++)
+    {
+        ApplyMarks(box, marks, label, dirty);
+    }
+}
+
+void Erode(const MorphologyBox& box, int16_t label, int iterations, int connectivity, vector<uint8_t>& marks, DirtyRegion& dirty)
+{
+    double flux;
+    for (int i = 0; i < iterations && MarkStep(box, label, connectivity, false, nullptr, marks, flux) > 0; i++)
+    {
+        ApplyMarks(box, marks, 0, dirty);
+    }
+}
+
+/**
+ * Fills the empty voxels that cannot be reached from the box faces without crossing the label. The background is
+ * traversed with 6-connectivity, so the label only needs to be 26-connected around a hole to enclose it.
+ */
+void FillHoles(const MorphologyBox& box, int16_t label, vector<uint8_t>& reached, DirtyRegion& dirty)
+{
+    fill(reached.begin(), reached.end(), 0);
+    vector<int64_t> stack;
+    auto visit = [&](int64_t x, int64_t y, int64_t z) {
+        const int64_t index = box.LocalIndex(x, y, z);
+        if (!reached[index] && box.At(x, y, z) != label)
+        {
+            reached[index] = 1;
+            stack.push_back(index);
+        }
+    };
+
+    for (int64_t z = box.z0; z < box.z1; z++)
+    {
+        for (int64_t y = box.y0; y < box.y1; y++)
+        {
+            for (int64_t x = box.x0; x < box.x1; x++)
+            {
+                if (x == box.x0 || x == box.x1 - 1 || y == box.y0 || y == box.y1 - 1 || z == box.z0 || z == box.z1 - 1)
+                {
+                    visit(x, y, z);
+                }
+            }
+        }
+    }
+    while (!stack.empty())
+    {
+        const int64_t index = stack.back();
+        stack.pop_back();
+        const int64_t x = box.x0 + index % box.Width();
+        const int64_t y = box.y0 + (index / box.Width()) % box.Height();
+        const int64_t z = box.z0 + index / (box.Width() * box.Height());
+        if (x > box.x0) visit(x - 1, y, z);
+        if (x < box.x1 - 1) visit(x + 1, y, z);
+        if (y > box.y0) visit(x, y - 1, z);
+        if (y < box.y1 - 1) visit(x, y + 1, z);
+        if (z > box.z0) visit(x, y, z - 1);
+        if (z < box.z1 - 1) visit(x, y, z + 1);
+    }
+
+    // Unreached empty voxels are holes
+    #pragma omp parallel for schedule(static)
+    for (int64_t i = 0; i < box.Size(); i++)
+    {
+        const int64_t x = box.x0 + i % box.Width();
+        const int64_t y = box.y0 + (i / box.Width()) % box.Height();
+        const int64_t z = box.z0 + i / (box.Width() * box.Height());
+        reached[i] = !reached[i] && box.At(x, y, z) == 0;
+    }
+    ApplyMarks(box, reached, label, dirty);
+}
+
+bool ValidBox(int64_t dimX, int64_t dimY, int64_t dimZ, int64_t x0, int64_t x1, int64_t y0, int64_t y1, int64_t z0, int64_t z1)
+{
+    return x0 >= 0 && x0 < x1 && x1 <= dimX && y0 >= 0 && y0 < y1 && y1 <= dimY && z0 >= 0 && z0 < z1 && z1 <= dimZ;
+}
+
+void ExportDirtyRegion(const DirtyRegion& dirty, int16_t label, SourceInfo* dirtyRegion)
+{
+    if (dirtyRegion == nullptr)
+    {
+        return;
+    }
+    *dirtyRegion = dirty.bounds;
+    if (dirty.bounds.maxX < 0)
+    {
+        // Empty region
+        SourceInfo empty{};
+        empty.maxX = -1;
+        empty.maxY = -1;
+        empty.maxZ = -1;
+        *dirtyRegion = empty;
+    }
+    dirtyRegion->maskVal = label;
+}
+}
+
+/**
+ * @brief Applies a morphological operation to one label of an int16 mask, within a box.
+ *
+ * Only voxels inside the box [x0, x1) x [y0, y1) x [z0, z1) are read or changed, so the box should enclose the
+ * label's bounding box, grown by the number of iterations for dilation and closing. Each step is evaluated over
+ * the whole box in parallel before it is applied.
+ *
+ * @param maskDataPtr Pointer to the int16 mask, with x varying fastest. Updated in place.
+ * @param dimX The x dimension of the mask.
+ * @param dimY The y dimension of the mask.
+ * @param dimZ The z dimension of the mask.
+ * @param label The (non-zero) label to operate on.
+ * @param operation The MorphologyOperation to apply.
+ * @param iterations The number of dilation or erosion steps (ignored for hole filling).
+ * @param connectivity The structuring element: 6 (face neighbours) or 26 (3x3x3 cube).
+ * @param x0 First x-coordinate of the box (0-based).
+ * @param x1 One past the last x-coordinate of the box.
+ * @param y0 First y-coordinate of the box (0-based).
+ * @param y1 One past the last y-coordinate of the box.
+ * @param z0 First z-coordinate of the box (0-based).
+ * @param z1 One past the last z-coordinate of the box.
+ * @param dirtyRegion Optional output for the bounding box of the changed voxels, which is empty (max < min) if
+ *        nothing changed.
+ * @return int Returns EXIT_SUCCESS on success, or EXIT_FAILURE if the arguments are invalid or memory could not be
+ *         allocated.
+ */
+int ApplyMaskMorphology(int16_t* maskDataPtr, int64_t dimX, int64_t dimY, int64_t dimZ, int16_t label, int operation, int iterations,
+                        int connectivity, int64_t x0, int64_t x1, int64_t y0, int64_t y1, int64_t z0, int64_t z1, SourceInfo* dirtyRegion)
+{
+    if (maskDataPtr == nullptr || label == 0 || iterations < 0 || (connectivity != 6 && connectivity != 26) ||
+        operation < MORPHOLOGY_DILATE || operation > MORPHOLOGY_CLOSE || !ValidBox(dimX, dimY, dimZ, x0, x1, y0, y1, z0, z1))
+    {
+        return EXIT_FAILURE;
+    }
+    const MorphologyBox box = {maskDataPtr, dimX, dimY, x0, x1, y0, y1, z0, z1};
+    DirtyRegion dirty;
+    try
+    {
+        vector<uint8_t> marks(box.Size());
+        switch (operation)
+        {
+            case MORPHOLOGY_DILATE:
+                Dilate(box, label, iterations, connectivity, marks, dirty);
+                break;
+            case MORPHOLOGY_ERODE:
+                Erode(box, label, iterations, connectivity, marks, dirty);
+                break;
+            case MORPHOLOGY_FILL_HOLES:
+                FillHoles(box, label, marks, dirty);
+                break;
+            case MORPHOLOGY_OPEN:
+                Erode(box, label, iterations, connectivity, marks, dirty);
+                Dilate(box, label, iterations, connectivity, marks, dirty);
+                break;
+            case MORPHOLOGY_CLOSE:
+                Dilate(box, label, iterations, connectivity, marks, dirty);
+                Erode(box, label, iterations, connectivity, marks, dirty);
+                break;
+        }
+    }
+    catch (const std::bad_alloc&)
+    {
+        return EXIT_FAILURE;
+    }
+    ExportDirtyRegion(dirty, label, dirtyRegion);
+    return EXIT_SUCCESS;
+}
+
+/**
+ * @brief Dilates one label of an int16 mask into its faint wings, stopping when the flux stops growing.
+ *
+ * As in SoFiA's mask dilation, the label is grown one step at a time, and each step is only applied if the summed
+ * flux of the new shell of voxels is more than @p fluxThreshold times the flux of the label so far. Dilation also
+ * stops after @p maxIterations steps, or if the label's flux is not positive. Only voxels inside the box are read
+ * or changed (see ApplyMaskMorphology).
+ *
+ * @param dataPtr Pointer to the cube data, with the same dimensions as the mask. Non-finite values count as zero flux.
+ * @param maskDataPtr Pointer to the int16 mask, with x varying fastest. Updated in place.
+ * @param dimX The x dimension of the cube.
+ * @param dimY The y dimension of the cube.
+ * @param dimZ The z dimension of the cube.
+ * @param label The (non-zero) label to dilate.
+ * @param maxIterations The maximum number of dilation steps.
+ * @param connectivity The structuring element: 6 (face neighbours) or 26 (3x3x3 cube).
+ * @param fluxThreshold The minimum relative flux increase for a step to be applied (e.g. 0.01 for 1%).
+ * @param x0 First x-coordinate of the box (0-based).
+ * @param x1 One past the last x-coordinate of the box.
+ * @param y0 First y-coordinate of the box (0-based).
+ * @param y1 One past the last y-coordinate of the box.
+ * @param z0 First z-coordinate of the box (0-based).
+ * @param z1 One past the last z-coordinate of the box.
+ * @param iterationsApplied Optional output for the number of dilation steps applied.
+ * @param dirtyRegion Optional output for the bounding box of the changed voxels (see ApplyMaskMorphology).
+ * @return int Returns EXIT_SUCCESS on success, or EXIT_FAILURE if the arguments are invalid or memory could not be
+ *         allocated.
+ */
+int DilateMaskByFlux(const float* dataPtr, int16_t* maskDataPtr, int64_t dimX, int64_t dimY, int64_t dimZ, int16_t label, int maxIterations,
+                     int connectivity, float fluxThreshold, int64_t x0, int64_t x1, int64_t y0, int64_t y1, int64_t z0, int64_t z1,
+                     int* iterationsApplied, SourceInfo* dirtyRegion)
+{
+    if (dataPtr == nullptr || maskDataPtr == nullptr || label == 0 || maxIterations < 0 || (connectivity != 6 && connectivity != 26) ||
+        !ValidBox(dimX, dimY, dimZ, x0, x1, y0, y1, z0, z1))
+    {
+        return EXIT_FAILURE;
+    }
+    const MorphologyBox box = {maskDataPtr, dimX, dimY, x0, x1, y0, y1, z0, z1};
+
+    double totalFlux = 0;
+    #pragma omp parallel for schedule(static) reduction(+:totalFlux)
+    for (int64_t z = z0; z < z1; z++)
+    {
+        for (int64_t y = y0; y < y1; y++)
+        {
+            for (int64_t x = x0; x < x1; x++)
+            {
+                const int64_t index = (z * dimY + y) * dimX + x;
+                if (maskDataPtr[index] == label && isfinite(dataPtr[index]))
+                {
+                    totalFlux += dataPtr[index];
+                }
+            }
+        }
+    }
+
+    DirtyRegion dirty;
+    int applied = 0;
+    try
+    {
+        vector<uint8_t> marks(box.Size());
+        while (applied < maxIterations && totalFlux > 0)
+        {
+            double shellFlux;
+            if (MarkStep(box, label, connectivity, true, dataPtr, marks, shellFlux) == 0 || shellFlux <= fluxThreshold * totalFlux)
+            {
+                break;
+            }
+            ApplyMarks(box, marks, label, dirty);
+            totalFlux += shellFlux;
+            applied++;
+        }
+    }
+    catch (const std::bad_alloc&)
+    {
+        return EXIT_FAILURE;
+    }
+    if (iterationsApplied != nullptr)
+    {
+        *iterationsApplied = applied;
+    }
+    ExportDirtyRegion(dirty, label, dirtyRegion);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,59 @@
+/*
+ * iDaVIE (immersive Data Visualisation Interactive Explorer)
+ * Copyright (C) 2024 Inter-University Institute for Data Intensive Astronomy
+ *
+ * This file is part of the iDaVIE project.
+ *
+ * iDaVIE is free software: you can redistribute it and/or modify it under the terms 
+ * of the GNU Lesser General Public License (LGPL) as published by the Free Software 
+ * Foundation, either version 3 of the License, or (at your option) any later version.
+ *
+ * iDaVIE is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; 
+ * without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR 
+ * PURPOSE. See the GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License along with 
+ * iDaVIE in the LICENSE file. If not, see <https://www.gnu.org/licenses/>.
+ *
+ * Additional information and disclaimers regarding liability and third-party 
+ * components can be found in the DISCLAIMER and NOTICE files included with this project.
+ *
+ */
+#ifndef NATIVE_PLUGINS_MORPHOLOGY_TOOL_H
+#define NATIVE_PLUGINS_MORPHOLOGY_TOOL_H
+
+#include <cstdint>
+#include <omp.h>
+
+#include "data_analysis_tool.h"
+
+#define DllExport __declspec (dllexport)
+
+#define EXIT_SUCCESS 0
+#define EXIT_FAILURE 1
+
+/**
+ * @brief Morphological operations on a single label of an int16 mask.
+ *
+ * Dilation grows the label into empty (zero) voxels only, never into other labels. Erosion removes voxels of the
+ * label that touch any other value. Hole filling sets the empty voxels that are enclosed by the label to the label.
+ * Opening is erosion followed by dilation, and closing is dilation followed by erosion.
+ */
+enum MorphologyOperation : int32_t
+{
+    MORPHOLOGY_DILATE = 0,
+    MORPHOLOGY_ERODE = 1,
+    MORPHOLOGY_FILL_HOLES = 2,
+    MORPHOLOGY_OPEN = 3,
+    MORPHOLOGY_CLOSE = 4
+};
+
+extern "C"
+{
+DllExport int ApplyMaskMorphology(int16_t*, int64_t, int64_t, int64_t, int16_t, int, int, int, int64_t, int64_t, int64_t, int64_t, int64_t, int64_t,
+                                  SourceInfo*);
+DllExport int DilateMaskByFlux(const float*, int16_t*, int64_t, int64_t, int64_t, int16_t, int, int, float, int64_t, int64_t, int64_t, int64_t,
+                               int64_t, int64_t, int*, SourceInfo*);
+}
+
+#endif //NATIVE_PLUGINS_MORPHOLOGY_TOOL_H
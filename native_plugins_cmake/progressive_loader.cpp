@@ -0,0 +1,291 @@
+/*
+ * iDaVIE (immersive Data Visualisation Interactive Explorer)
+ * Copyright (C) 2024 Inter-University Institute for Data Intensive Astronomy
+ *
+ * This file is part of the iDaVIE project.
+ *
+ * iDaVIE is free software: you can redistribute it and/or modify it under the terms 
+ * of the GNU Lesser General Public License (LGPL) as published by the Free Software 
+ * Foundation, either version 3 of the License, or (at your option) any later version.
+ *
+ * iDaVIE is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; 
+ * without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR 
+ * PURPOSE. See the GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License along with 
+ * iDaVIE in the LICENSE file. If not, see <https://www.gnu.org/licenses/>.
+ *
+ * Additional information and disclaimers regarding liability and third-party 
+ * components can be found in the DISCLAIMER and NOTICE files included with this project.
+ *
+ */
+#include "progressive_loader.h"
+#include "cube_buffer.h"
+#include "fits_reader.h"
+
+#include <algorithm>
+#include <new>
+
+using namespace std;
+
+namespace
+{
+void ReportProgress(ProgressiveLoad& load, int64_t channelsRead)
+{
+    lock_guard<mutex> lock(load.mutex);
+    load.state.channelsRead = channelsRead;
+}
+
+/**
+ * @brief Copies each sample of a strided read over its factor^3 block of the full-resolution buffer, for the
+ * full-resolution channels [zFirst, zEnd).
+ */
+void ReplicateSamples(ProgressiveLoad& load, const float* samples, const int64_t* sampleDims, int factor, int64_t zFirst, int64_t zEnd)
+{
+    const int64_t sliceSize = load.dimX * load.dimY;
+#pragma omp parallel for
+    for (int64_t z = zFirst; z < zEnd; z++)
+    {
+        const float* sampleSlice = samples + (z - zFirst) / factor * sampleDims[0] * sampleDims[1];
+        for (int64_t y = 0; y < load.dimY; y++)
+        {
+            const float* sampleRow = sampleSlice + y / factor * sampleDims[0];
+            float* row = load.data + z * sliceSize + y * load.dimX;
+            for (int64_t i = 0; i < sampleDims[0]; i++)
+            {
+                const int64_t xEnd = min<int64_t>((i + 1) * factor, load.dimX);
+                for (int64_t x = i * factor; x < xEnd; x++)
+                {
+                    row[x] = sampleRow[i];
+                }
+            }
+        }
+    }
+}
+
+/**
+ * @brief Reads every factor-th voxel of the region in slabs of channels and replicates them over the buffer.
+ */
+int ReadSampledLevel(ProgressiveLoad& load, int factor)
+{
+    const int64_t sampleSliceSize = ((load.dimX + factor - 1) / factor) * ((load.dimY + factor - 1) / factor);
+    const int64_t sampledChannels = (load.dimZ + factor - 1) / factor;
+    const int64_t channelsPerRead = max<int64_t>(1, DECIMATED_READ_SLAB_BYTES / (sampleSliceSize * (int64_t) sizeof(float)));
+    long startPix[4], finalPix[4];
+    copy(load.startPix, load.startPix + 4, startPix);
+    copy(load.finalPix, load.finalPix + 4, finalPix);
+
+    for (int64_t c = 0; c < sampledChannels && !load.stop; c += channelsPerRead)
+    {
+        const int64_t zFirst = c * factor;
+        const int64_t zEnd = min(load.dimZ, (c + channelsPerRead) * factor);
+        startPix[2] = load.startPix[2] + (long) zFirst;
+        finalPix[2] = load.startPix[2] + (long) zEnd - 1;
+        float* samples = nullptr;
+        int64_t sampleDims[3];
+        int status = 0;
+        if (FitsReadSubImageDecimated(load.fptr, load.naxis, 2, startPix, finalPix, factor, factor, factor, DECIMATED_READ_STRIDE, &samples, sampleDims, &status))
+        {
+            return status;
+        }
+        ReplicateSamples(load, samples, sampleDims, factor, zFirst, zEnd);
+        FreeFitsPtrMemory(samples);
+        ReportProgress(load, zEnd);
+    }
+    return 0;
+}
+
+/**
+ * @brief Reads the region at full resolution straight into the buffer, in slabs of channels.
+ */
+int ReadFullLevel(ProgressiveLoad& load)
+{
+    const int64_t sliceSize = load.dimX * load.dimY;
+    const int64_t channelsPerRead = max<int64_t>(1, DECIMATED_READ_SLAB_BYTES / (sliceSize * (int64_t) sizeof(float)));
+    long startPix[4], finalPix[4], increment[4] = {1, 1, 1, 1};
+    copy(load.startPix, load.startPix + 4, startPix);
+    copy(load.finalPix, load.finalPix + 4, finalPix);
+    int anynul;
+    float nulval = 0;
+
+    for (int64_t z = 0; z < load.dimZ && !load.stop; z += channelsPerRead)
+    {
+        const int64_t zEnd = min(load.dimZ, z + channelsPerRead);
+        startPix[2] = load.startPix[2] + (long) z;
+        finalPix[2] = load.startPix[2] + (long) zEnd - 1;
+        int status = 0;
+        if (fits_read_subset(load.fptr, TFLOAT, startPix, finalPix, increment, &nulval, load.data + z * sliceSize, &anynul, &status))
+        {
+            return status;
+        }
+        ReportProgress(load, zEnd);
+    }
+    return 0;
+}
+
+void LoaderWorker(ProgressiveLoad* load)
+{
+    int level = 0;
+    int factor = load->coarsestFactor;
+    int status = 0;
+    for (; factor >= 1 && !load->stop; factor /= 2, level++)
+    {
+        ReportProgress(*load, 0);
+        status = factor > 1 ? ReadSampledLevel(*load, factor) : ReadFullLevel(*load);
+        if (status || load->stop)
+        {
+            break;
+        }
+        {
+            lock_guard<mutex> lock(load->mutex);
+            load->state.levelsCompleted = level + 1;
+            load->state.currentFactor = factor;
+        }
+        if (load->callback)
+        {
+            load->callback(level, factor, 0);
+        }
+    }
+    {
+        lock_guard<mutex> lock(load->mutex);
+        load->state.status = status;
+        load->state.finished = 1;
+    }
+    if (status && load->callback)
+    {
+        load->callback(level, factor, status);
+    }
+}
+}
+
+/**
+ * @brief Starts loading a cube region coarse-to-fine on a background thread.
+ *
+ * The full-resolution buffer is allocated up front and returned immediately. Its contents are undefined until the
+ * first level completes; after that it always holds a complete version of the region, refined in place by each
+ * level. Completion of each level is reported through the callback (if not null) and through
+ * GetProgressiveLoadState, so rendering can start on the coarse data while the rest of the read continues.
+ *
+ * @param fileName The FITS file to open (a separate read-only handle is used).
+ * @param selectedHDU The index of the image HDU.
+ * @param cropX1, cropY1, cropZ1, cropX2, cropY2, cropZ2 Corners of the region (1-based, inclusive), as for DataCropAndDownsample.
+ * @param coarsestFactor Sampling stride of the first level, rounded down to a power of two. Each level halves it.
+ * @param callback Function called from the loader thread after each level, or null to rely on polling.
+ * @param result Output pointer to the new load, to be released with FreeProgressiveLoad.
+ * @param array Output for the region in X-Y-Z order, to be freed with FreeFitsPtrMemory after FreeProgressiveLoad.
+ * @return int The result code, 0 for success, a CFITSIO error code if not.
+ */
+int StartProgressiveLoad(char* fileName, int selectedHDU, int64_t cropX1, int64_t cropY1, int64_t cropZ1, int64_t cropX2, int64_t cropY2, int64_t cropZ2,
+                         int coarsestFactor, ProgressiveLoadCallback callback, ProgressiveLoad** result, float** array)
+{
+    if (!result || !array || coarsestFactor < 1 || coarsestFactor > PROGRESSIVE_LOAD_MAX_FACTOR)
+    {
+        return BAD_DIMEN;
+    }
+    int status = 0;
+    fitsfile* fptr = nullptr;
+    if (FitsOpenFileReadOnly(&fptr, fileName, &status))
+    {
+        return status;
+    }
+    int naxis = 0;
+    LONGLONG naxes[4] = {1, 1, 1, 1};
+    if (selectedHDU > 1)
+    {
+        fits_movabs_hdu(fptr, selectedHDU, nullptr, &status);
+    }
+    fits_get_img_dim(fptr, &naxis, &status);
+    if (status == 0 && (naxis < 3 || naxis > 4))
+    {
+        status = BAD_NAXIS;
+    }
+    fits_get_img_sizell(fptr, naxis, naxes, &status);
+    if (status == 0 && naxis == 4 && naxes[3] != 1)
+    {
+        status = BAD_DIMEN;
+    }
+    if (status == 0 && (min(cropX1, cropX2) < 1 || min(cropY1, cropY2) < 1 || min(cropZ1, cropZ2) < 1 || max(cropX1, cropX2) > naxes[0] ||
+                        max(cropY1, cropY2) > naxes[1] || max(cropZ1, cropZ2) > naxes[2]))
+    {
+        status = BAD_PIX_NUM;
+    }
+    if (status)
+    {
+        int closeStatus = 0;
+        fits_close_file(fptr, &closeStatus);
+        return status;
+    }
+
+    ProgressiveLoad* load = new (nothrow) ProgressiveLoad();
+    float* data = nullptr;
+    if (load)
+    {
+        load->dimX = abs(cropX2 - cropX1) + 1;
+        load->dimY = abs(cropY2 - cropY1) + 1;
+        load->dimZ = abs(cropZ2 - cropZ1) + 1;
+        data = AllocateCubeBuffer<float>(load->dimX * load->dimY * load->dimZ);
+    }
+    if (!data)
+    {
+        delete load;
+        fits_close_file(fptr, &status);
+        return MEMORY_ALLOCATION;
+    }
+
+    int factor = 1;
+    int numLevels = 1;
+    while (factor * 2 <= coarsestFactor)
+    {
+        factor *= 2;
+        numLevels++;
+    }
+    load->fptr = fptr;
+    load->naxis = naxis;
+    long startPix[4] = {(long) min(cropX1, cropX2), (long) min(cropY1, cropY2), (long) min(cropZ1, cropZ2), 1};
+    long finalPix[4] = {(long) max(cropX1, cropX2), (long) max(cropY1, cropY2), (long) max(cropZ1, cropZ2), 1};
+    copy(startPix, startPix + 4, load->startPix);
+    copy(finalPix, finalPix + 4, load->finalPix);
+    load->coarsestFactor = factor;
+    load->data = data;
+    load->callback = callback;
+    load->state = {};
+    load->state.numLevels = numLevels;
+    load->state.channelsTotal = load->dimZ;
+    load->stop = false;
+    load->worker = thread(LoaderWorker, load);
+    *result = load;
+    *array = data;
+    return 0;
+}
+
+/**
+ * @brief Reports how far a progressive load has got. Levels are only counted once fully written to the buffer.
+ */
+int GetProgressiveLoadState(ProgressiveLoad* load, ProgressiveLoadState* state)
+{
+    if (!load || !state)
+    {
+        return EXIT_FAILURE;
+    }
+    lock_guard<mutex> lock(load->mutex);
+    *state = load->state;
+    return EXIT_SUCCESS;
+}
+
+/**
+ * @brief Cancels the load if it is still running, waits for the loader thread and closes its file handle.
+ * The buffer is left to the caller.
+ */
+int FreeProgressiveLoad(ProgressiveLoad* load)
+{
+    if (!load)
+    {
+        return EXIT_FAILURE;
+    }
+    load->stop = true;
+    load->worker.join();
+    int status = 0;
+    fits_close_file(load->fptr, &status);
+    delete load;
+    return EXIT_SUCCESS;
+}
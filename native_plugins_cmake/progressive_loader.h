@@ -0,0 +1,95 @@
+/*
+ * iDaVIE (immersive Data Visualisation Interactive Explorer)
+ * Copyright (C) 2024 Inter-University Institute for Data Intensive Astronomy
+ *
+ * This file is part of the iDaVIE project.
+ *
+ * iDaVIE is free software: you can redistribute it and/or modify it under the terms 
+ * of the GNU Lesser General Public License (LGPL) as published by the Free Software 
+ * Foundation, either version 3 of the License, or (at your option) any later version.
+ *
+ * iDaVIE is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; 
+ * without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR 
+ * PURPOSE. See the GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License along with 
+ * iDaVIE in the LICENSE file. If not, see <https://www.gnu.org/licenses/>.
+ *
+ * Additional information and disclaimers regarding liability and third-party 
+ * components can be found in the DISCLAIMER and NOTICE files included with this project.
+ *
+ */
+#ifndef NATIVE_PLUGINS_PROGRESSIVE_LOADER_H
+#define NATIVE_PLUGINS_PROGRESSIVE_LOADER_H
+
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include <fitsio.h>
+
+#define DllExport __declspec (dllexport)
+
+#define EXIT_SUCCESS 0
+#define EXIT_FAILURE 1
+
+// Largest downsampling factor accepted for the first (coarsest) level
+#define PROGRESSIVE_LOAD_MAX_FACTOR 64
+
+/**
+ * @brief Called from the loader thread when a level has been written to the buffer, or when the load fails.
+ *
+ * @param level Index of the completed level, 0 being the coarsest.
+ * @param factor Sampling stride of the completed level (1 for full resolution).
+ * @param status 0 on success, or the CFITSIO error code that stopped the load.
+ */
+typedef void (*ProgressiveLoadCallback)(int32_t level, int32_t factor, int32_t status);
+
+/**
+ * @brief Progress of a load, as reported by GetProgressiveLoadState.
+ */
+struct ProgressiveLoadState
+{
+    int32_t numLevels;          /**< Number of levels, the last one being full resolution */
+    int32_t levelsCompleted;    /**< Levels fully written to the buffer */
+    int32_t currentFactor;      /**< Sampling stride of the last completed level, 0 before the first one */
+    int32_t status;             /**< 0, or the CFITSIO error code that stopped the load */
+    int32_t finished;           /**< Non-zero once the loader thread has stopped */
+    int32_t padding;
+    int64_t channelsRead;       /**< Channels of the level in progress written so far */
+    int64_t channelsTotal;      /**< Channels in the region */
+};
+
+/**
+ * @brief Coarse-to-fine load of a cube region into a single full-resolution buffer.
+ *
+ * The loader thread first reads every factor-th voxel of the region and replicates each sample over its
+ * factor^3 block, so that the whole buffer holds a coarse version of the region almost immediately. Each
+ * following level halves the stride and overwrites the buffer in place, ending with a full-resolution read.
+ * The loader owns its own fitsfile handle, so it does not interfere with the handles used elsewhere.
+ */
+struct ProgressiveLoad
+{
+    fitsfile* fptr;
+    int naxis;
+    long startPix[4];
+    long finalPix[4];
+    int64_t dimX, dimY, dimZ;
+    int coarsestFactor;
+    float* data;
+    ProgressiveLoadCallback callback;
+
+    std::mutex mutex;               /**< Guards state */
+    ProgressiveLoadState state;
+    std::atomic<bool> stop;
+    std::thread worker;
+};
+
+extern "C"
+{
+DllExport int StartProgressiveLoad(char*, int, int64_t, int64_t, int64_t, int64_t, int64_t, int64_t, int, ProgressiveLoadCallback, ProgressiveLoad**, float**);
+DllExport int GetProgressiveLoadState(ProgressiveLoad*, ProgressiveLoadState*);
+DllExport int FreeProgressiveLoad(ProgressiveLoad*);
+}
+
+#endif //NATIVE_PLUGINS_PROGRESSIVE_LOADER_H
@@ -0,0 +1,446 @@
+/*
+ * iDaVIE (immersive Data Visualisation Interactive Explorer)
+ * Copyright (C) 2024 Inter-University Institute for Data Intensive Astronomy
+ *
+ * This file is part of the iDaVIE project.
+ *
+ * iDaVIE is free software: you can redistribute it and/or modify it under the terms 
+ * of the GNU Lesser General Public License (LGPL) as published by the Free Software 
+ * Foundation, either version 3 of the License, or (at your option) any later version.
+ *
+ * iDaVIE is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; 
+ * without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR 
+ * PURPOSE. See the GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License along with 
+ * iDaVIE in the LICENSE file. If not, see <https://www.gnu.org/licenses/>.
+ *
+ * Additional information and disclaimers regarding liability and third-party 
+ * components can be found in the DISCLAIMER and NOTICE files included with this project.
+ *
+ */
+#include "region_prefetcher.h"
+#include "cube_buffer.h"
+#include "fits_reader.h"
+
+#include <algorithm>
+#include <cstring>
+#include <new>
+
+using namespace std;
+
+namespace
+{
+int64_t BoxVoxels(const PrefetchBox& box)
+{
+    return (box.x1 - box.x0) * (box.y1 - box.y0) * (box.z1 - box.z0);
+}
+
+bool Contains(const PrefetchBox& outer, const PrefetchBox& inner)
+{
+    return inner.x0 >= outer.x0 && inner.x1 <= outer.x1 && inner.y0 >= outer.y0 && inner.y1 <= outer.y1
+        && inner.z0 >= outer.z0 && inner.z1 <= outer.z1;
+}
+
+bool SameBox(const PrefetchBox& a, const PrefetchBox& b)
+{
+    return Contains(a, b) && Contains(b, a);
+}
+
+/**
+ * @brief Shifts a box to lie within the cube without changing its size where possible, then clips it.
+ */
+PrefetchBox FitToCube(const RegionPrefetcher& prefetcher, PrefetchBox box)
+{
+    auto fit = [](int64_t& lo, int64_t& hi, int64_t dim) {
+        if (lo < 0)
+        {
+            hi -= lo;
+            lo = 0;
+        }
+        if (hi > dim)
+        {
+            lo = max<int64_t>(0, lo - (hi - dim));
+            hi = dim;
+        }
+    };
+    fit(box.x0, box.x1, prefetcher.dimX);
+    fit(box.y0, box.y1, prefetcher.dimY);
+    fit(box.z0, box.z1, prefetcher.dimZ);
+    return box;
+}
+
+/**
+ * @brief Reads a box from disk into a cube buffer, holding the file lock.
+ */
+int ReadBox(RegionPrefetcher& prefetcher, const PrefetchBox& box, float** data)
+{
+    long startPix[4] = {(long) box.x0 + 1, (long) box.y0 + 1, (long) box.z0 + 1, 1};
+    long finalPix[4] = {(long) box.x1, (long) box.y1, (long) box.z1, 1};
+    int status = 0;
+    lock_guard<mutex> fileLock(prefetcher.fileMutex);
+    FitsReadSubImageFloat(prefetcher.fptr, prefetcher.naxis, 2, startPix, finalPix, BoxVoxels(box), data, &status);
+    return status;
+}
+
+/**
+ * @brief Copies the requested box out of a cached box that encloses it.
+ */
+void ExtractBox(const PrefetchCacheEntry& entry, const PrefetchBox& box, float* output)
+{
+    int64_t entryWidth = entry.box.x1 - entry.box.x0;
+    int64_t entryHeight = entry.box.y1 - entry.box.y0;
+    int64_t width = box.x1 - box.x0;
+    int64_t height = box.y1 - box.y0;
+    int64_t depth = box.z1 - box.z0;
+#pragma omp parallel for
+    for (int64_t k = 0; k < depth; k++)
+    {
+        for (int64_t j = 0; j < height; j++)
+        {
+            const float* source = entry.data + ((box.z0 - entry.box.z0 + k) * entryHeight + (box.y0 - entry.box.y0 + j)) * entryWidth + (box.x0 - entry.box.x0);
+            memcpy(output + (k * height + j) * width, source, width * sizeof(float));
+        }
+    }
+}
+
+/**
+ * @brief Finds the smallest cached box enclosing the request. Must be called with the prefetcher mutex held.
+ */
+list<PrefetchCacheEntry>::iterator FindEnclosing(RegionPrefetcher& prefetcher, const PrefetchBox& box)
+{
+    auto best = prefetcher.cache.end();
+    for (auto it = prefetcher.cache.begin(); it != prefetcher.cache.end(); ++it)
+    {
+        if (Contains(it->box, box) && (best == prefetcher.cache.end() || it->bytes < best->bytes))
+        {
+            best = it;
+        }
+    }
+    return best;
+}
+
+/**
+ * @brief Adds a box to the front of the cache, evicting least recently used entries to stay within budget.
+ * Takes ownership of data. Must be called with the prefetcher mutex held.
+ */
+void InsertEntry(RegionPrefetcher& prefetcher, const PrefetchBox& box, float* data, bool prefetched)
+{
+    int64_t bytes = BoxVoxels(box) * sizeof(float);
+    if (bytes > prefetcher.cacheBudget)
+    {
+        FreeFitsPtrMemory(data);
+        return;
+    }
+    while (!prefetcher.cache.empty() && prefetcher.stats.cachedBytes + bytes > prefetcher.cacheBudget)
+    {
+        PrefetchCacheEntry& last = prefetcher.cache.back();
+        prefetcher.stats.cachedBytes -= last.bytes;
+        prefetcher.stats.evictions++;
+        FreeFitsPtrMemory(last.data);
+        prefetcher.cache.pop_back();
+    }
+    prefetcher.cache.push_front({box, data, bytes, prefetched, false});
+    prefetcher.stats.cachedBytes += bytes;
+}
+
+/**
+ * @brief Predicts the next regions from the request history: the next pan step if the user is panning, the
+ * enclosing region at the next coarser level, and the spatial neighbours of the current region.
+ */
+vector<PrefetchBox> PredictRegions(const RegionPrefetcher& prefetcher)
+{
+    vector<PrefetchBox> candidates;
+    const PrefetchBox& current = prefetcher.history.back();
+    int64_t width = current.x1 - current.x0;
+    int64_t height = current.y1 - current.y0;
+    int64_t depth = current.z1 - current.z0;
+    auto shifted = [&](int64_t dx, int64_t dy, int64_t dz) {
+        return PrefetchBox{current.x0 + dx * width, current.x1 + dx * width, current.y0 + dy * height, current.y1 + dy * height,
+                           current.z0 + dz * depth, current.z1 + dz * depth};
+    };
+
+    if (prefetcher.history.size() > 1)
+    {
+        const PrefetchBox& previous = prefetcher.history[prefetcher.history.size() - 2];
+        bool sameSize = previous.x1 - previous.x0 == width && previous.y1 - previous.y0 == height && previous.z1 - previous.z0 == depth;
+        if (sameSize && !SameBox(previous, current))
+        {
+            auto sign = [](int64_t v) { return (int64_t) ((v > 0) - (v < 0)); };
+            candidates.push_back(shifted(sign(current.x0 - previous.x0), sign(current.y0 - previous.y0), sign(current.z0 - previous.z0)));
+        }
+    }
+
+    int64_t growX = width * (PREFETCH_ENCLOSING_SCALE - 1) / 2;
+    int64_t growY = height * (PREFETCH_ENCLOSING_SCALE - 1) / 2;
+    candidates.push_back({current.x0 - growX, current.x1 + growX, current.y0 - growY, current.y1 + growY, current.z0, current.z1});
+
+    candidates.push_back(shifted(1, 0, 0));
+    candidates.push_back(shifted(-1, 0, 0));
+    candidates.push_back(shifted(0, 1, 0));
+    candidates.push_back(shifted(0, -1, 0));
+
+    vector<PrefetchBox> predictions;
+    for (const auto& candidate : candidates)
+    {
+        PrefetchBox box = FitToCube(prefetcher, candidate);
+        bool duplicate = SameBox(box, current);
+        for (const auto& existing : predictions)
+        {
+            duplicate |= SameBox(existing, box);
+        }
+        if (!duplicate)
+        {
+            predictions.push_back(box);
+        }
+        if (predictions.size() == PREFETCH_MAX_PREDICTIONS)
+        {
+            break;
+        }
+    }
+    return predictions;
+}
+
+/**
+ * @brief Replaces the queued predictions with new ones that are not cached yet. Must be called with the
+ * prefetcher mutex held.
+ */
+void QueuePredictions(RegionPrefetcher& prefetcher, const vector<PrefetchBox>& predictions)
+{
+    prefetcher.queue.clear();
+    for (const auto& box : predictions)
+    {
+        if (BoxVoxels(box) * (int64_t) sizeof(float) > prefetcher.cacheBudget || FindEnclosing(prefetcher, box) != prefetcher.cache.end())
+        {
+            continue;
+        }
+        if (prefetcher.inFlight && Contains(prefetcher.inFlightBox, box))
+        {
+            continue;
+        }
+        prefetcher.queue.push_back(box);
+        prefetcher.stats.prefetchesIssued++;
+    }
+    if (!prefetcher.queue.empty())
+    {
+        prefetcher.wake.notify_one();
+    }
+}
+
+void PrefetchWorker(RegionPrefetcher* prefetcher)
+{
+    unique_lock<mutex> lock(prefetcher->mutex);
+    while (true)
+    {
+        prefetcher->wake.wait(lock, [prefetcher] { return prefetcher->stop || !prefetcher->queue.empty(); });
+        if (prefetcher->stop)
+        {
+            break;
+        }
+        PrefetchBox box = prefetcher->queue.front();
+        prefetcher->queue.pop_front();
+        if (FindEnclosing(*prefetcher, box) != prefetcher->cache.end())
+        {
+            continue;
+        }
+        prefetcher->inFlight = true;
+        prefetcher->inFlightBox = box;
+        lock.unlock();
+
+        float* data = nullptr;
+        int status = ReadBox(*prefetcher, box, &data);
+
+        lock.lock();
+        prefetcher->inFlight = false;
+        if (status == 0)
+        {
+            prefetcher->stats.prefetchesCompleted++;
+            prefetcher->stats.bytesRead += BoxVoxels(box) * sizeof(float);
+            InsertEntry(*prefetcher, box, data, true);
+        }
+        prefetcher->done.notify_all();
+    }
+}
+
+bool MakeBox(const RegionPrefetcher* prefetcher, int64_t cropX1, int64_t cropY1, int64_t cropZ1, int64_t cropX2, int64_t cropY2, int64_t cropZ2, PrefetchBox& box)
+{
+    box = {min(cropX1, cropX2) - 1, max(cropX1, cropX2), min(cropY1, cropY2) - 1, max(cropY1, cropY2), min(cropZ1, cropZ2) - 1, max(cropZ1, cropZ2)};
+    return prefetcher && box.x0 >= 0 && box.y0 >= 0 && box.z0 >= 0 && box.x1 <= prefetcher->dimX && box.y1 <= prefetcher->dimY && box.z1 <= prefetcher->dimZ;
+}
+}
+
+int CreateRegionPrefetcher(char* fileName, int selectedHDU, int64_t cacheBytes, RegionPrefetcher** result)
+{
+    int status = 0;
+    fitsfile* fptr = nullptr;
+    if (FitsOpenFileReadOnly(&fptr, fileName, &status))
+    {
+        return status;
+    }
+    int naxis = 0;
+    LONGLONG naxes[4] = {1, 1, 1, 1};
+    if (selectedHDU > 1)
+    {
+        fits_movabs_hdu(fptr, selectedHDU, nullptr, &status);
+    }
+    fits_get_img_dim(fptr, &naxis, &status);
+    if (status == 0 && (naxis < 3 || naxis > 4))
+    {
+        status = BAD_NAXIS;
+    }
+    fits_get_img_sizell(fptr, naxis, naxes, &status);
+    if (status == 0 && naxis == 4 && naxes[3] != 1)
+    {
+        status = BAD_DIMEN;
+    }
+    if (status)
+    {
+        int closeStatus = 0;
+        fits_close_file(fptr, &closeStatus);
+        return status;
+    }
+
+    RegionPrefetcher* prefetcher = new (nothrow) RegionPrefetcher();
+    if (!prefetcher)
+    {
+        fits_close_file(fptr, &status);
+        return MEMORY_ALLOCATION;
+    }
+    prefetcher->fptr = fptr;
+    prefetcher->naxis = naxis;
+    prefetcher->dimX = naxes[0];
+    prefetcher->dimY = naxes[1];
+    prefetcher->dimZ = naxes[2];
+    prefetcher->cacheBudget = max<int64_t>(cacheBytes, 0);
+    prefetcher->inFlight = false;
+    prefetcher->stop = false;
+    prefetcher->stats = {};
+    prefetcher->worker = thread(PrefetchWorker, prefetcher);
+    *result = prefetcher;
+    return 0;
+}
+
+int PrefetcherReadRegion(RegionPrefetcher* prefetcher, int64_t cropX1, int64_t cropY1, int64_t cropZ1, int64_t cropX2, int64_t cropY2, int64_t cropZ2, float** array)
+{
+    PrefetchBox box;
+    if (!MakeBox(prefetcher, cropX1, cropY1, cropZ1, cropX2, cropY2, cropZ2, box) || !array)
+    {
+        return BAD_PIX_NUM;
+    }
+    int64_t bytes = BoxVoxels(box) * sizeof(float);
+    float* output = nullptr;
+
+    try
+    {
+        unique_lock<mutex> lock(prefetcher->mutex);
+        prefetcher->stats.requests++;
+        prefetcher->history.push_back(box);
+        if (prefetcher->history.size() > PREFETCH_HISTORY_LENGTH)
+        {
+            prefetcher->history.pop_front();
+        }
+
+        // A prefetch of an enclosing region may already be on its way
+        prefetcher->done.wait(lock, [&] { return !prefetcher->inFlight || !Contains(prefetcher->inFlightBox, box); });
+        auto entry = FindEnclosing(*prefetcher, box);
+        if (entry != prefetcher->cache.end())
+        {
+            output = AllocateCubeBuffer<float>(BoxVoxels(box));
+            if (!output)
+            {
+                return MEMORY_ALLOCATION;
+            }
+            prefetcher->stats.hits++;
+            if (entry->prefetched && !entry->used)
+            {
+                prefetcher->stats.prefetchesUsed++;
+            }
+            entry->used = true;
+            prefetcher->cache.splice(prefetcher->cache.begin(), prefetcher->cache, entry);
+            ExtractBox(prefetcher->cache.front(), box, output);
+        }
+        else
+        {
+            prefetcher->stats.misses++;
+            // Stale predictions are dropped so that the synchronous read is not queued behind them
+            prefetcher->queue.clear();
+            lock.unlock();
+            // The region is read straight into the caller's buffer, and only copied when the cache can retain it
+            int status = ReadBox(*prefetcher, box, &output);
+            if (status)
+            {
+                return status;
+            }
+            float* retained = bytes <= prefetcher->cacheBudget ? AllocateCubeBuffer<float>(BoxVoxels(box)) : nullptr;
+            if (retained)
+            {
+                memcpy(retained, output, bytes);
+            }
+            lock.lock();
+            prefetcher->stats.bytesRead += bytes;
+            if (retained)
+            {
+                InsertEntry(*prefetcher, box, retained, false);
+            }
+        }
+        QueuePredictions(*prefetcher, PredictRegions(*prefetcher));
+    }
+    catch (const bad_alloc&)
+    {
+        FreeFitsPtrMemory(output);
+        return MEMORY_ALLOCATION;
+    }
+    *array = output;
+    return 0;
+}
+
+int PrefetcherHintRegion(RegionPrefetcher* prefetcher, int64_t cropX1, int64_t cropY1, int64_t cropZ1, int64_t cropX2, int64_t cropY2, int64_t cropZ2)
+{
+    PrefetchBox box;
+    if (!MakeBox(prefetcher, cropX1, cropY1, cropZ1, cropX2, cropY2, cropZ2, box))
+    {
+        return BAD_PIX_NUM;
+    }
+    lock_guard<mutex> lock(prefetcher->mutex);
+    if (BoxVoxels(box) * (int64_t) sizeof(float) <= prefetcher->cacheBudget && FindEnclosing(*prefetcher, box) == prefetcher->cache.end())
+    {
+        prefetcher->queue.push_front(box);
+        prefetcher->stats.prefetchesIssued++;
+        prefetcher->wake.notify_one();
+    }
+    return 0;
+}
+
+int GetPrefetcherStats(RegionPrefetcher* prefetcher, PrefetchStats* stats)
+{
+    if (!prefetcher || !stats)
+    {
+        return EXIT_FAILURE;
+    }
+    lock_guard<mutex> lock(prefetcher->mutex);
+    *stats = prefetcher->stats;
+    return EXIT_SUCCESS;
+}
+
+int FreeRegionPrefetcher(RegionPrefetcher* prefetcher)
+{
+    if (!prefetcher)
+    {
+        return EXIT_FAILURE;
+    }
+    {
+        lock_guard<mutex> lock(prefetcher->mutex);
+        prefetcher->stop = true;
+        prefetcher->queue.clear();
+    }
+    prefetcher->wake.notify_all();
+    prefetcher->worker.join();
+    for (auto& entry : prefetcher->cache)
+    {
+        FreeFitsPtrMemory(entry.data);
+    }
+    int status = 0;
+    fits_close_file(prefetcher->fptr, &status);
+    delete prefetcher;
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,151 @@
+/*
+ * iDaVIE (immersive Data Visualisation Interactive Explorer)
+ * Copyright (C) 2024 Inter-University Institute for Data Intensive Astronomy
+ *
+ * This file is part of the iDaVIE project.
+ *
+ * iDaVIE is free software: you can redistribute it and/or modify it under the terms 
+ * of the GNU Lesser General Public License (LGPL) as published by the Free Software 
+ * Foundation, either version 3 of the License, or (at your option) any later version.
+ *
+ * iDaVIE is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; 
+ * without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR 
+ * PURPOSE. See the GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License along with 
+ * iDaVIE in the LICENSE file. If not, see <https://www.gnu.org/licenses/>.
+ *
+ * Additional information and disclaimers regarding liability and third-party 
+ * components can be found in the DISCLAIMER and NOTICE files included with this project.
+ *
+ */
+#ifndef NATIVE_PLUGINS_REGION_PREFETCHER_H
+#define NATIVE_PLUGINS_REGION_PREFETCHER_H
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <list>
+#include <mutex>
+#include <thread>
+#include <fitsio.h>
+
+#define DllExport __declspec (dllexport)
+
+#define EXIT_SUCCESS 0
+#define EXIT_FAILURE 1
+
+// Number of recent region requests used to detect panning and zooming
+#define PREFETCH_HISTORY_LENGTH 4
+// Maximum number of regions predicted after each request
+#define PREFETCH_MAX_PREDICTIONS 4
+// Growth factor of the enclosing region predicted for the next (coarser) resolution level
+#define PREFETCH_ENCLOSING_SCALE 2
+
+/**
+ * @brief Region of the cube, 0-based and half-open along each axis.
+ */
+struct PrefetchBox
+{
+    int64_t x0, x1;
+    int64_t y0, y1;
+    int64_t z0, z1;
+};
+
+/**
+ * @brief Counters reported by GetPrefetcherStats.
+ */
+struct PrefetchStats
+{
+    int64_t requests;               /**< Regions requested through PrefetcherReadRegion */
+    int64_t hits;                   /**< Requests served from the cache (including prefetches still in flight) */
+    int64_t misses;                 /**< Requests that had to be read synchronously */
+    int64_t prefetchesIssued;       /**< Predicted regions queued for the background thread */
+    int64_t prefetchesCompleted;    /**< Predicted regions read into the cache */
+    int64_t prefetchesUsed;         /**< Prefetched regions that later served at least one request */
+    int64_t evictions;              /**< Cache entries evicted to stay within the byte budget */
+    int64_t cachedBytes;            /**< Bytes currently held by the cache */
+    int64_t bytesRead;              /**< Bytes read from disk, synchronously or in the background */
+};
+
+struct PrefetchCacheEntry
+{
+    PrefetchBox box;
+    float* data;
+    int64_t bytes;
+    bool prefetched;
+    bool used;
+};
+
+/**
+ * @brief Read-ahead cache for region requests on a cube on disk.
+ *
+ * Requests are served from the cache when a cached region encloses them, and otherwise read synchronously. After
+ * each request the prefetcher predicts the regions the user is likely to select next (the next pan step, the
+ * enclosing region at the next coarser resolution level, and the neighbouring regions) and reads them on a
+ * background thread into a least-recently-used cache bounded by a byte budget. The prefetcher owns its own
+ * fitsfile handle, so it does not interfere with the handles used elsewhere.
+ */
+struct RegionPrefetcher
+{
+    fitsfile* fptr;
+    int naxis;
+    int64_t dimX, dimY, dimZ;
+    int64_t cacheBudget;
+
+    std::mutex mutex;               /**< Guards everything below except fileMutex */
+    std::mutex fileMutex;           /**< Serialises CFITSIO access between the caller and the I/O thread */
+    std::condition_variable wake;
+    std::condition_variable done;
+    std::list<PrefetchCacheEntry> cache;
+    std::deque<PrefetchBox> queue;
+    std::deque<PrefetchBox> history;
+    PrefetchBox inFlightBox;
+    bool inFlight;
+    bool stop;
+    PrefetchStats stats;
+    std::thread worker;
+};
+
+extern "C"
+{
+/**
+ * @brief Opens a cube for region reads with read-ahead.
+ *
+ * @param fileName The FITS file to open (a separate read-only handle is used).
+ * @param selectedHDU The index of the image HDU.
+ * @param cacheBytes Maximum number of bytes held by the region cache.
+ * @param result Output pointer to the new prefetcher, to be released with FreeRegionPrefetcher.
+ * @return int The result code, 0 for success, a CFITSIO error code if not.
+ */
+DllExport int CreateRegionPrefetcher(char*, int, int64_t, RegionPrefetcher**);
+
+/**
+ * @brief Reads a region through the cache and schedules prefetches for the regions predicted to follow.
+ *
+ * @param prefetcher The prefetcher.
+ * @param cropX1, cropY1, cropZ1, cropX2, cropY2, cropZ2 Corners of the region (1-based, inclusive), as for DataCropAndDownsample.
+ * @param array Output for the region in X-Y-Z order, to be freed with FreeFitsPtrMemory.
+ * @return int The result code, 0 for success, a CFITSIO error code if not.
+ */
+DllExport int PrefetcherReadRegion(RegionPrefetcher*, int64_t, int64_t, int64_t, int64_t, int64_t, int64_t, float**);
+
+/**
+ * @brief Queues a region for prefetching ahead of the predictions, e.g. when the UI knows the next selection.
+ *
+ * @return int The result code, 0 for success, a CFITSIO error code if not.
+ */
+DllExport int PrefetcherHintRegion(RegionPrefetcher*, int64_t, int64_t, int64_t, int64_t, int64_t, int64_t);
+
+/**
+ * @brief Reports the hit/miss and prefetch counters of a prefetcher.
+ */
+DllExport int GetPrefetcherStats(RegionPrefetcher*, PrefetchStats*);
+
+/**
+ * @brief Stops the background thread, releases the cache and closes the prefetcher's file handle.
+ */
+DllExport int FreeRegionPrefetcher(RegionPrefetcher*);
+}
+
+#endif //NATIVE_PLUGINS_REGION_PREFETCHER_H
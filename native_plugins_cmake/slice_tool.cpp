@@ -0,0 +1,378 @@
+/*
+ * iDaVIE (immersive Data Visualisation Interactive Explorer)
+ * Copyright (C) 2024 Inter-University Institute for Data Intensive Astronomy
+ *
+ * This file is part of the iDaVIE project.
+ *
+ * iDaVIE is free software: you can redistribute it and/or modify it under the terms 
+ * of the GNU Lesser General Public License (LGPL) as published by the Free Software 
+ * Foundation, either version 3 of the License, or (at your option) any later version.
+ *
+ * iDaVIE is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; 
+ * without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR 
+ * PURPOSE. See the GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License along with 
+ * iDaVIE in the LICENSE file. If not, see <https://www.gnu.org/licenses/>.
+ *
+ * Additional information and disclaimers regarding liability and third-party 
+ * components can be found in the DISCLAIMER and NOTICE files included with this project.
+ *
+ */
+#include "slice_tool.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <new>
+#include <vector>
+
+using namespace std;
+
+namespace
+{
+const double DEGREES_PER_RADIAN = 57.295779513082321;
+
+/**
+ * @brief Precomputed bilinear interpolation of one position within a channel: the index of the lower-left pixel,
+ * the steps to its right and upper neighbours (0 at the image edge) and the fractional offsets.
+ */
+struct PlaneSample
+{
+    int64_t index;
+    int64_t stepX, stepY;
+    float fx, fy;
+    bool valid;
+};
+
+PlaneSample MakePlaneSample(double x, double y, int64_t dimX, int64_t dimY)
+{
+    PlaneSample sample{0, 0, 0, 0, 0, false};
+    if (!(x >= -0.5 && x <= dimX - 0.5 && y >= -0.5 && y <= dimY - 0.5))
+    {
+        return sample;
+    }
+    x = min(max(x, 0.0), (double) (dimX - 1));
+    y = min(max(y, 0.0), (double) (dimY - 1));
+    int64_t x0 = min((int64_t) x, dimX - 1);
+    int64_t y0 = min((int64_t) y, dimY - 1);
+    sample.index = y0 * dimX + x0;
+    sample.stepX = x0 + 1 < dimX ? 1 : 0;
+    sample.stepY = y0 + 1 < dimY ? dimX : 0;
+    sample.fx = (float) (x - x0);
+    sample.fy = (float) (y - y0);
+    sample.valid = true;
+    return sample;
+}
+
+/**
+ * @brief Bilinear interpolation that ignores NaN neighbours, renormalising the remaining weights. Returns NaN if no
+ * neighbour with a non-zero weight is valid.
+ */
+float InterpolatePlane(const float* slice, const PlaneSample& sample)
+{
+    const float* p = slice + sample.index;
+    float weights[4] = {(1 - sample.fx) * (1 - sample.fy), sample.fx * (1 - sample.fy), (1 - sample.fx) * sample.fy, sample.fx * sample.fy};
+    float values[4] = {p[0], p[sample.stepX], p[sample.stepY], p[sample.stepX + sample.stepY]};
+    float sum = 0, totalWeight = 0;
+    for (int i = 0; i < 4; i++)
+    {
+        if (weights[i] > 0 && !isnan(values[i]))
+        {
+            sum += weights[i] * values[i];
+            totalWeight += weights[i];
+        }
+    }
+    return totalWeight > 0 ? sum / totalWeight : numeric_limits<float>::quiet_NaN();
+}
+
+/**
+ * @brief Trilinear interpolation at a 0-based voxel position. Positions more than half a voxel outside the cube are
+ * NaN. If any of the eight neighbours is NaN, the remaining weights are renormalised.
+ */
+inline float InterpolateVolume(const float* dataPtr, int64_t dimX, int64_t dimY, int64_t dimZ, double x, double y, double z)
+{
+    if (!(x >= -0.5 && x <= dimX - 0.5 && y >= -0.5 && y <= dimY - 0.5 && z >= -0.5 && z <= dimZ - 0.5))
+    {
+        return numeric_limits<float>::quiet_NaN();
+    }
+    x = min(max(x, 0.0), (double) (dimX - 1));
+    y = min(max(y, 0.0), (double) (dimY - 1));
+    z = min(max(z, 0.0), (double) (dimZ - 1));
+    int64_t x0 = (int64_t) x, y0 = (int64_t) y, z0 = (int64_t) z;
+    float fx = (float) (x - x0), fy = (float) (y - y0), fz = (float) (z - z0);
+    int64_t stepX = x0 + 1 < dimX ? 1 : 0;
+    int64_t stepY = y0 + 1 < dimY ? dimX : 0;
+    int64_t stepZ = z0 + 1 < dimZ ? dimX * dimY : 0;
+    const float* p = dataPtr + (z0 * dimY + y0) * dimX + x0;
+    float values[8] = {p[0], p[stepX], p[stepY], p[stepX + stepY], p[stepZ], p[stepZ + stepX], p[stepZ + stepY], p[stepZ + stepX + stepY]};
+    float check = 0;
+    for (int i = 0; i < 8; i++)
+    {
+        check += values[i] * 0.0f;
+    }
+    if (check == 0)
+    {
+        // No NaN (or infinity) among the neighbours: plain trilinear interpolation
+        float c00 = values[0] + fx * (values[1] - values[0]);
+        float c10 = values[2] + fx * (values[3] - values[2]);
+        float c01 = values[4] + fx * (values[5] - values[4]);
+        float c11 = values[6] + fx * (values[7] - values[6]);
+        float c0 = c00 + fy * (c10 - c00);
+        float c1 = c01 + fy * (c11 - c01);
+        return c0 + fz * (c1 - c0);
+    }
+    float weights[8];
+    float gx = 1 - fx, gy = 1 - fy, gz = 1 - fz;
+    weights[0] = gx * gy * gz;
+    weights[1] = fx * gy * gz;
+    weights[2] = gx * fy * gz;
+    weights[3] = fx * fy * gz;
+    weights[4] = gx * gy * fz;
+    weights[5] = fx * gy * fz;
+    weights[6] = gx * fy * fz;
+    weights[7] = fx * fy * fz;
+    float sum = 0, totalWeight = 0;
+    for (int i = 0; i < 8; i++)
+    {
+        // Zero-weight neighbours are skipped so that a NaN beyond the sample cannot poison it
+        if (weights[i] > 0 && !isnan(values[i]))
+        {
+            sum += weights[i] * values[i];
+            totalWeight += weights[i];
+        }
+    }
+    return totalWeight > 0 ? sum / totalWeight : numeric_limits<float>::quiet_NaN();
+}
+
+void CopyAxisString(char* target, const char* source)
+{
+    strncpy(target, source ? source : "", PV_AXIS_STRING_LENGTH - 1);
+    target[PV_AXIS_STRING_LENGTH - 1] = '\0';
+}
+
+/**
+ * @brief Fills in the WCS description of a PV slice from the cube's frame set. Returns false if AST fails, in which
+ * case the pixel description is kept.
+ */
+bool DescribePvAxes(AstFrameSet* frameSetPtr, const vector<double>& pathX, const vector<double>& pathY, int64_t zStart, PvAxisInfo* axes)
+{
+    int64_t numberOffsets = pathX.size();
+    double spectralIn[6] = {pathX[0] + 1, pathX[0] + 1, pathY[0] + 1, pathY[0] + 1, (double) zStart + 1, (double) zStart + 2};
+    double spectralOut[6];
+    astTranN(frameSetPtr, 2, 3, 2, spectralIn, 1, 3, 2, spectralOut);
+
+    double offset = 0;
+    if (numberOffsets > 1)
+    {
+        vector<double> skyIn(3 * numberOffsets), skyOut(3 * numberOffsets);
+        for (int64_t i = 0; i < numberOffsets; i++)
+        {
+            skyIn[i] = pathX[i] + 1;
+            skyIn[numberOffsets + i] = pathY[i] + 1;
+            skyIn[2 * numberOffsets + i] = (double) zStart + 1;
+        }
+        astTranN(frameSetPtr, numberOffsets, 3, numberOffsets, skyIn.data(), 1, 3, numberOffsets, skyOut.data());
+        int skyAxes[2] = {1, 2};
+        AstFrame* skyFrame = static_cast<AstFrame*>(astPickAxes(frameSetPtr, 2, skyAxes, nullptr));
+        for (int64_t i = 1; i < numberOffsets && astOK; i++)
+        {
+            double start[2] = {skyOut[i - 1], skyOut[numberOffsets + i - 1]};
+            double end[2] = {skyOut[i], skyOut[numberOffsets + i]};
+            offset += astDistance(skyFrame, start, end);
+        }
+        if (skyFrame)
+        {
+            astAnnul(skyFrame);
+        }
+    }
+    if (!astOK || spectralOut[4] == AST__BAD || spectralOut[5] == AST__BAD)
+    {
+        astClearStatus;
+        return false;
+    }
+    axes->offsetStart = 0;
+    axes->offsetDelta = numberOffsets > 1 ? offset / (numberOffsets - 1) * DEGREES_PER_RADIAN : 0;
+    axes->spectralStart = spectralOut[4];
+    axes->spectralDelta = spectralOut[5] - spectralOut[4];
+    CopyAxisString(axes->offsetUnit, "deg");
+    CopyAxisString(axes->spectralUnit, astGetC(frameSetPtr, "Unit(3)"));
+    CopyAxisString(axes->spectralSystem, astGetC(frameSetPtr, "System(3)"));
+    return true;
+}
+}
+
+/**
+ * @brief Extracts a position-velocity slice along a polyline.
+ *
+ * The path is sampled every pixel along its length. At each sample, every channel is interpolated bilinearly within
+ * the channel plane (samples lie on whole channels, so trilinear interpolation reduces to bilinear). When the width
+ * is larger than one pixel, samples spaced one pixel apart across the path are averaged. NaN voxels are left out of
+ * both the interpolation and the average. Samples outside the cube are NaN. Channels are processed in parallel.
+ *
+ * @param dataPtr The cube, in X-Y-Z order.
+ * @param dimX, dimY, dimZ The dimensions of the cube.
+ * @param vertices The polyline as numVertices (x, y) pairs, in 0-based pixel coordinates.
+ * @param numVertices Number of vertices (at least 1).
+ * @param width Width of the path in pixels.
+ * @param zStart, zEnd The channel range, 0-based and half-open.
+ * @param frameSetPtr The cube's AST frame set, or nullptr to describe the axes in pixels and channels.
+ * @param image Output pointer to the slice, numOffsets wide and (zEnd - zStart) high, to be freed with FreeDataAnalysisMemory.
+ * @param numOffsets Output number of samples along the path.
+ * @param axes Output description of the slice's axes.
+ * @return int EXIT_SUCCESS, or EXIT_FAILURE if the arguments are invalid or the allocation fails.
+ */
+int ExtractPvSlice(const float* dataPtr, int64_t dimX, int64_t dimY, int64_t dimZ, const double* vertices, int numVertices, double width, int64_t zStart,
+                   int64_t zEnd, AstFrameSet* frameSetPtr, float** image, int64_t* numOffsets, PvAxisInfo* axes)
+{
+    zStart = max<int64_t>(zStart, 0);
+    zEnd = min(zEnd, dimZ);
+    if (!dataPtr || !vertices || numVertices < 1 || !image || !numOffsets || !axes || zStart >= zEnd)
+    {
+        return EXIT_FAILURE;
+    }
+
+    vector<double> pathX, pathY, normalX, normalY;
+    vector<PlaneSample> samples;
+    float* newImage = nullptr;
+    int64_t numberOffsets, numberAcross;
+    try
+    {
+        // Place the samples every pixel along the path, carrying the normal of the segment they lie on
+        double carry = 0;
+        pathX.push_back(vertices[0]);
+        pathY.push_back(vertices[1]);
+        normalX.push_back(0);
+        normalY.push_back(1);
+        for (int i = 1; i < numVertices; i++)
+        {
+            double dx = vertices[2 * i] - vertices[2 * i - 2];
+            double dy = vertices[2 * i + 1] - vertices[2 * i - 1];
+            double length = sqrt(dx * dx + dy * dy);
+            if (length <= 0)
+            {
+                continue;
+            }
+            if (pathX.size() == 1)
+            {
+                normalX[0] = -dy / length;
+                normalY[0] = dx / length;
+            }
+            for (double s = 1 - carry; s <= length; s += 1)
+            {
+                pathX.push_back(vertices[2 * i - 2] + dx * s / length);
+                pathY.push_back(vertices[2 * i - 1] + dy * s / length);
+                normalX.push_back(-dy / length);
+                normalY.push_back(dx / length);
+            }
+            carry = fmod(carry + length, 1.0);
+        }
+        numberOffsets = pathX.size();
+        numberAcross = width > 1 ? (int64_t) floor(width) : 1;
+        samples.resize(numberOffsets * numberAcross);
+        for (int64_t i = 0; i < numberOffsets; i++)
+        {
+            for (int64_t k = 0; k < numberAcross; k++)
+            {
+                double t = k - (numberAcross - 1) / 2.0;
+                samples[i * numberAcross + k] = MakePlaneSample(pathX[i] + t * normalX[i], pathY[i] + t * normalY[i], dimX, dimY);
+            }
+        }
+        newImage = new float[numberOffsets * (zEnd - zStart)];
+    }
+    catch (const bad_alloc&)
+    {
+        return EXIT_FAILURE;
+    }
+
+    int64_t sliceSize = dimX * dimY;
+#pragma omp parallel for
+    for (int64_t z = zStart; z < zEnd; z++)
+    {
+        const float* slice = dataPtr + z * sliceSize;
+        float* row = newImage + (z - zStart) * numberOffsets;
+        for (int64_t i = 0; i < numberOffsets; i++)
+        {
+            float sum = 0;
+            int count = 0;
+            for (int64_t k = 0; k < numberAcross; k++)
+            {
+                const PlaneSample& sample = samples[i * numberAcross + k];
+                if (!sample.valid)
+                {
+                    continue;
+                }
+                float value = InterpolatePlane(slice, sample);
+                if (!isnan(value))
+                {
+                    sum += value;
+                    count++;
+                }
+            }
+            row[i] = count ? sum / count : numeric_limits<float>::quiet_NaN();
+        }
+    }
+
+    axes->offsetStart = 0;
+    axes->offsetDelta = 1;
+    axes->spectralStart = (double) zStart + 1;
+    axes->spectralDelta = 1;
+    CopyAxisString(axes->offsetUnit, "pixel");
+    CopyAxisString(axes->spectralUnit, "");
+    CopyAxisString(axes->spectralSystem, "CHANNEL");
+    if (frameSetPtr)
+    {
+        DescribePvAxes(frameSetPtr, pathX, pathY, zStart, axes);
+    }
+
+    *image = newImage;
+    *numOffsets = numberOffsets;
+    return EXIT_SUCCESS;
+}
+
+/**
+ * @brief Resamples the cube on an arbitrarily oriented plane, at full resolution.
+ *
+ * Output pixel (i, j) is taken at origin + i * axisU + j * axisV, in 0-based voxel coordinates, with trilinear
+ * interpolation that ignores NaN voxels. Positions outside the cube are NaN. The output is split into square tiles
+ * that threads take in turn, so that each thread samples a compact region of the cube and reuses its cache lines.
+ *
+ * @param dataPtr The cube, in X-Y-Z order.
+ * @param dimX, dimY, dimZ The dimensions of the cube.
+ * @param origin Voxel position (x, y, z) of the first output pixel.
+ * @param axisU Step (dx, dy, dz) in voxels between neighbouring output pixels along a row.
+ * @param axisV Step (dx, dy, dz) in voxels between neighbouring output rows.
+ * @param width, height Dimensions of the output image.
+ * @param image Caller-owned buffer of width * height floats receiving the slice, rows first.
+ * @return int EXIT_SUCCESS, or EXIT_FAILURE if the arguments are invalid.
+ */
+int ResampleObliqueSlice(const float* dataPtr, int64_t dimX, int64_t dimY, int64_t dimZ, const double* origin, const double* axisU, const double* axisV,
+                         int64_t width, int64_t height, float* image)
+{
+    if (!dataPtr || !origin || !axisU || !axisV || !image || width < 1 || height < 1 || dimX < 1 || dimY < 1 || dimZ < 1)
+    {
+        return EXIT_FAILURE;
+    }
+    int64_t tilesX = (width + OBLIQUE_SLICE_TILE_SIZE - 1) / OBLIQUE_SLICE_TILE_SIZE;
+    int64_t tilesY = (height + OBLIQUE_SLICE_TILE_SIZE - 1) / OBLIQUE_SLICE_TILE_SIZE;
+    int64_t numberTiles = tilesX * tilesY;
+#pragma omp parallel for schedule(dynamic)
+    for (int64_t tile = 0; tile < numberTiles; tile++)
+    {
+        int64_t i0 = (tile % tilesX) * OBLIQUE_SLICE_TILE_SIZE, i1 = min(i0 + OBLIQUE_SLICE_TILE_SIZE, width);
+        int64_t j0 = (tile / tilesX) * OBLIQUE_SLICE_TILE_SIZE, j1 = min(j0 + OBLIQUE_SLICE_TILE_SIZE, height);
+        for (int64_t j = j0; j < j1; j++)
+        {
+            double rowX = origin[0] + j * axisV[0];
+            double rowY = origin[1] + j * axisV[1];
+            double rowZ = origin[2] + j * axisV[2];
+            float* row = image + j * width;
+            for (int64_t i = i0; i < i1; i++)
+            {
+                row[i] = InterpolateVolume(dataPtr, dimX, dimY, dimZ, rowX + i * axisU[0], rowY + i * axisU[1], rowZ + i * axisU[2]);
+            }
+        }
+    }
+    return EXIT_SUCCESS;
+}
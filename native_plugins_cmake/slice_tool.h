@@ -0,0 +1,62 @@
+/*
+ * iDaVIE (immersive Data Visualisation Interactive Explorer)
+ * Copyright (C) 2024 Inter-University Institute for Data Intensive Astronomy
+ *
+ * This file is part of the iDaVIE project.
+ *
+ * iDaVIE is free software: you can redistribute it and/or modify it under the terms 
+ * of the GNU Lesser General Public License (LGPL) as published by the Free Software 
+ * Foundation, either version 3 of the License, or (at your option) any later version.
+ *
+ * iDaVIE is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; 
+ * without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR 
+ * PURPOSE. See the GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License along with 
+ * iDaVIE in the LICENSE file. If not, see <https://www.gnu.org/licenses/>.
+ *
+ * Additional information and disclaimers regarding liability and third-party 
+ * components can be found in the DISCLAIMER and NOTICE files included with this project.
+ *
+ */
+#ifndef NATIVE_PLUGINS_SLICE_TOOL_H
+#define NATIVE_PLUGINS_SLICE_TOOL_H
+
+#include <cstdint>
+#include <omp.h>
+
+#define DllExport __declspec (dllexport)
+
+#define EXIT_SUCCESS 0
+#define EXIT_FAILURE 1
+
+// Size of the unit and system strings of PvAxisInfo
+#define PV_AXIS_STRING_LENGTH 32
+// Side of the square output tiles distributed between threads by ResampleObliqueSlice
+#define OBLIQUE_SLICE_TILE_SIZE 64
+
+/**
+ * @brief Linear description of the axes of a position-velocity slice, as returned by ExtractPvSlice.
+ *
+ * The first image axis is the offset along the path, in degrees if a frame set was given and in pixels otherwise.
+ * The second is the spectral axis, in the units and system of the cube's spectral axis, or in 1-based channels
+ * without a frame set. The offset step is the mean angular distance between consecutive samples.
+ */
+struct PvAxisInfo
+{
+    double offsetStart, offsetDelta;
+    double spectralStart, spectralDelta;
+    char offsetUnit[PV_AXIS_STRING_LENGTH];
+    char spectralUnit[PV_AXIS_STRING_LENGTH];
+    char spectralSystem[PV_AXIS_STRING_LENGTH];
+};
+
+extern "C"
+{
+#include "ast.h"
+DllExport int ExtractPvSlice(const float*, int64_t, int64_t, int64_t, const double*, int, double, int64_t, int64_t, AstFrameSet*, float**, int64_t*,
+                             PvAxisInfo*);
+DllExport int ResampleObliqueSlice(const float*, int64_t, int64_t, int64_t, const double*, const double*, const double*, int64_t, int64_t, float*);
+}
+
+#endif //NATIVE_PLUGINS_SLICE_TOOL_H
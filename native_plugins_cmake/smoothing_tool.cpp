@@ -0,0 +1,530 @@
+/*
+ * iDaVIE (immersive Data Visualisation Interactive Explorer)
+ * Copyright (C) 2024 Inter-University Institute for Data Intensive Astronomy
+ *
+ * This file is part of the iDaVIE project.
+ *
+ * iDaVIE is free software: you can redistribute it and/or modify it under the terms 
+ * of the GNU Lesser General Public License (LGPL) as published by the Free Software 
+ * Foundation, either version 3 of the License, or (at your option) any later version.
+ *
+ * iDaVIE is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; 
+ * without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR 
+ * PURPOSE. See the GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License along with 
+ * iDaVIE in the LICENSE file. If not, see <https://www.gnu.org/licenses/>.
+ *
+ * Additional information and disclaimers regarding liability and third-party 
+ * components can be found in the DISCLAIMER and NOTICE files included with this project.
+ *
+ */
+#include "smoothing_tool.h"
+#include "cube_buffer.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <new>
+#include <vector>
+
+using namespace std;
+
+namespace
+{
+struct Kernel
+{
+    vector<float> weights;  // 2 * radius + 1 weights, centred on the middle element
+    int64_t radius;
+};
+
+Kernel GaussianKernel(float fwhm)
+{
+    if (!(fwhm > 0))
+    {
+        return {{1.0f}, 0};
+    }
+    const double sigma = fwhm / (2.0 * sqrt(2.0 * log(2.0)));
+    const auto radius = (int64_t) ceil(SMOOTHING_GAUSSIAN_TRUNCATION * sigma);
+    Kernel kernel = {vector<float>(2 * radius + 1), radius};
+    for (int64_t i = -radius; i <= radius; i++)
+    {
+        kernel.weights[i + radius] = (float) exp(-0.5 * i * i / (sigma * sigma));
+    }
+    return kernel;
+}
+
+Kernel SpectralKernelWeights(int type, int width)
+{
+    if (type == SPECTRAL_KERNEL_NONE || width <= 1)
+    {
+        return {{1.0f}, 0};
+    }
+    const int64_t radius = width / 2;
+    Kernel kernel = {vector<float>(2 * radius + 1, 1.0f), radius};
+    if (type == SPECTRAL_KERNEL_HANNING)
+    {
+        const double pi = 3.14159265358979323846;
+        for (int64_t i = -radius; i <= radius; i++)
+        {
+            kernel.weights[i + radius] = (float) (0.5 * (1.0 + cos(2.0 * pi * i / (2 * radius + 2))));
+        }
+    }
+    return kernel;
+}
+
+/**
+ * Convolves a row with a kernel, normalising by the weights of the finite values under the kernel. Output
+ * element x is centred on input element x + offset. Non-finite input elements produce NaN output elements,
+ * so blanked voxels stay blanked.
+ */
+void ConvolveRow(const float* in, int64_t offset, int64_t inLength, const Kernel& kernel, float* out, int64_t outLength)
+{
+    const int64_t r = kernel.radius;
+    for (int64_t x = 0; x < outLength; x++)
+    {
+        const int64_t centre = x + offset;
+        if (!isfinite(in[centre]))
+        {
+            out[x] = NAN;
+            continue;
+        }
+        float sum = 0;
+        float weightSum = 0;
+        const int64_t first = max<int64_t>(-r, -centre);
+        const int64_t last = min<int64_t>(r, inLength - 1 - centre);
+        for (int64_t j = first; j <= last; j++)
+        {
+            const float val = in[centre + j];
+            if (isfinite(val))
+            {
+                sum += kernel.weights[j + r] * val;
+                weightSum += kernel.weights[j + r];
+            }
+        }
+        out[x] = sum / weightSum;
+    }
+}
+
+/**
+ * Convolves a set of rows (of one channel, or of successive channels) with a kernel across the rows, normalising
+ * by the weights of the finite values. rows(i) returns row i, for i in [first, last), and output row centred on
+ * row c is written to out. The inner loops run along the rows, so they vectorise.
+ */
+template<typename RowFunc>
+void ConvolveAcrossRows(RowFunc&& rows, int64_t first, int64_t last, int64_t centre, const Kernel& kernel, int64_t width,
+                        float* sum, float* weightSum, float* out)
+{
+    const int64_t r = kernel.radius;
+    fill(sum, sum + width, 0.0f);
+    fill(weightSum, weightSum + width, 0.0f);
+    for (int64_t j = max(-r, first - centre); j <= min(r, last - 1 - centre); j++)
+    {
+        const float* row = rows(centre + j);
+        const float weight = kernel.weights[j + r];
+        for (int64_t x = 0; x < width; x++)
+        {
+            const bool finite = isfinite(row[x]);
+            sum[x] += finite ? weight * row[x] : 0.0f;
+            weightSum[x] += finite ? weight : 0.0f;
+        }
+    }
+    const float* centreRow = rows(centre);
+    for (int64_t x = 0; x < width; x++)
+    {
+        out[x] = isfinite(centreRow[x]) ? sum[x] / weightSum[x] : NAN;
+    }
+}
+
+struct Region
+{
+    int64_t dimX, dimY, dimZ;
+    int64_t x0, x1, y0, y1, z0, z1;
+
+    int64_t Width() const { return x1 - x0; }
+    int64_t Height() const { return y1 - y0; }
+    int64_t PlaneSize() const { return Width() * Height(); }
+};
+
+/**
+ * Spatially smooths channel z of the region into out, using the data around the region (up to the kernel radius)
+ * as support. tmp holds the x-smoothed rows of the region's x range, extended by the kernel radius in y.
+ */
+void SmoothChannel(const float* data, const Region& region, int64_t z, const Kernel& kernel, vector<float>& tmp, float* out)
+{
+    const int64_t width = region.Width();
+    const int64_t r = kernel.radius;
+    const int64_t ex0 = max<int64_t>(0, region.x0 - r);
+    const int64_t ex1 = min(region.dimX, region.x1 + r);
+    const int64_t ey0 = max<int64_t>(0, region.y0 - r);
+    const int64_t ey1 = min(region.dimY, region.y1 + r);
+    const float* channel = data + z * region.dimX * region.dimY;
+
+    #pragma omp parallel for schedule(static)
+    for (int64_t y = ey0; y < ey1; y++)
+    {
+        ConvolveRow(channel + y * region.dimX + ex0, region.x0 - ex0, ex1 - ex0, kernel, tmp.data() + (y - ey0) * width, width);
+    }
+
+    const float* rows = tmp.data() - ey0 * width;
+    #pragma omp parallel
+    {
+        vector<float> sum(width);
+        vector<float> weightSum(width);
+        #pragma omp for schedule(static)
+        for (int64_t y = region.y0; y < region.y1; y++)
+        {
+            ConvolveAcrossRows([rows, width](int64_t i) { return rows + i * width; }, ey0, ey1, y, kernel, width,
+                               sum.data(), weightSum.data(), out + (y - region.y0) * width);
+        }
+    }
+}
+
+/**
+ * Writes the smoothed region directly into a full-resolution output buffer.
+ */
+struct FullResolutionSink
+{
+    float* output;
+    int64_t z0;
+    int64_t planeSize;
+
+    bool Reserve(int64_t)
+    {
+        return true;
+    }
+
+    float* Plane(int64_t z)
+    {
+        return output + (z - z0) * planeSize;
+    }
+
+    void Commit(int64_t)
+    {
+    }
+};
+
+/**
+ * Average or max pools the smoothed region into a downsampled output as each channel is produced, matching
+ * the pooling of DataCropAndDownsample, so that no full-resolution smoothed copy is needed.
+ */
+template<bool maxMode>
+struct DownsampleSink
+{
+    float* output;
+    int64_t z0, z1;
+    int64_t width, height;
+    int64_t factorX, factorY, factorZ;
+    int64_t newDimX, newDimY;
+    int64_t slab = 1;
+    vector<float> planes;
+    vector<float> accumulation;
+    vector<int> counts;
+
+    bool Reserve(int64_t slabSize)
+    {
+        slab = slabSize;
+        planes.resize(slab * width * height);
+        accumulation.assign(newDimX * newDimY, maxMode ? -numeric_limits<float>::max() : 0.0f);
+        counts.assign(newDimX * newDimY, 0);
+        return true;
+    }
+
+    float* Plane(int64_t z)
+    {
+        return planes.data() + ((z - z0) % slab) * width * height;
+    }
+
+    void Commit(int64_t z)
+    {
+        const float* plane = Plane(z);
+        #pragma omp parallel for schedule(static)
+        for (int64_t newY = 0; newY < newDimY; newY++)
+        {
+            for (int64_t y = newY * factorY; y < min(height, (newY + 1) * factorY); y++)
+            {
+                const float* row = plane + y * width;
+                for (int64_t x = 0; x < width; x++)
+                {
+                    const float val = row[x];
+                    if (!isnan(val))
+                    {
+                        const int64_t index = newY * newDimX + x / factorX;
+                        counts[index]++;
+                        if constexpr (maxMode)
+                        {
+                            accumulation[index] = max(accumulation[index], val);
+                        }
+                        else
+                        {
+                            accumulation[index] += val;
+                        }
+                    }
+                }
+            }
+        }
+
+        const int64_t local = z - z0;
+        if ((local + 1) % factorZ != 0 && z != z1 - 1)
+        {
+            return;
+        }
+        float* out = output + (local / factorZ) * newDimX * newDimY;
+        #pragma omp parallel for schedule(static)
+        for (int64_t i = 0; i < newDimX * newDimY; i++)
+        {
+            if (counts[i])
+            {
+                out[i] = maxMode ? accumulation[i] : accumulation[i] / (float) counts[i];
+            }
+            else
+            {
+                out[i] = NAN;
+            }
+            accumulation[i] = maxMode ? -numeric_limits<float>::max() : 0.0f;
+            counts[i] = 0;
+        }
+    }
+};
+
+/**
+ * Returns a sink pooling the region by the given factors into output, which holds the downsampled region.
+ */
+template<bool maxMode>
+DownsampleSink<maxMode> MakeDownsampleSink(float* output, const Region& region, int64_t factorX, int64_t factorY, int64_t factorZ)
+{
+    DownsampleSink<maxMode> sink{};
+    sink.output = output;
+    sink.z0 = region.z0;
+    sink.z1 = region.z1;
+    sink.width = region.Width();
+    sink.height = region.Height();
+    sink.factorX = factorX;
+    sink.factorY = factorY;
+    sink.factorZ = factorZ;
+    sink.newDimX = (sink.width + factorX - 1) / factorX;
+    sink.newDimY = (sink.height + factorY - 1) / factorY;
+    return sink;
+}
+
+/**
+ * Smooths a region of a cube with separable spatial and spectral kernels, streaming the result channel by
+ * channel into a sink. Channels are processed in slabs: the input channels each slab needs are spatially
+ * smoothed into a ring of planes (channels shared with the previous slab are kept), after which the spectral
+ * pass writes the slab's output planes. The working memory is bounded by SMOOTHING_BUFFER_BYTES, except that
+ * at least one output channel and its spectral neighbours are always held.
+ */
+template<typename Sink>
+void SmoothRegion(const float* data, const Region& region, const Kernel& spatial, const Kernel& spectral, Sink& sink)
+{
+    const int64_t width = region.Width();
+    const int64_t height = region.Height();
+    const int64_t planeSize = region.PlaneSize();
+    const int64_t r = spectral.radius;
+    const int64_t numChannels = region.z1 - region.z0;
+    const auto planesInBudget = (int64_t) (SMOOTHING_BUFFER_BYTES / (planeSize * sizeof(float)));
+    const int64_t slab = max<int64_t>(1, min(numChannels, planesInBudget / 2 - r));
+    const int64_t ringSize = slab + 2 * r;
+
+    vector<float> ring(ringSize * planeSize);
+    vector<float> tmp(width * min(region.dimY, height + 2 * spatial.radius));
+    sink.Reserve(slab);
+
+    auto ringPlane = [&](int64_t z) {
+        return ring.data() + (z % ringSize) * planeSize;
+    };
+
+    int64_t nextChannel = max<int64_t>(0, region.z0 - r);
+    for (int64_t s = region.z0; s < region.z1; s += slab)
+    {
+        const int64_t e = min(region.z1, s + slab);
+        const int64_t inputEnd = min(region.dimZ, e + r);
+        for (; nextChannel < inputEnd; nextChannel++)
+        {
+            SmoothChannel(data, region, nextChannel, spatial, tmp, ringPlane(nextChannel));
+        }
+
+        const int64_t inputStart = max<int64_t>(0, s - r);
+        #pragma omp parallel
+        {
+            vector<float> sum(width);
+            vector<float> weightSum(width);
+            #pragma omp for schedule(static)
+            for (int64_t t = 0; t < (e - s) * height; t++)
+            {
+                const int64_t z = s + t / height;
+                const int64_t y = t % height;
+                ConvolveAcrossRows([&ringPlane, y, width](int64_t i) { return ringPlane(i) + y * width; },
+                                   max(inputStart, z - r), min(inputEnd, z + r + 1), z, spectral, width,
+                                   sum.data(), weightSum.data(), sink.Plane(z) + y * width);
+            }
+        }
+        for (int64_t z = s; z < e; z++)
+        {
+            sink.Commit(z);
+        }
+    }
+}
+
+bool ValidRegion(const Region& region)
+{
+    return region.dimX > 0 && region.dimY > 0 && region.dimZ > 0 &&
+           region.x0 >= 0 && region.x0 < region.x1 && region.x1 <= region.dimX &&
+           region.y0 >= 0 && region.y0 < region.y1 && region.y1 <= region.dimY &&
+           region.z0 >= 0 && region.z0 < region.z1 && region.z1 <= region.dimZ;
+}
+
+bool ValidKernels(float spatialFwhm, int spectralKernel)
+{
+    return spatialFwhm >= 0 && spectralKernel >= SPECTRAL_KERNEL_NONE && spectralKernel <= SPECTRAL_KERNEL_HANNING;
+}
+}
+
+/**
+ * @brief Smooths the region [x0, x1) x [y0, y1) x [z0, z1) of a cube into a caller-owned buffer.
+ *
+ * The data around the region (up to the kernel radii) is used as support, so smoothing a region gives the same
+ * result as cropping the smoothed cube. See SmoothCube for the smoothing itself.
+ *
+ * @return int Returns EXIT_SUCCESS on success, or EXIT_FAILURE if the arguments are invalid or the working
+ *         buffers could not be allocated.
+ */
+int SmoothCubeRegion(const float* data, int64_t dimX, int64_t dimY, int64_t dimZ, int64_t x0, int64_t x1, int64_t y0, int64_t y1,
+                     int64_t z0, int64_t z1, float spatialFwhm, int spectralKernel, int spectralWidth, float* output)
+{
+    const Region region = {dimX, dimY, dimZ, x0, x1, y0, y1, z0, z1};
+    if (data == nullptr || output == nullptr || !ValidRegion(region) || !ValidKernels(spatialFwhm, spectralKernel))
+    {
+        return EXIT_FAILURE;
+    }
+    try
+    {
+        FullResolutionSink sink = {output, z0, region.PlaneSize()};
+        SmoothRegion(data, region, GaussianKernel(spatialFwhm), SpectralKernelWeights(spectralKernel, spectralWidth), sink);
+    }
+    catch (const std::bad_alloc&)
+    {
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
+
+/**
+ * @brief Smooths a cube with a spatial Gaussian and a spectral boxcar or Hanning kernel.
+ *
+ * The convolution is separable: rows, columns and spectra are each convolved with a 1D kernel, and each pass
+ * is normalised by the weights of the finite values under the kernel, so that blanked voxels and the cube
+ * edges do not bias the result. Blanked (non-finite) voxels remain NaN. The channels are smoothed in slabs
+ * held in a bounded working buffer, with the passes parallelised over rows.
+ *
+ * @param data Pointer to the cube data, with x varying fastest.
+ * @param smoothedData Output pointer to the smoothed cube, allocated internally with the current cube buffer
+ *        mode. Must be freed with FreeDataAnalysisMemory.
+ * @param dimX The x dimension of the cube.
+ * @param dimY The y dimension of the cube.
+ * @param dimZ The z dimension of the cube.
+ * @param spatialFwhm The FWHM of the spatial Gaussian kernel in pixels (0 for no spatial smoothing).
+ * @param spectralKernel The SpectralKernel used along the z axis.
+ * @param spectralWidth The width of the spectral kernel in channels.
+ * @return int Returns EXIT_SUCCESS on success, or EXIT_FAILURE if the arguments are invalid or memory could not
+ *         be allocated.
+ */
+int SmoothCube(const float* data, float** smoothedData, int64_t dimX, int64_t dimY, int64_t dimZ, float spatialFwhm, int spectralKernel,
+               int spectralWidth)
+{
+    if (smoothedData == nullptr || dimX <= 0 || dimY <= 0 || dimZ <= 0)
+    {
+        return EXIT_FAILURE;
+    }
+    float* smoothed = AllocateCubeBuffer<float>(dimX * dimY * dimZ);
+    if (smoothed == nullptr)
+    {
+        return EXIT_FAILURE;
+    }
+    if (SmoothCubeRegion(data, dimX, dimY, dimZ, 0, dimX, 0, dimY, 0, dimZ, spatialFwhm, spectralKernel, spectralWidth, smoothed) != EXIT_SUCCESS)
+    {
+        if (!ReleaseCubeBuffer(smoothed))
+        {
+            delete[] smoothed;
+        }
+        return EXIT_FAILURE;
+    }
+    *smoothedData = smoothed;
+    return EXIT_SUCCESS;
+}
+
+/**
+ * @brief Smooths, crops and downsamples a cube in a single streaming pass, producing a texture directly.
+ *
+ * Each smoothed channel is pooled into the output as soon as it is produced, so the full-resolution smoothed
+ * cube is never held in memory. Cropping and pooling follow DataCropAndDownsample, while the smoothing
+ * (see SmoothCube) uses the data around the crop region as support.
+ *
+ * @param dataPtr Pointer to the input cube, with x varying fastest.
+ * @param newDataPtr Output pointer to the downsampled cube, allocated internally. Must be freed with
+ *        FreeDataAnalysisMemory.
+ * @param dimX Original X-dimension of the input volume.
+ * @param dimY Original Y-dimension of the input volume.
+ * @param dimZ Original Z-dimension of the input volume.
+ * @param cropX1 First X-coordinate for the cropping region (1-based index).
+ * @param cropY1 First Y-coordinate for the cropping region (1-based index).
+ * @param cropZ1 First Z-coordinate for the cropping region (1-based index).
+ * @param cropX2 Second X-coordinate for the cropping region (1-based index).
+ * @param cropY2 Second Y-coordinate for the cropping region (1-based index).
+ * @param cropZ2 Second Z-coordinate for the cropping region (1-based index).
+ * @param factorX Downsampling factor in the X direction.
+ * @param factorY Downsampling factor in the Y direction.
+ * @param factorZ Downsampling factor in the Z direction.
+ * @param maxDownsampling If true, performs max pooling instead of average pooling.
+ * @param spatialFwhm The FWHM of the spatial Gaussian kernel in pixels (0 for no spatial smoothing).
+ * @param spectralKernel The SpectralKernel used along the z axis.
+ * @param spectralWidth The width of the spectral kernel in channels.
+ * @return int Returns EXIT_SUCCESS on success, or EXIT_FAILURE on invalid input or if memory could not be allocated.
+ */
+int SmoothCropAndDownsample(const float* dataPtr, float** newDataPtr, int64_t dimX, int64_t dimY, int64_t dimZ, int64_t cropX1, int64_t cropY1,
+                            int64_t cropZ1, int64_t cropX2, int64_t cropY2, int64_t cropZ2, int factorX, int factorY, int factorZ,
+                            bool maxDownsampling, float spatialFwhm, int spectralKernel, int spectralWidth)
+{
+    if (cropX1 > dimX || cropX2 > dimX || cropY1 > dimY || cropY2 > dimY || cropZ1 > dimZ || cropZ2 > dimZ || cropX1 < 1 || cropX2 < 1 ||
+        cropY1 < 1 || cropY2 < 1 || cropZ1 < 1 || cropZ2 < 1 || factorX < 1 || factorY < 1 || factorZ < 1)
+    {
+        return EXIT_FAILURE;
+    }
+    const Region region = {dimX, dimY, dimZ, min(cropX1, cropX2) - 1, max(cropX1, cropX2), min(cropY1, cropY2) - 1, max(cropY1, cropY2),
+                           min(cropZ1, cropZ2) - 1, max(cropZ1, cropZ2)};
+    if (dataPtr == nullptr || newDataPtr == nullptr || !ValidKernels(spatialFwhm, spectralKernel))
+    {
+        return EXIT_FAILURE;
+    }
+    const int64_t newDimX = (region.Width() + factorX - 1) / factorX;
+    const int64_t newDimY = (region.Height() + factorY - 1) / factorY;
+    const int64_t newDimZ = (region.z1 - region.z0 + factorZ - 1) / factorZ;
+    float* reducedCube = new (std::nothrow) float[newDimX * newDimY * newDimZ];
+    if (reducedCube == nullptr)
+    {
+        return EXIT_FAILURE;
+    }
+
+    const Kernel spatial = GaussianKernel(spatialFwhm);
+    const Kernel spectral = SpectralKernelWeights(spectralKernel, spectralWidth);
+    try
+    {
+        if (maxDownsampling)
+        {
+            DownsampleSink<true> sink = MakeDownsampleSink<true>(reducedCube, region, factorX, factorY, factorZ);
+            SmoothRegion(dataPtr, region, spatial, spectral, sink);
+        }
+        else
+        {
+            DownsampleSink<false> sink = MakeDownsampleSink<false>(reducedCube, region, factorX, factorY, factorZ);
+            SmoothRegion(dataPtr, region, spatial, spectral, sink);
+        }
+    }
+    catch (const std::bad_alloc&)
+    {
+        delete[] reducedCube;
+        return EXIT_FAILURE;
+    }
+    *newDataPtr = reducedCube;
+    return EXIT_SUCCESS;
+}
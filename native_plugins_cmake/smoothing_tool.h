@@ -0,0 +1,60 @@
+/*
+ * iDaVIE (immersive Data Visualisation Interactive Explorer)
+ * Copyright (C) 2024 Inter-University Institute for Data Intensive Astronomy
+ *
+ * This file is part of the iDaVIE project.
+ *
+ * iDaVIE is free software: you can redistribute it and/or modify it under the terms 
+ * of the GNU Lesser General Public License (LGPL) as published by the Free Software 
+ * Foundation, either version 3 of the License, or (at your option) any later version.
+ *
+ * iDaVIE is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; 
+ * without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR 
+ * PURPOSE. See the GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License along with 
+ * iDaVIE in the LICENSE file. If not, see <https://www.gnu.org/licenses/>.
+ *
+ * Additional information and disclaimers regarding liability and third-party 
+ * components can be found in the DISCLAIMER and NOTICE files included with this project.
+ *
+ */
+#ifndef NATIVE_PLUGINS_SMOOTHING_TOOL_H
+#define NATIVE_PLUGINS_SMOOTHING_TOOL_H
+
+#include <cstdint>
+#include <omp.h>
+
+#define DllExport __declspec (dllexport)
+
+#define EXIT_SUCCESS 0
+#define EXIT_FAILURE 1
+
+// Upper bound on the working buffers of a smoothing pass (spatially smoothed channels and spectral output)
+#define SMOOTHING_BUFFER_BYTES (256LL * 1024 * 1024)
+// Gaussian kernels are truncated at this many standard deviations
+#define SMOOTHING_GAUSSIAN_TRUNCATION 3.0
+
+/**
+ * @brief Spectral smoothing kernels. The kernel width is given in channels and rounded up to an odd number.
+ *
+ * SPECTRAL_KERNEL_BOXCAR weights all channels equally. SPECTRAL_KERNEL_HANNING uses the weights
+ * 0.5 * (1 + cos(2 pi i / (width + 1))), e.g. (0.5, 1, 0.5) for a width of 3.
+ */
+enum SpectralKernel : int32_t
+{
+    SPECTRAL_KERNEL_NONE = 0,
+    SPECTRAL_KERNEL_BOXCAR = 1,
+    SPECTRAL_KERNEL_HANNING = 2
+};
+
+int SmoothCubeRegion(const float*, int64_t, int64_t, int64_t, int64_t, int64_t, int64_t, int64_t, int64_t, int64_t, float, int, int, float*);
+
+extern "C"
+{
+DllExport int SmoothCube(const float*, float**, int64_t, int64_t, int64_t, float, int, int);
+DllExport int SmoothCropAndDownsample(const float*, float**, int64_t, int64_t, int64_t, int64_t, int64_t, int64_t, int64_t, int64_t, int64_t,
+                                      int, int, int, bool, float, int, int);
+}
+
+#endif //NATIVE_PLUGINS_SMOOTHING_TOOL_H
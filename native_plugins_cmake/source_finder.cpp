@@ -0,0 +1,216 @@
+/*
+ * iDaVIE (immersive Data Visualisation Interactive Explorer)
+ * Copyright (C) 2024 Inter-University Institute for Data Intensive Astronomy
+ *
+ * This file is part of the iDaVIE project.
+ *
+ * iDaVIE is free software: you can redistribute it and/or modify it under the terms 
+ * of the GNU Lesser General Public License (LGPL) as published by the Free Software 
+ * Foundation, either version 3 of the License, or (at your option) any later version.
+ *
+ * iDaVIE is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; 
+ * without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR 
+ * PURPOSE. See the GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License along with 
+ * iDaVIE in the LICENSE file. If not, see <https://www.gnu.org/licenses/>.
+ *
+ * Additional information and disclaimers regarding liability and third-party 
+ * components can be found in the DISCLAIMER and NOTICE files included with this project.
+ *
+ */
+#include "source_finder.h"
+#include "labelling_tool.h"
+#include "smoothing_tool.h"
+#include "statistics_tool.h"
+
+#include <algorithm>
+#include <cmath>
+#include <new>
+#include <vector>
+
+using namespace std;
+
+namespace
+{
+struct Box
+{
+    int64_t x0, x1;
+    int64_t y0, y1;
+    int64_t z0, z1;
+
+    int64_t Width() const { return x1 - x0; }
+    int64_t Height() const { return y1 - y0; }
+    int64_t Depth() const { return z1 - z0; }
+    int64_t Size() const { return Width() * Height() * Depth(); }
+};
+
+/**
+ * Returns the largest label of the mask outside the box, so that new labels inside the box do not clash
+ * with existing sources.
+ */
+int16_t MaxLabelOutside(const int16_t* mask, int64_t dimX, int64_t dimY, int64_t dimZ, const Box& box)
+{
+    int16_t maxLabel = 0;
+    #pragma omp parallel
+    {
+        int16_t localMax = 0;
+        #pragma omp for schedule(static)
+        for (int64_t z = 0; z < dimZ; z++)
+        {
+            for (int64_t y = 0; y < dimY; y++)
+            {
+                const int16_t* row = mask + (z * dimY + y) * dimX;
+                const bool rowInBox = y >= box.y0 && y < box.y1 && z >= box.z0 && z < box.z1;
+                for (int64_t x = 0; x < dimX; x++)
+                {
+                    if (!(rowInBox && x >= box.x0 && x < box.x1))
+                    {
+                        localMax = max(localMax, row[x]);
+                    }
+                }
+            }
+        }
+        #pragma omp critical
+        {
+            maxLabel = max(maxLabel, localMax);
+        }
+    }
+    return maxLabel;
+}
+
+/**
+ * Flags the voxels of a smoothed copy of the box that exceed the threshold times the noise RMS, which is
+ * measured either over the whole box or per channel.
+ */
+int FlagDetections(const float* smoothed, const Box& box, float threshold, int noiseMethod, bool perChannelNoise, vector<uint8_t>& detections)
+{
+    const int64_t planeSize = box.Width() * box.Height();
+    vector<float> rms(box.Depth());
+    if (perChannelNoise)
+    {
+        if (GetNoiseSpectrum(smoothed, box.Width(), box.Height(), box.Depth(), noiseMethod, rms.data()) != EXIT_SUCCESS)
+        {
+            return EXIT_FAILURE;
+        }
+    }
+    else
+    {
+        float globalRms;
+        if (GetNoiseEstimate(smoothed, box.Size(), noiseMethod, &globalRms) != EXIT_SUCCESS)
+        {
+            return EXIT_FAILURE;
+        }
+        fill(rms.begin(), rms.end(), globalRms);
+    }
+
+    #pragma omp parallel for schedule(static)
+    for (int64_t z = 0; z < box.Depth(); z++)
+    {
+        // Channels without a noise estimate (entirely blank) cannot hold detections
+        if (!(rms[z] > 0))
+        {
+            continue;
+        }
+        const float cut = threshold * rms[z];
+        const float* plane = smoothed + z * planeSize;
+        uint8_t* flags = detections.data() + z * planeSize;
+        for (int64_t i = 0; i < planeSize; i++)
+        {
+            flags[i] |= plane[i] > cut;
+        }
+    }
+    return EXIT_SUCCESS;
+}
+}
+
+/**
+ * @brief Finds sources in a sub-cube with the smooth-and-clip (S+C) algorithm, and writes them into a mask.
+ *
+ * The sub-cube is smoothed with every combination of the given spatial and spectral kernels (see SmoothCube;
+ * a spatial FWHM of 0 and a spectral width of 1 leave the data unsmoothed). In each smoothed copy, voxels above
+ * @p threshold times the robust noise RMS of that copy are flagged, and the union of the flags is linked into
+ * 26-connected sources. Sources whose bounding box is smaller than the minimum extents are discarded.
+ *
+ * Inside the sub-cube, the mask is overwritten with the new sources, labelled consecutively after the largest
+ * label found elsewhere in the mask. The mask outside the sub-cube is left unchanged.
+ *
+ * @param dataPtr Pointer to the cube data, with x varying fastest.
+ * @param maskDataPtr Pointer to the int16 mask of the cube (same dimensions as the data), updated in place.
+ * @param dimX The x dimension of the cube.
+ * @param dimY The y dimension of the cube.
+ * @param dimZ The z dimension of the cube.
+ * @param x0 First x-coordinate of the sub-cube (0-based).
+ * @param x1 One past the last x-coordinate of the sub-cube.
+ * @param y0 First y-coordinate of the sub-cube (0-based).
+ * @param y1 One past the last y-coordinate of the sub-cube.
+ * @param z0 First z-coordinate of the sub-cube (0-based).
+ * @param z1 One past the last z-coordinate of the sub-cube.
+ * @param spatialFwhms Array of spatial Gaussian FWHMs, in pixels.
+ * @param numSpatialKernels Number of spatial kernels.
+ * @param spectralWidths Array of spectral kernel widths, in channels.
+ * @param numSpectralKernels Number of spectral kernels.
+ * @param spectralKernel The SpectralKernel type of the spectral kernels.
+ * @param threshold The detection threshold, in units of the noise RMS.
+ * @param noiseMethod The NoiseMethod used to measure the noise of each smoothed copy.
+ * @param perChannelNoise If true, the noise is measured per channel instead of over the whole sub-cube.
+ * @param minSizeX Minimum x extent of a source, in pixels.
+ * @param minSizeY Minimum y extent of a source, in pixels.
+ * @param minSizeZ Minimum z extent of a source, in channels.
+ * @param sourceCount Output pointer to the number of sources found.
+ * @param sources Output pointer to an array of `SourceInfo` structures in cube coordinates (allocated internally).
+ *                Must be freed with FreeDataAnalysisMemory.
+ * @return int Returns EXIT_SUCCESS on success, or EXIT_FAILURE if the arguments are invalid, memory could not be
+ *         allocated, or more sources were found than fit into the int16 label range (in which case the mask is
+ *         left unchanged).
+ */
+int FindSourcesSmoothAndClip(const float* dataPtr, int16_t* maskDataPtr, int64_t dimX, int64_t dimY, int64_t dimZ, int64_t x0, int64_t x1,
+                             int64_t y0, int64_t y1, int64_t z0, int64_t z1, const float* spatialFwhms, int numSpatialKernels,
+                             const int* spectralWidths, int numSpectralKernels, int spectralKernel, float threshold, int noiseMethod,
+                             bool perChannelNoise, int64_t minSizeX, int64_t minSizeY, int64_t minSizeZ, int* sourceCount, SourceInfo** sources)
+{
+    const Box box = {x0, x1, y0, y1, z0, z1};
+    if (dataPtr == nullptr || maskDataPtr == nullptr || sourceCount == nullptr || sources == nullptr || spatialFwhms == nullptr ||
+        spectralWidths == nullptr || numSpatialKernels < 1 || numSpectralKernels < 1 || !(threshold > 0) ||
+        x0 < 0 || x1 > dimX || x0 >= x1 || y0 < 0 || y1 > dimY || y0 >= y1 || z0 < 0 || z1 > dimZ || z0 >= z1)
+    {
+        return EXIT_FAILURE;
+    }
+
+    vector<SourceInfo> found;
+    try
+    {
+        vector<float> smoothed(box.Size());
+        vector<uint8_t> detections(box.Size(), 0);
+        for (int s = 0; s < numSpatialKernels; s++)
+        {
+            for (int k = 0; k < numSpectralKernels; k++)
+            {
+                if (SmoothCubeRegion(dataPtr, dimX, dimY, dimZ, x0, x1, y0, y1, z0, z1, spatialFwhms[s], spectralKernel, spectralWidths[k],
+                                     smoothed.data()) != EXIT_SUCCESS ||
+                    FlagDetections(smoothed.data(), box, threshold, noiseMethod, perChannelNoise, detections) != EXIT_SUCCESS)
+                {
+                    return EXIT_FAILURE;
+                }
+            }
+        }
+        smoothed = vector<float>();
+
+        const int16_t firstLabel = MaxLabelOutside(maskDataPtr, dimX, dimY, dimZ, box);
+        const ComponentFilter filter = {0, {minSizeX, minSizeY, minSizeZ}};
+        const LabelOutput output = {maskDataPtr, dimX, dimY, x0, y0, z0};
+        if (LabelBinaryComponents(detections.data(), box.Width(), box.Height(), box.Depth(), 26, filter, firstLabel, output, found) != EXIT_SUCCESS)
+        {
+            return EXIT_FAILURE;
+        }
+    }
+    catch (const std::bad_alloc&)
+    {
+        return EXIT_FAILURE;
+    }
+
+    *sourceCount = (int) found.size();
+    *sources = new SourceInfo[found.size()];
+    copy(found.begin(), found.end(), *sources);
+    return EXIT_SUCCESS;
+}
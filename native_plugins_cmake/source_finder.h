@@ -19,16 +19,23 @@
  * components can be found in the DISCLAIMER and NOTICE files included with this project.
  *
  */
-// ZScale algorithm, adapted from Client Display Library (CDL) source code (Mike Fitzpatrick NOAO/IRAF Project)
+#ifndef NATIVE_PLUGINS_SOURCE_FINDER_H
+#define NATIVE_PLUGINS_SOURCE_FINDER_H
 
-#define INDEF -999
+#include <cstdint>
+#include <omp.h>
 
-void cdl_zscale(unsigned char* im, /* image data to be sampled		*/
-                int nx, int ny,    /* image dimensions			*/
-                int bitpix,        /* bits per pixel			*/
-                float* z1,
-                float* z2,      /* output min and max greyscale values	*/
-                float contrast, /* adj. to slope of transfer function	*/
-                int opt_size,   /* desired number of pixels in sample	*/
-                int len_stdline /* optimal number of pixels per line	*/
-);
+#include "data_analysis_tool.h"
+
+#define DllExport __declspec (dllexport)
+
+#define EXIT_SUCCESS 0
+#define EXIT_FAILURE 1
+
+extern "C"
+{
+DllExport int FindSourcesSmoothAndClip(const float*, int16_t*, int64_t, int64_t, int64_t, int64_t, int64_t, int64_t, int64_t, int64_t, int64_t,
+                                       const float*, int, const int*, int, int, float, int, bool, int64_t, int64_t, int64_t, int*, SourceInfo**);
+}
+
+#endif //NATIVE_PLUGINS_SOURCE_FINDER_H
@@ -0,0 +1,723 @@
+/*
+ * iDaVIE (immersive Data Visualisation Interactive Explorer)
+ * Copyright (C) 2024 Inter-University Institute for Data Intensive Astronomy
+ *
+ * This file is part of the iDaVIE project.
+ *
+ * iDaVIE is free software: you can redistribute it and/or modify it under the terms 
+ * of the GNU Lesser General Public License (LGPL) as published by the Free Software 
+ * Foundation, either version 3 of the License, or (at your option) any later version.
+ *
+ * iDaVIE is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; 
+ * without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR 
+ * PURPOSE. See the GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License along with 
+ * iDaVIE in the LICENSE file. If not, see <https://www.gnu.org/licenses/>.
+ *
+ * Additional information and disclaimers regarding liability and third-party 
+ * components can be found in the DISCLAIMER and NOTICE files included with this project.
+ *
+ */
+#include "sparse_mask.h"
+
+#include <algorithm>
+#include <cstring>
+#include <new>
+#include <unordered_map>
+
+using namespace std;
+
+namespace
+{
+/**
+ * @brief Re-encodes a brick from its dense voxels. Bricks without non-zero voxels are released, and bricks whose
+ * runs take less memory than the dense voxels are converted to runs. The label list is rebuilt exactly.
+ */
+void EncodeBrick(const int16_t* voxels, unique_ptr<SparseMaskBrick>& brick)
+{
+    vector<SparseMaskRun> runs;
+    vector<int16_t> labels;
+    int32_t offset = 0;
+    while (offset < SPARSE_MASK_BRICK_VOXELS)
+    {
+        int16_t value = voxels[offset];
+        int32_t end = offset + 1;
+        while (end < SPARSE_MASK_BRICK_VOXELS && voxels[end] == value)
+        {
+            end++;
+        }
+        if (value)
+        {
+            runs.push_back({(uint16_t) offset, (uint16_t) (end - offset), value});
+            labels.push_back(value);
+        }
+        offset = end;
+    }
+
+    if (runs.empty())
+    {
+        brick.reset();
+        return;
+    }
+
+    sort(labels.begin(), labels.end());
+    labels.erase(unique(labels.begin(), labels.end()), labels.end());
+
+    if (!brick)
+    {
+        brick = make_unique<SparseMaskBrick>();
+    }
+    if (runs.size() * sizeof(SparseMaskRun) < SPARSE_MASK_BRICK_VOXELS * sizeof(int16_t))
+    {
+        brick->runs = move(runs);
+        vector<int16_t>().swap(brick->voxels);
+    }
+    else
+    {
+        if (brick->voxels.data() != voxels)
+        {
+            brick->voxels.assign(voxels, voxels + SPARSE_MASK_BRICK_VOXELS);
+        }
+        vector<SparseMaskRun>().swap(brick->runs);
+    }
+    labels.shrink_to_fit();
+    brick->labels = move(labels);
+    brick->runs.shrink_to_fit();
+}
+
+void ExpandSource(SourceInfo& source, int64_t x0, int64_t x1, int64_t y, int64_t z)
+{
+    source.minX = min(source.minX, x0);
+    source.maxX = max(source.maxX, x1);
+    source.minY = min(source.minY, y);
+    source.maxY = max(source.maxY, y);
+    source.minZ = min(source.minZ, z);
+    source.maxZ = max(source.maxZ, z);
+}
+
+/**
+ * @brief Calls visit(x0, x1, y, z, value) for every row segment of non-zero voxels in the brick (inclusive x range,
+ * cube coordinates). Padding voxels beyond the cube edge are always zero, so no clipping is needed.
+ */
+template<typename Visitor>
+void ForEachSegment(const SparseMask& mask, int64_t brickIndex, Visitor visit)
+{
+    const SparseMaskBrick& brick = *mask.bricks[brickIndex];
+    int64_t bx = (brickIndex % mask.bricksX) << SPARSE_MASK_BRICK_SHIFT;
+    int64_t by = ((brickIndex / mask.bricksX) % mask.bricksY) << SPARSE_MASK_BRICK_SHIFT;
+    int64_t bz = (brickIndex / (mask.bricksX * mask.bricksY)) << SPARSE_MASK_BRICK_SHIFT;
+    auto emit = [&](int32_t offset, int32_t length, int16_t value) {
+        while (length > 0)
+        {
+            int32_t lx = offset & (SPARSE_MASK_BRICK_SIZE - 1);
+            int32_t ly = (offset >> SPARSE_MASK_BRICK_SHIFT) & (SPARSE_MASK_BRICK_SIZE - 1);
+            int32_t lz = offset >> (2 * SPARSE_MASK_BRICK_SHIFT);
+            int32_t count = min(length, SPARSE_MASK_BRICK_SIZE - lx);
+            visit(bx + lx, bx + lx + count - 1, by + ly, bz + lz, value);
+            offset += count;
+            length -= count;
+        }
+    };
+
+    if (brick.voxels.empty())
+    {
+        for (const auto& run : brick.runs)
+        {
+            emit(run.start, run.length, run.value);
+        }
+        return;
+    }
+    int32_t offset = 0;
+    while (offset < SPARSE_MASK_BRICK_VOXELS)
+    {
+        int16_t value = brick.voxels[offset];
+        int32_t end = offset + 1;
+        while (end < SPARSE_MASK_BRICK_VOXELS && brick.voxels[end] == value)
+        {
+            end++;
+        }
+        if (value)
+        {
+            emit(offset, end - offset, value);
+        }
+        offset = end;
+    }
+}
+}
+
+int16_t SparseMaskBrick::Get(int32_t offset) const
+{
+    if (!voxels.empty())
+    {
+        return voxels[offset];
+    }
+    auto it = upper_bound(runs.begin(), runs.end(), offset, [](int32_t o, const SparseMaskRun& run) { return o < run.start; });
+    if (it == runs.begin())
+    {
+        return 0;
+    }
+    --it;
+    return (offset < it->start + it->length) ? it->value : 0;
+}
+
+void SparseMaskBrick::Decode(int32_t offset, int32_t count, int16_t* output) const
+{
+    if (!voxels.empty())
+    {
+        memcpy(output, voxels.data() + offset, count * sizeof(int16_t));
+        return;
+    }
+    fill(output, output + count, (int16_t) 0);
+    int32_t end = offset + count;
+    auto it = upper_bound(runs.begin(), runs.end(), offset, [](int32_t o, const SparseMaskRun& run) { return o < run.start; });
+    if (it != runs.begin())
+    {
+        --it;
+    }
+    for (; it != runs.end() && it->start < end; ++it)
+    {
+        int32_t first = max<int32_t>(it->start, offset);
+        int32_t last = min<int32_t>(it->start + it->length, end);
+        if (first < last)
+        {
+            fill(output + (first - offset), output + (last - offset), it->value);
+        }
+    }
+}
+
+SparseMask::SparseMask(int64_t dimX, int64_t dimY, int64_t dimZ)
+    : dimX(dimX), dimY(dimY), dimZ(dimZ),
+      bricksX((dimX + SPARSE_MASK_BRICK_SIZE - 1) >> SPARSE_MASK_BRICK_SHIFT),
+      bricksY((dimY + SPARSE_MASK_BRICK_SIZE - 1) >> SPARSE_MASK_BRICK_SHIFT),
+      bricksZ((dimZ + SPARSE_MASK_BRICK_SIZE - 1) >> SPARSE_MASK_BRICK_SHIFT),
+      bricks(bricksX * bricksY * bricksZ)
+{
+}
+
+int16_t SparseMask::Get(int64_t x, int64_t y, int64_t z) const
+{
+    const auto& brick = bricks[BrickIndex(x, y, z)];
+    return brick ? brick->Get(BrickOffset(x, y, z)) : 0;
+}
+
+void SparseMask::Set(int64_t x, int64_t y, int64_t z, int16_t value)
+{
+    auto& brick = bricks[BrickIndex(x, y, z)];
+    if (!brick)
+    {
+        if (!value)
+        {
+            return;
+        }
+        brick = make_unique<SparseMaskBrick>();
+        brick->voxels.assign(SPARSE_MASK_BRICK_VOXELS, 0);
+    }
+    else if (brick->voxels.empty())
+    {
+        // Run-length encoded bricks are expanded on their first edit and re-encoded by Compact
+        vector<int16_t> voxels(SPARSE_MASK_BRICK_VOXELS);
+        brick->Decode(0, SPARSE_MASK_BRICK_VOXELS, voxels.data());
+        brick->voxels = move(voxels);
+        vector<SparseMaskRun>().swap(brick->runs);
+    }
+    brick->voxels[BrickOffset(x, y, z)] = value;
+    if (value)
+    {
+        auto it = lower_bound(brick->labels.begin(), brick->labels.end(), value);
+        if (it == brick->labels.end() || *it != value)
+        {
+            brick->labels.insert(it, value);
+        }
+    }
+}
+
+void SparseMask::ReadRow(int64_t y, int64_t z, int64_t x0, int64_t x1, int16_t* output) const
+{
+    int64_t x = x0;
+    while (x < x1)
+    {
+        int64_t brickEnd = min(((x >> SPARSE_MASK_BRICK_SHIFT) + 1) << SPARSE_MASK_BRICK_SHIFT, x1);
+        const auto& brick = bricks[BrickIndex(x, y, z)];
+        if (brick)
+        {
+            brick->Decode(BrickOffset(x, y, z), (int32_t) (brickEnd - x), output + (x - x0));
+        }
+        else
+        {
+            fill(output + (x - x0), output + (brickEnd - x0), (int16_t) 0);
+        }
+        x = brickEnd;
+    }
+}
+
+void SparseMask::Compact()
+{
+    int64_t numBricks = bricks.size();
+#pragma omp parallel for schedule(dynamic, 64)
+    for (int64_t i = 0; i < numBricks; i++)
+    {
+        auto& brick = bricks[i];
+        if (brick && !brick->voxels.empty())
+        {
+            EncodeBrick(brick->voxels.data(), brick);
+        }
+    }
+}
+
+int64_t SparseMask::MemoryUsage() const
+{
+    int64_t bytes = sizeof(SparseMask) + bricks.capacity() * sizeof(bricks[0]);
+    for (const auto& brick : bricks)
+    {
+        if (brick)
+        {
+            bytes += sizeof(SparseMaskBrick) + brick->voxels.capacity() * sizeof(int16_t)
+                + brick->runs.capacity() * sizeof(SparseMaskRun) + brick->labels.capacity() * sizeof(int16_t);
+        }
+    }
+    return bytes;
+}
+
+vector<int64_t> SparseMask::BricksWithLabel(int16_t label) const
+{
+    vector<int64_t> result;
+    for (int64_t i = 0; i < (int64_t) bricks.size(); i++)
+    {
+        const auto& brick = bricks[i];
+        if (brick && binary_search(brick->labels.begin(), brick->labels.end(), label))
+        {
+            result.push_back(i);
+        }
+    }
+    return result;
+}
+
+/**
+ * @brief Creates an empty sparse mask. Unlike CreateEmptyImageInt16, no voxel storage is allocated until voxels are set.
+ *
+ * @param dimX, dimY, dimZ Dimensions of the mask
+ * @param result Output pointer to the new mask, to be released with FreeSparseMask
+ * @return EXIT_SUCCESS, or EXIT_FAILURE if the dimensions are invalid or memory could not be allocated
+ */
+int CreateSparseMask(int64_t dimX, int64_t dimY, int64_t dimZ, SparseMask** result)
+{
+    if (!result || dimX < 1 || dimY < 1 || dimZ < 1)
+    {
+        return EXIT_FAILURE;
+    }
+    try
+    {
+        *result = new SparseMask(dimX, dimY, dimZ);
+    }
+    catch (const bad_alloc&)
+    {
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
+
+/**
+ * @brief Converts a dense int16 mask into a compacted sparse mask. Bricks are encoded in parallel.
+ *
+ * @param maskDataPtr Dense mask of size dimX * dimY * dimZ
+ * @param dimX, dimY, dimZ Dimensions of the mask
+ * @param result Output pointer to the new mask, to be released with FreeSparseMask
+ * @return EXIT_SUCCESS, or EXIT_FAILURE if the inputs are invalid or memory could not be allocated
+ */
+int CreateSparseMaskFromDense(const int16_t* maskDataPtr, int64_t dimX, int64_t dimY, int64_t dimZ, SparseMask** result)
+{
+    if (!maskDataPtr || CreateSparseMask(dimX, dimY, dimZ, result) != EXIT_SUCCESS)
+    {
+        return EXIT_FAILURE;
+    }
+    SparseMask* mask = *result;
+    int64_t numBricks = mask->bricks.size();
+    bool failed = false;
+#pragma omp parallel
+    {
+        vector<int16_t> scratch(SPARSE_MASK_BRICK_VOXELS);
+#pragma omp for schedule(dynamic, 16)
+        for (int64_t i = 0; i < numBricks; i++)
+        {
+            int64_t bx = (i % mask->bricksX) << SPARSE_MASK_BRICK_SHIFT;
+            int64_t by = ((i / mask->bricksX) % mask->bricksY) << SPARSE_MASK_BRICK_SHIFT;
+            int64_t bz = (i / (mask->bricksX * mask->bricksY)) << SPARSE_MASK_BRICK_SHIFT;
+            int64_t countX = min<int64_t>(SPARSE_MASK_BRICK_SIZE, dimX - bx);
+            int64_t countY = min<int64_t>(SPARSE_MASK_BRICK_SIZE, dimY - by);
+            int64_t countZ = min<int64_t>(SPARSE_MASK_BRICK_SIZE, dimZ - bz);
+
+            bool occupied = false;
+            fill(scratch.begin(), scratch.end(), (int16_t) 0);
+            for (int64_t lz = 0; lz < countZ; lz++)
+            {
+                for (int64_t ly = 0; ly < countY; ly++)
+                {
+                    const int16_t* row = maskDataPtr + ((bz + lz) * dimY + by + ly) * dimX + bx;
+                    int16_t* out = scratch.data() + ((lz << SPARSE_MASK_BRICK_SHIFT) + ly) * SPARSE_MASK_BRICK_SIZE;
+                    for (int64_t lx = 0; lx < countX; lx++)
+                    {
+                        out[lx] = row[lx];
+                        occupied |= (row[lx] != 0);
+                    }
+                }
+            }
+            if (occupied)
+            {
+                try
+                {
+                    EncodeBrick(scratch.data(), mask->bricks[i]);
+                }
+                catch (const bad_alloc&)
+                {
+#pragma omp critical
+                    failed = true;
+                }
+            }
+        }
+    }
+    if (failed)
+    {
+        delete mask;
+        *result = nullptr;
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
+
+/**
+ * @brief Releases a sparse mask created by CreateSparseMask or CreateSparseMaskFromDense.
+ */
+int FreeSparseMask(SparseMask* mask)
+{
+    delete mask;
+    return EXIT_SUCCESS;
+}
+
+/**
+ * @brief Reads a single voxel (0-based coordinates) of a sparse mask.
+ */
+int GetSparseMaskVoxel(const SparseMask* mask, int64_t x, int64_t y, int64_t z, int16_t* value)
+{
+    if (!mask || !value || x < 0 || y < 0 || z < 0 || x >= mask->dimX || y >= mask->dimY || z >= mask->dimZ)
+    {
+        return EXIT_FAILURE;
+    }
+    *value = mask->Get(x, y, z);
+    return EXIT_SUCCESS;
+}
+
+/**
+ * @brief Writes a single voxel (0-based coordinates) of a sparse mask. The touched brick stays dense until
+ * CompactSparseMask is called, so a painting session should be followed by a compaction.
+ */
+int SetSparseMaskVoxel(SparseMask* mask, int64_t x, int64_t y, int64_t z, int16_t value)
+{
+    if (!mask || x < 0 || y < 0 || z < 0 || x >= mask->dimX || y >= mask->dimY || z >= mask->dimZ)
+    {
+        return EXIT_FAILURE;
+    }
+    try
+    {
+        mask->Set(x, y, z, value);
+    }
+    catch (const bad_alloc&)
+    {
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
+
+/**
+ * @brief Re-encodes all edited bricks, releasing bricks that no longer contain any masked voxels.
+ */
+int CompactSparseMask(SparseMask* mask)
+{
+    if (!mask)
+    {
+        return EXIT_FAILURE;
+    }
+    try
+    {
+        mask->Compact();
+    }
+    catch (const bad_alloc&)
+    {
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
+
+/**
+ * @brief Reports the memory held by a sparse mask.
+ *
+ * @param mask The sparse mask
+ * @param memoryBytes Output for the total number of bytes held by the mask
+ * @param occupiedBricks Output for the number of bricks with storage (may be nullptr)
+ * @param encodedBricks Output for the number of run-length encoded bricks (may be nullptr)
+ * @return EXIT_SUCCESS, or EXIT_FAILURE if the mask or memoryBytes is null
+ */
+int GetSparseMaskInfo(const SparseMask* mask, int64_t* memoryBytes, int64_t* occupiedBricks, int64_t* encodedBricks)
+{
+    if (!mask || !memoryBytes)
+    {
+        return EXIT_FAILURE;
+    }
+    *memoryBytes = mask->MemoryUsage();
+    int64_t occupied = 0;
+    int64_t encoded = 0;
+    for (const auto& brick : mask->bricks)
+    {
+        if (brick)
+        {
+            occupied++;
+            if (brick->voxels.empty())
+            {
+                encoded++;
+            }
+        }
+    }
+    if (occupiedBricks)
+    {
+        *occupiedBricks = occupied;
+    }
+    if (encodedBricks)
+    {
+        *encodedBricks = encoded;
+    }
+    return EXIT_SUCCESS;
+}
+
+/**
+ * @brief Decodes a box of a sparse mask into a caller-owned dense buffer, e.g. for texture uploads or for
+ * consumers that still expect a dense mask.
+ *
+ * @param mask The sparse mask
+ * @param x0, x1, y0, y1, z0, z1 Box to decode (0-based, half-open)
+ * @param output Buffer of (x1 - x0) * (y1 - y0) * (z1 - z0) values, filled in X-Y-Z order
+ * @return EXIT_SUCCESS, or EXIT_FAILURE if the box is invalid
+ */
+int SparseMaskToDense(const SparseMask* mask, int64_t x0, int64_t x1, int64_t y0, int64_t y1, int64_t z0, int64_t z1, int16_t* output)
+{
+    if (!mask || !output || x0 < 0 || y0 < 0 || z0 < 0 || x1 > mask->dimX || y1 > mask->dimY || z1 > mask->dimZ
+        || x0 >= x1 || y0 >= y1 || z0 >= z1)
+    {
+        return EXIT_FAILURE;
+    }
+    int64_t width = x1 - x0;
+    int64_t height = y1 - y0;
+#pragma omp parallel for
+    for (int64_t z = z0; z < z1; z++)
+    {
+        for (int64_t y = y0; y < y1; y++)
+        {
+            mask->ReadRow(y, z, x0, x1, output + ((z - z0) * height + (y - y0)) * width);
+        }
+    }
+    return EXIT_SUCCESS;
+}
+
+/**
+ * @brief Sparse counterpart of GetMaskedSources. Only occupied bricks are visited, in parallel.
+ *
+ * @param mask The sparse mask
+ * @param maskCount Output for the number of sources
+ * @param results Output array of source bounding boxes, to be freed with FreeDataAnalysisMemory
+ * @return EXIT_SUCCESS, or EXIT_FAILURE on invalid input or allocation failure
+ */
+int GetSparseMaskSources(const SparseMask* mask, int* maskCount, SourceInfo** results)
+{
+    if (!mask || !maskCount || !results)
+    {
+        return EXIT_FAILURE;
+    }
+    try
+    {
+        unordered_map<int16_t, SourceInfo> sourceMap;
+        int64_t numBricks = mask->bricks.size();
+#pragma omp parallel
+        {
+            unordered_map<int16_t, SourceInfo> localMap;
+#pragma omp for schedule(dynamic, 64)
+            for (int64_t i = 0; i < numBricks; i++)
+            {
+                if (!mask->bricks[i])
+                {
+                    continue;
+                }
+                ForEachSegment(*mask, i, [&](int64_t x0, int64_t x1, int64_t y, int64_t z, int16_t value) {
+                    auto it = localMap.find(value);
+                    if (it == localMap.end())
+                    {
+                        SourceInfo& source = localMap[value];
+                        source.minX = x0;
+                        source.maxX = x1;
+                        source.minY = y;
+                        source.maxY = y;
+                        source.minZ = z;
+                        source.maxZ = z;
+                        source.maskVal = value;
+                    }
+                    else
+                    {
+                        ExpandSource(it->second, x0, x1, y, z);
+                    }
+                });
+            }
+#pragma omp critical
+            {
+                for (const auto& [value, local] : localMap)
+                {
+                    auto it = sourceMap.find(value);
+                    if (it == sourceMap.end())
+                    {
+                        sourceMap[value] = local;
+                    }
+                    else
+                    {
+                        ExpandSource(it->second, local.minX, local.maxX, local.minY, local.minZ);
+                        ExpandSource(it->second, local.minX, local.maxX, local.maxY, local.maxZ);
+                    }
+                }
+            }
+        }
+
+        vector<SourceInfo> sorted;
+        sorted.reserve(sourceMap.size());
+        for (const auto& [value, source] : sourceMap)
+        {
+            sorted.push_back(source);
+        }
+        sort(sorted.begin(), sorted.end(), [](const SourceInfo& a, const SourceInfo& b) { return a.maskVal < b.maskVal; });
+        SourceInfo* sources = new SourceInfo[sorted.size()];
+        copy(sorted.begin(), sorted.end(), sources);
+        *maskCount = sorted.size();
+        *results = sources;
+    }
+    catch (const bad_alloc&)
+    {
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
+
+/**
+ * @brief Lists the voxels carrying a given label, visiting only the bricks that contain it.
+ *
+ * @param mask The sparse mask
+ * @param label The non-zero label to list
+ * @param count Output for the number of voxels
+ * @param indices Output array of linear voxel indices (x + dimX * (y + dimY * z)) in ascending order, to be freed
+ *                with FreeDataAnalysisMemory
+ * @return EXIT_SUCCESS, or EXIT_FAILURE on invalid input or allocation failure
+ */
+int GetSparseMaskLabelVoxels(const SparseMask* mask, int16_t label, int64_t* count, int64_t** indices)
+{
+    if (!mask || !label || !count || !indices)
+    {
+        return EXIT_FAILURE;
+    }
+    try
+    {
+        vector<int64_t> voxels;
+        for (int64_t brickIndex : mask->BricksWithLabel(label))
+        {
+            ForEachSegment(*mask, brickIndex, [&](int64_t x0, int64_t x1, int64_t y, int64_t z, int16_t value) {
+                if (value != label)
+                {
+                    return;
+                }
+                int64_t rowIndex = (z * mask->dimY + y) * mask->dimX;
+                for (int64_t x = x0; x <= x1; x++)
+                {
+                    voxels.push_back(rowIndex + x);
+                }
+            });
+        }
+        sort(voxels.begin(), voxels.end());
+        int64_t* result = new int64_t[voxels.size()];
+        copy(voxels.begin(), voxels.end(), result);
+        *count = voxels.size();
+        *indices = result;
+    }
+    catch (const bad_alloc&)
+    {
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
+
+/**
+ * @brief Sparse counterpart of GetSourceStats, with the same outputs. The mask is decoded one row of the
+ * source's bounding box at a time.
+ */
+int GetSparseSourceStats(const float* dataPtr, const SparseMask* mask, SourceInfo source, SourceStats* stats, AstFrameSet* frameSetPtr)
+{
+    if (!dataPtr || !mask)
+    {
+        return EXIT_FAILURE;
+    }
+    SparseMaskReader reader = {mask};
+    try
+    {
+        return ComputeSourceStats(dataPtr, reader, mask->dimX, mask->dimY, mask->dimZ, source, stats, frameSetPtr);
+    }
+    catch (const bad_alloc&)
+    {
+        return EXIT_FAILURE;
+    }
+}
+
+/**
+ * @brief Sparse counterpart of MaskCropAndDownsample, with the same (1-based, inclusive) crop conventions.
+ * The output is a dense array, to be freed with FreeDataAnalysisMemory.
+ */
+int SparseMaskCropAndDownsample(const SparseMask* mask, int16_t** newDataPtr, int64_t cropX1, int64_t cropY1, int64_t cropZ1,
+    int64_t cropX2, int64_t cropY2, int64_t cropZ2, int factorX, int factorY, int factorZ)
+{
+    if (!mask || !newDataPtr)
+    {
+        return EXIT_FAILURE;
+    }
+    SparseMaskReader reader = {mask};
+    try
+    {
+        return ComputeMaskCropAndDownsample(reader, newDataPtr, mask->dimX, mask->dimY, mask->dimZ,
+            cropX1, cropY1, cropZ1, cropX2, cropY2, cropZ2, factorX, factorY, factorZ);
+    }
+    catch (const bad_alloc&)
+    {
+        return EXIT_FAILURE;
+    }
+}
+
+/**
+ * @brief Writes a sparse mask into an open int16 FITS image, one channel at a time, so that the dense mask is
+ * never materialised. This is the sparse counterpart of FitsWriteSubImageInt16.
+ *
+ * @param fptr The fitsfile being written to
+ * @param mask The sparse mask
+ * @param fPix The first pixel (1-based, xyz) of the image region covered by the mask
+ * @param status Value containing outcome of CFITSIO operation
+ * @return int The result code, 0 for success, a CFITSIO error code if not
+ */
+int SparseMaskWriteFits(fitsfile* fptr, const SparseMask* mask, long* fPix, int* status)
+{
+    if (!mask || !fPix)
+    {
+        return EXIT_FAILURE;
+    }
+    vector<int16_t> plane(mask->dimX * mask->dimY);
+    for (int64_t z = 0; z < mask->dimZ && *status == 0; z++)
+    {
+#pragma omp parallel for
+        for (int64_t y = 0; y < mask->dimY; y++)
+        {
+            mask->ReadRow(y, z, 0, mask->dimX, plane.data() + y * mask->dimX);
+        }
+        long firstPix[3] = {fPix[0], fPix[1], fPix[2] + (long) z};
+        long lastPix[3] = {fPix[0] + (long) mask->dimX - 1, fPix[1] + (long) mask->dimY - 1, fPix[2] + (long) z};
+        fits_write_subset(fptr, TSHORT, firstPix, lastPix, plane.data(), status);
+    }
+    return *status;
+}
@@ -0,0 +1,136 @@
+/*
+ * iDaVIE (immersive Data Visualisation Interactive Explorer)
+ * Copyright (C) 2024 Inter-University Institute for Data Intensive Astronomy
+ *
+ * This file is part of the iDaVIE project.
+ *
+ * iDaVIE is free software: you can redistribute it and/or modify it under the terms 
+ * of the GNU Lesser General Public License (LGPL) as published by the Free Software 
+ * Foundation, either version 3 of the License, or (at your option) any later version.
+ *
+ * iDaVIE is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; 
+ * without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR 
+ * PURPOSE. See the GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License along with 
+ * iDaVIE in the LICENSE file. If not, see <https://www.gnu.org/licenses/>.
+ *
+ * Additional information and disclaimers regarding liability and third-party 
+ * components can be found in the DISCLAIMER and NOTICE files included with this project.
+ *
+ */
+#ifndef NATIVE_PLUGINS_SPARSE_MASK_H
+#define NATIVE_PLUGINS_SPARSE_MASK_H
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+#include <omp.h>
+#include <fitsio.h>
+
+#include "data_analysis_tool.h"
+
+#define DllExport __declspec (dllexport)
+
+#define EXIT_SUCCESS 0
+#define EXIT_FAILURE 1
+
+// Bricks are cubes of 2^SPARSE_MASK_BRICK_SHIFT voxels along each axis
+#define SPARSE_MASK_BRICK_SHIFT 5
+#define SPARSE_MASK_BRICK_SIZE (1 << SPARSE_MASK_BRICK_SHIFT)
+#define SPARSE_MASK_BRICK_VOXELS (SPARSE_MASK_BRICK_SIZE * SPARSE_MASK_BRICK_SIZE * SPARSE_MASK_BRICK_SIZE)
+
+/**
+ * @brief A run of identical non-zero mask values inside a brick, indexed in the brick's X-Y-Z order.
+ */
+struct SparseMaskRun
+{
+    uint16_t start;
+    uint16_t length;
+    int16_t value;
+};
+
+/**
+ * @brief A single brick of a sparse mask. A brick is either dense (voxels holds all SPARSE_MASK_BRICK_VOXELS
+ * values) or run-length encoded (voxels is empty and runs holds the non-zero runs in ascending order).
+ * Bricks that only contain zeros are not stored at all.
+ */
+struct SparseMaskBrick
+{
+    std::vector<int16_t> voxels;
+    std::vector<SparseMaskRun> runs;
+    std::vector<int16_t> labels;    /**< Sorted labels that may occur in the brick (exact after compaction) */
+
+    int16_t Get(int32_t offset) const;
+    void Decode(int32_t offset, int32_t count, int16_t* output) const;
+};
+
+/**
+ * @brief Bricked int16 mask whose memory scales with the number of masked voxels rather than the cube size.
+ *
+ * Voxels are written to dense bricks, which CompactSparseMask re-encodes as runs (or drops entirely) once
+ * editing is done. Reads are safe from multiple threads; writes are not.
+ */
+struct SparseMask
+{
+    int64_t dimX, dimY, dimZ;
+    int64_t bricksX, bricksY, bricksZ;
+    std::vector<std::unique_ptr<SparseMaskBrick>> bricks;
+
+    SparseMask(int64_t dimX, int64_t dimY, int64_t dimZ);
+
+    int64_t BrickIndex(int64_t x, int64_t y, int64_t z) const
+    {
+        return ((z >> SPARSE_MASK_BRICK_SHIFT) * bricksY + (y >> SPARSE_MASK_BRICK_SHIFT)) * bricksX + (x >> SPARSE_MASK_BRICK_SHIFT);
+    }
+    static int32_t BrickOffset(int64_t x, int64_t y, int64_t z)
+    {
+        const int64_t m = SPARSE_MASK_BRICK_SIZE - 1;
+        return (int32_t) ((((z & m) << SPARSE_MASK_BRICK_SHIFT) + (y & m)) << SPARSE_MASK_BRICK_SHIFT) + (int32_t) (x & m);
+    }
+
+    int16_t Get(int64_t x, int64_t y, int64_t z) const;
+    void Set(int64_t x, int64_t y, int64_t z, int16_t value);
+    void ReadRow(int64_t y, int64_t z, int64_t x0, int64_t x1, int16_t* output) const;
+    void Compact();
+    int64_t MemoryUsage() const;
+    std::vector<int64_t> BricksWithLabel(int16_t label) const;
+};
+
+/**
+ * @brief Mask reader adaptor used by the source statistics and downsampling kernels for sparse masks.
+ * Rows are decoded into the caller's scratch buffer.
+ */
+struct SparseMaskReader
+{
+    const SparseMask* mask;
+
+    const int16_t* Row(int64_t y, int64_t z, int64_t x0, int64_t x1, int16_t* scratch) const
+    {
+        mask->ReadRow(y, z, x0, x1, scratch);
+        return scratch;
+    }
+    int16_t At(int64_t x, int64_t y, int64_t z) const
+    {
+        return mask->Get(x, y, z);
+    }
+};
+
+extern "C"
+{
+DllExport int CreateSparseMask(int64_t, int64_t, int64_t, SparseMask**);
+DllExport int CreateSparseMaskFromDense(const int16_t*, int64_t, int64_t, int64_t, SparseMask**);
+DllExport int FreeSparseMask(SparseMask*);
+DllExport int GetSparseMaskVoxel(const SparseMask*, int64_t, int64_t, int64_t, int16_t*);
+DllExport int SetSparseMaskVoxel(SparseMask*, int64_t, int64_t, int64_t, int16_t);
+DllExport int CompactSparseMask(SparseMask*);
+DllExport int GetSparseMaskInfo(const SparseMask*, int64_t*, int64_t*, int64_t*);
+DllExport int SparseMaskToDense(const SparseMask*, int64_t, int64_t, int64_t, int64_t, int64_t, int64_t, int16_t*);
+DllExport int GetSparseMaskSources(const SparseMask*, int*, SourceInfo**);
+DllExport int GetSparseMaskLabelVoxels(const SparseMask*, int16_t, int64_t*, int64_t**);
+DllExport int GetSparseSourceStats(const float*, const SparseMask*, SourceInfo, SourceStats*, AstFrameSet*);
+DllExport int SparseMaskCropAndDownsample(const SparseMask*, int16_t**, int64_t, int64_t, int64_t, int64_t, int64_t, int64_t, int, int, int);
+DllExport int SparseMaskWriteFits(fitsfile*, const SparseMask*, long*, int*);
+}
+
+#endif //NATIVE_PLUGINS_SPARSE_MASK_H
@@ -0,0 +1,359 @@
+/*
+ * iDaVIE (immersive Data Visualisation Interactive Explorer)
+ * Copyright (C) 2024 Inter-University Institute for Data Intensive Astronomy
+ *
+ * This file is part of the iDaVIE project.
+ *
+ * iDaVIE is free software: you can redistribute it and/or modify it under the terms 
+ * of the GNU Lesser General Public License (LGPL) as published by the Free Software 
+ * Foundation, either version 3 of the License, or (at your option) any later version.
+ *
+ * iDaVIE is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; 
+ * without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR 
+ * PURPOSE. See the GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License along with 
+ * iDaVIE in the LICENSE file. If not, see <https://www.gnu.org/licenses/>.
+ *
+ * Additional information and disclaimers regarding liability and third-party 
+ * components can be found in the DISCLAIMER and NOTICE files included with this project.
+ *
+ */
+#include "spectral_cube.h"
+#include "cube_buffer.h"
+#include "data_analysis_tool.h"
+#include "typed_cube.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <limits>
+#include <mutex>
+#include <new>
+#include <unordered_map>
+#include <vector>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <unistd.h>
+#endif
+
+using namespace std;
+
+namespace
+{
+std::mutex registryMutex;
+// Copies in use for each source cube, and every copy handed out by CreateSpectralCube that has not been freed yet
+std::unordered_map<const float*, std::shared_ptr<SpectralCube>> registry;
+std::unordered_map<const SpectralCube*, std::shared_ptr<SpectralCube>> handles;
+std::atomic<int64_t> allocatedBytes{0};
+
+int64_t GetAvailableMemory()
+{
+#ifdef _WIN32
+    MEMORYSTATUSEX status;
+    status.dwLength = sizeof(status);
+    if (!GlobalMemoryStatusEx(&status))
+    {
+        return 0;
+    }
+    return status.ullAvailPhys;
+#else
+    return (int64_t) sysconf(_SC_AVPHYS_PAGES) * sysconf(_SC_PAGESIZE);
+#endif
+}
+
+/**
+ * @brief Releases a copy once neither its handle nor any FindSpectralCube result refers to it.
+ */
+void DestroySpectralCube(SpectralCube* cube)
+{
+    allocatedBytes -= cube->dimX * cube->dimY * cube->dimZ * (int64_t) sizeof(float);
+    if (!ReleaseCubeBuffer(cube->data))
+    {
+        delete[] cube->data;
+    }
+    delete cube;
+}
+
+/**
+ * @brief Cache-oblivious transpose of the channels [z0, z1) and pixels [p0, p1) of an X-fastest cube (numberPixels
+ * pixels per channel) into spectral-major order. The block is halved along its longer side until it fits in cache.
+ */
+void TransposeBlock(const float* source, float* target, int64_t numberPixels, int64_t dimZ, int64_t z0, int64_t z1, int64_t p0, int64_t p1)
+{
+    int64_t depth = z1 - z0;
+    int64_t width = p1 - p0;
+    if (depth <= SPECTRAL_CUBE_TRANSPOSE_BLOCK && width <= SPECTRAL_CUBE_TRANSPOSE_BLOCK)
+    {
+        for (int64_t p = p0; p < p1; p++)
+        {
+            float* spectrum = target + p * dimZ;
+            for (int64_t z = z0; z < z1; z++)
+            {
+                spectrum[z] = source[z * numberPixels + p];
+            }
+        }
+    }
+    else if (depth >= width)
+    {
+        int64_t zMid = z0 + depth / 2;
+        TransposeBlock(source, target, numberPixels, dimZ, z0, zMid, p0, p1);
+        TransposeBlock(source, target, numberPixels, dimZ, zMid, z1, p0, p1);
+    }
+    else
+    {
+        int64_t pMid = p0 + width / 2;
+        TransposeBlock(source, target, numberPixels, dimZ, z0, z1, p0, pMid);
+        TransposeBlock(source, target, numberPixels, dimZ, z0, z1, pMid, p1);
+    }
+}
+}
+
+std::shared_ptr<const SpectralCube> FindSpectralCube(const float* dataPtr, int64_t dimX, int64_t dimY, int64_t dimZ)
+{
+    std::lock_guard<std::mutex> lock(registryMutex);
+    auto it = registry.find(dataPtr);
+    if (it == registry.end())
+    {
+        return nullptr;
+    }
+    const SpectralCube& cube = *it->second;
+    if (cube.dimX != dimX || cube.dimY != dimY || cube.dimZ != dimZ)
+    {
+        return nullptr;
+    }
+    return it->second;
+}
+
+/**
+ * @brief Reports the memory needed for a spectral-major copy, so the UI can offer it only when RAM allows.
+ *
+ * @param dimX, dimY, dimZ The dimensions of the cube.
+ * @param requiredBytes Bytes needed for the copy.
+ * @param availableBytes Physical memory currently available to the process.
+ * @param inUseBytes Bytes held by the spectral-major copies already created.
+ * @return int EXIT_SUCCESS.
+ */
+int GetSpectralCubeMemoryInfo(int64_t dimX, int64_t dimY, int64_t dimZ, int64_t* requiredBytes, int64_t* availableBytes, int64_t* inUseBytes)
+{
+    if (requiredBytes)
+    {
+        *requiredBytes = dimX * dimY * dimZ * (int64_t) sizeof(float);
+    }
+    if (availableBytes)
+    {
+        *availableBytes = GetAvailableMemory();
+    }
+    if (inUseBytes)
+    {
+        *inUseBytes = allocatedBytes.load();
+    }
+    return EXIT_SUCCESS;
+}
+
+/**
+ * @brief Builds a spectral-major copy of a cube with a parallel cache-oblivious transpose, and registers it so that
+ * profile and moment computations on the cube use it.
+ *
+ * The copy is allocated with the current cube buffer mode. The transpose splits the pixels statically, as the moment
+ * and profile loops that read the copy do, so in the first-touch modes each thread writes the spectra whose pages the
+ * allocation placed on its NUMA node.
+ *
+ * @param dataPtr The cube, in X-Y-Z order. It must outlive the copy.
+ * @param dimX, dimY, dimZ The dimensions of the cube.
+ * @param maxBytes Upper bound on the size of the copy, or 0 to only require that it fits in available memory.
+ * @param spectralCube Output pointer to the copy, to be freed with FreeSpectralCube.
+ * @return int EXIT_SUCCESS, or EXIT_FAILURE if the copy would exceed the memory limit or cannot be allocated.
+ */
+int CreateSpectralCube(const float* dataPtr, int64_t dimX, int64_t dimY, int64_t dimZ, int64_t maxBytes, SpectralCube** spectralCube)
+{
+    if (!dataPtr || !spectralCube || dimX < 1 || dimY < 1 || dimZ < 1)
+    {
+        return EXIT_FAILURE;
+    }
+    int64_t numberPixels = dimX * dimY;
+    int64_t bytes = numberPixels * dimZ * (int64_t) sizeof(float);
+    int64_t limit = maxBytes > 0 ? maxBytes : GetAvailableMemory();
+    if (bytes > limit)
+    {
+        return EXIT_FAILURE;
+    }
+
+    float* data = AllocateCubeBuffer<float>(numberPixels * dimZ);
+    SpectralCube* copy = data ? new (nothrow) SpectralCube{dataPtr, data, dimX, dimY, dimZ} : nullptr;
+    if (!copy)
+    {
+        if (data && !ReleaseCubeBuffer(data))
+        {
+            delete[] data;
+        }
+        return EXIT_FAILURE;
+    }
+    allocatedBytes += bytes;
+    shared_ptr<SpectralCube> cube;
+    try
+    {
+        cube = shared_ptr<SpectralCube>(copy, DestroySpectralCube);
+    }
+    catch (const bad_alloc&)
+    {
+        // The deleter has already released the copy
+        return EXIT_FAILURE;
+    }
+
+    int64_t numberChunks = (numberPixels + SPECTRAL_CUBE_PIXEL_CHUNK - 1) / SPECTRAL_CUBE_PIXEL_CHUNK;
+#pragma omp parallel for schedule(static)
+    for (int64_t chunk = 0; chunk < numberChunks; chunk++)
+    {
+        int64_t p0 = chunk * SPECTRAL_CUBE_PIXEL_CHUNK;
+        int64_t p1 = min(p0 + SPECTRAL_CUBE_PIXEL_CHUNK, numberPixels);
+        TransposeBlock(dataPtr, cube->data, numberPixels, dimZ, 0, dimZ, p0, p1);
+    }
+
+    try
+    {
+        std::lock_guard<std::mutex> lock(registryMutex);
+        handles[cube.get()] = cube;
+        registry[dataPtr] = cube;
+    }
+    catch (const bad_alloc&)
+    {
+        std::lock_guard<std::mutex> lock(registryMutex);
+        handles.erase(cube.get());
+        return EXIT_FAILURE;
+    }
+    *spectralCube = cube.get();
+    return EXIT_SUCCESS;
+}
+
+/**
+ * @brief Unregisters and frees a spectral-major copy. Call before freeing or editing the cube it was built from.
+ * Computations that already hold the copy finish on it, and its memory is released when the last one returns.
+ */
+int FreeSpectralCube(SpectralCube* spectralCube)
+{
+    shared_ptr<SpectralCube> cube;
+    {
+        std::lock_guard<std::mutex> lock(registryMutex);
+        auto handle = handles.find(spectralCube);
+        if (handle == handles.end())
+        {
+            return EXIT_FAILURE;
+        }
+        cube = move(handle->second);
+        handles.erase(handle);
+        auto it = registry.find(cube->source);
+        if (it != registry.end() && it->second == cube)
+        {
+            registry.erase(it);
+        }
+    }
+    return EXIT_SUCCESS;
+}
+
+/**
+ * @brief Computes the moment 0 and moment 1 maps of a channel range, matching MomentMapGenerator.compute: voxels below
+ * the threshold (and NaN voxels) are ignored, and moment 1 is the intensity-weighted spectral coordinate.
+ *
+ * Reads the spectral-major copy of the cube when one is registered, and the cube itself otherwise.
+ *
+ * @param dataPtr The cube, in X-Y-Z order.
+ * @param dimX, dimY, dimZ The dimensions of the cube.
+ * @param zStart, zEnd The channel range, 0-based and half-open.
+ * @param spectrum Spectral coordinate of each of the dimZ channels, or nullptr to use the channel index.
+ * @param threshold Minimum value of the voxels included.
+ * @param moment0 Caller-owned buffer of dimX * dimY floats receiving moment 0.
+ * @param moment1 Caller-owned buffer of dimX * dimY floats receiving moment 1, or nullptr.
+ * @return int EXIT_SUCCESS, or EXIT_FAILURE if the arguments are invalid.
+ */
+int ComputeMomentMaps(const float* dataPtr, int64_t dimX, int64_t dimY, int64_t dimZ, int64_t zStart, int64_t zEnd, const float* spectrum, float threshold,
+                      float* moment0, float* moment1)
+{
+    zStart = max<int64_t>(zStart, 0);
+    zEnd = min(zEnd, dimZ);
+    if (!dataPtr || !moment0 || zStart >= zEnd)
+    {
+        return EXIT_FAILURE;
+    }
+    int64_t numberPixels = dimX * dimY;
+    shared_ptr<const SpectralCube> cube = FindSpectralCube(dataPtr, dimX, dimY, dimZ);
+    if (cube)
+    {
+#pragma omp parallel for
+        for (int64_t p = 0; p < numberPixels; p++)
+        {
+            const float* pixelSpectrum = cube->data + p * dimZ;
+            float sum = 0, sumWeighted = 0;
+            for (int64_t z = zStart; z < zEnd; z++)
+            {
+                float value = pixelSpectrum[z];
+                if (value >= threshold)
+                {
+                    sum += value;
+                    sumWeighted += value * (spectrum ? spectrum[z] : (float) z);
+                }
+            }
+            moment0[p] = sum;
+            if (moment1)
+            {
+                moment1[p] = sumWeighted / sum;
+            }
+        }
+        return EXIT_SUCCESS;
+    }
+
+    ComputeMomentRows(dataPtr, FloatDecoder(), dimX, dimY, zStart, zEnd, spectrum, threshold, moment0, moment1);
+    return EXIT_SUCCESS;
+}
+
+/**
+ * @brief Moment maps of a cube in X-Y-Z order, for any storage type and value decoder (see FloatDecoder). Each thread
+ * accumulates whole rows channel by channel, so reads stay contiguous. Arguments are as for ComputeMomentMaps, with
+ * the channel range already clamped.
+ */
+template<typename T, typename Decoder>
+void ComputeMomentRows(const T* dataPtr, const Decoder& decoder, int64_t dimX, int64_t dimY, int64_t zStart, int64_t zEnd, const float* spectrum,
+                       float threshold, float* moment0, float* moment1)
+{
+    const int64_t numberPixels = dimX * dimY;
+#pragma omp parallel
+    {
+        vector<float> sumWeighted(dimX);
+#pragma omp for
+        for (int64_t y = 0; y < dimY; y++)
+        {
+            float* sum = moment0 + y * dimX;
+            fill(sum, sum + dimX, 0.0f);
+            fill(sumWeighted.begin(), sumWeighted.end(), 0.0f);
+            for (int64_t z = zStart; z < zEnd; z++)
+            {
+                const T* row = dataPtr + z * numberPixels + y * dimX;
+                float coordinate = spectrum ? spectrum[z] : (float) z;
+                for (int64_t x = 0; x < dimX; x++)
+                {
+                    float value = decoder(row[x]);
+                    if (value >= threshold)
+                    {
+                        sum[x] += value;
+                        sumWeighted[x] += value * coordinate;
+                    }
+                }
+            }
+            if (moment1)
+            {
+                for (int64_t x = 0; x < dimX; x++)
+                {
+                    moment1[y * dimX + x] = sumWeighted[x] / sum[x];
+                }
+            }
+        }
+    }
+}
+
+template void ComputeMomentRows<float, FloatDecoder>(const float*, const FloatDecoder&, int64_t, int64_t, int64_t, int64_t, const float*, float, float*, float*);
+template void ComputeMomentRows<int16_t, ScaledDecoder<int16_t>>(const int16_t*, const ScaledDecoder<int16_t>&, int64_t, int64_t, int64_t, int64_t, const float*, float,
+                                                                 float*, float*);
+template void ComputeMomentRows<int32_t, ScaledDecoder<int32_t>>(const int32_t*, const ScaledDecoder<int32_t>&, int64_t, int64_t, int64_t, int64_t, const float*, float,
+                                                                 float*, float*);
@@ -0,0 +1,68 @@
+/*
+ * iDaVIE (immersive Data Visualisation Interactive Explorer)
+ * Copyright (C) 2024 Inter-University Institute for Data Intensive Astronomy
+ *
+ * This file is part of the iDaVIE project.
+ *
+ * iDaVIE is free software: you can redistribute it and/or modify it under the terms 
+ * of the GNU Lesser General Public License (LGPL) as published by the Free Software 
+ * Foundation, either version 3 of the License, or (at your option) any later version.
+ *
+ * iDaVIE is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; 
+ * without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR 
+ * PURPOSE. See the GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License along with 
+ * iDaVIE in the LICENSE file. If not, see <https://www.gnu.org/licenses/>.
+ *
+ * Additional information and disclaimers regarding liability and third-party 
+ * components can be found in the DISCLAIMER and NOTICE files included with this project.
+ *
+ */
+#ifndef NATIVE_PLUGINS_SPECTRAL_CUBE_H
+#define NATIVE_PLUGINS_SPECTRAL_CUBE_H
+
+#include <cstdint>
+#include <memory>
+#include <omp.h>
+
+#define DllExport __declspec (dllexport)
+
+#define EXIT_SUCCESS 0
+#define EXIT_FAILURE 1
+
+// Side of the square blocks (channels x pixels) at which the recursive transpose stops splitting
+#define SPECTRAL_CUBE_TRANSPOSE_BLOCK 32
+// Number of pixels assigned to each thread by the parallel transpose
+#define SPECTRAL_CUBE_PIXEL_CHUNK 4096
+
+/**
+ * @brief Spectral-major copy of a cube: the spectrum of pixel (x, y) is contiguous at data[(y * dimX + x) * dimZ].
+ *
+ * A copy is registered against the X-fastest cube it was built from. Z profiles, region spectra and moment maps
+ * computed on that cube look it up with FindSpectralCube and read whole spectra instead of striding by dimX * dimY.
+ */
+struct SpectralCube
+{
+    const float* source;
+    float* data;
+    int64_t dimX, dimY, dimZ;
+};
+
+/**
+ * @brief Returns the spectral-major copy registered for a cube of the given dimensions, or nullptr if there is none.
+ * The copy stays valid while the returned pointer is held, even if FreeSpectralCube is called on it meanwhile.
+ */
+std::shared_ptr<const SpectralCube> FindSpectralCube(const float*, int64_t, int64_t, int64_t);
+
+template<typename T, typename Decoder> void ComputeMomentRows(const T*, const Decoder&, int64_t, int64_t, int64_t, int64_t, const float*, float, float*, float*);
+
+extern "C"
+{
+DllExport int GetSpectralCubeMemoryInfo(int64_t, int64_t, int64_t, int64_t*, int64_t*, int64_t*);
+DllExport int CreateSpectralCube(const float*, int64_t, int64_t, int64_t, int64_t, SpectralCube**);
+DllExport int FreeSpectralCube(SpectralCube*);
+DllExport int ComputeMomentMaps(const float*, int64_t, int64_t, int64_t, int64_t, int64_t, const float*, float, float*, float*);
+}
+
+#endif //NATIVE_PLUGINS_SPECTRAL_CUBE_H
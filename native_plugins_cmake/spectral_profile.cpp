@@ -0,0 +1,483 @@
+/*
+ * iDaVIE (immersive Data Visualisation Interactive Explorer)
+ * Copyright (C) 2024 Inter-University Institute for Data Intensive Astronomy
+ *
+ * This file is part of the iDaVIE project.
+ *
+ * iDaVIE is free software: you can redistribute it and/or modify it under the terms 
+ * of the GNU Lesser General Public License (LGPL) as published by the Free Software 
+ * Foundation, either version 3 of the License, or (at your option) any later version.
+ *
+ * iDaVIE is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; 
+ * without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR 
+ * PURPOSE. See the GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License along with 
+ * iDaVIE in the LICENSE file. If not, see <https://www.gnu.org/licenses/>.
+ *
+ * Additional information and disclaimers regarding liability and third-party 
+ * components can be found in the DISCLAIMER and NOTICE files included with this project.
+ *
+ */
+#include "spectral_profile.h"
+#include "spectral_cube.h"
+
+#include <algorithm>
+#include <cmath>
+#include <iterator>
+#include <limits>
+#include <new>
+
+using namespace std;
+
+namespace
+{
+const float LOWEST_FLOAT = -numeric_limits<float>::infinity();
+
+bool IsSpatial(const SpectralProfileRegion& region)
+{
+    return region.type == PROFILE_REGION_BOX || region.type == PROFILE_REGION_ELLIPSE;
+}
+
+bool SameMaskRegion(const SpectralProfileRegion& a, const SpectralProfileRegion& b)
+{
+    return a.type == PROFILE_REGION_MASK_LABEL && b.type == PROFILE_REGION_MASK_LABEL && a.label == b.label && a.x0 == b.x0 && a.x1 == b.x1 &&
+           a.y0 == b.y0 && a.y1 == b.y1 && a.z0 == b.z0 && a.z1 == b.z1;
+}
+
+/**
+ * @brief Lists the pixel indices of a box or ellipse, clipped to the image, in increasing order.
+ */
+void RegionPixels(const SpectralProfileEngine& engine, const SpectralProfileRegion& region, vector<int64_t>& pixels)
+{
+    pixels.clear();
+    if (region.type == PROFILE_REGION_BOX)
+    {
+        int64_t x0 = max<int64_t>(region.x0, 0), x1 = min(region.x1, engine.dimX);
+        int64_t y0 = max<int64_t>(region.y0, 0), y1 = min(region.y1, engine.dimY);
+        if (x0 >= x1 || y0 >= y1)
+        {
+            return;
+        }
+        pixels.reserve((x1 - x0) * (y1 - y0));
+        for (int64_t y = y0; y < y1; y++)
+        {
+            for (int64_t x = x0; x < x1; x++)
+            {
+                pixels.push_back(y * engine.dimX + x);
+            }
+        }
+        return;
+    }
+    double a = fabs(region.semiMajor), b = fabs(region.semiMinor);
+    if (a <= 0 || b <= 0)
+    {
+        return;
+    }
+    double cosAngle = cos(region.angle), sinAngle = sin(region.angle);
+    double extent = max(a, b);
+    int64_t x0 = max<int64_t>((int64_t) floor(region.centreX - extent), 0), x1 = min((int64_t) ceil(region.centreX + extent) + 1, engine.dimX);
+    int64_t y0 = max<int64_t>((int64_t) floor(region.centreY - extent), 0), y1 = min((int64_t) ceil(region.centreY + extent) + 1, engine.dimY);
+    for (int64_t y = y0; y < y1; y++)
+    {
+        double dy = y - region.centreY;
+        for (int64_t x = x0; x < x1; x++)
+        {
+            double dx = x - region.centreX;
+            double u = (dx * cosAngle + dy * sinAngle) / a;
+            double v = (dy * cosAngle - dx * sinAngle) / b;
+            if (u * u + v * v <= 1.0)
+            {
+                pixels.push_back(y * engine.dimX + x);
+            }
+        }
+    }
+}
+
+/**
+ * @brief Adds (sign 1) or subtracts (sign -1) the spectra of the given pixels, read from a spectral-major copy of the
+ * cube, to the engine's sums and counts. Maxima are updated too if requested. Each thread accumulates whole spectra
+ * of its share of the pixels before merging.
+ */
+void AccumulateSpectra(SpectralProfileEngine& engine, const SpectralCube& cube, const vector<int64_t>& pixels, int sign, bool updateMaxima)
+{
+    int64_t numberPixels = pixels.size();
+    int64_t dimZ = engine.dimZ;
+    if (numberPixels == 0)
+    {
+        return;
+    }
+#pragma omp parallel
+    {
+        vector<double> sums(dimZ, 0.0);
+        vector<int64_t> counts(dimZ, 0);
+        vector<float> maxima(updateMaxima ? dimZ : 0, LOWEST_FLOAT);
+#pragma omp for
+        for (int64_t i = 0; i < numberPixels; i++)
+        {
+            const float* spectrum = cube.data + pixels[i] * dimZ;
+            for (int64_t z = 0; z < dimZ; z++)
+            {
+                float value = spectrum[z];
+                if (isnan(value))
+                {
+                    continue;
+                }
+                sums[z] += value;
+                counts[z]++;
+                if (updateMaxima)
+                {
+                    maxima[z] = max(maxima[z], value);
+                }
+            }
+        }
+#pragma omp critical
+        {
+            for (int64_t z = 0; z < dimZ; z++)
+            {
+                engine.sums[z] += sign * sums[z];
+                engine.counts[z] += sign * counts[z];
+                if (updateMaxima)
+                {
+                    engine.maxima[z] = max(engine.maxima[z], maxima[z]);
+                }
+            }
+        }
+    }
+}
+
+/**
+ * @brief Recomputes the sums, counts and maxima of every channel over the engine's spatial pixels.
+ */
+void SpatialPass(SpectralProfileEngine& engine)
+{
+    shared_ptr<const SpectralCube> cube = FindSpectralCube(engine.data, engine.dimX, engine.dimY, engine.dimZ);
+    if (cube)
+    {
+        fill(engine.sums.begin(), engine.sums.end(), 0.0);
+        fill(engine.counts.begin(), engine.counts.end(), 0);
+        fill(engine.maxima.begin(), engine.maxima.end(), LOWEST_FLOAT);
+        AccumulateSpectra(engine, *cube, engine.pixels, 1, true);
+        engine.maxValid = true;
+        return;
+    }
+    const int64_t* pixels = engine.pixels.data();
+    int64_t numberPixels = engine.pixels.size();
+    int64_t sliceSize = engine.dimX * engine.dimY;
+#pragma omp parallel for
+    for (int64_t z = 0; z < engine.dimZ; z++)
+    {
+        const float* slice = engine.data + z * sliceSize;
+        double sum = 0;
+        int64_t count = 0;
+        float maximum = LOWEST_FLOAT;
+        for (int64_t i = 0; i < numberPixels; i++)
+        {
+            float value = slice[pixels[i]];
+            if (isnan(value))
+            {
+                continue;
+            }
+            sum += value;
+            count++;
+            maximum = max(maximum, value);
+        }
+        engine.sums[z] = sum;
+        engine.counts[z] = count;
+        engine.maxima[z] = maximum;
+    }
+    engine.maxValid = true;
+}
+
+/**
+ * @brief Updates the cached sums and counts with the pixels entering and leaving the region. Maxima stay valid only
+ * if no pixel left.
+ */
+void IncrementalPass(SpectralProfileEngine& engine, const vector<int64_t>& added, const vector<int64_t>& removed)
+{
+    bool updateMaxima = engine.maxValid && removed.empty();
+    shared_ptr<const SpectralCube> cube = FindSpectralCube(engine.data, engine.dimX, engine.dimY, engine.dimZ);
+    if (cube)
+    {
+        AccumulateSpectra(engine, *cube, added, 1, updateMaxima);
+        AccumulateSpectra(engine, *cube, removed, -1, false);
+        engine.maxValid = updateMaxima;
+        return;
+    }
+    int64_t sliceSize = engine.dimX * engine.dimY;
+#pragma omp parallel for
+    for (int64_t z = 0; z < engine.dimZ; z++)
+    {
+        const float* slice = engine.data + z * sliceSize;
+        double sum = 0;
+        int64_t count = 0;
+        float maximum = engine.maxima[z];
+        for (int64_t pixel : added)
+        {
+            float value = slice[pixel];
+            if (isnan(value))
+            {
+                continue;
+            }
+            sum += value;
+            count++;
+            maximum = max(maximum, value);
+        }
+        for (int64_t pixel : removed)
+        {
+            float value = slice[pixel];
+            if (isnan(value))
+            {
+                continue;
+            }
+            sum -= value;
+            count--;
+        }
+        engine.sums[z] += sum;
+        engine.counts[z] += count;
+        if (updateMaxima)
+        {
+            engine.maxima[z] = maximum;
+        }
+    }
+    engine.maxValid = updateMaxima;
+}
+
+void MaxPass(SpectralProfileEngine& engine)
+{
+    if (FindSpectralCube(engine.data, engine.dimX, engine.dimY, engine.dimZ))
+    {
+        SpatialPass(engine);
+        return;
+    }
+    const int64_t* pixels = engine.pixels.data();
+    int64_t numberPixels = engine.pixels.size();
+    int64_t sliceSize = engine.dimX * engine.dimY;
+#pragma omp parallel for
+    for (int64_t z = 0; z < engine.dimZ; z++)
+    {
+        const float* slice = engine.data + z * sliceSize;
+        float maximum = LOWEST_FLOAT;
+        for (int64_t i = 0; i < numberPixels; i++)
+        {
+            float value = slice[pixels[i]];
+            if (!isnan(value))
+            {
+                maximum = max(maximum, value);
+            }
+        }
+        engine.maxima[z] = maximum;
+    }
+    engine.maxValid = true;
+}
+
+/**
+ * @brief Computes the sums, counts and maxima of every channel over the voxels of a mask label within the region's
+ * search box.
+ */
+void MaskPass(SpectralProfileEngine& engine, const SpectralProfileRegion& region)
+{
+    bool wholeCube = region.x0 >= region.x1 || region.y0 >= region.y1 || region.z0 >= region.z1;
+    int64_t x0 = wholeCube ? 0 : max<int64_t>(region.x0, 0), x1 = wholeCube ? engine.dimX : min(region.x1, engine.dimX);
+    int64_t y0 = wholeCube ? 0 : max<int64_t>(region.y0, 0), y1 = wholeCube ? engine.dimY : min(region.y1, engine.dimY);
+    int64_t z0 = wholeCube ? 0 : max<int64_t>(region.z0, 0), z1 = wholeCube ? engine.dimZ : min(region.z1, engine.dimZ);
+    int16_t label = (int16_t) region.label;
+    int64_t sliceSize = engine.dimX * engine.dimY;
+    int64_t regionSize = 0;
+#pragma omp parallel for reduction(+:regionSize)
+    for (int64_t z = 0; z < engine.dimZ; z++)
+    {
+        double sum = 0;
+        int64_t count = 0;
+        float maximum = LOWEST_FLOAT;
+        for (int64_t y = y0; z >= z0 && z < z1 && y < y1; y++)
+        {
+            int64_t rowStart = z * sliceSize + y * engine.dimX;
+            const float* dataRow = engine.data + rowStart;
+            const int16_t* maskRow = engine.mask + rowStart;
+            for (int64_t x = x0; x < x1; x++)
+            {
+                if (maskRow[x] != label)
+                {
+                    continue;
+                }
+                regionSize++;
+                float value = dataRow[x];
+                if (isnan(value))
+                {
+                    continue;
+                }
+                sum += value;
+                count++;
+                maximum = max(maximum, value);
+            }
+        }
+        engine.sums[z] = sum;
+        engine.counts[z] = count;
+        engine.maxima[z] = maximum;
+    }
+    engine.regionSize = regionSize;
+    engine.maxValid = true;
+}
+}
+
+/**
+ * @brief Creates a profile engine over a cube and, optionally, its mask.
+ *
+ * The engine keeps pointers to the cube and mask, which must outlive it. After either is edited, call
+ * InvalidateSpectralProfileCache.
+ *
+ * @param dataPtr The cube, in X-Y-Z order.
+ * @param maskDataPtr The mask, or nullptr if mask label regions are not needed.
+ * @param dimX, dimY, dimZ The dimensions of the cube.
+ * @param engine Output pointer to the engine, to be freed with FreeSpectralProfileEngine.
+ * @return int EXIT_SUCCESS, or EXIT_FAILURE if the arguments are invalid or the allocation fails.
+ */
+int CreateSpectralProfileEngine(const float* dataPtr, const int16_t* maskDataPtr, int64_t dimX, int64_t dimY, int64_t dimZ, SpectralProfileEngine** engine)
+{
+    if (!dataPtr || !engine || dimX < 1 || dimY < 1 || dimZ < 1)
+    {
+        return EXIT_FAILURE;
+    }
+    try
+    {
+        auto newEngine = new SpectralProfileEngine();
+        newEngine->data = dataPtr;
+        newEngine->mask = maskDataPtr;
+        newEngine->dimX = dimX;
+        newEngine->dimY = dimY;
+        newEngine->dimZ = dimZ;
+        newEngine->valid = false;
+        newEngine->maxValid = false;
+        newEngine->regionSize = 0;
+        newEngine->sums.resize(dimZ);
+        newEngine->counts.resize(dimZ);
+        newEngine->maxima.resize(dimZ);
+        *engine = newEngine;
+    }
+    catch (const bad_alloc&)
+    {
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
+
+/**
+ * @brief Computes the spectrum of a region into a caller-owned buffer.
+ *
+ * Channels without any valid voxel in the region are set to NaN. Repeating the last region costs nothing, and a box or
+ * ellipse that overlaps the previous spatial region mostly only visits the pixels that changed.
+ *
+ * @param engine The profile engine.
+ * @param region The region to aggregate over.
+ * @param aggregate One of ProfileAggregate.
+ * @param profile Caller-owned buffer of dimZ floats receiving the spectrum.
+ * @param regionSize Optional output receiving the number of pixels in the spatial region, or of voxels of the label.
+ * @return int EXIT_SUCCESS, or EXIT_FAILURE if the arguments are invalid or the allocation fails.
+ */
+int ComputeSpectralProfile(SpectralProfileEngine* engine, const SpectralProfileRegion* region, int aggregate, float* profile, int64_t* regionSize)
+{
+    if (!engine || !region || !profile || aggregate < PROFILE_SUM || aggregate > PROFILE_MAX)
+    {
+        return EXIT_FAILURE;
+    }
+    if (region->type == PROFILE_REGION_MASK_LABEL && !engine->mask)
+    {
+        return EXIT_FAILURE;
+    }
+    if (!IsSpatial(*region) && region->type != PROFILE_REGION_MASK_LABEL)
+    {
+        return EXIT_FAILURE;
+    }
+    try
+    {
+        if (IsSpatial(*region))
+        {
+            vector<int64_t> pixels;
+            RegionPixels(*engine, *region, pixels);
+            bool spatialCache = engine->valid && IsSpatial(engine->region);
+            vector<int64_t> added, removed;
+            if (spatialCache)
+            {
+                set_difference(pixels.begin(), pixels.end(), engine->pixels.begin(), engine->pixels.end(), back_inserter(added));
+                set_difference(engine->pixels.begin(), engine->pixels.end(), pixels.begin(), pixels.end(), back_inserter(removed));
+            }
+            engine->pixels.swap(pixels);
+            engine->regionSize = engine->pixels.size();
+            if (spatialCache && added.size() + removed.size() < engine->pixels.size())
+            {
+                if (!added.empty() || !removed.empty())
+                {
+                    IncrementalPass(*engine, added, removed);
+                }
+            }
+            else
+            {
+                SpatialPass(*engine);
+            }
+            if (aggregate == PROFILE_MAX && !engine->maxValid)
+            {
+                MaxPass(*engine);
+            }
+        }
+        else if (!engine->valid || !SameMaskRegion(engine->region, *region))
+        {
+            engine->pixels.clear();
+            MaskPass(*engine, *region);
+        }
+    }
+    catch (const bad_alloc&)
+    {
+        engine->valid = false;
+        return EXIT_FAILURE;
+    }
+    engine->region = *region;
+    engine->valid = true;
+
+#pragma omp parallel for
+    for (int64_t z = 0; z < engine->dimZ; z++)
+    {
+        int64_t count = engine->counts[z];
+        if (count <= 0)
+        {
+            profile[z] = numeric_limits<float>::quiet_NaN();
+        }
+        else if (aggregate == PROFILE_SUM)
+        {
+            profile[z] = (float) engine->sums[z];
+        }
+        else if (aggregate == PROFILE_MEAN)
+        {
+            profile[z] = (float) (engine->sums[z] / count);
+        }
+        else
+        {
+            profile[z] = engine->maxima[z];
+        }
+    }
+    if (regionSize)
+    {
+        *regionSize = engine->regionSize;
+    }
+    return EXIT_SUCCESS;
+}
+
+/**
+ * @brief Discards the cached region, so the next profile is computed from scratch. Call after editing the cube or mask.
+ */
+int InvalidateSpectralProfileCache(SpectralProfileEngine* engine)
+{
+    if (!engine)
+    {
+        return EXIT_FAILURE;
+    }
+    engine->valid = false;
+    engine->maxValid = false;
+    return EXIT_SUCCESS;
+}
+
+int FreeSpectralProfileEngine(SpectralProfileEngine* engine)
+{
+    delete engine;
+    return EXIT_SUCCESS;
+}
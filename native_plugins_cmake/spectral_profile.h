@@ -0,0 +1,108 @@
+/*
+ * iDaVIE (immersive Data Visualisation Interactive Explorer)
+ * Copyright (C) 2024 Inter-University Institute for Data Intensive Astronomy
+ *
+ * This file is part of the iDaVIE project.
+ *
+ * iDaVIE is free software: you can redistribute it and/or modify it under the terms 
+ * of the GNU Lesser General Public License (LGPL) as published by the Free Software 
+ * Foundation, either version 3 of the License, or (at your option) any later version.
+ *
+ * iDaVIE is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; 
+ * without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR 
+ * PURPOSE. See the GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License along with 
+ * iDaVIE in the LICENSE file. If not, see <https://www.gnu.org/licenses/>.
+ *
+ * Additional information and disclaimers regarding liability and third-party 
+ * components can be found in the DISCLAIMER and NOTICE files included with this project.
+ *
+ */
+#ifndef NATIVE_PLUGINS_SPECTRAL_PROFILE_H
+#define NATIVE_PLUGINS_SPECTRAL_PROFILE_H
+
+#include <cstdint>
+#include <vector>
+#include <omp.h>
+
+#define DllExport __declspec (dllexport)
+
+#define EXIT_SUCCESS 0
+#define EXIT_FAILURE 1
+
+/**
+ * @brief Shapes of the regions over which spectra are aggregated.
+ *
+ * Box and ellipse regions are spatial and cover every channel. Mask label regions cover the voxels of the mask equal
+ * to the label, searched within the region's box.
+ */
+enum ProfileRegionType : int32_t
+{
+    PROFILE_REGION_BOX = 0,
+    PROFILE_REGION_ELLIPSE = 1,
+    PROFILE_REGION_MASK_LABEL = 2
+};
+
+/**
+ * @brief Aggregates computed per channel over the region's valid (non-NaN) voxels.
+ */
+enum ProfileAggregate : int32_t
+{
+    PROFILE_SUM = 0,
+    PROFILE_MEAN = 1,
+    PROFILE_MAX = 2
+};
+
+/**
+ * @brief Region passed to ComputeSpectralProfile.
+ *
+ * The box is 0-based and half-open. It is the region itself for PROFILE_REGION_BOX and the search box for
+ * PROFILE_REGION_MASK_LABEL (an empty box searches the whole cube); z0 and z1 are only used for mask labels.
+ * Ellipses are centred on (centreX, centreY) in 0-based pixel coordinates, with the semi-major axis rotated by
+ * angle radians anticlockwise from the X axis. Pixels are included when their centre lies inside the ellipse.
+ */
+struct SpectralProfileRegion
+{
+    int32_t type;
+    int32_t label;
+    int64_t x0, x1;
+    int64_t y0, y1;
+    int64_t z0, z1;
+    double centreX, centreY;
+    double semiMajor, semiMinor;
+    double angle;
+};
+
+/**
+ * @brief Profile engine over one cube, caching the per-channel aggregates of the last region.
+ *
+ * For spatial regions the cache holds the region's pixels. When the next region shares most of them, only the pixels
+ * that entered or left the region are visited. Maxima cannot be updated when pixels leave, so they are recomputed on
+ * demand. The engine is not thread-safe; use one engine per caller.
+ */
+struct SpectralProfileEngine
+{
+    const float* data;
+    const int16_t* mask;
+    int64_t dimX, dimY, dimZ;
+
+    bool valid;
+    bool maxValid;
+    SpectralProfileRegion region;
+    int64_t regionSize;                 /**< Pixels in the cached spatial region, or voxels of the cached mask label */
+    std::vector<int64_t> pixels;        /**< Sorted pixel indices (y * dimX + x) of the cached spatial region */
+    std::vector<double> sums;
+    std::vector<int64_t> counts;
+    std::vector<float> maxima;
+};
+
+extern "C"
+{
+DllExport int CreateSpectralProfileEngine(const float*, const int16_t*, int64_t, int64_t, int64_t, SpectralProfileEngine**);
+DllExport int ComputeSpectralProfile(SpectralProfileEngine*, const SpectralProfileRegion*, int, float*, int64_t*);
+DllExport int InvalidateSpectralProfileCache(SpectralProfileEngine*);
+DllExport int FreeSpectralProfileEngine(SpectralProfileEngine*);
+}
+
+#endif //NATIVE_PLUGINS_SPECTRAL_PROFILE_H
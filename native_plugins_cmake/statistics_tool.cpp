@@ -0,0 +1,1426 @@
+/*
+ * iDaVIE (immersive Data Visualisation Interactive Explorer)
+ * Copyright (C) 2024 Inter-University Institute for Data Intensive Astronomy
+ *
+ * This file is part of the iDaVIE project.
+ *
+ * iDaVIE is free software: you can redistribute it and/or modify it under the terms 
+ * of the GNU Lesser General Public License (LGPL) as published by the Free Software 
+ * Foundation, either version 3 of the License, or (at your option) any later version.
+ *
+ * iDaVIE is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; 
+ * without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR 
+ * PURPOSE. See the GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License along with 
+ * iDaVIE in the LICENSE file. If not, see <https://www.gnu.org/licenses/>.
+ *
+ * Additional information and disclaimers regarding liability and third-party 
+ * components can be found in the DISCLAIMER and NOTICE files included with this project.
+ *
+ */
+#include "statistics_tool.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <new>
+#include <vector>
+
+using namespace std;
+
+namespace
+{
+/**
+ * View over a contiguous float array, split into fixed-size chunks that are distributed over the
+ * threads of each parallel pass.
+ */
+struct ContiguousView
+{
+    static constexpr int64_t CHUNK_SIZE = 65536;
+
+    const float* data;
+    int64_t size;
+
+    int64_t NumChunks() const
+    {
+        return (size + CHUNK_SIZE - 1) / CHUNK_SIZE;
+    }
+
+    template<typename Func>
+    void ForChunk(int64_t chunk, Func&& func) const
+    {
+        const int64_t start = chunk * CHUNK_SIZE;
+        const int64_t end = min(size, start + CHUNK_SIZE);
+        for (int64_t i = start; i < end; i++)
+        {
+            func(data[i]);
+        }
+    }
+};
+
+/**
+ * View over an axis-aligned box [x0, x1) x [y0, y1) x [z0, z1) of a cube, split into chunks of one row each.
+ */
+struct BoxView
+{
+    const float* data;
+    int64_t dimX;
+    int64_t dimY;
+    int64_t x0, x1;
+    int64_t y0, y1;
+    int64_t z0, z1;
+
+    int64_t NumChunks() const
+    {
+        return (y1 - y0) * (z1 - z0);
+    }
+
+    template<typename Func>
+    void ForChunk(int64_t chunk, Func&& func) const
+    {
+        const int64_t y = y0 + chunk % (y1 - y0);
+        const int64_t z = z0 + chunk / (y1 - y0);
+        const float* row = data + (z * dimY + y) * dimX;
+        for (int64_t x = x0; x < x1; x++)
+        {
+            func(row[x]);
+        }
+    }
+};
+
+/**
+ * View over the voxels of a box of a cube that carry a given label in a mask of the same dimensions, split into
+ * chunks of one row each.
+ */
+struct MaskedBoxView
+{
+    const float* data;
+    const int16_t* mask;
+    int16_t label;
+    int64_t dimX;
+    int64_t dimY;
+    int64_t x0, x1;
+    int64_t y0, y1;
+    int64_t z0, z1;
+
+    int64_t NumChunks() const
+    {
+        return (y1 - y0) * (z1 - z0);
+    }
+
+    template<typename Func>
+    void ForChunk(int64_t chunk, Func&& func) const
+    {
+        const int64_t y = y0 + chunk % (y1 - y0);
+        const int64_t z = z0 + chunk / (y1 - y0);
+        const int64_t offset = (z * dimY + y) * dimX;
+        const float* row = data + offset;
+        const int16_t* maskRow = mask + offset;
+        for (int64_t x = x0; x < x1; x++)
+        {
+            if (maskRow[x] == label)
+            {
+                func(row[x]);
+            }
+        }
+    }
+};
+
+/**
+ * Clips a box to the cube and calls func with a BoxView over it, or with a MaskedBoxView if a mask is given.
+ * Returns EXIT_FAILURE without calling func if the clipped box is empty.
+ */
+template<typename Func>
+int WithRegionView(const float* data, int64_t dimX, int64_t dimY, int64_t dimZ, int64_t x0, int64_t x1, int64_t y0, int64_t y1,
+                   int64_t z0, int64_t z1, const int16_t* mask, int16_t label, Func&& func)
+{
+    x0 = max<int64_t>(x0, 0);
+    y0 = max<int64_t>(y0, 0);
+    z0 = max<int64_t>(z0, 0);
+    x1 = min(x1, dimX);
+    y1 = min(y1, dimY);
+    z1 = min(z1, dimZ);
+    if (data == nullptr || x0 >= x1 || y0 >= y1 || z0 >= z1)
+    {
+        return EXIT_FAILURE;
+    }
+    if (mask)
+    {
+        MaskedBoxView view = {data, mask, label, dimX, dimY, x0, x1, y0, y1, z0, z1};
+        return func(view);
+    }
+    BoxView view = {data, dimX, dimY, x0, x1, y0, y1, z0, z1};
+    return func(view);
+}
+
+/**
+ * View presenting the absolute deviations of another view's values from a centre value.
+ */
+template<typename View>
+struct AbsDeviationView
+{
+    const View& view;
+    float centre;
+
+    int64_t NumChunks() const
+    {
+        return view.NumChunks();
+    }
+
+    template<typename Func>
+    void ForChunk(int64_t chunk, Func&& func) const
+    {
+        const float c = centre;
+        view.ForChunk(chunk, [&func, c](float val) {
+            func(fabs(val - c));
+        });
+    }
+};
+
+struct FiniteSummary
+{
+    int64_t count;
+    float minVal;
+    float maxVal;
+};
+
+/**
+ * Counts the finite values of a view and finds their range in a single parallel pass.
+ */
+template<typename View>
+FiniteSummary SummariseFinite(const View& view)
+{
+    FiniteSummary summary = {0, numeric_limits<float>::max(), -numeric_limits<float>::max()};
+    const int64_t numChunks = view.NumChunks();
+    #pragma omp parallel
+    {
+        FiniteSummary local = {0, numeric_limits<float>::max(), -numeric_limits<float>::max()};
+        #pragma omp for schedule(static)
+        for (int64_t c = 0; c < numChunks; c++)
+        {
+            view.ForChunk(c, [&local](float val) {
+                if (isfinite(val))
+                {
+                    local.count++;
+                    local.minVal = min(local.minVal, val);
+                    local.maxVal = max(local.maxVal, val);
+                }
+            });
+        }
+        #pragma omp critical
+        {
+            summary.count += local.count;
+            summary.minVal = min(summary.minVal, local.minVal);
+            summary.maxVal = max(summary.maxVal, local.maxVal);
+        }
+    }
+    return summary;
+}
+
+struct MomentSummary
+{
+    int64_t count;
+    float minVal;
+    float maxVal;
+    double sum;
+    double squareSum;
+};
+
+/**
+ * Accumulates the count, range, sum and sum of squares of the finite values of a view in a single parallel pass.
+ */
+template<typename View>
+MomentSummary SummariseMoments(const View& view)
+{
+    MomentSummary summary = {0, numeric_limits<float>::max(), -numeric_limits<float>::max(), 0, 0};
+    const int64_t numChunks = view.NumChunks();
+    #pragma omp parallel
+    {
+        MomentSummary local = {0, numeric_limits<float>::max(), -numeric_limits<float>::max(), 0, 0};
+        #pragma omp for schedule(static)
+        for (int64_t c = 0; c < numChunks; c++)
+        {
+            view.ForChunk(c, [&local](float val) {
+                if (isfinite(val))
+                {
+                    local.count++;
+                    local.minVal = min(local.minVal, val);
+                    local.maxVal = max(local.maxVal, val);
+                    local.sum += val;
+                    local.squareSum += (double) val * val;
+                }
+            });
+        }
+        #pragma omp critical
+        {
+            summary.count += local.count;
+            summary.minVal = min(summary.minVal, local.minVal);
+            summary.maxVal = max(summary.maxVal, local.maxVal);
+            summary.sum += local.sum;
+            summary.squareSum += local.squareSum;
+        }
+    }
+    return summary;
+}
+
+/**
+ * Bins the finite values of a view into numBins linear bins over [minVal, maxVal], with the same conventions as
+ * GetHistogram: values outside the range are skipped and values equal to maxVal fall into the last bin.
+ */
+template<typename View>
+void RangeHistogram(const View& view, int numBins, float minVal, float maxVal, int* histogram)
+{
+    fill(histogram, histogram + numBins, 0);
+    const double scale = numBins / ((double) maxVal - (double) minVal);
+    const int64_t numChunks = view.NumChunks();
+    #pragma omp parallel
+    {
+        vector<int> localHistogram(numBins, 0);
+        #pragma omp for schedule(static)
+        for (int64_t c = 0; c < numChunks; c++)
+        {
+            view.ForChunk(c, [&](float val) {
+                if (!(val >= minVal && val <= maxVal))
+                {
+                    return;
+                }
+                int bin = (int) (((double) val - (double) minVal) * scale);
+                localHistogram[min(bin, numBins - 1)]++;
+            });
+        }
+        #pragma omp critical
+        {
+            for (int i = 0; i < numBins; i++)
+            {
+                histogram[i] += localHistogram[i];
+            }
+        }
+    }
+}
+
+/**
+ * State of a single requested order statistic during histogram refinement. The requested value is
+ * always contained in the inclusive range [lo, hi], where both ends are actual data values.
+ */
+struct PercentileTarget
+{
+    int64_t rank;   // Rank of the requested value among all finite values
+    int64_t below;  // Number of finite values smaller than lo
+    int64_t count;  // Number of finite values in [lo, hi]
+    float lo;
+    float hi;
+    float value;
+    bool done;
+};
+
+/**
+ * Resolves the targets by repeated histogram refinement. Each pass bins the values that fall inside
+ * each unresolved target's range, and narrows the range to the exact extent of the bin that contains
+ * the requested rank. Since the bin mapping is monotonic and both ends of a range land in different
+ * bins, the range shrinks strictly with every pass. Once a range holds few enough values, they are
+ * gathered and the exact value is selected with nth_element.
+ */
+template<typename View>
+void RefinePercentileTargets(const View& view, vector<PercentileTarget>& targets)
+{
+    const int numBins = PERCENTILE_ENGINE_BINS;
+    const int64_t numChunks = view.NumChunks();
+
+    while (true)
+    {
+        vector<int> active;
+        vector<char> gather;
+        vector<double> scales;
+        for (int i = 0; i < (int) targets.size(); i++)
+        {
+            auto& target = targets[i];
+            if (target.done)
+            {
+                continue;
+            }
+            if (target.lo == target.hi)
+            {
+                target.value = target.lo;
+                target.done = true;
+                continue;
+            }
+            active.push_back(i);
+            gather.push_back(target.count <= PERCENTILE_ENGINE_CANDIDATES);
+            scales.push_back(numBins / ((double) target.hi - (double) target.lo));
+        }
+        if (active.empty())
+        {
+            break;
+        }
+
+        const int numActive = active.size();
+        vector<int64_t> histograms(numActive * numBins, 0);
+        vector<float> binMin(numActive * numBins, numeric_limits<float>::max());
+        vector<float> binMax(numActive * numBins, -numeric_limits<float>::max());
+        vector<vector<float>> candidates(numActive);
+
+        #pragma omp parallel
+        {
+            vector<int64_t> localHistograms(numActive * numBins, 0);
+            vector<float> localMin(numActive * numBins, numeric_limits<float>::max());
+            vector<float> localMax(numActive * numBins, -numeric_limits<float>::max());
+            vector<vector<float>> localCandidates(numActive);
+
+            #pragma omp for schedule(static)
+            for (int64_t c = 0; c < numChunks; c++)
+            {
+                view.ForChunk(c, [&](float val) {
+                    for (int a = 0; a < numActive; a++)
+                    {
+                        const auto& target = targets[active[a]];
+                        // Also rejects NaNs and infinities, as the range ends are finite
+                        if (!(val >= target.lo && val <= target.hi))
+                        {
+                            continue;
+                        }
+                        if (gather[a])
+                        {
+                            localCandidates[a].push_back(val);
+                        }
+                        else
+                        {
+                            int bin = (int) (((double) val - (double) target.lo) * scales[a]);
+                            bin = a * numBins + min(bin, numBins - 1);
+                            localHistograms[bin]++;
+                            localMin[bin] = min(localMin[bin], val);
+                            localMax[bin] = max(localMax[bin], val);
+                        }
+                    }
+                });
+            }
+
+            #pragma omp critical
+            {
+                for (int a = 0; a < numActive; a++)
+                {
+                    if (gather[a])
+                    {
+                        candidates[a].insert(candidates[a].end(), localCandidates[a].begin(), localCandidates[a].end());
+                        continue;
+                    }
+                    for (int i = a * numBins; i < (a + 1) * numBins; i++)
+                    {
+                        histograms[i] += localHistograms[i];
+                        binMin[i] = min(binMin[i], localMin[i]);
+                        binMax[i] = max(binMax[i], localMax[i]);
+                    }
+                }
+            }
+        }
+
+        for (int a = 0; a < numActive; a++)
+        {
+            auto& target = targets[active[a]];
+            const int64_t localRank = target.rank - target.below;
+            if (gather[a])
+            {
+                auto& values = candidates[a];
+                nth_element(values.begin(), values.begin() + localRank, values.end());
+                target.value = values[localRank];
+                target.done = true;
+                continue;
+            }
+            int64_t cumulative = 0;
+            bool found = false;
+            for (int i = a * numBins; i < (a + 1) * numBins && !found; i++)
+            {
+                if (cumulative + histograms[i] > localRank)
+                {
+                    target.below += cumulative;
+                    target.count = histograms[i];
+                    target.lo = binMin[i];
+                    target.hi = binMax[i];
+                    found = true;
+                }
+                cumulative += histograms[i];
+            }
+            if (!found)
+            {
+                // Only possible if the data changed between passes
+                target.value = target.hi;
+                target.done = true;
+            }
+        }
+    }
+}
+
+/**
+ * Computes the values at the given percentiles of the finite values in a view. The value at percentile
+ * p is the element of rank floor(p * (n - 1) / 100) among the n finite values, matching the ranking
+ * used by the previous sort-based implementation.
+ */
+template<typename View>
+int ComputePercentiles(const View& view, const float* percentiles, int numPercentiles, float* percentileValues)
+{
+    for (int i = 0; i < numPercentiles; i++)
+    {
+        percentileValues[i] = NAN;
+        if (!(percentiles[i] >= 0 && percentiles[i] <= 100))
+        {
+            return EXIT_FAILURE;
+        }
+    }
+
+    const FiniteSummary summary = SummariseFinite(view);
+    if (summary.count == 0)
+    {
+        return EXIT_FAILURE;
+    }
+
+    vector<PercentileTarget> targets(numPercentiles);
+    for (int i = 0; i < numPercentiles; i++)
+    {
+        auto rank = (int64_t) ((double) percentiles[i] * (summary.count - 1) / 100.0);
+        targets[i] = {min(rank, summary.count - 1), 0, summary.count, summary.minVal, summary.maxVal, NAN, false};
+    }
+    RefinePercentileTargets(view, targets);
+
+    for (int i = 0; i < numPercentiles; i++)
+    {
+        percentileValues[i] = targets[i].value;
+    }
+    return EXIT_SUCCESS;
+}
+
+/**
+ * Bins the finite values of a view into numBins linear bins over [lo, hi]. Values equal to hi fall into
+ * the last bin. If levelBins is given, only values whose bin in that coarser level lies in
+ * [levelFirst, levelLast] are counted, so that a zoomed level covers exactly the coarse bins it replaces.
+ */
+template<typename View>
+vector<int64_t> LinearHistogram(const View& view, int numBins, double lo, double hi,
+                                int coarseBins = 0, double coarseLo = 0, double coarseHi = 0, int coarseFirst = 0, int coarseLast = 0)
+{
+    vector<int64_t> histogram(numBins, 0);
+    const double scale = numBins / (hi - lo);
+    const double coarseScale = coarseBins ? coarseBins / (coarseHi - coarseLo) : 0;
+    const int64_t numChunks = view.NumChunks();
+
+    #pragma omp parallel
+    {
+        vector<int64_t> localHistogram(numBins, 0);
+        #pragma omp for schedule(static)
+        for (int64_t c = 0; c < numChunks; c++)
+        {
+            view.ForChunk(c, [&](float val) {
+                if (!isfinite(val))
+                {
+                    return;
+                }
+                if (coarseBins)
+                {
+                    int coarseBin = min((int) (((double) val - coarseLo) * coarseScale), coarseBins - 1);
+                    if (coarseBin < coarseFirst || coarseBin > coarseLast)
+                    {
+                        return;
+                    }
+                }
+                int bin = (int) (((double) val - lo) * scale);
+                localHistogram[max(0, min(bin, numBins - 1))]++;
+            });
+        }
+        #pragma omp critical
+        {
+            for (int i = 0; i < numBins; i++)
+            {
+                histogram[i] += localHistogram[i];
+            }
+        }
+    }
+    return histogram;
+}
+
+/**
+ * Builds the coarse level of a multi-resolution histogram over the full range of the view, and a zoomed
+ * level over the coarse bins holding the central percentiles when they span only a small fraction of
+ * the coarse bins.
+ */
+template<typename View>
+int BuildMultiResolutionHistogram(const View& view, MultiResolutionHistogram& histogram)
+{
+    const FiniteSummary summary = SummariseFinite(view);
+    if (summary.count == 0)
+    {
+        return EXIT_FAILURE;
+    }
+    histogram.minVal = summary.minVal;
+    histogram.maxVal = summary.maxVal;
+    histogram.count = summary.count;
+
+    const double lo = summary.minVal;
+    const double hi = summary.maxVal;
+    if (lo == hi)
+    {
+        // A single zero-width bin, treated as a point mass when re-binning
+        histogram.edges = {lo, hi};
+        histogram.counts = {summary.count};
+        return EXIT_SUCCESS;
+    }
+
+    const int numBins = MULTIRES_HISTOGRAM_BINS;
+    vector<int64_t> coarse = LinearHistogram(view, numBins, lo, hi);
+    auto coarseEdge = [&](int i) {
+        return i == numBins ? hi : lo + (hi - lo) * i / numBins;
+    };
+
+    // Coarse bins holding the lower and upper zoom percentiles
+    const auto lowerRank = (int64_t) (MULTIRES_HISTOGRAM_ZOOM_PERCENTILE * (summary.count - 1) / 100.0);
+    const auto upperRank = (int64_t) ((100.0 - MULTIRES_HISTOGRAM_ZOOM_PERCENTILE) * (summary.count - 1) / 100.0);
+    int first = 0;
+    int last = numBins - 1;
+    int64_t cumulative = 0;
+    for (int i = 0; i < numBins; i++)
+    {
+        if (cumulative <= lowerRank && cumulative + coarse[i] > lowerRank)
+        {
+            first = i;
+        }
+        if (cumulative <= upperRank && cumulative + coarse[i] > upperRank)
+        {
+            last = i;
+            break;
+        }
+        cumulative += coarse[i];
+    }
+
+    histogram.edges.clear();
+    histogram.counts.clear();
+    if (last - first + 1 > numBins / 16)
+    {
+        // The bulk of the data is already spread over enough coarse bins
+        for (int i = 0; i < numBins; i++)
+        {
+            histogram.edges.push_back(coarseEdge(i));
+        }
+        histogram.edges.push_back(hi);
+        histogram.counts = std::move(coarse);
+        return EXIT_SUCCESS;
+    }
+
+    const double zoomLo = coarseEdge(first);
+    const double zoomHi = coarseEdge(last + 1);
+    vector<int64_t> zoom = LinearHistogram(view, numBins, zoomLo, zoomHi, numBins, lo, hi, first, last);
+
+    histogram.edges.reserve(2 * numBins + 1);
+    histogram.counts.reserve(2 * numBins);
+    for (int i = 0; i < first; i++)
+    {
+        histogram.edges.push_back(coarseEdge(i));
+        histogram.counts.push_back(coarse[i]);
+    }
+    for (int i = 0; i < numBins; i++)
+    {
+        histogram.edges.push_back(zoomLo + (zoomHi - zoomLo) * i / numBins);
+        histogram.counts.push_back(zoom[i]);
+    }
+    for (int i = last + 1; i < numBins; i++)
+    {
+        histogram.edges.push_back(coarseEdge(i));
+        histogram.counts.push_back(coarse[i]);
+    }
+    histogram.edges.push_back(hi);
+    return EXIT_SUCCESS;
+}
+
+/**
+ * Iterative sigma clipping around the clipped mean, starting from the given centre and RMS. The RMS of a
+ * Gaussian truncated at +-k sigma is smaller than sigma, so each estimate is divided by the RMS of a
+ * truncated unit Gaussian to keep the iteration converging to the true sigma.
+ */
+template<typename View>
+float SigmaClippedRms(const View& view, double centre, double rms)
+{
+    const double k = NOISE_CLIP_THRESHOLD;
+    const double truncatedPdf = 2.0 * k * exp(-0.5 * k * k) / 2.5066282746310002; // sqrt(2 pi)
+    const double truncationCorrection = sqrt(1.0 - truncatedPdf / erf(k / sqrt(2.0)));
+    const int64_t numChunks = view.NumChunks();
+
+    for (int iteration = 0; iteration < NOISE_CLIP_MAX_ITERATIONS && rms > 0; iteration++)
+    {
+        const double lo = centre - k * rms;
+        const double hi = centre + k * rms;
+        int64_t count = 0;
+        double sum = 0;
+        double sumSquares = 0;
+        #pragma omp parallel
+        {
+            int64_t localCount = 0;
+            double localSum = 0;
+            double localSumSquares = 0;
+            #pragma omp for schedule(static)
+            for (int64_t c = 0; c < numChunks; c++)
+            {
+                view.ForChunk(c, [&](float val) {
+                    if (val >= lo && val <= hi)
+                    {
+                        localCount++;
+                        localSum += val;
+                        localSumSquares += (double) val * val;
+                    }
+                });
+            }
+            #pragma omp critical
+            {
+                count += localCount;
+                sum += localSum;
+                sumSquares += localSumSquares;
+            }
+        }
+        if (count < 2)
+        {
+            break;
+        }
+        const double mean = sum / count;
+        const double newRms = sqrt(max(0.0, sumSquares / count - mean * mean)) / truncationCorrection;
+        const bool converged = fabs(newRms - rms) <= 1e-4 * rms;
+        centre = mean;
+        rms = newRms;
+        if (converged)
+        {
+            break;
+        }
+    }
+    return (float) rms;
+}
+
+/**
+ * Fits a Gaussian centred on the given centre to the histogram of the values in [centre - range, centre],
+ * as a weighted linear least-squares fit of ln(n) against (x - centre)^2. Falls back to the initial RMS if
+ * the histogram is too sparse for a fit.
+ */
+template<typename View>
+float NegativeGaussianRms(const View& view, double centre, double rms)
+{
+    const int numBins = NOISE_FIT_BINS;
+    const double lo = centre - NOISE_FIT_RANGE * rms;
+    const double scale = numBins / (centre - lo);
+    const int64_t numChunks = view.NumChunks();
+    vector<int64_t> histogram(numBins, 0);
+
+    #pragma omp parallel
+    {
+        vector<int64_t> localHistogram(numBins, 0);
+        #pragma omp for schedule(static)
+        for (int64_t c = 0; c < numChunks; c++)
+        {
+            view.ForChunk(c, [&](float val) {
+                if (val >= lo && val < centre)
+                {
+                    localHistogram[min((int) ((val - lo) * scale), numBins - 1)]++;
+                }
+            });
+        }
+        #pragma omp critical
+        {
+            for (int i = 0; i < numBins; i++)
+            {
+                histogram[i] += localHistogram[i];
+            }
+        }
+    }
+
+    // The variance of ln(n) is about 1 / n, so bins are weighted by their counts
+    double sumW = 0, sumU = 0, sumY = 0, sumUU = 0, sumUY = 0;
+    int usedBins = 0;
+    for (int i = 0; i < numBins; i++)
+    {
+        if (histogram[i] == 0)
+        {
+            continue;
+        }
+        const double offset = lo + (i + 0.5) / scale - centre;
+        const double u = offset * offset;
+        const double y = log((double) histogram[i]);
+        const auto w = (double) histogram[i];
+        sumW += w;
+        sumU += w * u;
+        sumY += w * y;
+        sumUU += w * u * u;
+        sumUY += w * u * y;
+        usedBins++;
+    }
+    const double denominator = sumW * sumUU - sumU * sumU;
+    if (usedBins < 3 || denominator <= 0)
+    {
+        return (float) rms;
+    }
+    const double slope = (sumW * sumUY - sumU * sumY) / denominator;
+    if (slope >= 0)
+    {
+        return (float) rms;
+    }
+    return (float) sqrt(-0.5 / slope);
+}
+
+/**
+ * Estimates the noise RMS of the finite values of a view with the given NoiseMethod. The median and MAD are
+ * resolved exactly by the histogram refinement of the percentile engine. Returns NaN if the view has no
+ * finite values.
+ */
+template<typename View>
+float EstimateNoise(const View& view, int method)
+{
+    const float median = 50;
+    float centre, mad;
+    if (ComputePercentiles(view, &median, 1, &centre) != EXIT_SUCCESS)
+    {
+        return NAN;
+    }
+    AbsDeviationView<View> deviations = {view, centre};
+    if (ComputePercentiles(deviations, &median, 1, &mad) != EXIT_SUCCESS)
+    {
+        return NAN;
+    }
+    const double rms = NOISE_MAD_TO_SIGMA * mad;
+    if (rms == 0 || method == NOISE_METHOD_MAD)
+    {
+        return (float) rms;
+    }
+    if (method == NOISE_METHOD_SIGMA_CLIP)
+    {
+        return SigmaClippedRms(view, centre, rms);
+    }
+    return NegativeGaussianRms(view, centre, rms);
+}
+
+/**
+ * Forward and inverse transforms of the supported histogram bin spacings. Output bins are linear in the
+ * transformed coordinate.
+ */
+double TransformValue(double val, int spacing, double softening)
+{
+    switch (spacing)
+    {
+        case HISTOGRAM_SPACING_LOG:
+            return log(val);
+        case HISTOGRAM_SPACING_ASINH:
+            return asinh(val / softening);
+        case HISTOGRAM_SPACING_SQRT:
+            return sqrt(val);
+        default:
+            return val;
+    }
+}
+
+double InverseTransformValue(double val, int spacing, double softening)
+{
+    switch (spacing)
+    {
+        case HISTOGRAM_SPACING_LOG:
+            return exp(val);
+        case HISTOGRAM_SPACING_ASINH:
+            return sinh(val) * softening;
+        case HISTOGRAM_SPACING_SQRT:
+            return val * val;
+        default:
+            return val;
+    }
+}
+}
+
+/**
+ * @brief Computes the values at any number of percentiles of a float array, without copying or sorting it.
+ *
+ * Non-finite values (NaN and infinities) are excluded. The percentiles are resolved by parallel histogram
+ * refinement: a first pass finds the range of the data, and each subsequent pass histograms only the values
+ * inside the bin that holds each requested rank, until few enough candidates remain to select the exact
+ * value. Each pass is O(n), a handful of passes are needed even for very large arrays, and the extra
+ * memory is O(bins) per thread, independent of the array size.
+ *
+ * @param data Pointer to the input array of floating-point values.
+ * @param size Number of elements in the input data array.
+ * @param percentiles Array of @p numPercentiles percentiles to compute, each in the range [0, 100].
+ * @param numPercentiles Number of requested percentiles.
+ * @param percentileValues Output array of @p numPercentiles values, in the order of @p percentiles.
+ * @return int Returns EXIT_SUCCESS on success, or EXIT_FAILURE if a percentile is out of range or the
+ *         array contains no finite values (in which case the outputs are NaN).
+ *
+ * @note The value at percentile p is the element of rank floor(p * (n - 1) / 100) among the n finite values.
+ */
+int GetPercentileValues(const float* data, int64_t size, const float* percentiles, int numPercentiles, float* percentileValues)
+{
+    if (data == nullptr || size <= 0 || numPercentiles <= 0)
+    {
+        return EXIT_FAILURE;
+    }
+    ContiguousView view = {data, size};
+    return ComputePercentiles(view, percentiles, numPercentiles, percentileValues);
+}
+
+/**
+ * @brief Builds a multi-resolution histogram of a float array, from which histograms of any sub-range and bin
+ * spacing can later be produced with RebinMultiResolutionHistogram, without revisiting the data.
+ *
+ * Non-finite values are excluded. The histogram is built in at most three parallel passes over the data.
+ *
+ * @param data Pointer to the input array of floating-point values.
+ * @param size Number of elements in the input data array.
+ * @param histogram Output pointer to the new histogram, to be released with FreeMultiResolutionHistogram.
+ * @return int Returns EXIT_SUCCESS on success, or EXIT_FAILURE if the array contains no finite values or the
+ *         histogram could not be allocated.
+ */
+int CreateMultiResolutionHistogram(const float* data, int64_t size, MultiResolutionHistogram** histogram)
+{
+    if (data == nullptr || size <= 0 || histogram == nullptr)
+    {
+        return EXIT_FAILURE;
+    }
+    *histogram = nullptr;
+    auto* newHistogram = new (std::nothrow) MultiResolutionHistogram();
+    if (newHistogram == nullptr)
+    {
+        return EXIT_FAILURE;
+    }
+    ContiguousView view = {data, size};
+    if (BuildMultiResolutionHistogram(view, *newHistogram) != EXIT_SUCCESS)
+    {
+        delete newHistogram;
+        return EXIT_FAILURE;
+    }
+    *histogram = newHistogram;
+    return EXIT_SUCCESS;
+}
+
+/**
+ * @brief Retrieves the range and number of finite values covered by a multi-resolution histogram.
+ *
+ * @param histogram The histogram to query.
+ * @param minVal Output pointer to the minimum finite value.
+ * @param maxVal Output pointer to the maximum finite value.
+ * @param count Output pointer to the number of finite values.
+ * @return int Returns EXIT_SUCCESS on success, or EXIT_FAILURE if the histogram is null.
+ */
+int GetMultiResolutionHistogramInfo(const MultiResolutionHistogram* histogram, float* minVal, float* maxVal, int64_t* count)
+{
+    if (histogram == nullptr)
+    {
+        return EXIT_FAILURE;
+    }
+    *minVal = histogram->minVal;
+    *maxVal = histogram->maxVal;
+    *count = histogram->count;
+    return EXIT_SUCCESS;
+}
+
+/**
+ * @brief Produces a histogram of the range [lo, hi] with the given number of bins and bin spacing from a
+ * multi-resolution histogram, in O(fine bins + output bins) time.
+ *
+ * The counts of fine bins straddling an output bin edge are split in proportion to their overlap with each
+ * output bin, so each output count is accurate to within the counts of the two fine bins at its edges.
+ * Values outside [lo, hi] are not counted, consistent with GetHistogram.
+ *
+ * @param histogram The multi-resolution histogram to re-bin.
+ * @param lo The lower edge of the output range.
+ * @param hi The upper edge of the output range.
+ * @param numBins The number of output bins.
+ * @param spacing The HistogramSpacing of the output bins. Logarithmic spacing requires lo > 0, and square
+ *        root spacing requires lo >= 0.
+ * @param softening The softening scale of asinh spacing, below which bins are approximately linear. If not
+ *        positive, a scale of 1% of the larger magnitude of lo and hi is used.
+ * @param histogramValues Output array of @p numBins counts.
+ * @param binEdges Optional output array of @p numBins + 1 bin edges (may be null).
+ * @return int Returns EXIT_SUCCESS on success, or EXIT_FAILURE if the arguments are invalid.
+ */
+int RebinMultiResolutionHistogram(const MultiResolutionHistogram* histogram, float lo, float hi, int numBins, int spacing,
+                                  float softening, int* histogramValues, float* binEdges)
+{
+    if (histogram == nullptr || histogramValues == nullptr || numBins <= 0 || !(hi > lo) || !isfinite(lo) || !isfinite(hi))
+    {
+        return EXIT_FAILURE;
+    }
+    if ((spacing == HISTOGRAM_SPACING_LOG && lo <= 0) || (spacing == HISTOGRAM_SPACING_SQRT && lo < 0) ||
+        spacing < HISTOGRAM_SPACING_LINEAR || spacing > HISTOGRAM_SPACING_SQRT)
+    {
+        return EXIT_FAILURE;
+    }
+    double scale = softening;
+    if (!(scale > 0))
+    {
+        scale = 0.01 * max(fabs((double) lo), fabs((double) hi));
+    }
+
+    // Output bin edges, uniformly spaced in the transformed coordinate
+    vector<double> edges(numBins + 1);
+    const double tLo = TransformValue(lo, spacing, scale);
+    const double tHi = TransformValue(hi, spacing, scale);
+    for (int i = 0; i <= numBins; i++)
+    {
+        edges[i] = InverseTransformValue(tLo + (tHi - tLo) * i / numBins, spacing, scale);
+    }
+    edges[0] = lo;
+    edges[numBins] = hi;
+
+    // Both bin sequences are sorted, so a single merge pass distributes the fine counts
+    vector<double> values(numBins, 0.0);
+    const auto& fineEdges = histogram->edges;
+    const auto& fineCounts = histogram->counts;
+    const auto numFine = (int64_t) fineCounts.size();
+    int64_t j = upper_bound(fineEdges.begin(), fineEdges.end(), (double) lo) - fineEdges.begin() - 1;
+    int k = 0;
+    for (j = max<int64_t>(j, 0); j < numFine && fineEdges[j] <= hi; j++)
+    {
+        const double a = fineEdges[j];
+        const double b = fineEdges[j + 1];
+        const auto count = (double) fineCounts[j];
+        if (count == 0)
+        {
+            continue;
+        }
+        if (b <= a)
+        {
+            // Zero-width bin of a constant data set
+            if (a >= lo)
+            {
+                int bin = upper_bound(edges.begin(), edges.end(), a) - edges.begin() - 1;
+                values[min(bin, numBins - 1)] += count;
+            }
+            continue;
+        }
+        const double start = max(a, (double) lo);
+        const double end = min(b, (double) hi);
+        while (k < numBins - 1 && edges[k + 1] <= start)
+        {
+            k++;
+        }
+        for (int i = k; i < numBins && edges[i] < end; i++)
+        {
+            const double overlap = min(end, edges[i + 1]) - max(start, edges[i]);
+            if (overlap > 0)
+            {
+                values[i] += count * overlap / (b - a);
+            }
+        }
+    }
+
+    for (int i = 0; i < numBins; i++)
+    {
+        histogramValues[i] = (int) min(llround(values[i]), (long long) numeric_limits<int>::max());
+    }
+    if (binEdges != nullptr)
+    {
+        for (int i = 0; i <= numBins; i++)
+        {
+            binEdges[i] = (float) edges[i];
+        }
+    }
+    return EXIT_SUCCESS;
+}
+
+/**
+ * @brief Releases a histogram created by CreateMultiResolutionHistogram.
+ *
+ * @param histogram The histogram to release (may be null).
+ * @return int Always returns EXIT_SUCCESS.
+ */
+int FreeMultiResolutionHistogram(MultiResolutionHistogram* histogram)
+{
+    delete histogram;
+    return EXIT_SUCCESS;
+}
+
+/**
+ * @brief Estimates the robust noise RMS of a float array.
+ *
+ * Non-finite values are excluded. All passes over the data run in parallel, and medians are found by
+ * histogram refinement rather than sorting, so no copy of the data is made.
+ *
+ * @param data Pointer to the input array of floating-point values.
+ * @param size Number of elements in the input data array.
+ * @param method The NoiseMethod used for the estimate.
+ * @param rms Output pointer to the estimated RMS (NaN if there are no finite values).
+ * @return int Returns EXIT_SUCCESS on success, or EXIT_FAILURE if the arguments are invalid or the array
+ *         contains no finite values.
+ */
+int GetNoiseEstimate(const float* data, int64_t size, int method, float* rms)
+{
+    if (data == nullptr || size <= 0 || rms == nullptr || method < NOISE_METHOD_MAD || method > NOISE_METHOD_NEGATIVE_GAUSS)
+    {
+        return EXIT_FAILURE;
+    }
+    ContiguousView view = {data, size};
+    *rms = EstimateNoise(view, method);
+    return isnan(*rms) ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+/**
+ * @brief Estimates the robust noise RMS of each channel of a cube.
+ *
+ * Channels are processed in parallel, one channel per thread. Channels without finite values get a NaN RMS.
+ *
+ * @param data Pointer to the cube data, with x varying fastest.
+ * @param dimX The x dimension of the cube.
+ * @param dimY The y dimension of the cube.
+ * @param dimZ The z (spectral) dimension of the cube.
+ * @param method The NoiseMethod used for the estimates.
+ * @param spectrum Caller-owned output array of @p dimZ RMS values.
+ * @return int Returns EXIT_SUCCESS on success, or EXIT_FAILURE if the arguments are invalid.
+ */
+int GetNoiseSpectrum(const float* data, int64_t dimX, int64_t dimY, int64_t dimZ, int method, float* spectrum)
+{
+    if (data == nullptr || spectrum == nullptr || dimX <= 0 || dimY <= 0 || dimZ <= 0 ||
+        method < NOISE_METHOD_MAD || method > NOISE_METHOD_NEGATIVE_GAUSS)
+    {
+        return EXIT_FAILURE;
+    }
+    const int64_t channelSize = dimX * dimY;
+    #pragma omp parallel for schedule(dynamic)
+    for (int64_t z = 0; z < dimZ; z++)
+    {
+        ContiguousView view = {data + z * channelSize, channelSize};
+        spectrum[z] = EstimateNoise(view, method);
+    }
+    return EXIT_SUCCESS;
+}
+
+/**
+ * @brief Estimates the robust noise RMS of each tile of a cube, giving a noise cube at tile resolution.
+ *
+ * The cube is divided into tiles of @p tileX x @p tileY x @p tileZ voxels (smaller at the upper edges), which
+ * are processed in parallel, one tile per thread. Tiles without finite values get a NaN RMS.
+ *
+ * @param data Pointer to the cube data, with x varying fastest.
+ * @param dimX The x dimension of the cube.
+ * @param dimY The y dimension of the cube.
+ * @param dimZ The z (spectral) dimension of the cube.
+ * @param tileX The x size of the tiles.
+ * @param tileY The y size of the tiles.
+ * @param tileZ The z size of the tiles. A size of 1 gives a separate noise map for each channel.
+ * @param method The NoiseMethod used for the estimates.
+ * @param noise Caller-owned output array of ceil(dimX / tileX) * ceil(dimY / tileY) * ceil(dimZ / tileZ)
+ *        RMS values, with the tile x index varying fastest.
+ * @return int Returns EXIT_SUCCESS on success, or EXIT_FAILURE if the arguments are invalid.
+ */
+int GetNoiseCube(const float* data, int64_t dimX, int64_t dimY, int64_t dimZ, int64_t tileX, int64_t tileY, int64_t tileZ,
+                 int method, float* noise)
+{
+    if (data == nullptr || noise == nullptr || dimX <= 0 || dimY <= 0 || dimZ <= 0 || tileX <= 0 || tileY <= 0 || tileZ <= 0 ||
+        method < NOISE_METHOD_MAD || method > NOISE_METHOD_NEGATIVE_GAUSS)
+    {
+        return EXIT_FAILURE;
+    }
+    const int64_t numTilesX = (dimX + tileX - 1) / tileX;
+    const int64_t numTilesY = (dimY + tileY - 1) / tileY;
+    const int64_t numTilesZ = (dimZ + tileZ - 1) / tileZ;
+    const int64_t numTiles = numTilesX * numTilesY * numTilesZ;
+    #pragma omp parallel for schedule(dynamic)
+    for (int64_t t = 0; t < numTiles; t++)
+    {
+        const int64_t i = t % numTilesX;
+        const int64_t j = (t / numTilesX) % numTilesY;
+        const int64_t k = t / (numTilesX * numTilesY);
+        BoxView view = {data, dimX, dimY,
+                        i * tileX, min(dimX, (i + 1) * tileX),
+                        j * tileY, min(dimY, (j + 1) * tileY),
+                        k * tileZ, min(dimZ, (k + 1) * tileZ)};
+        noise[t] = EstimateNoise(view, method);
+    }
+    return EXIT_SUCCESS;
+}
+
+/**
+ * @brief Computes the range, mean and standard deviation of the finite values in a box of a cube, optionally
+ * restricted to the voxels of one mask label, without copying the region.
+ *
+ * @param data Pointer to the cube data, with x varying fastest.
+ * @param dimX The x dimension of the cube.
+ * @param dimY The y dimension of the cube.
+ * @param dimZ The z (spectral) dimension of the cube.
+ * @param x0, x1, y0, y1, z0, z1 The box, 0-based and half-open. It is clipped to the cube.
+ * @param mask Mask of the same dimensions as the cube, or nullptr to use every voxel of the box.
+ * @param label The mask value of the voxels to use (ignored without a mask).
+ * @param maxResult Output pointer to the maximum value.
+ * @param minResult Output pointer to the minimum value.
+ * @param meanResult Output pointer to the mean.
+ * @param stdDevResult Output pointer to the sample standard deviation.
+ * @param count Output pointer to the number of finite values used.
+ * @return int Returns EXIT_SUCCESS on success, or EXIT_FAILURE if the box is empty or holds no finite values
+ *         (in which case the outputs are NaN).
+ */
+int GetRegionStats(const float* data, int64_t dimX, int64_t dimY, int64_t dimZ, int64_t x0, int64_t x1, int64_t y0, int64_t y1, int64_t z0, int64_t z1,
+                   const int16_t* mask, int16_t label, float* maxResult, float* minResult, float* meanResult, float* stdDevResult, int64_t* count)
+{
+    if (maxResult == nullptr || minResult == nullptr || meanResult == nullptr || stdDevResult == nullptr || count == nullptr)
+    {
+        return EXIT_FAILURE;
+    }
+    *maxResult = *minResult = *meanResult = *stdDevResult = NAN;
+    *count = 0;
+    return WithRegionView(data, dimX, dimY, dimZ, x0, x1, y0, y1, z0, z1, mask, label, [&](const auto& view) {
+        const MomentSummary summary = SummariseMoments(view);
+        const double n = (double) summary.count;
+        *count = summary.count;
+        if (summary.count == 0)
+        {
+            return EXIT_FAILURE;
+        }
+        *maxResult = summary.maxVal;
+        *minResult = summary.minVal;
+        *meanResult = (float) (summary.sum / n);
+        *stdDevResult = summary.count > 1 ? (float) sqrt(max(0.0, (n * summary.squareSum - summary.sum * summary.sum) / (n * (n - 1)))) : 0.0f;
+        return EXIT_SUCCESS;
+    });
+}
+
+/**
+ * @brief Computes the histogram of a box of a cube, optionally restricted to the voxels of one mask label, without
+ * copying the region. Binning follows GetHistogram.
+ *
+ * @param data Pointer to the cube data, with x varying fastest.
+ * @param dimX The x dimension of the cube.
+ * @param dimY The y dimension of the cube.
+ * @param dimZ The z (spectral) dimension of the cube.
+ * @param x0, x1, y0, y1, z0, z1 The box, 0-based and half-open. It is clipped to the cube.
+ * @param mask Mask of the same dimensions as the cube, or nullptr to use every voxel of the box.
+ * @param label The mask value of the voxels to use (ignored without a mask).
+ * @param numBins The number of bins.
+ * @param minVal The lower edge of the first bin.
+ * @param maxVal The upper edge of the last bin, which includes it.
+ * @param histogram Caller-owned output array of @p numBins counts.
+ * @return int Returns EXIT_SUCCESS on success, or EXIT_FAILURE if the arguments are invalid or the box is empty.
+ */
+int GetRegionHistogram(const float* data, int64_t dimX, int64_t dimY, int64_t dimZ, int64_t x0, int64_t x1, int64_t y0, int64_t y1, int64_t z0,
+                       int64_t z1, const int16_t* mask, int16_t label, int numBins, float minVal, float maxVal, int* histogram)
+{
+    if (histogram == nullptr || numBins <= 0 || !(maxVal > minVal))
+    {
+        return EXIT_FAILURE;
+    }
+    return WithRegionView(data, dimX, dimY, dimZ, x0, x1, y0, y1, z0, z1, mask, label, [&](const auto& view) {
+        RangeHistogram(view, numBins, minVal, maxVal, histogram);
+        return EXIT_SUCCESS;
+    });
+}
+
+/**
+ * @brief Computes the values at the requested percentiles of the finite values in a box of a cube, optionally
+ * restricted to the voxels of one mask label, without copying the region. Ranking follows GetPercentileValues.
+ *
+ * @param data Pointer to the cube data, with x varying fastest.
+ * @param dimX The x dimension of the cube.
+ * @param dimY The y dimension of the cube.
+ * @param dimZ The z (spectral) dimension of the cube.
+ * @param x0, x1, y0, y1, z0, z1 The box, 0-based and half-open. It is clipped to the cube.
+ * @param mask Mask of the same dimensions as the cube, or nullptr to use every voxel of the box.
+ * @param label The mask value of the voxels to use (ignored without a mask).
+ * @param percentiles Array of @p numPercentiles percentiles to compute, each in the range [0, 100].
+ * @param numPercentiles Number of requested percentiles.
+ * @param percentileValues Output array of @p numPercentiles values, in the order of @p percentiles.
+ * @return int Returns EXIT_SUCCESS on success, or EXIT_FAILURE if a percentile is out of range, the box is empty
+ *         or it holds no finite values.
+ */
+int GetRegionPercentileValues(const float* data, int64_t dimX, int64_t dimY, int64_t dimZ, int64_t x0, int64_t x1, int64_t y0, int64_t y1, int64_t z0,
+                              int64_t z1, const int16_t* mask, int16_t label, const float* percentiles, int numPercentiles, float* percentileValues)
+{
+    if (percentiles == nullptr || percentileValues == nullptr || numPercentiles <= 0)
+    {
+        return EXIT_FAILURE;
+    }
+    return WithRegionView(data, dimX, dimY, dimZ, x0, x1, y0, y1, z0, z1, mask, label, [&](const auto& view) {
+        return ComputePercentiles(view, percentiles, numPercentiles, percentileValues);
+    });
+}
+
+/**
+ * @brief Computes the statistics of every channel of a cube, and optionally a small histogram of each channel.
+ *
+ * The first pass accumulates the range, sums and NaN counts of all channels at once, in parallel over spatial tiles
+ * with per-thread accumulators, so that each thread reads contiguous runs of every channel. A second pass, in
+ * parallel over channels, bins each channel into the requested histogram over its own range and into a fine
+ * histogram over CHANNEL_STATS_ROBUST_RANGE times the RMS about the mean, from which the median and the median
+ * absolute deviation are read with a resolution of a fraction of the RMS.
+ *
+ * @param data Pointer to the cube data, with x varying fastest.
+ * @param dimX The x dimension of the cube.
+ * @param dimY The y dimension of the cube.
+ * @param dimZ The z (spectral) dimension of the cube.
+ * @param numBins The number of bins of each channel's histogram, spanning the channel's range.
+ * @param stats Caller-owned output array of @p dimZ channel statistics.
+ * @param histograms Caller-owned output array of @p dimZ * @p numBins counts, channel after channel, or nullptr.
+ * @return int Returns EXIT_SUCCESS on success, or EXIT_FAILURE if the arguments are invalid or the accumulators
+ *         could not be allocated.
+ */
+int GetChannelStatistics(const float* data, int64_t dimX, int64_t dimY, int64_t dimZ, int numBins, ChannelStatistics* stats, int* histograms)
+{
+    if (data == nullptr || stats == nullptr || dimX <= 0 || dimY <= 0 || dimZ <= 0 || (histograms != nullptr && numBins <= 0))
+    {
+        return EXIT_FAILURE;
+    }
+    const int64_t channelSize = dimX * dimY;
+    const int64_t numTiles = (channelSize + CHANNEL_STATS_TILE_PIXELS - 1) / CHANNEL_STATS_TILE_PIXELS;
+    vector<MomentSummary> summaries;
+    vector<int64_t> nanCounts;
+    try
+    {
+        summaries.assign(dimZ, {0, numeric_limits<float>::max(), -numeric_limits<float>::max(), 0, 0});
+        nanCounts.assign(dimZ, 0);
+    }
+    catch (const bad_alloc&)
+    {
+        return EXIT_FAILURE;
+    }
+
+    bool allocationFailed = false;
+    #pragma omp parallel
+    {
+        vector<MomentSummary> local;
+        vector<int64_t> localNans;
+        try
+        {
+            local.assign(dimZ, {0, numeric_limits<float>::max(), -numeric_limits<float>::max(), 0, 0});
+            localNans.assign(dimZ, 0);
+        }
+        catch (const bad_alloc&)
+        {
+            #pragma omp critical
+            allocationFailed = true;
+        }
+        #pragma omp for schedule(dynamic)
+        for (int64_t t = 0; t < numTiles; t++)
+        {
+            if (local.empty())
+            {
+                continue;
+            }
+            const int64_t start = t * CHANNEL_STATS_TILE_PIXELS;
+            const int64_t end = min(channelSize, start + CHANNEL_STATS_TILE_PIXELS);
+            for (int64_t z = 0; z < dimZ; z++)
+            {
+                const float* channel = data + z * channelSize;
+                MomentSummary& summary = local[z];
+                for (int64_t i = start; i < end; i++)
+                {
+                    const float val = channel[i];
+                    if (isnan(val))
+                    {
+                        localNans[z]++;
+                    }
+                    else if (isfinite(val))
+                    {
+                        summary.count++;
+                        summary.minVal = min(summary.minVal, val);
+                        summary.maxVal = max(summary.maxVal, val);
+                        summary.sum += val;
+                        summary.squareSum += (double) val * val;
+                    }
+                }
+            }
+        }
+        #pragma omp critical
+        {
+            for (int64_t z = 0; z < (int64_t) local.size(); z++)
+            {
+                summaries[z].count += local[z].count;
+                summaries[z].minVal = min(summaries[z].minVal, local[z].minVal);
+                summaries[z].maxVal = max(summaries[z].maxVal, local[z].maxVal);
+                summaries[z].sum += local[z].sum;
+                summaries[z].squareSum += local[z].squareSum;
+                nanCounts[z] += localNans[z];
+            }
+        }
+    }
+    if (allocationFailed)
+    {
+        return EXIT_FAILURE;
+    }
+
+    #pragma omp parallel
+    {
+        vector<int64_t> robustHistogram(CHANNEL_STATS_ROBUST_BINS);
+        #pragma omp for schedule(dynamic)
+        for (int64_t z = 0; z < dimZ; z++)
+        {
+            const MomentSummary& summary = summaries[z];
+            ChannelStatistics& channelStats = stats[z];
+            int* histogram = histograms ? histograms + z * numBins : nullptr;
+            if (histogram)
+            {
+                fill(histogram, histogram + numBins, 0);
+            }
+            channelStats.count = summary.count;
+            channelStats.nanFraction = (float) ((double) nanCounts[z] / channelSize);
+            if (summary.count == 0)
+            {
+                channelStats.minVal = channelStats.maxVal = channelStats.mean = channelStats.rms = channelStats.robustRms = NAN;
+                continue;
+            }
+            const double n = (double) summary.count;
+            const double mean = summary.sum / n;
+            const double stdDev = sqrt(max(0.0, summary.squareSum / n - mean * mean));
+            channelStats.minVal = summary.minVal;
+            channelStats.maxVal = summary.maxVal;
+            channelStats.mean = (float) mean;
+            channelStats.rms = (float) sqrt(summary.squareSum / n);
+            if (stdDev == 0)
+            {
+                channelStats.robustRms = 0;
+                if (histogram)
+                {
+                    histogram[0] = (int) summary.count;
+                }
+                continue;
+            }
+
+            // Values beyond the fine histogram's range are only counted, which is all the median and MAD need
+            const double lo = max((double) summary.minVal, mean - CHANNEL_STATS_ROBUST_RANGE * stdDev);
+            const double hi = min((double) summary.maxVal, mean + CHANNEL_STATS_ROBUST_RANGE * stdDev);
+            const double robustScale = CHANNEL_STATS_ROBUST_BINS / (hi - lo);
+            const double scale = histogram ? numBins / ((double) summary.maxVal - (double) summary.minVal) : 0;
+            fill(robustHistogram.begin(), robustHistogram.end(), 0);
+            int64_t below = 0;
+            const float* channel = data + z * channelSize;
+            for (int64_t i = 0; i < channelSize; i++)
+            {
+                const float val = channel[i];
+                if (!isfinite(val))
+                {
+                    continue;
+                }
+                if (histogram)
+                {
+                    histogram[min((int) (((double) val - summary.minVal) * scale), numBins - 1)]++;
+                }
+                if (val < lo)
+                {
+                    below++;
+                }
+                else if (val <= hi)
+                {
+                    robustHistogram[min((int) (((double) val - lo) * robustScale), CHANNEL_STATS_ROBUST_BINS - 1)]++;
+                }
+            }
+
+            // The median is the centre of the bin holding the middle rank, and the MAD the half-width (in bins) of
+            // the smallest window around it holding half of the values
+            const int64_t half = (summary.count + 1) / 2;
+            int64_t cumulative = below;
+            int medianBin = 0;
+            while (medianBin < CHANNEL_STATS_ROBUST_BINS - 1 && cumulative + robustHistogram[medianBin] < half)
+            {
+                cumulative += robustHistogram[medianBin++];
+            }
+            int64_t inside = robustHistogram[medianBin];
+            int width = 0;
+            while (inside < half && width < CHANNEL_STATS_ROBUST_BINS)
+            {
+                width++;
+                if (medianBin - width >= 0)
+                {
+                    inside += robustHistogram[medianBin - width];
+                }
+                if (medianBin + width < CHANNEL_STATS_ROBUST_BINS)
+                {
+                    inside += robustHistogram[medianBin + width];
+                }
+            }
+            channelStats.robustRms = (float) (NOISE_MAD_TO_SIGMA * width / robustScale);
+        }
+    }
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,137 @@
+/*
+ * iDaVIE (immersive Data Visualisation Interactive Explorer)
+ * Copyright (C) 2024 Inter-University Institute for Data Intensive Astronomy
+ *
+ * This file is part of the iDaVIE project.
+ *
+ * iDaVIE is free software: you can redistribute it and/or modify it under the terms 
+ * of the GNU Lesser General Public License (LGPL) as published by the Free Software 
+ * Foundation, either version 3 of the License, or (at your option) any later version.
+ *
+ * iDaVIE is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; 
+ * without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR 
+ * PURPOSE. See the GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License along with 
+ * iDaVIE in the LICENSE file. If not, see <https://www.gnu.org/licenses/>.
+ *
+ * Additional information and disclaimers regarding liability and third-party 
+ * components can be found in the DISCLAIMER and NOTICE files included with this project.
+ *
+ */
+#ifndef NATIVE_PLUGINS_STATISTICS_TOOL_H
+#define NATIVE_PLUGINS_STATISTICS_TOOL_H
+
+#include <cstdint>
+#include <vector>
+#include <omp.h>
+
+#define DllExport __declspec (dllexport)
+
+#define EXIT_SUCCESS 0
+#define EXIT_FAILURE 1
+
+// Number of bins used by each refinement pass of the percentile engine
+#define PERCENTILE_ENGINE_BINS 16384
+// Once a percentile is narrowed down to this many candidates, they are gathered and selected directly
+#define PERCENTILE_ENGINE_CANDIDATES (4 * PERCENTILE_ENGINE_BINS)
+
+// Number of bins in each level of a multi-resolution histogram
+#define MULTIRES_HISTOGRAM_BINS 65536
+// Percentiles bounding the zoomed level of a multi-resolution histogram
+#define MULTIRES_HISTOGRAM_ZOOM_PERCENTILE 0.1
+
+// Scale factor converting the median absolute deviation of Gaussian noise into its standard deviation
+#define NOISE_MAD_TO_SIGMA 1.482602218505602
+// Clipping threshold (in units of the current RMS) and iteration limit of sigma-clipped noise estimates
+#define NOISE_CLIP_THRESHOLD 3.0
+#define NOISE_CLIP_MAX_ITERATIONS 20
+// Range (in units of the MAD-based RMS) and number of bins of the histogram fitted by negative-half Gaussian estimates
+#define NOISE_FIT_RANGE 4.0
+#define NOISE_FIT_BINS 64
+
+// Number of pixels of each channel handled per spatial tile by the first pass of GetChannelStatistics
+#define CHANNEL_STATS_TILE_PIXELS 16384
+// Number of bins, and range around the mean in units of the RMS, of the histogram giving each channel's robust RMS
+#define CHANNEL_STATS_ROBUST_BINS 2048
+#define CHANNEL_STATS_ROBUST_RANGE 5.0
+
+/**
+ * @brief Methods of robust noise estimation.
+ *
+ * NOISE_METHOD_MAD scales the median absolute deviation from the median.
+ * NOISE_METHOD_SIGMA_CLIP iteratively computes the RMS of the values within NOISE_CLIP_THRESHOLD times the
+ * RMS of the clipped mean, starting from the MAD-based estimate and correcting for the truncation of the
+ * Gaussian wings.
+ * NOISE_METHOD_NEGATIVE_GAUSS fits a Gaussian centred on the median to the histogram of the values below the
+ * median, which emission does not contaminate.
+ */
+enum NoiseMethod : int32_t
+{
+    NOISE_METHOD_MAD = 0,
+    NOISE_METHOD_SIGMA_CLIP = 1,
+    NOISE_METHOD_NEGATIVE_GAUSS = 2
+};
+
+enum HistogramSpacing : int32_t
+{
+    HISTOGRAM_SPACING_LINEAR = 0,
+    HISTOGRAM_SPACING_LOG = 1,
+    HISTOGRAM_SPACING_ASINH = 2,
+    HISTOGRAM_SPACING_SQRT = 3
+};
+
+/**
+ * @brief Fine-grained histogram of a data set, from which histograms of any sub-range and bin spacing
+ * can be derived without revisiting the data.
+ *
+ * The histogram consists of a coarse level of linear bins spanning the full data range, and, when the
+ * bulk of the data is concentrated in a small part of that range (a narrow noise peak with a long
+ * bright tail), a zoomed level of linear bins spanning the central 0.1-99.9 percentile range. The zoomed
+ * level replaces the coarse bins it covers, and both levels are stored flattened as one sequence of
+ * contiguous fine bins.
+ */
+struct MultiResolutionHistogram
+{
+    float minVal;                  /**< Minimum finite data value */
+    float maxVal;                  /**< Maximum finite data value */
+    int64_t count;                 /**< Number of finite data values */
+    std::vector<double> edges;     /**< Edges of the fine bins (size: number of fine bins + 1) */
+    std::vector<int64_t> counts;   /**< Counts of the fine bins */
+};
+
+/**
+ * @brief Statistics of one channel, as returned by GetChannelStatistics. Only finite values are used; channels
+ * without any have NaN statistics.
+ */
+struct ChannelStatistics
+{
+    float minVal;           /**< Minimum value */
+    float maxVal;           /**< Maximum value */
+    float mean;             /**< Mean value */
+    float rms;              /**< Root mean square of the values */
+    float robustRms;        /**< Median absolute deviation from the median, scaled to a Gaussian sigma */
+    float nanFraction;      /**< Fraction of the channel's pixels that are NaN */
+    int64_t count;          /**< Number of finite values */
+};
+
+extern "C"
+{
+DllExport int GetPercentileValues(const float*, int64_t, const float*, int, float*);
+DllExport int CreateMultiResolutionHistogram(const float*, int64_t, MultiResolutionHistogram**);
+DllExport int GetMultiResolutionHistogramInfo(const MultiResolutionHistogram*, float*, float*, int64_t*);
+DllExport int RebinMultiResolutionHistogram(const MultiResolutionHistogram*, float, float, int, int, float, int*, float*);
+DllExport int FreeMultiResolutionHistogram(MultiResolutionHistogram*);
+DllExport int GetNoiseEstimate(const float*, int64_t, int, float*);
+DllExport int GetNoiseSpectrum(const float*, int64_t, int64_t, int64_t, int, float*);
+DllExport int GetNoiseCube(const float*, int64_t, int64_t, int64_t, int64_t, int64_t, int64_t, int, float*);
+DllExport int GetChannelStatistics(const float*, int64_t, int64_t, int64_t, int, ChannelStatistics*, int*);
+DllExport int GetRegionStats(const float*, int64_t, int64_t, int64_t, int64_t, int64_t, int64_t, int64_t, int64_t, int64_t, const int16_t*, int16_t,
+                             float*, float*, float*, float*, int64_t*);
+DllExport int GetRegionHistogram(const float*, int64_t, int64_t, int64_t, int64_t, int64_t, int64_t, int64_t, int64_t, int64_t, const int16_t*, int16_t,
+                                 int, float, float, int*);
+DllExport int GetRegionPercentileValues(const float*, int64_t, int64_t, int64_t, int64_t, int64_t, int64_t, int64_t, int64_t, int64_t, const int16_t*,
+                                        int16_t, const float*, int, float*);
+}
+
+#endif //NATIVE_PLUGINS_STATISTICS_TOOL_H
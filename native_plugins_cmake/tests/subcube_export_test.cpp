@@ -0,0 +1,129 @@
+/*
+ * iDaVIE (immersive Data Visualisation Interactive Explorer)
+ * Copyright (C) 2024 Inter-University Institute for Data Intensive Astronomy
+ *
+ * This file is part of the iDaVIE project.
+ *
+ * iDaVIE is free software: you can redistribute it and/or modify it under the terms 
+ * of the GNU Lesser General Public License (LGPL) as published by the Free Software 
+ * Foundation, either version 3 of the License, or (at your option) any later version.
+ *
+ * iDaVIE is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; 
+ * without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR 
+ * PURPOSE. See the GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License along with 
+ * iDaVIE in the LICENSE file. If not, see <https://www.gnu.org/licenses/>.
+ *
+ * Additional information and disclaimers regarding liability and third-party 
+ * components can be found in the DISCLAIMER and NOTICE files included with this project.
+ *
+ */
+
+// Round-trips a small subcube through FitsWriteSubcubeFromMemory and checks the pixels and the shifted WCS.
+
+#include "../fits_reader.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+namespace
+{
+    const int64_t DIM_X = 7;
+    const int64_t DIM_Y = 6;
+    const int64_t DIM_Z = 5;
+
+    int Fail(const char* message, int status)
+    {
+        char errorText[FLEN_ERRMSG] = "";
+        fits_get_errstatus(status, errorText);
+        fprintf(stderr, "%s (status %d: %s)\n", message, status, errorText);
+        return EXIT_FAILURE;
+    }
+}
+
+int main()
+{
+    char sourceName[] = "!subcube_export_test_source.fits";
+    char outputName[] = "!subcube_export_test_output.fits";
+    char outputPath[] = "subcube_export_test_output.fits";
+
+    std::vector<float> cube(DIM_X * DIM_Y * DIM_Z);
+    for (size_t i = 0; i < cube.size(); i++)
+        cube[i] = 0.25f * i - 3.0f;
+
+    // Header source with a simple linear WCS
+    int status = 0;
+    fitsfile* source = nullptr;
+    long naxes[3] = {DIM_X, DIM_Y, DIM_Z};
+    fits_create_file(&source, sourceName, &status);
+    fits_create_img(source, FLOAT_IMG, 3, naxes, &status);
+    double crpix[3] = {4.0, 3.5, 1.0};
+    double cdelt[3] = {-0.01, 0.01, 1000.0};
+    char crpixKeys[3][FLEN_KEYWORD] = {"CRPIX1", "CRPIX2", "CRPIX3"};
+    char cdeltKeys[3][FLEN_KEYWORD] = {"CDELT1", "CDELT2", "CDELT3"};
+    for (int axis = 0; axis < 3; axis++)
+    {
+        fits_write_key(source, TDOUBLE, crpixKeys[axis], &crpix[axis], nullptr, &status);
+        fits_write_key(source, TDOUBLE, cdeltKeys[axis], &cdelt[axis], nullptr, &status);
+    }
+    LONGLONG firstPixel[3] = {1, 1, 1};
+    fits_write_pixll(source, TFLOAT, firstPixel, (LONGLONG) cube.size(), cube.data(), &status);
+    if (status)
+        return Fail("Could not create the header source", status);
+
+    const int64_t crop1[3] = {2, 3, 2};
+    const int64_t crop2[3] = {6, 5, 4};
+    FitsWriteSubcubeFromMemory(outputName, source, cube.data(), DIM_X, DIM_Y, DIM_Z, crop2[0], crop1[1], crop1[2], crop1[0], crop2[1], crop2[2], 1, 1, 1,
+                               nullptr, &status);
+    if (status)
+        return Fail("FitsWriteSubcubeFromMemory failed", status);
+    fits_close_file(source, &status);
+
+    fitsfile* output = nullptr;
+    if (fits_open_file(&output, outputPath, READONLY, &status))
+        return Fail("Could not open the written subcube", status);
+    int naxis = 0;
+    LONGLONG outputAxes[3] = {0, 0, 0};
+    fits_get_img_dim(output, &naxis, &status);
+    fits_get_img_sizell(output, 3, outputAxes, &status);
+    const int64_t width = crop2[0] - crop1[0] + 1;
+    const int64_t height = crop2[1] - crop1[1] + 1;
+    const int64_t depth = crop2[2] - crop1[2] + 1;
+    if (status || naxis != 3 || outputAxes[0] != width || outputAxes[1] != height || outputAxes[2] != depth)
+        return Fail("Unexpected subcube dimensions", status);
+
+    std::vector<float> written(width * height * depth);
+    float nulval = 0;
+    int anynul = 0;
+    fits_read_pixll(output, TFLOAT, firstPixel, (LONGLONG) written.size(), &nulval, written.data(), &anynul, &status);
+    if (status)
+        return Fail("Could not read the written subcube", status);
+    for (int64_t z = 0; z < depth; z++)
+    {
+        for (int64_t y = 0; y < height; y++)
+        {
+            for (int64_t x = 0; x < width; x++)
+            {
+                float expected = cube[((crop1[2] - 1 + z) * DIM_Y + crop1[1] - 1 + y) * DIM_X + crop1[0] - 1 + x];
+                if (written[(z * height + y) * width + x] != expected)
+                    return Fail("Pixel values differ from the in-memory cube", status);
+            }
+        }
+    }
+
+    for (int axis = 0; axis < 3; axis++)
+    {
+        double value = 0;
+        fits_read_key(output, TDOUBLE, crpixKeys[axis], &value, nullptr, &status);
+        if (status || value != crpix[axis] - (crop1[axis] - 1))
+            return Fail("CRPIX was not shifted to the crop origin", status);
+        fits_read_key(output, TDOUBLE, cdeltKeys[axis], &value, nullptr, &status);
+        if (status || value != cdelt[axis])
+            return Fail("CDELT changed without downsampling", status);
+    }
+    fits_close_file(output, &status);
+    printf("Subcube round trip passed\n");
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,1035 @@
+/*
+ * iDaVIE (immersive Data Visualisation Interactive Explorer)
+ * Copyright (C) 2024 Inter-University Institute for Data Intensive Astronomy
+ *
+ * This file is part of the iDaVIE project.
+ *
+ * iDaVIE is free software: you can redistribute it and/or modify it under the terms 
+ * of the GNU Lesser General Public License (LGPL) as published by the Free Software 
+ * Foundation, either version 3 of the License, or (at your option) any later version.
+ *
+ * iDaVIE is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; 
+ * without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR 
+ * PURPOSE. See the GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License along with 
+ * iDaVIE in the LICENSE file. If not, see <https://www.gnu.org/licenses/>.
+ *
+ * Additional information and disclaimers regarding liability and third-party 
+ * components can be found in the DISCLAIMER and NOTICE files included with this project.
+ *
+ */
+#include "tile_compression.h"
+#include "cube_buffer.h"
+#include "fits_reader.h"
+#include "sparse_mask.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <new>
+#include <type_traits>
+#include <zlib.h>
+
+using namespace std;
+
+namespace
+{
+// Quantized values reserved by the tiled image convention for blank and exact zero pixels
+const int32_t QUANTIZED_NULL_VALUE = -2147483647;
+const int32_t QUANTIZED_ZERO_VALUE = -2147483646;
+
+enum TileAlgorithm
+{
+    TILE_RICE,
+    TILE_GZIP_1,
+    TILE_GZIP_2
+};
+
+struct CompressedImageInfo
+{
+    int bitpix;
+    int naxis;
+    int64_t axes[TILE_COMPRESSION_MAX_AXES];
+    int64_t tileDims[TILE_COMPRESSION_MAX_AXES];
+    int64_t tileCounts[TILE_COMPRESSION_MAX_AXES];
+    int algorithm;
+    int blockSize;
+    int bytePix;
+    bool quantized;
+    int ditherMethod;
+    int64_t ditherSeed;
+    double scale, zero;
+    int scaleColumn, zeroColumn;
+    bool hasBlank;
+    int64_t blank;
+    int blankColumn;
+    double bscale, bzero;
+    int dataColumn, gzipColumn;
+};
+
+struct CompressedTile
+{
+    int64_t index;
+    vector<uint8_t> bytes;
+    bool lossless;      /**< Tile stored in GZIP_COMPRESSED_DATA because it could not be quantized */
+    double scale, zero;
+    int64_t blank;
+};
+
+struct TileScratch
+{
+    vector<int32_t> values;
+    vector<uint8_t> raw;
+    vector<uint8_t> shuffled;
+    vector<float> pixels;
+};
+
+/**
+ * @brief The dither sequence of the tiled image convention (Park-Miller generator, seeded with 1).
+ */
+const vector<float>& DitherSequence()
+{
+    static const vector<float> sequence = [] {
+        vector<float> values(TILE_COMPRESSION_RANDOM_VALUES);
+        double a = 16807.0;
+        double m = 2147483647.0;
+        double seed = 1.0;
+        for (int i = 0; i < TILE_COMPRESSION_RANDOM_VALUES; i++)
+        {
+            double temp = a * seed;
+            seed = temp - m * ((int) (temp / m));
+            values[i] = (float) (seed / m);
+        }
+        return values;
+    }();
+    return sequence;
+}
+
+bool ProbeKey(fitsfile* fptr, int datatype, const char* name, void* value)
+{
+    int status = 0;
+    fits_read_key(fptr, datatype, name, value, nullptr, &status);
+    return status == 0;
+}
+
+int ProbeColumn(fitsfile* fptr, const char* name)
+{
+    int status = 0;
+    int column = 0;
+    char templateName[FLEN_VALUE];
+    strncpy(templateName, name, FLEN_VALUE - 1);
+    templateName[FLEN_VALUE - 1] = '\0';
+    fits_get_colnum(fptr, CASEINSEN, templateName, &column, &status);
+    return status == 0 ? column : 0;
+}
+
+/**
+ * @brief Parses the compression keywords of the current HDU. Returns false for layouts the parallel reader
+ * does not handle (HCOMPRESS, PLIO, 64-bit integers, uncompressed tiles), which are left to CFITSIO.
+ */
+bool ReadCompressedImageInfo(fitsfile* fptr, int dims, CompressedImageInfo& info)
+{
+    char text[FLEN_VALUE];
+    if (!ProbeKey(fptr, TINT, "ZBITPIX", &info.bitpix) || !ProbeKey(fptr, TINT, "ZNAXIS", &info.naxis))
+    {
+        return false;
+    }
+    if (info.naxis < 1 || info.naxis > TILE_COMPRESSION_MAX_AXES || info.naxis != dims || info.bitpix == LONGLONG_IMG)
+    {
+        return false;
+    }
+    for (int i = 0; i < info.naxis; i++)
+    {
+        char name[FLEN_KEYWORD];
+        LONGLONG value;
+        snprintf(name, FLEN_KEYWORD, "ZNAXIS%d", i + 1);
+        if (!ProbeKey(fptr, TLONGLONG, name, &value) || value < 1)
+        {
+            return false;
+        }
+        info.axes[i] = value;
+        snprintf(name, FLEN_KEYWORD, "ZTILE%d", i + 1);
+        // Without ZTILEn keywords each row of the image is a tile
+        info.tileDims[i] = ProbeKey(fptr, TLONGLONG, name, &value) ? max<LONGLONG>(value, 1) : (i == 0 ? info.axes[0] : 1);
+        info.tileCounts[i] = (info.axes[i] + info.tileDims[i] - 1) / info.tileDims[i];
+    }
+
+    if (!ProbeKey(fptr, TSTRING, "ZCMPTYPE", text))
+    {
+        return false;
+    }
+    if (!strcmp(text, "RICE_1") || !strcmp(text, "RICE_ONE"))
+    {
+        info.algorithm = TILE_RICE;
+    }
+    else if (!strcmp(text, "GZIP_1"))
+    {
+        info.algorithm = TILE_GZIP_1;
+    }
+    else if (!strcmp(text, "GZIP_2"))
+    {
+        info.algorithm = TILE_GZIP_2;
+    }
+    else
+    {
+        return false;
+    }
+
+    info.blockSize = 32;
+    info.bytePix = info.bitpix > 0 ? info.bitpix / 8 : 4;
+    for (int i = 1; i < 100; i++)
+    {
+        char name[FLEN_KEYWORD];
+        snprintf(name, FLEN_KEYWORD, "ZNAME%d", i);
+        if (!ProbeKey(fptr, TSTRING, name, text))
+        {
+            break;
+        }
+        int value;
+        snprintf(name, FLEN_KEYWORD, "ZVAL%d", i);
+        if (!ProbeKey(fptr, TINT, name, &value))
+        {
+            continue;
+        }
+        if (!strcmp(text, "BLOCKSIZE"))
+        {
+            info.blockSize = value;
+        }
+        else if (!strcmp(text, "BYTEPIX"))
+        {
+            info.bytePix = value;
+        }
+    }
+    if (info.bytePix != 1 && info.bytePix != 2 && info.bytePix != 4)
+    {
+        return false;
+    }
+
+    info.scaleColumn = ProbeColumn(fptr, "ZSCALE");
+    info.zeroColumn = ProbeColumn(fptr, "ZZERO");
+    info.blankColumn = ProbeColumn(fptr, "ZBLANK");
+    info.dataColumn = ProbeColumn(fptr, "COMPRESSED_DATA");
+    info.gzipColumn = ProbeColumn(fptr, "GZIP_COMPRESSED_DATA");
+    if (!info.dataColumn || ProbeColumn(fptr, "UNCOMPRESSED_DATA"))
+    {
+        return false;
+    }
+
+    info.scale = 1.0;
+    info.zero = 0.0;
+    bool hasScale = info.scaleColumn || ProbeKey(fptr, TDOUBLE, "ZSCALE", &info.scale);
+    if (!info.zeroColumn)
+    {
+        ProbeKey(fptr, TDOUBLE, "ZZERO", &info.zero);
+    }
+
+    // Files without ZQUANTIZ predate dithering and were quantized without it
+    info.ditherMethod = NO_DITHER;
+    bool quantizeNone = false;
+    if (ProbeKey(fptr, TSTRING, "ZQUANTIZ", text))
+    {
+        if (!strcmp(text, "SUBTRACTIVE_DITHER_1"))
+        {
+            info.ditherMethod = SUBTRACTIVE_DITHER_1;
+        }
+        else if (!strcmp(text, "SUBTRACTIVE_DITHER_2"))
+        {
+            info.ditherMethod = SUBTRACTIVE_DITHER_2;
+        }
+        else if (!strcmp(text, "NONE"))
+        {
+            quantizeNone = true;
+        }
+    }
+    LONGLONG seed = 1;
+    ProbeKey(fptr, TLONGLONG, "ZDITHER0", &seed);
+    info.ditherSeed = seed;
+    info.quantized = info.bitpix < 0 && hasScale && !quantizeNone;
+    if (info.bitpix < 0 && !info.quantized && info.algorithm == TILE_RICE)
+    {
+        return false;
+    }
+    if (info.quantized)
+    {
+        info.bytePix = 4;
+    }
+
+    LONGLONG blank;
+    info.hasBlank = info.blankColumn != 0;
+    info.blank = 0;
+    if (ProbeKey(fptr, TLONGLONG, "ZBLANK", &blank) || (!info.quantized && ProbeKey(fptr, TLONGLONG, "BLANK", &blank)))
+    {
+        info.hasBlank = true;
+        info.blank = blank;
+    }
+
+    info.bscale = 1.0;
+    info.bzero = 0.0;
+    if (info.bitpix > 0)
+    {
+        ProbeKey(fptr, TDOUBLE, "BSCALE", &info.bscale);
+        ProbeKey(fptr, TDOUBLE, "BZERO", &info.bzero);
+    }
+    return true;
+}
+
+bool Gunzip(const uint8_t* input, size_t inputSize, uint8_t* output, size_t outputSize)
+{
+    z_stream stream = {};
+    // 15 + 32: maximum window, automatic gzip or zlib header detection
+    if (inflateInit2(&stream, 15 + 32) != Z_OK)
+    {
+        return false;
+    }
+    stream.next_in = const_cast<Bytef*>(input);
+    stream.avail_in = (uInt) inputSize;
+    stream.next_out = output;
+    stream.avail_out = (uInt) outputSize;
+    int result = inflate(&stream, Z_FINISH);
+    bool complete = (result == Z_STREAM_END || result == Z_BUF_ERROR || result == Z_OK) && stream.total_out == outputSize;
+    inflateEnd(&stream);
+    return complete;
+}
+
+int32_t ReadBigEndian(const uint8_t* bytes, int size)
+{
+    switch (size)
+    {
+        case 1:
+            return bytes[0];
+        case 2:
+            return (int16_t) ((bytes[0] << 8) | bytes[1]);
+        default:
+            return (int32_t) (((uint32_t) bytes[0] << 24) | ((uint32_t) bytes[1] << 16) | ((uint32_t) bytes[2] << 8) | bytes[3]);
+    }
+}
+
+float ReadBigEndianFloat(const uint8_t* bytes, int size)
+{
+    if (size == 8)
+    {
+        uint64_t bits = 0;
+        for (int i = 0; i < 8; i++)
+        {
+            bits = (bits << 8) | bytes[i];
+        }
+        double value;
+        memcpy(&value, &bits, sizeof(value));
+        return (float) value;
+    }
+    uint32_t bits = (uint32_t) ReadBigEndian(bytes, 4);
+    float value;
+    memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+/**
+ * @brief Decompresses a tile of numPixels pixels into scratch.pixels, applying unquantization or integer scaling.
+ */
+bool DecodeTile(const CompressedImageInfo& info, const CompressedTile& tile, int64_t numPixels, TileScratch& scratch)
+{
+    scratch.pixels.resize(numPixels);
+    float* output = scratch.pixels.data();
+    if (tile.bytes.empty())
+    {
+        fill(output, output + numPixels, NAN);
+        return true;
+    }
+
+    if (tile.lossless || (!info.quantized && info.bitpix < 0))
+    {
+        int size = abs(info.bitpix) / 8;
+        scratch.raw.resize(numPixels * size);
+        if (!Gunzip(tile.bytes.data(), tile.bytes.size(), scratch.raw.data(), scratch.raw.size()))
+        {
+            return false;
+        }
+        const uint8_t* raw = scratch.raw.data();
+        if (info.algorithm == TILE_GZIP_2 && !tile.lossless)
+        {
+            scratch.shuffled.swap(scratch.raw);
+            scratch.raw.resize(numPixels * size);
+            for (int b = 0; b < size; b++)
+            {
+                for (int64_t i = 0; i < numPixels; i++)
+                {
+                    scratch.raw[i * size + b] = scratch.shuffled[b * numPixels + i];
+                }
+            }
+            raw = scratch.raw.data();
+        }
+        for (int64_t i = 0; i < numPixels; i++)
+        {
+            output[i] = ReadBigEndianFloat(raw + i * size, size);
+        }
+        return true;
+    }
+
+    scratch.values.resize(numPixels);
+    int32_t* values = scratch.values.data();
+    unsigned char* compressed = const_cast<unsigned char*>(tile.bytes.data());
+    int compressedSize = (int) tile.bytes.size();
+    if (info.algorithm == TILE_RICE)
+    {
+        if (info.bytePix == 4)
+        {
+            if (fits_rdecomp(compressed, compressedSize, (unsigned int*) values, (int) numPixels, info.blockSize))
+            {
+                return false;
+            }
+        }
+        else if (info.bytePix == 2)
+        {
+            scratch.raw.resize(numPixels * sizeof(unsigned short));
+            unsigned short* shorts = (unsigned short*) scratch.raw.data();
+            if (fits_rdecomp_short(compressed, compressedSize, shorts, (int) numPixels, info.blockSize))
+            {
+                return false;
+            }
+            for (int64_t i = 0; i < numPixels; i++)
+            {
+                values[i] = (int16_t) shorts[i];
+            }
+        }
+        else
+        {
+            scratch.raw.resize(numPixels);
+            if (fits_rdecomp_byte(compressed, compressedSize, scratch.raw.data(), (int) numPixels, info.blockSize))
+            {
+                return false;
+            }
+            for (int64_t i = 0; i < numPixels; i++)
+            {
+                values[i] = scratch.raw[i];
+            }
+        }
+    }
+    else
+    {
+        int size = info.bytePix;
+        scratch.raw.resize(numPixels * size);
+        if (!Gunzip(tile.bytes.data(), tile.bytes.size(), scratch.raw.data(), scratch.raw.size()))
+        {
+            return false;
+        }
+        const uint8_t* raw = scratch.raw.data();
+        if (info.algorithm == TILE_GZIP_2)
+        {
+            for (int64_t i = 0; i < numPixels; i++)
+            {
+                uint8_t bytes[4];
+                for (int b = 0; b < size; b++)
+                {
+                    bytes[b] = raw[b * numPixels + i];
+                }
+                values[i] = ReadBigEndian(bytes, size);
+            }
+        }
+        else
+        {
+            for (int64_t i = 0; i < numPixels; i++)
+            {
+                values[i] = ReadBigEndian(raw + i * size, size);
+            }
+        }
+    }
+
+    if (info.quantized)
+    {
+        if (info.ditherMethod == NO_DITHER)
+        {
+            for (int64_t i = 0; i < numPixels; i++)
+            {
+                output[i] = (info.hasBlank && values[i] == tile.blank) ? NAN : (float) (values[i] * tile.scale + tile.zero);
+            }
+            return true;
+        }
+        const vector<float>& sequence = DitherSequence();
+        int64_t seedIndex = (tile.index + info.ditherSeed - 1) % TILE_COMPRESSION_RANDOM_VALUES;
+        int nextRandom = (int) (sequence[seedIndex] * 500);
+        for (int64_t i = 0; i < numPixels; i++)
+        {
+            if (info.hasBlank && values[i] == tile.blank)
+            {
+                output[i] = NAN;
+            }
+            else if (info.ditherMethod == SUBTRACTIVE_DITHER_2 && values[i] == QUANTIZED_ZERO_VALUE)
+            {
+                output[i] = 0.0f;
+            }
+            else
+            {
+                output[i] = (float) (((double) values[i] - sequence[nextRandom] + 0.5) * tile.scale + tile.zero);
+            }
+            if (++nextRandom == TILE_COMPRESSION_RANDOM_VALUES)
+            {
+                seedIndex = (seedIndex + 1) % TILE_COMPRESSION_RANDOM_VALUES;
+                nextRandom = (int) (sequence[seedIndex] * 500);
+            }
+        }
+        return true;
+    }
+
+    for (int64_t i = 0; i < numPixels; i++)
+    {
+        output[i] = (info.hasBlank && values[i] == info.blank) ? NAN : (float) (values[i] * info.bscale + info.bzero);
+    }
+    return true;
+}
+
+/**
+ * @brief Position and extent (0-based) of a tile within the image.
+ */
+int64_t TileGeometry(const CompressedImageInfo& info, int64_t index, int64_t* start, int64_t* extent)
+{
+    int64_t numPixels = 1;
+    for (int a = 0; a < info.naxis; a++)
+    {
+        start[a] = (index % info.tileCounts[a]) * info.tileDims[a];
+        extent[a] = min(info.tileDims[a], info.axes[a] - start[a]);
+        index /= info.tileCounts[a];
+        numPixels *= extent[a];
+    }
+    return numPixels;
+}
+
+/**
+ * @brief Copies the part of a decoded tile that overlaps the requested subset into the output, one tile row at a time.
+ */
+void ScatterTile(const CompressedImageInfo& info, const int64_t* tileStart, const int64_t* tileExtent, const float* pixels,
+    const long* startPix, const long* finalPix, const int64_t* strides, float* output)
+{
+    int64_t lo = max<int64_t>(tileStart[0], startPix[0] - 1);
+    int64_t hi = min<int64_t>(tileStart[0] + tileExtent[0], finalPix[0]);
+    if (lo >= hi)
+    {
+        return;
+    }
+    int64_t numRows = 1;
+    for (int a = 1; a < info.naxis; a++)
+    {
+        numRows *= tileExtent[a];
+    }
+    for (int64_t row = 0; row < numRows; row++)
+    {
+        int64_t remainder = row;
+        int64_t offset = lo - (startPix[0] - 1);
+        bool inside = true;
+        for (int a = 1; a < info.naxis && inside; a++)
+        {
+            int64_t coord = tileStart[a] + remainder % tileExtent[a];
+            remainder /= tileExtent[a];
+            inside = coord >= startPix[a] - 1 && coord < finalPix[a];
+            offset += (coord - (startPix[a] - 1)) * strides[a];
+        }
+        if (inside)
+        {
+            memcpy(output + offset, pixels + row * tileExtent[0] + (lo - tileStart[0]), (hi - lo) * sizeof(float));
+        }
+    }
+}
+
+/**
+ * @brief Reads the compressed bytes and per-tile scaling of one tile (0-based index) through CFITSIO.
+ */
+bool ReadTile(fitsfile* fptr, const CompressedImageInfo& info, int64_t index, CompressedTile& tile, int* status)
+{
+    LONGLONG row = index + 1;
+    LONGLONG length = 0;
+    LONGLONG heapOffset = 0;
+    int anynul = 0;
+    tile.index = index;
+    tile.lossless = false;
+    tile.scale = info.scale;
+    tile.zero = info.zero;
+    tile.blank = info.blank;
+    fits_read_descriptll(fptr, info.dataColumn, row, &length, &heapOffset, status);
+    int column = info.dataColumn;
+    if (length == 0 && info.gzipColumn && *status == 0)
+    {
+        fits_read_descriptll(fptr, info.gzipColumn, row, &length, &heapOffset, status);
+        column = info.gzipColumn;
+        tile.lossless = true;
+    }
+    tile.bytes.resize(length);
+    if (length)
+    {
+        fits_read_col(fptr, TBYTE, column, row, 1, length, nullptr, tile.bytes.data(), &anynul, status);
+    }
+    if (info.scaleColumn)
+    {
+        fits_read_col(fptr, TDOUBLE, info.scaleColumn, row, 1, 1, nullptr, &tile.scale, &anynul, status);
+    }
+    if (info.zeroColumn)
+    {
+        fits_read_col(fptr, TDOUBLE, info.zeroColumn, row, 1, 1, nullptr, &tile.zero, &anynul, status);
+    }
+    if (info.blankColumn)
+    {
+        LONGLONG blank = 0;
+        fits_read_col(fptr, TLONGLONG, info.blankColumn, row, 1, 1, nullptr, &blank, &anynul, status);
+        tile.blank = blank;
+    }
+    return *status == 0;
+}
+}
+
+bool ReadTileCompressedSubImage(fitsfile* fptr, int dims, const long* startPix, const long* finalPix, int64_t nelem, float** array, int* status)
+{
+    int probeStatus = 0;
+    if (!fits_is_compressed_image(fptr, &probeStatus) || probeStatus)
+    {
+        return false;
+    }
+    CompressedImageInfo info = {};
+    if (!ReadCompressedImageInfo(fptr, dims, info))
+    {
+        return false;
+    }
+
+    int64_t strides[TILE_COMPRESSION_MAX_AXES];
+    int64_t firstTile[TILE_COMPRESSION_MAX_AXES];
+    int64_t tileRange[TILE_COMPRESSION_MAX_AXES];
+    int64_t numTiles = 1;
+    for (int a = 0; a < info.naxis; a++)
+    {
+        if (startPix[a] < 1 || finalPix[a] > info.axes[a] || startPix[a] > finalPix[a])
+        {
+            return false;
+        }
+        strides[a] = a == 0 ? 1 : strides[a - 1] * (finalPix[a - 1] - startPix[a - 1] + 1);
+        firstTile[a] = (startPix[a] - 1) / info.tileDims[a];
+        tileRange[a] = (finalPix[a] - 1) / info.tileDims[a] - firstTile[a] + 1;
+        numTiles *= tileRange[a];
+    }
+
+    std::stringstream debug;
+    debug << "Reading tile-compressed sub image in parallel: " << numTiles << " overlapping tiles.";
+    WriteLogFile(defaultDebugFile.data(), debug.str().c_str(), 0);
+
+    float* dataarray = AllocateCubeBuffer<float>(nelem);
+    if (dataarray == nullptr)
+    {
+        *status = MEMORY_ALLOCATION;
+        return true;
+    }
+
+    try
+    {
+        int64_t next = 0;
+        while (next < numTiles && *status == 0)
+        {
+            // Sequential read of the next batch of overlapping tiles, in file order
+            vector<CompressedTile> batch;
+            int64_t batchBytes = 0;
+            while (next < numTiles && batchBytes < TILE_COMPRESSION_BATCH_BYTES)
+            {
+                int64_t remainder = next++;
+                int64_t index = 0;
+                int64_t multiplier = 1;
+                for (int a = 0; a < info.naxis; a++)
+                {
+                    index += (firstTile[a] + remainder % tileRange[a]) * multiplier;
+                    remainder /= tileRange[a];
+                    multiplier *= info.tileCounts[a];
+                }
+                batch.emplace_back();
+                if (!ReadTile(fptr, info, index, batch.back(), status))
+                {
+                    break;
+                }
+                batchBytes += batch.back().bytes.size();
+            }
+            if (*status)
+            {
+                break;
+            }
+
+            bool failed = false;
+            int64_t batchSize = batch.size();
+#pragma omp parallel
+            {
+                TileScratch scratch;
+                int64_t tileStart[TILE_COMPRESSION_MAX_AXES];
+                int64_t tileExtent[TILE_COMPRESSION_MAX_AXES];
+#pragma omp for schedule(dynamic)
+                for (int64_t i = 0; i < batchSize; i++)
+                {
+                    int64_t numPixels = TileGeometry(info, batch[i].index, tileStart, tileExtent);
+                    if (DecodeTile(info, batch[i], numPixels, scratch))
+                    {
+                        ScatterTile(info, tileStart, tileExtent, scratch.pixels.data(), startPix, finalPix, strides, dataarray);
+                    }
+                    else
+                    {
+#pragma omp critical
+                        failed = true;
+                    }
+                }
+            }
+            if (failed)
+            {
+                *status = DATA_DECOMPRESSION_ERR;
+            }
+        }
+    }
+    catch (const bad_alloc&)
+    {
+        *status = MEMORY_ALLOCATION;
+    }
+
+    if (*status)
+    {
+        FreeFitsPtrMemory(dataarray);
+        return true;
+    }
+    *array = dataarray;
+    return true;
+}
+
+namespace
+{
+/**
+ * @brief Tile source over a dense cube. Tile sources fill whole rows [y0, y0 + rows) of channel z.
+ */
+template<typename T>
+struct DenseTileSource
+{
+    const T* data;
+    int64_t dimX, dimY;
+
+    void Read(int64_t y0, int64_t rows, int64_t z, T* output) const
+    {
+        memcpy(output, data + (z * dimY + y0) * dimX, rows * dimX * sizeof(T));
+    }
+};
+
+struct SparseTileSource
+{
+    const SparseMask* mask;
+
+    void Read(int64_t y0, int64_t rows, int64_t z, int16_t* output) const
+    {
+        for (int64_t r = 0; r < rows; r++)
+        {
+            mask->ReadRow(y0 + r, z, 0, mask->dimX, output + r * mask->dimX);
+        }
+    }
+};
+
+template<typename T>
+void StoreBigEndian(T value, uint8_t* bytes)
+{
+    typename conditional<sizeof(T) == 2, uint16_t, uint32_t>::type bits;
+    memcpy(&bits, &value, sizeof(T));
+    for (int b = sizeof(T) - 1; b >= 0; b--)
+    {
+        bytes[b] = bits & 0xFF;
+        bits >>= 8;
+    }
+}
+
+bool Gzip(const uint8_t* input, size_t inputSize, vector<uint8_t>& output)
+{
+    z_stream stream = {};
+    // 15 + 16: maximum window with a gzip wrapper, as expected by CFITSIO
+    if (deflateInit2(&stream, TILE_COMPRESSION_GZIP_LEVEL, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+    {
+        return false;
+    }
+    output.resize(deflateBound(&stream, (uLong) inputSize) + 32);
+    stream.next_in = const_cast<Bytef*>(input);
+    stream.avail_in = (uInt) inputSize;
+    stream.next_out = output.data();
+    stream.avail_out = (uInt) output.size();
+    int result = deflate(&stream, Z_FINISH);
+    output.resize(stream.total_out);
+    deflateEnd(&stream);
+    return result == Z_STREAM_END;
+}
+
+template<typename T>
+bool CompressTile(const T* pixels, int64_t numPixels, int compressionType, vector<uint8_t>& output, vector<uint8_t>& scratch)
+{
+    if constexpr (is_same<T, int16_t>::value)
+    {
+        if (compressionType == RICE_1)
+        {
+            output.resize(numPixels * (sizeof(T) + 1) + 64);
+            int length = fits_rcomp_short(const_cast<short*>(pixels), (int) numPixels, output.data(), (int) output.size(), TILE_COMPRESSION_RICE_BLOCK_SIZE);
+            if (length < 0)
+            {
+                return false;
+            }
+            output.resize(length);
+            return true;
+        }
+    }
+
+    const int size = sizeof(T);
+    scratch.resize(numPixels * size);
+    uint8_t bytes[sizeof(T)];
+    for (int64_t i = 0; i < numPixels; i++)
+    {
+        StoreBigEndian(pixels[i], bytes);
+        for (int b = 0; b < size; b++)
+        {
+            // GZIP_2 shuffles the bytes so that all most significant bytes come first
+            if (compressionType == GZIP_2)
+            {
+                scratch[b * numPixels + i] = bytes[b];
+            }
+            else
+            {
+                scratch[i * size + b] = bytes[b];
+            }
+        }
+    }
+    return Gzip(scratch.data(), scratch.size(), output);
+}
+
+int64_t TileRows(int64_t dimX, int64_t dimY)
+{
+    return max<int64_t>(1, min<int64_t>(dimY, TILE_COMPRESSION_TILE_PIXELS / dimX));
+}
+
+/**
+ * @brief Appends a compressed image HDU, compressing batches of tiles with all threads and writing them in order.
+ */
+template<typename T, typename Source>
+void WriteCompressedTiles(fitsfile* fptr, fitsfile* headerSource, const Source& source, int64_t dimX, int64_t dimY, int64_t dimZ, const int64_t* cropStart,
+                          const int* factors, int compressionType, int* status)
+{
+    int64_t tileRows = TileRows(dimX, dimY);
+    int64_t tilesPerChannel = (dimY + tileRows - 1) / tileRows;
+    int64_t numTiles = tilesPerChannel * dimZ;
+
+    // 64-bit descriptors are needed once the heap may exceed 2 GB
+    char ttype[] = "COMPRESSED_DATA";
+    char tform[] = "1PB";
+    if (dimX * dimY * dimZ * (int64_t) sizeof(T) > numeric_limits<int32_t>::max())
+    {
+        tform[1] = 'Q';
+    }
+    char* ttypes[] = {ttype};
+    char* tforms[] = {tform};
+    fits_create_tbl(fptr, BINARY_TBL, 0, 1, ttypes, tforms, nullptr, nullptr, status);
+
+    int zimage = 1;
+    int zbitpix = is_same<T, float>::value ? FLOAT_IMG : SHORT_IMG;
+    int znaxis = 3;
+    LONGLONG axes[3] = {dimX, dimY, dimZ};
+    LONGLONG tiles[3] = {dimX, tileRows, 1};
+    fits_write_key(fptr, TLOGICAL, "ZIMAGE", &zimage, "extension contains compressed image", status);
+    fits_write_key(fptr, TINT, "ZBITPIX", &zbitpix, "data type of original image", status);
+    fits_write_key(fptr, TINT, "ZNAXIS", &znaxis, "dimension of original image", status);
+    for (int a = 0; a < 3; a++)
+    {
+        char name[FLEN_KEYWORD];
+        snprintf(name, FLEN_KEYWORD, "ZNAXIS%d", a + 1);
+        fits_write_key(fptr, TLONGLONG, name, &axes[a], "length of original image axis", status);
+        snprintf(name, FLEN_KEYWORD, "ZTILE%d", a + 1);
+        fits_write_key(fptr, TLONGLONG, name, &tiles[a], "size of tiles to be compressed", status);
+    }
+    char algorithm[FLEN_VALUE];
+    strcpy(algorithm, compressionType == RICE_1 ? "RICE_1" : (compressionType == GZIP_2 ? "GZIP_2" : "GZIP_1"));
+    fits_write_key(fptr, TSTRING, "ZCMPTYPE", algorithm, "compression algorithm", status);
+    if (compressionType == RICE_1)
+    {
+        char blockSizeName[] = "BLOCKSIZE";
+        char bytePixName[] = "BYTEPIX";
+        int blockSize = TILE_COMPRESSION_RICE_BLOCK_SIZE;
+        int bytePix = sizeof(T);
+        fits_write_key(fptr, TSTRING, "ZNAME1", blockSizeName, "compression block size", status);
+        fits_write_key(fptr, TINT, "ZVAL1", &blockSize, "pixels per block", status);
+        fits_write_key(fptr, TSTRING, "ZNAME2", bytePixName, "bytes per pixel (1, 2, 4, or 8)", status);
+        fits_write_key(fptr, TINT, "ZVAL2", &bytePix, "bytes per pixel (1, 2, 4, or 8)", status);
+    }
+    if (is_same<T, float>::value)
+    {
+        char quantize[] = "NONE";
+        fits_write_key(fptr, TSTRING, "ZQUANTIZ", quantize, "lossless compression without quantization", status);
+    }
+    CopyHeaderRecords(headerSource, fptr, status);
+    UpdateSubcubeWcs(fptr, cropStart, factors, status);
+
+    LONGLONG row = 1;
+    int64_t next = 0;
+    while (next < numTiles && *status == 0)
+    {
+        int64_t batchEnd = next;
+        int64_t batchBytes = 0;
+        while (batchEnd < numTiles && batchBytes < TILE_COMPRESSION_BATCH_BYTES)
+        {
+            batchBytes += dimX * tileRows * sizeof(T);
+            batchEnd++;
+        }
+
+        vector<vector<uint8_t>> compressed(batchEnd - next);
+        bool failed = false;
+#pragma omp parallel
+        {
+            vector<T> pixels;
+            vector<uint8_t> scratch;
+#pragma omp for schedule(dynamic)
+            for (int64_t i = next; i < batchEnd; i++)
+            {
+                int64_t z = i / tilesPerChannel;
+                int64_t y0 = (i % tilesPerChannel) * tileRows;
+                int64_t rows = min(tileRows, dimY - y0);
+                pixels.resize(rows * dimX);
+                source.Read(y0, rows, z, pixels.data());
+                if (!CompressTile(pixels.data(), rows * dimX, compressionType, compressed[i - next], scratch))
+                {
+#pragma omp critical
+                    failed = true;
+                }
+            }
+        }
+        if (failed)
+        {
+            *status = DATA_COMPRESSION_ERR;
+            break;
+        }
+        // Tiles are appended sequentially, in row order
+        for (auto& tile : compressed)
+        {
+            fits_write_col(fptr, TBYTE, 1, row++, 1, (LONGLONG) tile.size(), tile.data(), status);
+            vector<uint8_t>().swap(tile);
+        }
+        next = batchEnd;
+    }
+}
+
+/**
+ * @brief Writes a compressed image through CFITSIO's own (serial) compressor, used for HCOMPRESS and for
+ * quantized floating point RICE.
+ */
+template<typename T, typename Source>
+void WriteCfitsioCompressed(fitsfile* fptr, fitsfile* headerSource, const Source& source, int64_t dimX, int64_t dimY, int64_t dimZ, const int64_t* cropStart,
+                            const int* factors, int compressionType, int* status)
+{
+    int64_t tileRows = TileRows(dimX, dimY);
+    long tileDims[3] = {(long) dimX, (long) tileRows, 1};
+    long naxes[3] = {(long) dimX, (long) dimY, (long) dimZ};
+    int datatype = is_same<T, float>::value ? TFLOAT : TSHORT;
+    fits_set_compression_type(fptr, compressionType, status);
+    fits_set_tile_dim(fptr, 3, tileDims, status);
+    fits_create_img(fptr, is_same<T, float>::value ? FLOAT_IMG : SHORT_IMG, 3, naxes, status);
+    CopyHeaderRecords(headerSource, fptr, status);
+    UpdateSubcubeWcs(fptr, cropStart, factors, status);
+
+    vector<T> pixels(dimX * tileRows);
+    for (int64_t z = 0; z < dimZ && *status == 0; z++)
+    {
+        for (int64_t y0 = 0; y0 < dimY && *status == 0; y0 += tileRows)
+        {
+            int64_t rows = min(tileRows, dimY - y0);
+            source.Read(y0, rows, z, pixels.data());
+            long firstPix[3] = {1, (long) y0 + 1, (long) z + 1};
+            long lastPix[3] = {(long) dimX, (long) (y0 + rows), (long) z + 1};
+            fits_write_subset(fptr, datatype, firstPix, lastPix, pixels.data(), status);
+        }
+    }
+}
+
+template<typename T, typename Source>
+int WriteCompressedFile(char* fileName, fitsfile* headerSource, const Source& source, int64_t dimX, int64_t dimY, int64_t dimZ, const int64_t* cropStart,
+                        const int* factors, int compressionType, char* historyTimestamp, int* status)
+{
+    if (dimX < 1 || dimY < 1 || dimZ < 1)
+    {
+        return *status = BAD_DIMEN;
+    }
+    bool parallel = compressionType == GZIP_1 || compressionType == GZIP_2 || (compressionType == RICE_1 && is_same<T, int16_t>::value);
+    if (!parallel && compressionType != RICE_1 && compressionType != HCOMPRESS_1)
+    {
+        return *status = DATA_COMPRESSION_ERR;
+    }
+
+    std::stringstream debug;
+    debug << "Writing tile-compressed image (type " << compressionType << ") of [" << dimX << ", " << dimY << ", " << dimZ << "] to " << fileName << ".";
+    if (!parallel && is_same<T, float>::value)
+    {
+        debug << " Floating point data will be quantized (lossy).";
+    }
+    WriteLogFile(defaultDebugFile.data(), debug.str().c_str(), 0);
+
+    fitsfile* fptr;
+    if (fits_create_file(&fptr, fileName, status))
+    {
+        return *status;
+    }
+    try
+    {
+        if (parallel)
+        {
+            // Empty primary HDU, followed by the compressed image extension
+            fits_create_img(fptr, SHORT_IMG, 0, nullptr, status);
+            WriteCompressedTiles<T>(fptr, headerSource, source, dimX, dimY, dimZ, cropStart, factors, compressionType, status);
+        }
+        else
+        {
+            WriteCfitsioCompressed<T>(fptr, headerSource, source, dimX, dimY, dimZ, cropStart, factors, compressionType, status);
+        }
+    }
+    catch (const bad_alloc&)
+    {
+        *status = MEMORY_ALLOCATION;
+    }
+    if (historyTimestamp)
+    {
+        fits_write_history(fptr, historyTimestamp, status);
+    }
+
+    debug.clear();
+    debug.str("");
+    debug << "Completed tile-compressed image writing with result code " << *status << ".";
+    WriteLogFile(defaultDebugFile.data(), debug.str().c_str(), 0);
+
+    int closeStatus = 0;
+    if (*status)
+    {
+        fits_delete_file(fptr, &closeStatus);
+    }
+    else
+    {
+        fits_close_file(fptr, status);
+    }
+    return *status;
+}
+}
+
+int FitsWriteCompressedImageFloat(char* fileName, fitsfile* headerSource, const float* data, int64_t dimX, int64_t dimY, int64_t dimZ, int64_t cropStartX,
+                                  int64_t cropStartY, int64_t cropStartZ, int factorX, int factorY, int factorZ, int compressionType, char* historyTimestamp, int* status)
+{
+    const int64_t cropStart[3] = {cropStartX, cropStartY, cropStartZ};
+    const int factors[3] = {max(factorX, 1), max(factorY, 1), max(factorZ, 1)};
+    DenseTileSource<float> source = {data, dimX, dimY};
+    return WriteCompressedFile<float>(fileName, headerSource, source, dimX, dimY, dimZ, cropStart, factors, compressionType, historyTimestamp, status);
+}
+
+int FitsWriteCompressedImageInt16(char* fileName, fitsfile* headerSource, const int16_t* data, int64_t dimX, int64_t dimY, int64_t dimZ, int64_t cropStartX,
+                                  int64_t cropStartY, int64_t cropStartZ, int factorX, int factorY, int factorZ, int compressionType, char* historyTimestamp, int* status)
+{
+    const int64_t cropStart[3] = {cropStartX, cropStartY, cropStartZ};
+    const int factors[3] = {max(factorX, 1), max(factorY, 1), max(factorZ, 1)};
+    DenseTileSource<int16_t> source = {data, dimX, dimY};
+    return WriteCompressedFile<int16_t>(fileName, headerSource, source, dimX, dimY, dimZ, cropStart, factors, compressionType, historyTimestamp, status);
+}
+
+int FitsWriteCompressedSparseMask(char* fileName, fitsfile* headerSource, const SparseMask* mask, int64_t cropStartX, int64_t cropStartY, int64_t cropStartZ,
+                                  int factorX, int factorY, int factorZ, int compressionType, char* historyTimestamp, int* status)
+{
+    if (!mask)
+    {
+        return *status = NULL_INPUT_PTR;
+    }
+    const int64_t cropStart[3] = {cropStartX, cropStartY, cropStartZ};
+    const int factors[3] = {max(factorX, 1), max(factorY, 1), max(factorZ, 1)};
+    SparseTileSource source = {mask};
+    return WriteCompressedFile<int16_t>(fileName, headerSource, source, mask->dimX, mask->dimY, mask->dimZ, cropStart, factors, compressionType, historyTimestamp,
+                                        status);
+}
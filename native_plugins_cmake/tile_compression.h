@@ -0,0 +1,105 @@
+/*
+ * iDaVIE (immersive Data Visualisation Interactive Explorer)
+ * Copyright (C) 2024 Inter-University Institute for Data Intensive Astronomy
+ *
+ * This file is part of the iDaVIE project.
+ *
+ * iDaVIE is free software: you can redistribute it and/or modify it under the terms 
+ * of the GNU Lesser General Public License (LGPL) as published by the Free Software 
+ * Foundation, either version 3 of the License, or (at your option) any later version.
+ *
+ * iDaVIE is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; 
+ * without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR 
+ * PURPOSE. See the GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License along with 
+ * iDaVIE in the LICENSE file. If not, see <https://www.gnu.org/licenses/>.
+ *
+ * Additional information and disclaimers regarding liability and third-party 
+ * components can be found in the DISCLAIMER and NOTICE files included with this project.
+ *
+ */
+#ifndef NATIVE_PLUGINS_TILE_COMPRESSION_H
+#define NATIVE_PLUGINS_TILE_COMPRESSION_H
+
+#include <cstdint>
+#include <vector>
+#include <omp.h>
+#include <fitsio.h>
+
+#define DllExport __declspec (dllexport)
+
+// Compressed tiles are read from disk in batches of at most this many bytes, and each batch is decompressed in parallel
+#define TILE_COMPRESSION_BATCH_BYTES (256LL * 1024 * 1024)
+// Highest image dimensionality handled by the parallel tile reader
+#define TILE_COMPRESSION_MAX_AXES 6
+// Length of the dither sequence defined by the tiled image compression convention
+#define TILE_COMPRESSION_RANDOM_VALUES 10000
+// Written tiles span whole rows of a channel, with enough rows to hold about this many pixels
+#define TILE_COMPRESSION_TILE_PIXELS (1 << 20)
+#define TILE_COMPRESSION_RICE_BLOCK_SIZE 32
+// zlib level used for GZIP tiles; masks compress well even at the fastest level
+#define TILE_COMPRESSION_GZIP_LEVEL 1
+
+struct SparseMask;
+
+/**
+ * @brief Reads a rectangular subset of a tile-compressed image HDU (RICE_1, GZIP_1 or GZIP_2), decompressing the
+ * tiles that overlap the subset in parallel and scattering them into the output.
+ *
+ * The compressed tiles are read sequentially through CFITSIO in batches of TILE_COMPRESSION_BATCH_BYTES, after which
+ * each batch is decompressed, unquantized (including subtractive dithering) and scaled by all threads.
+ *
+ * @param fptr The fitsfile being read, positioned at a compressed image HDU.
+ * @param dims The number of axes in the FITS image.
+ * @param startPix The first pixel (1-based) of the subset along each axis.
+ * @param finalPix The last pixel (1-based) of the subset along each axis.
+ * @param nelem The number of pixels in the subset.
+ * @param array Output for the subset, allocated with AllocateCubeBuffer.
+ * @param status Value containing outcome of CFITSIO operation.
+ * @return true if the HDU layout is supported and the read was attempted (status holds the result), or false if the
+ *         caller should fall back to CFITSIO's serial reader (status is unchanged).
+ */
+bool ReadTileCompressedSubImage(fitsfile*, int, const long*, const long*, int64_t, float**, int*);
+
+extern "C"
+{
+/**
+ * @brief Writes a float cube to a new tile-compressed FITS file (an empty primary HDU followed by the compressed image).
+ *
+ * GZIP_1 and GZIP_2 tiles are lossless and compressed by all threads before being appended in order. RICE_1 and
+ * HCOMPRESS_1 are handed to CFITSIO's serial compressor, which quantizes floating point data with its default
+ * (dithered) quantization level, so they are lossy for float cubes. Callers must only offer them as an explicit lossy
+ * option; GZIP_1 or GZIP_2 should be used when the values have to be preserved exactly.
+ *
+ * The compressed writers are not yet called from the export UI.
+ *
+ * @param fileName The destination file name (prefix with '!' to overwrite).
+ * @param headerSource Optional fitsfile whose current header is copied, without structural and scaling keywords. Its WCS
+ *        is shifted and scaled to the written region, as in FitsWriteSubcubeFromMemory.
+ * @param data The cube, in X-Y-Z order.
+ * @param dimX, dimY, dimZ The cube dimensions.
+ * @param cropStartX, cropStartY, cropStartZ First pixel (1-based) of the written region within the header source's cube,
+ *        counted in pixels of the downsampled cube; 1, 1, 1 when writing the whole cube.
+ * @param factorX, factorY, factorZ Downsampling factors of the written cube relative to the header source's cube.
+ * @param compressionType RICE_1, GZIP_1, GZIP_2 or HCOMPRESS_1, using the CFITSIO values.
+ * @param historyTimestamp A char array containing the history data to be written to the file header.
+ * @param status Value containing outcome of CFITSIO operation.
+ * @return int The result code, 0 for success, a CFITSIO error code if not.
+ */
+DllExport int FitsWriteCompressedImageFloat(char*, fitsfile*, const float*, int64_t, int64_t, int64_t, int64_t, int64_t, int64_t, int, int, int, int, char*, int*);
+
+/**
+ * @brief Int16 counterpart of FitsWriteCompressedImageFloat, intended for masks. RICE_1, GZIP_1 and GZIP_2 tiles are
+ * compressed in parallel; HCOMPRESS_1 is handed to CFITSIO. All methods are lossless for int16 data.
+ */
+DllExport int FitsWriteCompressedImageInt16(char*, fitsfile*, const int16_t*, int64_t, int64_t, int64_t, int64_t, int64_t, int64_t, int, int, int, int, char*, int*);
+
+/**
+ * @brief Writes a sparse mask to a new tile-compressed FITS file, decoding one tile at a time so that the dense mask
+ * is never materialised. Parameters as for FitsWriteCompressedImageInt16.
+ */
+DllExport int FitsWriteCompressedSparseMask(char*, fitsfile*, const SparseMask*, int64_t, int64_t, int64_t, int, int, int, int, char*, int*);
+}
+
+#endif //NATIVE_PLUGINS_TILE_COMPRESSION_H
@@ -0,0 +1,372 @@
+/*
+ * iDaVIE (immersive Data Visualisation Interactive Explorer)
+ * Copyright (C) 2024 Inter-University Institute for Data Intensive Astronomy
+ *
+ * This file is part of the iDaVIE project.
+ *
+ * iDaVIE is free software: you can redistribute it and/or modify it under the terms 
+ * of the GNU Lesser General Public License (LGPL) as published by the Free Software 
+ * Foundation, either version 3 of the License, or (at your option) any later version.
+ *
+ * iDaVIE is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; 
+ * without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR 
+ * PURPOSE. See the GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License along with 
+ * iDaVIE in the LICENSE file. If not, see <https://www.gnu.org/licenses/>.
+ *
+ * Additional information and disclaimers regarding liability and third-party 
+ * components can be found in the DISCLAIMER and NOTICE files included with this project.
+ *
+ */
+#include "typed_cube.h"
+#include "cube_buffer.h"
+#include "data_analysis_tool.h"
+#include "spectral_cube.h"
+
+#include <algorithm>
+#include <limits>
+#include <new>
+#include <vector>
+
+using namespace std;
+
+namespace
+{
+template<typename T>
+ScaledDecoder<T> MakeDecoder(const TypedCube& cube)
+{
+    ScaledDecoder<T> decoder;
+    // A BLANK value outside the range of the storage type cannot occur in the data
+    decoder.hasBlank = cube.hasBlank && cube.blank >= (int64_t) numeric_limits<T>::lowest() && cube.blank <= (int64_t) numeric_limits<T>::max();
+    decoder.blank = decoder.hasBlank ? (T) cube.blank : T();
+    decoder.scale = cube.scale;
+    decoder.zero = cube.zero;
+    return decoder;
+}
+
+/**
+ * @brief Calls func with the cube's data, cast to its storage type, and the matching value decoder.
+ */
+template<typename Func>
+int WithTypedData(const TypedCube* cube, Func&& func)
+{
+    if (!cube || !cube->data)
+    {
+        return EXIT_FAILURE;
+    }
+    switch (cube->storage)
+    {
+        case TYPED_CUBE_FLOAT32:
+            return func(static_cast<const float*>(cube->data), FloatDecoder());
+        case TYPED_CUBE_INT16:
+            return func(static_cast<const int16_t*>(cube->data), MakeDecoder<int16_t>(*cube));
+        case TYPED_CUBE_INT32:
+            return func(static_cast<const int32_t*>(cube->data), MakeDecoder<int32_t>(*cube));
+        default:
+            return EXIT_FAILURE;
+    }
+}
+
+/**
+ * @brief Reads a subset of the image in channel slabs into a buffer of the storage type, without scaling.
+ */
+template<typename T>
+int ReadRawChunks(fitsfile* fptr, int dims, int zAxis, const long* startPix, const long* finalPix, int datatype, T* data, int* status)
+{
+    vector<long> sliceStartPix(startPix, startPix + dims);
+    vector<long> sliceFinalPix(finalPix, finalPix + dims);
+    vector<long> increment(dims, 1);
+    const int64_t sliceSize = (int64_t) (finalPix[0] - startPix[0] + 1) * (finalPix[1] - startPix[1] + 1);
+    const int64_t channelsPerRead = max<int64_t>(1, TYPED_CUBE_READ_CHUNK_BYTES / (sliceSize * (int64_t) sizeof(T)));
+    T nulval = 0;
+    int anynul;
+    for (long z = startPix[zAxis]; z <= finalPix[zAxis] && !*status; z += (long) channelsPerRead)
+    {
+        sliceStartPix[zAxis] = z;
+        sliceFinalPix[zAxis] = min(z + (long) channelsPerRead - 1, finalPix[zAxis]);
+        fits_read_subset(fptr, datatype, sliceStartPix.data(), sliceFinalPix.data(), increment.data(), &nulval, data + (z - startPix[zAxis]) * sliceSize,
+                         &anynul, status);
+    }
+    return *status;
+}
+}
+
+/**
+ * @brief Reads a rectangular subset of the FITS image in the storage type of the file.
+ *
+ * BITPIX 16 and 32 images are read as raw integers, with BSCALE, BZERO and BLANK recorded in the cube so that the
+ * TypedCube kernels can decode them; BITPIX -32 images are read as floats. Other BITPIX values are rejected with
+ * BAD_BITPIX, and should be read through FitsReadSubImageFloat instead. The scaling of the HDU is restored afterwards.
+ *
+ * @param fptr The fitsfile being worked on.
+ * @param dims The number of axes in the FITS image.
+ * @param zAxis The index of the z Axis in the FITS image.
+ * @param startPix An array containing the indices of the first pixel (xyz, left bottom front) to be read.
+ * @param finalPix An array containing the indices of the last pixel (xyz, right top back) to be read.
+ * @param result Output pointer to the new cube, to be released with FreeTypedCube.
+ * @param status Value containing outcome of CFITSIO operation.
+ * @return int The result code, 0 for success, a CFITSIO error code if not.
+ */
+int FitsReadSubImageTyped(fitsfile* fptr, int dims, int zAxis, long* startPix, long* finalPix, TypedCube** result, int* status)
+{
+    if (*status)
+    {
+        return *status;
+    }
+    if (!result || dims < 3 || zAxis < 2 || zAxis >= dims)
+    {
+        return *status = BAD_DIMEN;
+    }
+    int bitpix = 0;
+    if (fits_get_img_type(fptr, &bitpix, status))
+    {
+        return *status;
+    }
+
+    int32_t storage;
+    switch (bitpix)
+    {
+        case SHORT_IMG:
+            storage = TYPED_CUBE_INT16;
+            break;
+        case LONG_IMG:
+            storage = TYPED_CUBE_INT32;
+            break;
+        case FLOAT_IMG:
+            storage = TYPED_CUBE_FLOAT32;
+            break;
+        default:
+            return *status = BAD_BITPIX;
+    }
+
+    double scale = 1.0;
+    double zero = 0.0;
+    LONGLONG blank = 0;
+    int hasBlank = 0;
+    if (storage != TYPED_CUBE_FLOAT32)
+    {
+        if (fits_read_key(fptr, TDOUBLE, "BSCALE", &scale, nullptr, status) == KEY_NO_EXIST)
+        {
+            *status = 0;
+            scale = 1.0;
+        }
+        if (fits_read_key(fptr, TDOUBLE, "BZERO", &zero, nullptr, status) == KEY_NO_EXIST)
+        {
+            *status = 0;
+            zero = 0.0;
+        }
+        if (fits_read_key(fptr, TLONGLONG, "BLANK", &blank, nullptr, status) == KEY_NO_EXIST)
+        {
+            *status = 0;
+        }
+        else
+        {
+            hasBlank = 1;
+        }
+        // Raw values are read and decoded by the kernels instead
+        fits_set_bscale(fptr, 1.0, 0.0, status);
+        if (*status)
+        {
+            return *status;
+        }
+    }
+
+    int64_t dimX = finalPix[0] - startPix[0] + 1;
+    int64_t dimY = finalPix[1] - startPix[1] + 1;
+    int64_t dimZ = finalPix[zAxis] - startPix[zAxis] + 1;
+    int64_t numberElements = dimX * dimY * dimZ;
+    TypedCube* cube = new (nothrow) TypedCube();
+    if (cube)
+    {
+        switch (storage)
+        {
+            case TYPED_CUBE_INT16:
+                cube->data = AllocateCubeBuffer<int16_t>(numberElements);
+                if (cube->data)
+                {
+                    ReadRawChunks(fptr, dims, zAxis, startPix, finalPix, TSHORT, static_cast<int16_t*>(cube->data), status);
+                }
+                break;
+            case TYPED_CUBE_INT32:
+                cube->data = AllocateCubeBuffer<int32_t>(numberElements);
+                if (cube->data)
+                {
+                    ReadRawChunks(fptr, dims, zAxis, startPix, finalPix, TINT, static_cast<int32_t*>(cube->data), status);
+                }
+                break;
+            default:
+                cube->data = AllocateCubeBuffer<float>(numberElements);
+                if (cube->data)
+                {
+                    ReadRawChunks(fptr, dims, zAxis, startPix, finalPix, TFLOAT, static_cast<float*>(cube->data), status);
+                }
+                break;
+        }
+    }
+    if (storage != TYPED_CUBE_FLOAT32)
+    {
+        int scaleStatus = 0;
+        fits_set_bscale(fptr, scale, zero, &scaleStatus);
+    }
+    if (!cube || !cube->data)
+    {
+        delete cube;
+        return *status = MEMORY_ALLOCATION;
+    }
+
+    cube->storage = storage;
+    cube->hasBlank = hasBlank;
+    cube->blank = blank;
+    cube->scale = scale;
+    cube->zero = zero;
+    cube->dimX = dimX;
+    cube->dimY = dimY;
+    cube->dimZ = dimZ;
+    if (*status)
+    {
+        FreeTypedCube(cube);
+        return *status;
+    }
+    *result = cube;
+    return 0;
+}
+
+/**
+ * @brief Computes the maximum, minimum, mean and standard deviation of a typed cube, ignoring blank and NaN voxels.
+ *
+ * Unlike FindStats, the mean and standard deviation are normalised by the number of valid voxels.
+ *
+ * @return int EXIT_SUCCESS, or EXIT_FAILURE if the cube is invalid or has no valid voxels.
+ */
+int TypedCubeFindStats(const TypedCube* cube, float* maxResult, float* minResult, float* meanResult, float* stdDevResult)
+{
+    return WithTypedData(cube, [&](const auto* data, const auto& decoder) {
+        return ComputeStats(data, decoder, cube->dimX * cube->dimY * cube->dimZ, false, maxResult, minResult, meanResult, stdDevResult);
+    });
+}
+
+/**
+ * @brief Computes the histogram of the physical values of a typed cube, with the same binning as GetHistogram.
+ *
+ * @param cube The cube.
+ * @param numBins The number of bins.
+ * @param minVal, maxVal The range covered by the bins; the maximum is included in the final bin.
+ * @param histogram Output for the bin counts, to be freed with FreeDataAnalysisMemory.
+ * @return int EXIT_SUCCESS, or EXIT_FAILURE if the arguments are invalid.
+ */
+int TypedCubeGetHistogram(const TypedCube* cube, int numBins, float minVal, float maxVal, int** histogram)
+{
+    if (numBins < 1 || !(maxVal > minVal) || !histogram)
+    {
+        return EXIT_FAILURE;
+    }
+    int* histogramArray = new (nothrow) int[numBins]();
+    if (!histogramArray)
+    {
+        return EXIT_FAILURE;
+    }
+    int result = EXIT_FAILURE;
+    try
+    {
+        result = WithTypedData(cube, [&](const auto* data, const auto& decoder) {
+            return ComputeHistogram(data, decoder, cube->dimX * cube->dimY * cube->dimZ, numBins, minVal, maxVal, histogramArray);
+        });
+    }
+    catch (const bad_alloc&)
+    {
+        result = EXIT_FAILURE;
+    }
+    if (result != EXIT_SUCCESS)
+    {
+        delete[] histogramArray;
+        return result;
+    }
+    *histogram = histogramArray;
+    return EXIT_SUCCESS;
+}
+
+/**
+ * @brief Crops and downsamples a typed cube into a float cube, as DataCropAndDownsample does for float cubes.
+ *
+ * @param cube The cube.
+ * @param newDataPtr Output for the downsampled cube, to be freed with FreeDataAnalysisMemory.
+ * @param cropX1, cropY1, cropZ1, cropX2, cropY2, cropZ2 Corners of the region (1-based, inclusive).
+ * @param factorX, factorY, factorZ Downsampling factors.
+ * @param maxDownsampling If true, uses max pooling; otherwise, uses average pooling.
+ * @return int EXIT_SUCCESS, or EXIT_FAILURE on invalid cropping parameters.
+ */
+int TypedCubeCropAndDownsample(const TypedCube* cube, float** newDataPtr, int64_t cropX1, int64_t cropY1, int64_t cropZ1, int64_t cropX2, int64_t cropY2,
+                               int64_t cropZ2, int factorX, int factorY, int factorZ, bool maxDownsampling)
+{
+    if (!newDataPtr || factorX < 1 || factorY < 1 || factorZ < 1)
+    {
+        return EXIT_FAILURE;
+    }
+    return WithTypedData(cube, [&](const auto* data, const auto& decoder) {
+        if (maxDownsampling)
+        {
+            return DataCropAndDownsample<true>(data, decoder, newDataPtr, cube->dimX, cube->dimY, cube->dimZ, cropX1, cropY1, cropZ1, cropX2, cropY2, cropZ2,
+                                               factorX, factorY, factorZ);
+        }
+        return DataCropAndDownsample<false>(data, decoder, newDataPtr, cube->dimX, cube->dimY, cube->dimZ, cropX1, cropY1, cropZ1, cropX2, cropY2, cropZ2,
+                                            factorX, factorY, factorZ);
+    });
+}
+
+/**
+ * @brief Computes the moment 0 and moment 1 maps of a channel range of a typed cube, as ComputeMomentMaps does.
+ *
+ * @param cube The cube.
+ * @param zStart, zEnd The channel range, 0-based and half-open.
+ * @param spectrum Spectral coordinate of each of the dimZ channels, or nullptr to use the channel index.
+ * @param threshold Minimum value of the voxels included.
+ * @param moment0 Caller-owned buffer of dimX * dimY floats receiving moment 0.
+ * @param moment1 Caller-owned buffer of dimX * dimY floats receiving moment 1, or nullptr.
+ * @return int EXIT_SUCCESS, or EXIT_FAILURE if the arguments are invalid.
+ */
+int TypedCubeMomentMaps(const TypedCube* cube, int64_t zStart, int64_t zEnd, const float* spectrum, float threshold, float* moment0, float* moment1)
+{
+    if (!cube || !moment0)
+    {
+        return EXIT_FAILURE;
+    }
+    zStart = max<int64_t>(zStart, 0);
+    zEnd = min(zEnd, cube->dimZ);
+    if (zStart >= zEnd)
+    {
+        return EXIT_FAILURE;
+    }
+    return WithTypedData(cube, [&](const auto* data, const auto& decoder) {
+        ComputeMomentRows(data, decoder, cube->dimX, cube->dimY, zStart, zEnd, spectrum, threshold, moment0, moment1);
+        return EXIT_SUCCESS;
+    });
+}
+
+/**
+ * @brief Releases a typed cube and its data.
+ */
+int FreeTypedCube(TypedCube* cube)
+{
+    if (!cube)
+    {
+        return EXIT_FAILURE;
+    }
+    if (cube->data && !ReleaseCubeBuffer(cube->data))
+    {
+        switch (cube->storage)
+        {
+            case TYPED_CUBE_INT16:
+                delete[] static_cast<int16_t*>(cube->data);
+                break;
+            case TYPED_CUBE_INT32:
+                delete[] static_cast<int32_t*>(cube->data);
+                break;
+            default:
+                delete[] static_cast<float*>(cube->data);
+                break;
+        }
+    }
+    delete cube;
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,99 @@
+/*
+ * iDaVIE (immersive Data Visualisation Interactive Explorer)
+ * Copyright (C) 2024 Inter-University Institute for Data Intensive Astronomy
+ *
+ * This file is part of the iDaVIE project.
+ *
+ * iDaVIE is free software: you can redistribute it and/or modify it under the terms 
+ * of the GNU Lesser General Public License (LGPL) as published by the Free Software 
+ * Foundation, either version 3 of the License, or (at your option) any later version.
+ *
+ * iDaVIE is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; 
+ * without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR 
+ * PURPOSE. See the GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License along with 
+ * iDaVIE in the LICENSE file. If not, see <https://www.gnu.org/licenses/>.
+ *
+ * Additional information and disclaimers regarding liability and third-party 
+ * components can be found in the DISCLAIMER and NOTICE files included with this project.
+ *
+ */
+#ifndef NATIVE_PLUGINS_TYPED_CUBE_H
+#define NATIVE_PLUGINS_TYPED_CUBE_H
+
+#include <cstdint>
+#include <limits>
+#include <omp.h>
+#include <fitsio.h>
+
+#define DllExport __declspec (dllexport)
+
+#define EXIT_SUCCESS 0
+#define EXIT_FAILURE 1
+
+// Size of the channel slabs read from disk when loading a typed cube
+#define TYPED_CUBE_READ_CHUNK_BYTES (64LL * 1024 * 1024)
+
+/**
+ * @brief Storage types of a TypedCube.
+ */
+enum TypedCubeStorage : int32_t
+{
+    TYPED_CUBE_FLOAT32 = 0,
+    TYPED_CUBE_INT16 = 1,
+    TYPED_CUBE_INT32 = 2
+};
+
+/**
+ * @brief Cube kept in the storage type of the FITS file.
+ *
+ * Integer cubes hold the raw BITPIX 16 or 32 values; the physical value of a voxel is raw * scale + zero, and voxels
+ * equal to the BLANK value (when the header defines one) are treated as NaN. Float cubes hold the physical values
+ * directly, with scale 1 and zero 0. The TypedCube kernels decode values on the fly, so the cube takes the same
+ * memory as the data in the file and the reductions read two or four times fewer bytes than on a float copy.
+ */
+struct TypedCube
+{
+    void* data;
+    int32_t storage;            /**< TypedCubeStorage of data */
+    int32_t hasBlank;           /**< Non-zero if blank is a valid BLANK value */
+    int64_t blank;
+    double scale;               /**< BSCALE */
+    double zero;                /**< BZERO */
+    int64_t dimX, dimY, dimZ;
+};
+
+/**
+ * @brief Value decoder for the raw values of an integer TypedCube: raw * scale + zero, with BLANK voxels as NaN.
+ * See FloatDecoder for the float counterpart.
+ */
+template<typename T>
+struct ScaledDecoder
+{
+    T blank;
+    bool hasBlank;
+    double scale;
+    double zero;
+
+    bool IsBlank(T raw) const
+    {
+        return hasBlank && raw == blank;
+    }
+    float operator()(T raw) const
+    {
+        return IsBlank(raw) ? std::numeric_limits<float>::quiet_NaN() : (float) (raw * scale + zero);
+    }
+};
+
+extern "C"
+{
+DllExport int FitsReadSubImageTyped(fitsfile*, int, int, long*, long*, TypedCube**, int*);
+DllExport int TypedCubeFindStats(const TypedCube*, float*, float*, float*, float*);
+DllExport int TypedCubeGetHistogram(const TypedCube*, int, float, float, int**);
+DllExport int TypedCubeCropAndDownsample(const TypedCube*, float**, int64_t, int64_t, int64_t, int64_t, int64_t, int64_t, int, int, int, bool);
+DllExport int TypedCubeMomentMaps(const TypedCube*, int64_t, int64_t, const float*, float, float*, float*);
+DllExport int FreeTypedCube(TypedCube*);
+}
+
+#endif //NATIVE_PLUGINS_TYPED_CUBE_H
@@ -0,0 +1,327 @@
+/*
+ * iDaVIE (immersive Data Visualisation Interactive Explorer)
+ * Copyright (C) 2024 Inter-University Institute for Data Intensive Astronomy
+ *
+ * This file is part of the iDaVIE project.
+ *
+ * iDaVIE is free software: you can redistribute it and/or modify it under the terms 
+ * of the GNU Lesser General Public License (LGPL) as published by the Free Software 
+ * Foundation, either version 3 of the License, or (at your option) any later version.
+ *
+ * iDaVIE is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; 
+ * without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR 
+ * PURPOSE. See the GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License along with 
+ * iDaVIE in the LICENSE file. If not, see <https://www.gnu.org/licenses/>.
+ *
+ * Additional information and disclaimers regarding liability and third-party 
+ * components can be found in the DISCLAIMER and NOTICE files included with this project.
+ *
+ */
+#include "zscale_tool.h"
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+using namespace std;
+
+/*
+ * ZScale algorithm (Client Display Library, Mike Fitzpatrick NOAO/IRAF Project), reimplemented with 64-bit
+ * sizes. An evenly spaced sample of the data is sorted, and a straight line is fitted to the sorted sample with
+ * iterative k-sigma rejection. The slope of the line, divided by the contrast, gives the display range about
+ * the median.
+ */
+namespace
+{
+/**
+ * Extracts an evenly spaced sample of the finite values in channels [zStart, zEnd) of a cube. Like the CDL implementation,
+ * every colStep-th pixel of a set of sampled rows is taken. The rows are spread evenly over the channels, and
+ * when several channels are sampled, their y positions follow a golden-ratio sequence so that the sampled rows
+ * do not line up between channels.
+ */
+vector<float> SampleCube(const float* data, int64_t dimX, int64_t dimY, int64_t zStart, int64_t zEnd, int64_t sampleSize)
+{
+    const int64_t numChannels = zEnd - zStart;
+    const int64_t numRows = dimY * numChannels;
+
+    const int64_t optPixPerLine = max<int64_t>(1, min<int64_t>(dimX, ZSCALE_LINE_LENGTH));
+    const int64_t colStep = max<int64_t>(2, (dimX + optPixPerLine - 1) / optPixPerLine);
+    const int64_t pixPerLine = max<int64_t>(1, (dimX + colStep - 1) / colStep);
+
+    const int64_t minLines = max<int64_t>(1, sampleSize / ZSCALE_LINE_LENGTH);
+    const int64_t optLines = max(minLines, min(numRows, (sampleSize + pixPerLine - 1) / pixPerLine));
+    const int64_t numLines = max<int64_t>(1, min(optLines, (numRows + 1) / 2));
+
+    vector<float> sample(numLines * pixPerLine);
+    #pragma omp parallel for schedule(static) if(numLines * pixPerLine >= ZSCALE_PARALLEL_SAMPLES)
+    for (int64_t line = 0; line < numLines; line++)
+    {
+        int64_t z, y;
+        if (numChannels == 1)
+        {
+            z = zStart;
+            y = (int64_t) ((line + 0.5) * dimY / numLines);
+        }
+        else
+        {
+            z = zStart + (int64_t) ((line + 0.5) * numChannels / numLines);
+            double phase = 0.5 + line * 0.6180339887498949;
+            y = (int64_t) ((phase - floor(phase)) * dimY);
+        }
+        const float* row = data + (z * dimY + min(y, dimY - 1)) * dimX;
+        float* out = sample.data() + line * pixPerLine;
+        for (int64_t i = 0; i < pixPerLine; i++)
+        {
+            out[i] = row[min(i * colStep, dimX - 1)];
+        }
+    }
+
+    sample.erase(remove_if(sample.begin(), sample.end(), [](float val) { return !isfinite(val); }), sample.end());
+    return sample;
+}
+
+/**
+ * Fits a straight line to the sorted sample with iterative k-sigma rejection, growing each rejection by
+ * ngrow pixels on both sides. The flattening, sigma and rejection passes run in parallel for large samples.
+ * Returns the number of pixels left in the fit.
+ */
+int64_t FitLine(const vector<float>& data, double& zStart, double& zSlope, int64_t ngrow)
+{
+    const auto npix = (int64_t) data.size();
+    if (npix == 1)
+    {
+        zStart = data[0];
+        zSlope = 0;
+        return 1;
+    }
+    const bool parallel = npix >= ZSCALE_PARALLEL_SAMPLES;
+
+    // The x values [0, npix) are normalised to [-1, 1], which diagonalises the least-squares matrix
+    const double xScale = 2.0 / (npix - 1);
+    vector<char> rejected(npix, 0);
+    vector<char> outlier(npix, 0);
+
+    double sumXX = 0, sumXZ = 0, sumX = 0, sumZ = 0;
+    #pragma omp parallel for reduction(+:sumXX, sumXZ, sumZ) if(parallel)
+    for (int64_t i = 0; i < npix; i++)
+    {
+        const double x = i * xScale - 1.0;
+        sumXX += x * x;
+        sumXZ += x * data[i];
+        sumZ += data[i];
+    }
+    double z0 = sumZ / npix;
+    double dz = sumXZ / sumXX;
+    const double initialSlope = dz;
+
+    int64_t ngoodpix = npix;
+    const int64_t minpix = max<int64_t>(ZSCALE_MIN_PIXELS, (int64_t) (npix * ZSCALE_MAX_REJECT));
+    for (int iteration = 0; iteration < ZSCALE_MAX_ITERATIONS; iteration++)
+    {
+        const int64_t lastNgoodpix = ngoodpix;
+
+        // Sigma of the residuals about the current line
+        int64_t count = 0;
+        double sum = 0, sumSquares = 0;
+        #pragma omp parallel for reduction(+:count, sum, sumSquares) if(parallel)
+        for (int64_t i = 0; i < npix; i++)
+        {
+            if (!rejected[i])
+            {
+                const double residual = data[i] - ((i * xScale - 1.0) * dz + z0);
+                count++;
+                sum += residual;
+                sumSquares += residual * residual;
+            }
+        }
+        if (count < 2)
+        {
+            break;
+        }
+        const double variance = sumSquares / (count - 1) - sum * sum / ((double) count * (count - 1));
+        const double threshold = ZSCALE_KREJ * sqrt(max(0.0, variance));
+
+        // Detect deviant pixels, then reject them and their neighbours out to the growing radius
+        #pragma omp parallel for schedule(static) if(parallel)
+        for (int64_t i = 0; i < npix; i++)
+        {
+            const double residual = data[i] - ((i * xScale - 1.0) * dz + z0);
+            outlier[i] = !rejected[i] && fabs(residual) > threshold;
+        }
+        int64_t lastOutlier = -npix;
+        for (int64_t i = 0; i < npix; i++)
+        {
+            if (outlier[i])
+            {
+                lastOutlier = i;
+                for (int64_t j = max<int64_t>(0, i - ngrow); j < i; j++)
+                {
+                    rejected[j] = 1;
+                }
+            }
+            if (i - lastOutlier <= ngrow)
+            {
+                rejected[i] = 1;
+            }
+        }
+
+        // Refit the line to the remaining pixels. After rejection, the sum of the x values need no longer be zero.
+        ngoodpix = 0;
+        sumXX = sumXZ = sumX = sumZ = 0;
+        #pragma omp parallel for reduction(+:ngoodpix, sumXX, sumXZ, sumX, sumZ) if(parallel)
+        for (int64_t i = 0; i < npix; i++)
+        {
+            if (!rejected[i])
+            {
+                const double x = i * xScale - 1.0;
+                ngoodpix++;
+                sumXX += x * x;
+                sumXZ += x * data[i];
+                sumX += x;
+                sumZ += data[i];
+            }
+        }
+        if (ngoodpix > 0)
+        {
+            const double rowRatio = sumX / sumXX;
+            z0 = (sumZ - rowRatio * sumXZ) / (ngoodpix - rowRatio * sumX);
+            dz = (sumXZ - z0 * sumX) / sumXX;
+        }
+        if (ngoodpix >= lastNgoodpix || ngoodpix < minpix)
+        {
+            break;
+        }
+    }
+
+    // Transform the line coefficients back to the x range [0, npix)
+    zStart = z0 - dz;
+    zSlope = dz * xScale;
+    if (fabs(zSlope) < 0.001)
+    {
+        zSlope = initialSlope * xScale;
+    }
+    return ngoodpix;
+}
+
+/**
+ * Computes z1 and z2 from a sample of finite values. Returns false if the sample is empty.
+ */
+bool ZScaleFromSample(vector<float>& sample, float contrast, float* z1, float* z2)
+{
+    const auto npix = (int64_t) sample.size();
+    if (npix == 0)
+    {
+        *z1 = NAN;
+        *z2 = NAN;
+        return false;
+    }
+    sort(sample.begin(), sample.end());
+    const float zmin = sample.front();
+    const float zmax = sample.back();
+
+    // The median is the average of the two central values if there is an even number of pixels
+    const int64_t centrePixel = max<int64_t>(1, (npix + 1) / 2);
+    float median = sample[centrePixel - 1];
+    if (npix % 2 == 0 && centrePixel < npix)
+    {
+        median = (median + sample[centrePixel]) / 2;
+    }
+
+    // If more than half of the sample is rejected by the fit, the full range is used
+    const int64_t minpix = max<int64_t>(ZSCALE_MIN_PIXELS, (int64_t) (npix * ZSCALE_MAX_REJECT));
+    const int64_t ngrow = max<int64_t>(1, llround(npix * 0.01));
+    double zStart, zSlope;
+    const int64_t ngoodpix = FitLine(sample, zStart, zSlope, ngrow);
+    if (ngoodpix < minpix)
+    {
+        *z1 = zmin;
+        *z2 = zmax;
+        return true;
+    }
+    if (contrast > 0)
+    {
+        zSlope /= contrast;
+    }
+    *z1 = (float) max<double>(zmin, median - (centrePixel - 1) * zSlope);
+    *z2 = (float) min<double>(zmax, median + (npix - centrePixel) * zSlope);
+    return true;
+}
+
+bool ValidChannelRange(int64_t dimX, int64_t dimY, int64_t dimZ, int64_t zStart, int64_t zEnd)
+{
+    return dimX > 0 && dimY > 0 && dimZ > 0 && zStart >= 0 && zEnd <= dimZ && zStart < zEnd;
+}
+}
+
+/**
+ * @brief Computes ZScale display limits over a range of channels of a cube (or over a single image).
+ *
+ * The sample is taken with a deterministic stride across all channels in the range, so the result is
+ * reproducible. Non-finite values are excluded.
+ *
+ * @param data Pointer to the cube data, with x varying fastest.
+ * @param dimX The x dimension of the cube.
+ * @param dimY The y dimension of the cube.
+ * @param dimZ The z dimension of the cube (1 for an image).
+ * @param zStart The first channel of the range.
+ * @param zEnd One past the last channel of the range.
+ * @param sampleSize The desired number of pixels in the sample. If not positive, ZSCALE_DEFAULT_SAMPLE_SIZE is used.
+ * @param contrast The contrast factor dividing the slope of the fitted line. If not positive, the slope is used as is.
+ * @param z1 Output pointer to the lower display limit.
+ * @param z2 Output pointer to the upper display limit.
+ * @return int Returns EXIT_SUCCESS on success, or EXIT_FAILURE if the arguments are invalid or the sample
+ *         contains no finite values (in which case the outputs are NaN).
+ */
+int GetZScaleRange(const float* data, int64_t dimX, int64_t dimY, int64_t dimZ, int64_t zStart, int64_t zEnd, int64_t sampleSize,
+                   float contrast, float* z1, float* z2)
+{
+    if (data == nullptr || z1 == nullptr || z2 == nullptr || !ValidChannelRange(dimX, dimY, dimZ, zStart, zEnd))
+    {
+        return EXIT_FAILURE;
+    }
+    if (sampleSize <= 0)
+    {
+        sampleSize = ZSCALE_DEFAULT_SAMPLE_SIZE;
+    }
+    vector<float> sample = SampleCube(data, dimX, dimY, zStart, zEnd, sampleSize);
+    return ZScaleFromSample(sample, contrast, z1, z2) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+/**
+ * @brief Computes ZScale display limits for each channel in a range of channels of a cube, in a single call.
+ *
+ * Channels are processed in parallel, one channel per thread. Channels without finite values get NaN limits.
+ *
+ * @param data Pointer to the cube data, with x varying fastest.
+ * @param dimX The x dimension of the cube.
+ * @param dimY The y dimension of the cube.
+ * @param dimZ The z dimension of the cube.
+ * @param zStart The first channel of the range.
+ * @param zEnd One past the last channel of the range.
+ * @param sampleSize The desired number of pixels in each channel's sample. If not positive, ZSCALE_DEFAULT_SAMPLE_SIZE is used.
+ * @param contrast The contrast factor dividing the slope of the fitted line. If not positive, the slope is used as is.
+ * @param z1 Caller-owned output array of zEnd - zStart lower display limits.
+ * @param z2 Caller-owned output array of zEnd - zStart upper display limits.
+ * @return int Returns EXIT_SUCCESS on success, or EXIT_FAILURE if the arguments are invalid.
+ */
+int GetChannelZScales(const float* data, int64_t dimX, int64_t dimY, int64_t dimZ, int64_t zStart, int64_t zEnd, int64_t sampleSize,
+                      float contrast, float* z1, float* z2)
+{
+    if (data == nullptr || z1 == nullptr || z2 == nullptr || !ValidChannelRange(dimX, dimY, dimZ, zStart, zEnd))
+    {
+        return EXIT_FAILURE;
+    }
+    if (sampleSize <= 0)
+    {
+        sampleSize = ZSCALE_DEFAULT_SAMPLE_SIZE;
+    }
+    #pragma omp parallel for schedule(dynamic)
+    for (int64_t z = zStart; z < zEnd; z++)
+    {
+        vector<float> sample = SampleCube(data, dimX, dimY, z, z + 1, sampleSize);
+        ZScaleFromSample(sample, contrast, z1 + (z - zStart), z2 + (z - zStart));
+    }
+    return EXIT_SUCCESS;
+}
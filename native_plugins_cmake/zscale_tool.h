@@ -0,0 +1,51 @@
+/*
+ * iDaVIE (immersive Data Visualisation Interactive Explorer)
+ * Copyright (C) 2024 Inter-University Institute for Data Intensive Astronomy
+ *
+ * This file is part of the iDaVIE project.
+ *
+ * iDaVIE is free software: you can redistribute it and/or modify it under the terms 
+ * of the GNU Lesser General Public License (LGPL) as published by the Free Software 
+ * Foundation, either version 3 of the License, or (at your option) any later version.
+ *
+ * iDaVIE is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; 
+ * without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR 
+ * PURPOSE. See the GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License along with 
+ * iDaVIE in the LICENSE file. If not, see <https://www.gnu.org/licenses/>.
+ *
+ * Additional information and disclaimers regarding liability and third-party 
+ * components can be found in the DISCLAIMER and NOTICE files included with this project.
+ *
+ */
+#ifndef NATIVE_PLUGINS_ZSCALE_TOOL_H
+#define NATIVE_PLUGINS_ZSCALE_TOOL_H
+
+#include <cstdint>
+#include <omp.h>
+
+#define DllExport __declspec (dllexport)
+
+#define EXIT_SUCCESS 0
+#define EXIT_FAILURE 1
+
+// Default parameters of the ZScale algorithm
+#define ZSCALE_DEFAULT_CONTRAST 0.25f
+#define ZSCALE_DEFAULT_SAMPLE_SIZE 600
+#define ZSCALE_LINE_LENGTH 120
+// Parameters of the iterative line fit
+#define ZSCALE_MIN_PIXELS 5
+#define ZSCALE_MAX_REJECT 0.5
+#define ZSCALE_KREJ 2.5
+#define ZSCALE_MAX_ITERATIONS 5
+// Samples larger than this are flattened and rejected in parallel
+#define ZSCALE_PARALLEL_SAMPLES 65536
+
+extern "C"
+{
+DllExport int GetZScaleRange(const float*, int64_t, int64_t, int64_t, int64_t, int64_t, int64_t, float, float*, float*);
+DllExport int GetChannelZScales(const float*, int64_t, int64_t, int64_t, int64_t, int64_t, int64_t, float, float*, float*);
+}
+
+#endif //NATIVE_PLUGINS_ZSCALE_TOOL_H